@@ -0,0 +1,152 @@
+/* adv2arena.c - bump pointer allocation of compiler data
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+
+/* round a size up so every allocation is aligned for any type */
+#define ARENAALIGN(n)   (((n) + 7) & ~(size_t)7)
+
+/* local function prototypes */
+static ArenaBlock *NewArenaBlock(ParseContext *c, Arena *arena, size_t size);
+static void FreeArenaBlocks(ArenaBlock *block);
+
+/* InitArena - initialize an empty arena */
+void InitArena(Arena *arena)
+{
+    arena->blocks = NULL;
+    arena->free = NULL;
+}
+
+/* ArenaAlloc - allocate memory from an arena
+ *
+ * Memory allocated from an arena can't be freed by itself. It lasts until the
+ * arena is reset or freed.
+ */
+void *ArenaAlloc(ParseContext *c, Arena *arena, size_t size)
+{
+    ArenaBlock *block = arena->blocks;
+    void *data;
+
+    size = ARENAALIGN(size ? size : 1);
+    if (c->stats)
+        CountAlloc(c, size, VMTRUE);
+    if (!block || block->used + size > block->size)
+        block = NewArenaBlock(c, arena, size);
+
+    data = (uint8_t *)(block + 1) + block->used;
+    block->used += size;
+    return data;
+}
+
+/* ResetArena - release everything allocated from an arena and keep the blocks for reuse */
+void ResetArena(Arena *arena)
+{
+    ArenaBlock *block, *next;
+    for (block = arena->blocks; block != NULL; block = next) {
+        next = block->next;
+        if (block->size != ARENABLOCKSIZE)
+            free(block);
+        else {
+            block->next = arena->free;
+            arena->free = block;
+        }
+    }
+    arena->blocks = NULL;
+}
+
+/* RetainArena - move everything allocated from one arena to another
+ *
+ * The memory stays where it is but now lasts as long as the other arena.
+ */
+void RetainArena(Arena *arena, Arena *to)
+{
+    ArenaBlock *last;
+
+    if (!arena->blocks)
+        return;
+
+    /* keep allocating from the current block of the other arena */
+    for (last = arena->blocks; last->next != NULL; last = last->next)
+        ;
+    if (to->blocks) {
+        last->next = to->blocks->next;
+        to->blocks->next = arena->blocks;
+    }
+    else
+        to->blocks = arena->blocks;
+    arena->blocks = NULL;
+}
+
+/* RecycleArena - release everything allocated from one arena and give its blocks to another for reuse */
+void RecycleArena(Arena *arena, Arena *to)
+{
+    ArenaBlock *block, *next;
+    ResetArena(arena);
+    for (block = arena->free; block != NULL; block = next) {
+        next = block->next;
+        block->next = to->free;
+        to->free = block;
+    }
+    arena->free = NULL;
+}
+
+/* FreeArena - free all of the memory of an arena */
+void FreeArena(Arena *arena)
+{
+    FreeArenaBlocks(arena->blocks);
+    FreeArenaBlocks(arena->free);
+    InitArena(arena);
+}
+
+/* NewArenaBlock - make a block with room for an allocation the current block can't hold
+ *
+ * Allocations larger than a quarter of a block get a block of their own so
+ * the rest of the current block isn't wasted.
+ */
+static ArenaBlock *NewArenaBlock(ParseContext *c, Arena *arena, size_t size)
+{
+    ArenaBlock *block;
+
+    if (size > ARENABLOCKSIZE / 4) {
+        if (!(block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + size)))
+            Abort(c, "insufficient memory - needed %d bytes", (int)size);
+        block->size = size;
+        if (arena->blocks) {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+        else {
+            block->next = NULL;
+            arena->blocks = block;
+        }
+    }
+    else {
+        if ((block = arena->free) != NULL)
+            arena->free = block->next;
+        else {
+            if (!(block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + ARENABLOCKSIZE)))
+                Abort(c, "insufficient memory - needed %d bytes", ARENABLOCKSIZE);
+            block->size = ARENABLOCKSIZE;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    block->used = 0;
+    return block;
+}
+
+/* FreeArenaBlocks - free a list of arena blocks */
+static void FreeArenaBlocks(ArenaBlock *block)
+{
+    ArenaBlock *next;
+    for (; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+}
@@ -15,11 +15,43 @@
 #define K               1024
 
 /* program limits */
-#define MAXLINE         128
 #define MAXTOKEN        32
-#define MAXCODE         (32*K)
-#define MAXDATA         (64*K)
-#define MAXSTRING       (256*K)
+#define MINSEGMENT      (16*K)      /* initial size of the code and data segments (they grow as needed) */
+#define ARENABLOCKSIZE  (64*K)
+
+/* extension of a relocatable object file */
+#define OBJECT_EXT      ".ado"
+
+/* starting value of a hash computed by HashData */
+#define HASHSEED        14695981039346656037ull
+
+/* inlining limits */
+#define MAXINLINELENGTH         32      /* largest function expanded without an 'inline' hint */
+#define MAXINLINELOCALS         120     /* most locals a function can have after expansion */
+#define DEFINLINEBUDGET         512     /* default code growth allowed for inline expansion */
+#define INLINE_CALL_SAVINGS     10      /* bytes of call, frame, and return removed by expansion */
+#define INLINE_TEMPORARY_COST   4       /* bytes needed to initialize a temporary */
+#define INLINE_SLOT_COST        8       /* budget charged for each slot added to the frame of the caller */
+
+/* optimizer limits */
+#define DEFOPTLEVEL             1       /* default optimization level */
+#define MAXOPTPASSES            4       /* most rounds of copy propagation and dead store removal */
+#define MAXOPTLOCALS            120     /* most locals a function can have after adding temporaries */
+
+/* compile time call limits */
+#define MAXEVALSTEPS            10000000    /* most instructions a compile time call can execute */
+#define MAXEVALARGS             16          /* most arguments a compile time call can pass */
+#define MAXINITSTEPS            100000000   /* most instructions the initialization function can execute */
+
+/* switch statement limits */
+#define MINJUMPTABLECASES       4       /* fewest cases dispatched through a jump table */
+#define JUMPTABLEDENSITY        3       /* most jump table entries allowed per case */
+#define MAXLINEARCASES          3       /* most cases compared one at a time */
+
+/* code generation limits */
+#define MAXCODETHREADS          32          /* most threads generating code */
+#define MAXQUEUEDFUNCTIONS      64          /* most functions waiting to be linked into code space */
+#define CODETHREADSTACKSIZE     (8*K*K)     /* stack size of a code generation thread */
 
 /* forward type declarations */
 typedef struct ParseTreeNode ParseTreeNode;
@@ -53,6 +85,11 @@ enum {
     T_ASM,
     T_PRINT,
     T_PRINTLN,
+    T_INLINE,
+    T_NOINLINE,
+    T_SWITCH,
+    T_CASE,
+    T_DEFAULT,
     _T_NON_KEYWORDS,
     T_LE = _T_NON_KEYWORDS, /* '<=' */
     T_EQ,                   /* '==' */
@@ -86,7 +123,8 @@ enum {
 typedef enum {
     BLOCK_FOR = 1,
     BLOCK_WHILE,
-    BLOCK_DO
+    BLOCK_DO,
+    BLOCK_SWITCH
 } BlockType;
 
 /* block structure */
@@ -113,10 +151,46 @@ typedef struct Symbol Symbol;
 typedef struct String String;
 typedef struct Fixup Fixup;
 
+/* inline hints */
+enum {
+    INLINE_DEFAULT,
+    INLINE_ALWAYS,
+    INLINE_NEVER
+};
+
+/* block of memory in an arena */
+typedef struct ArenaBlock ArenaBlock;
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+};
+
+/* arena of memory that is freed all at once */
+typedef struct {
+    ArenaBlock *blocks;         /* blocks in use (allocating from the first) */
+    ArenaBlock *free;           /* blocks that can be reused */
+} Arena;
+
+/* hash table entry */
+typedef struct {
+    VMUVALUE hash;
+    const char *name;           /* name stored in the value (NULL if the slot is empty) */
+    void *value;
+} HashEntry;
+
+/* hash table using open addressing (the lists keep the insertion order) */
+typedef struct {
+    HashEntry *entries;
+    int count;
+    int size;                   /* zero or a power of two */
+} HashTable;
+
 /* symbol table */
 typedef struct {
     Symbol *head;
     Symbol **pTail;
+    HashTable hash;
 } SymbolTable;
 
 /* symbol structure */
@@ -128,6 +202,9 @@ struct Symbol {
         Fixup *fixups;
         VMVALUE value;
     } v;
+    ParseTreeNode *inlineFunction;  /* parse tree of a function that can be expanded inline */
+    int property;                   /* constant is a property tag */
+    int pending;                    /* function whose code hasn't been linked so its value isn't known yet */
     char name[1];
 };
 
@@ -151,11 +228,12 @@ struct Fixup {
 /* forward type declarations */
 typedef struct LocalSymbol LocalSymbol;
 
-/* local symbol table */
+/* local symbol table (the hash is only used while parsing the function) */
 typedef struct {
     LocalSymbol *head;
     LocalSymbol **pTail;
     int count;
+    HashTable hash;
 } LocalSymbolTable;
 
 /* local symbol structure */
@@ -201,6 +279,7 @@ struct String {
     Fixup *fixups;
     int offset;
     int size;
+    int indexed;        /* read a byte at a time so it can't be compressed */
     char data[1];
 };
 
@@ -213,18 +292,24 @@ struct ObjectListEntry {
 
 typedef struct IncludedFile IncludedFile;
 typedef struct ParseFile ParseFile;
+typedef struct Module Module;
 
 /* current include file */
 typedef struct {
     IncludedFile *file;
-    void *fp;
 } CurrentIncludeFile;
 
 /* parse file */
 struct ParseFile {
     ParseFile *next;            /* next file in stack */
     CurrentIncludeFile file;
+    char *text;                 /* text of the file (ends with a newline) */
+    size_t size;                /* size of the text */
+    int mapped;                 /* text is mapped rather than read into memory */
+    char *nextLine;             /* start of the next line in the text */
     int lineNumber;             /* current line number */
+    Module *module;             /* module being recorded from this file or NULL */
+    uint64_t startTime;         /* time the file was pushed (when collecting statistics) */
 };
 
 /* included file */
@@ -233,6 +318,92 @@ struct IncludedFile {
     char name[1];               /* file name */
 };
 
+/* relocation types (what an address stored in code or data points into) */
+#define RELOC_NONE      0
+#define RELOC_CODE      1
+#define RELOC_DATA      2
+#define RELOC_REF       3       /* generate - the operand is the index of a code reference */
+#define RELOC_STRING    4       /* an address in string space (strings don't move once they are there) */
+#define RELOC_METHOD    5       /* the data offset of a method property used as a selector until BindMethods */
+#define RELOC_SHORT     0x80    /* flag - the address is a 16 bit operand (after relaxation) */
+#define RELOC_TYPE(r)   ((r) & ~RELOC_SHORT)
+
+/* image item types */
+typedef enum {
+    IT_CODE,        /* function or method */
+    IT_DATA,        /* variable, array, or vocabulary table */
+    IT_OBJECT,      /* object or class */
+    IT_STRING       /* string constant */
+} ItemType;
+
+/* image item structure (items are contiguous and in address order) */
+typedef struct {
+    ItemType type;
+    VMVALUE offset;             /* offset of the item in code or data space */
+    char *name;                 /* name of the item or NULL */
+    VMVALUE *selectors;         /* code - property tags used as constant selectors */
+    int selectorCount;          /* code - number of constant selectors */
+    int dynamicSelectors;       /* code - uses computed selectors */
+    VMVALUE *storedTags;        /* code - property tags of constant selectors that are assigned */
+    int storedTagCount;         /* code - number of assigned constant selectors */
+    int dynamicStores;          /* code - assigns properties with computed selectors */
+    int hasAsm;                 /* code - contains asm instructions that can't be decoded */
+    int reachable;              /* item is reachable from main */
+} ImageItem;
+
+/* text of a string constant to be compressed */
+typedef struct {
+    uint8_t *data;              /* characters without the terminator (compressed in place) */
+    int length;                 /* number of bytes in data */
+} Text;
+
+/* code reference types (addresses that are filled in when a function is linked) */
+typedef enum {
+    CR_SYMBOL,      /* address of a global symbol */
+    CR_STRING,      /* address of a string constant */
+    CR_METHOD       /* address of the method stored in a property */
+} CodeRefType;
+
+/* code reference structure */
+typedef struct {
+    CodeRefType type;
+    union {
+        Symbol *symbol;
+        String *string;
+        VMVALUE offset;         /* data offset of the property */
+    } v;
+} CodeRef;
+
+/* queue of functions waiting for code generation */
+typedef struct CodeQueue CodeQueue;
+
+/* compiler phases (for the timing report) */
+typedef enum {
+    PHASE_OTHER,        /* anything outside of the other phases */
+    PHASE_SCAN,         /* reading tokens */
+    PHASE_PARSE,        /* building parse trees and data */
+    PHASE_OPTIMIZE,     /* inlining, folding, and optimizing parse trees */
+    PHASE_GENERATE,     /* generating code on the main thread or waiting for it */
+    PHASE_LINK,         /* adding the code of functions to code space */
+    PHASE_MODULE,       /* loading and writing modules and object files */
+    PHASE_VOCABULARY,   /* creating the vocabulary arrays */
+    PHASE_STRINGS,      /* placing strings */
+    PHASE_CONNECT,      /* connecting objects with their parents */
+    PHASE_SHAKE,        /* removing unreachable code and data */
+    PHASE_RELAX,        /* shortening literals and branches */
+    PHASE_PROFILE,      /* arranging code and data using a profile */
+    PHASE_INITIALIZE,   /* running the initialization function */
+    PHASE_IMAGE,        /* building and writing the image */
+    PHASECOUNT
+} CompilePhase;
+
+/* phase timing and memory statistics */
+typedef struct CompileStats CompileStats;
+
+/* native assembler context (symbols defined by NATIVE instructions) */
+typedef struct PasmContext PasmContext;
+typedef void PasmSymbolFcn(void *cookie, const char *name, uint32_t value);
+
 /* word structure */
 typedef struct Word Word;
 struct Word {
@@ -250,19 +421,27 @@ typedef struct {
 /* parse context */
 typedef struct {
     jmp_buf errorTarget;                            /* error target */
+    Arena globalArena;                              /* symbols, strings, and words kept until the image is built */
+    Arena functionArena;                            /* parse trees and locals of the function being compiled */
     ParseFile *currentFile;                         /* scan - current input file */
     IncludedFile *includedFiles;                    /* scan - list of files that have already been included */
+    HashTable includeHash;                          /* scan - included files by name */
     IncludedFile *currentInclude;                   /* scan - file currently being included */
-    char lineBuf[MAXLINE];                          /* scan - current input line */
+    char *lineStart;                                /* scan - start of the current input line */
+    char *lineEnd;                                  /* scan - end of the current input line (after the newline) */
     char *linePtr;                                  /* scan - pointer to the current character */
     int savedToken;                                 /* scan - lookahead token */
     int tokenOffset;                                /* scan - offset to the start of the current token */
-    char token[MAXTOKEN];                           /* scan - current token string */
+    char *token;                                    /* scan - current token string */
+    size_t tokenSize;                               /* scan - size of the token buffer (strings can be any length) */
     VMVALUE value;                                  /* scan - current token integer value */
     int inComment;                                  /* scan - inside of a slash/star comment */
+    uint64_t tokenHash;                             /* scan - hash of the tokens read so far (when using modules) */
+    int atDeclaration;                              /* parse - between declarations (where an included module can end) */
     SymbolTable globals;                            /* parse - global symbol table */
     String *strings;                                /* parse - string constants */
     String **pNextString;                           /* parse - place to store next string constant */
+    HashTable stringHash;                           /* parse - string constants by value */
     ObjectListEntry *objects;                       /* parse - list of objects for parent/sibling/child linking */
     VMVALUE parentProperty;                         /* parse - parent property tag */
     VMVALUE siblingProperty;                        /* parse - sibling property tag */
@@ -272,17 +451,39 @@ typedef struct {
     LocalSymbol *trySymbols;                        /* parse - stack of try catch symbols */
     int currentTryDepth;                            /* parse - current depth of try statements */
     Block *block;                                   /* generate - current loop block */
+    CodeRef *codeRefs;                              /* generate - addresses used by the current function */
+    int codeRefCount;                               /* generate - number of code references */
+    int codeRefMax;                                 /* generate - size of the code reference array */
+    VMVALUE *selectors;                             /* generate - constant selectors used by the current function */
+    int selectorCount;                              /* generate - number of constant selectors */
+    int selectorMax;                                /* generate - size of the selector array */
+    int dynamicSelectors;                           /* generate - current function uses computed selectors */
+    VMVALUE *storedTags;                            /* prepare - property tags assigned by the current function */
+    int storedTagCount;                             /* prepare - number of assigned property tags */
+    int storedTagMax;                               /* prepare - size of the assigned property tag array */
+    int dynamicStores;                              /* prepare - current function assigns properties with computed selectors */
+    CodeQueue *codeQueue;                           /* functions waiting for their code to be generated or linked */
+    CompileStats *stats;                            /* phase timing and memory statistics or NULL */
+    PasmContext *pasm;                              /* native assembler context */
+    ImageItem *codeItems;                           /* functions and methods in code space */
+    int codeItemCount;                              /* number of code items */
+    int codeItemMax;                                /* size of the code item array */
+    ImageItem *dataItems;                           /* variables, objects, and strings in data space */
+    int dataItemCount;                              /* number of data items */
+    int dataItemMax;                                /* size of the data item array */
     int propertyCount;                              /* property count */
     int dataDepth;                                  /* depth of data block nesting */
     DataBlock *dataBlocks;                          /* list of data blocks */
     DataBlock **pNextDataBlock;                     /* place to store next data block */
-    uint8_t codeBuf[MAXCODE];                       /* code buffer */
+    uint8_t *codeBuf;                               /* code buffer (moves when it grows) */
     uint8_t *codeFree;                              /* next available code location */
     uint8_t *codeTop;                               /* top of code buffer */
-    uint8_t dataBuf[MAXDATA];                       /* data buffer */
+    uint8_t *codeRelocs;                            /* relocation type of the address at each code offset */
+    uint8_t *dataBuf;                               /* data buffer (moves when it grows) */
     uint8_t *dataFree;                              /* next available data location */
     uint8_t *dataTop;                               /* top of data buffer */
-    uint8_t stringBuf[MAXSTRING];                   /* string buffer */
+    uint8_t *dataRelocs;                            /* relocation type of the address at each data offset */
+    uint8_t *stringBuf;                             /* string buffer */
     uint8_t *stringFree;                            /* next available string location */
     uint8_t *stringTop;                             /* top of string buffer */
     Symbol *wordsSymbol;                            /* symbol table entry for '_words' */
@@ -291,9 +492,26 @@ typedef struct {
     Word **pNextWord;                               /* place to store next word */
     int wordCount;                                  /* number of words */
     int wordType;                                   /* word type of current property */
+    int inlineBudget;                               /* code growth still allowed for inline expansion */
+    int optimizeLevel;                              /* optimization level (0 = none, 1 = default, 2 = dataflow) */
+    int evaluateCalls;                              /* folding a constant expression (calls to defined functions are run) */
+    char *mainName;                                 /* function the image starts with */
+    char *initName;                                 /* function run at compile time to initialize data */
+    int useModules;                                 /* load and write cached modules of included files */
+    int objectMode;                                 /* compiling an object file (property tags are hashes of their names) */
     int debugMode;                                  /* debug mode flag */
 } ParseContext;
 
+/* options for building the image of a compiled or linked program */
+typedef struct {
+    char *inputFile;                                /* file the default output file name comes from */
+    char *outputFile;                               /* image file or NULL for the default */
+    char *templateName;                             /* template the image is added to or NULL */
+    char *profileName;                              /* profile used to arrange code and data or NULL */
+    int showSymbols;                                /* show the global symbol table */
+    int runProgram;                                 /* run the program once the image is written */
+} ImageOptions;
+
 /* partial value function codes */
 typedef enum {
     PVF_LOAD,
@@ -331,6 +549,7 @@ enum {
     NodeTypeAsm,
     NodeTypeEmpty,
     NodeTypePrint,
+    NodeTypeSwitch,
     NodeTypeGlobalSymbolRef,
     NodeTypeLocalSymbolRef,
     NodeTypeArgumentRef,
@@ -367,17 +586,38 @@ struct PrintOp {
     ParseTreeNode *expr;
 };
 
+/* switch case structure */
+typedef struct SwitchCase SwitchCase;
+struct SwitchCase {
+    SwitchCase *next;
+    int isDefault;
+    VMVALUE value;
+    ParseTreeNode *body;
+    int label;                  /* generate - branch chain to the case body */
+};
+
 /* parse tree node structure */
+/* function definition (kept out of the parse tree node so every other node is smaller) */
+typedef struct {
+    char *name;
+    LocalSymbolTable arguments;
+    LocalSymbolTable locals;
+    int maximumTryDepth;
+    int hasAsm;
+    int inlineHint;
+    int codeLength;
+    int localSlots;                 /* frame slots used by locals that share slots or zero */
+    VMVALUE *storedTags;            /* property tags assigned with constant selectors */
+    int storedTagCount;             /* number of assigned property tags */
+    int dynamicStores;              /* properties are assigned with computed selectors */
+    ParseTreeNode *body;
+} FunctionDef;
+
+/* parse tree node */
 struct ParseTreeNode {
     int nodeType;
     union {
-        struct {
-            char *name;
-            LocalSymbolTable arguments;
-            LocalSymbolTable locals;
-            int maximumTryDepth;
-            ParseTreeNode *body;
-        } functionDef;
+        FunctionDef *functionDef;
         struct {
             ParseTreeNode *test;
             ParseTreeNode *thenStatement;
@@ -421,6 +661,11 @@ struct ParseTreeNode {
         struct {
             PrintOp *ops;
         } printStatement;
+        struct {
+            ParseTreeNode *expr;
+            SwitchCase *cases;
+            int caseCount;
+        } switchStatement;
         struct {
             Symbol *symbol;
         } symbolRef;
@@ -474,6 +719,7 @@ struct ParseTreeNode {
             ParseTreeNode *selector;
             NodeListEntry *args;
             int argc;
+            VMVALUE method;         /* generate - data offset of the property holding the method found at compile time or zero */
         } methodCall;
         struct {
             ParseTreeNode *object;
@@ -481,6 +727,7 @@ struct ParseTreeNode {
         struct {
             ParseTreeNode *object;
             ParseTreeNode *selector;
+            VMVALUE offset;         /* generate - data offset of the property found at compile time or zero */
         } propertyRef;
         struct {
             NodeListEntry *exprs;
@@ -488,7 +735,11 @@ struct ParseTreeNode {
     } u;
 };
 
-/* adv2com.c */
+/* adv2context.c */
+void InitContext(ParseContext *c);
+void FreeContext(ParseContext *c);
+char *DefaultOutputName(ParseContext *c, const char *inputFile, const char *ext);
+void BuildProgram(ParseContext *c, ImageOptions *options);
 int FindObject(ParseContext *c, const char *name);
 VMVALUE AddProperty(ParseContext *c, const char *name);
 void AddObject(ParseContext *c, VMVALUE object);
@@ -503,7 +754,11 @@ void Abort(ParseContext *c, const char *fmt, ...);
 void AddStringRef(ParseContext *c, String *string, FixupType fixupType, VMVALUE offset);
 void AddStringPtrRef(ParseContext *c, String *string, VMVALUE *pOffset);
 String *AddString(ParseContext *c, char *value);
+void ReserveCode(ParseContext *c, size_t size);
+void ReserveData(ParseContext *c, size_t size);
 void *LocalAlloc(ParseContext *c, size_t size);
+void *GlobalAlloc(ParseContext *c, size_t size);
+void *FunctionAlloc(ParseContext *c, size_t size);
 
 /* adv2parse.c */
 void ParseDeclarations(ParseContext *c);
@@ -511,11 +766,18 @@ void PrintLocalSymbols(LocalSymbolTable *table, char *tag, int indent);
 void StoreInitializer(ParseContext *c, VMVALUE value);
 
 /* adv2pasm.c */
-int PasmAssemble1(char *line, uint32_t *pValue);
+PasmContext *PasmNewContext(void);
+void PasmFreeContext(PasmContext *c);
+int PasmAssemble(PasmContext *c, char **lines, int *lineNumbers, int count, uint32_t *values);
+int PasmSerial(PasmContext *c);
+int PasmSymbols(PasmContext *c, int serial, PasmSymbolFcn *fcn, void *cookie);
+int PasmDefineSymbol(PasmContext *c, const char *name, uint32_t value);
 
 /* adv2scan.c */
 void InitScan(ParseContext *c);
 int PushFile(ParseContext *c, const char *name);
+void AddIncludedFile(ParseContext *c, const char *name);
+int HashFile(ParseContext *c, const char *name, uint64_t *pHash);
 void FRequire(ParseContext *c, int requiredToken);
 void Require(ParseContext *c, int token, int requiredToken);
 int GetToken(ParseContext *c);
@@ -527,11 +789,103 @@ void UngetC(ParseContext *c);
 int GetLine(ParseContext *c);
 void ParseError(ParseContext *c, char *fmt, ...);
 
+/* adv2eval.c */
+int EvaluateCall(ParseContext *c, ParseTreeNode *node, VMVALUE *pValue);
+
+/* adv2fold.c */
+void FoldFunction(ParseContext *c, ParseTreeNode *node);
+ParseTreeNode *FoldExpr(ParseContext *c, ParseTreeNode *node);
+int IsPure(ParseTreeNode *node);
+
+/* adv2arena.c */
+void InitArena(Arena *arena);
+void *ArenaAlloc(ParseContext *c, Arena *arena, size_t size);
+void ResetArena(Arena *arena);
+void RetainArena(Arena *arena, Arena *to);
+void RecycleArena(Arena *arena, Arena *to);
+void FreeArena(Arena *arena);
+
+/* adv2hash.c */
+void InitHashTable(HashTable *table);
+void FreeHashTable(HashTable *table);
+void *FindHashEntry(HashTable *table, const char *name);
+void AddHashEntry(ParseContext *c, HashTable *table, const char *name, void *value);
+uint64_t HashData(uint64_t hash, const void *data, size_t size);
+
+/* adv2module.c */
+int LoadModule(ParseContext *c, const char *name);
+void BeginModule(ParseContext *c, const char *name);
+void EndModule(ParseContext *c, ParseFile *f);
+Module *BeginObject(ParseContext *c);
+void EndObject(ParseContext *c, Module *m, const char *name);
+void LinkObject(ParseContext *c, const char *name);
+void CheckLinkedSymbols(ParseContext *c);
+
+/* adv2inline.c */
+int AddInlineCandidate(ParseContext *c, Symbol *symbol, ParseTreeNode *function);
+void InlineCalls(ParseContext *c, ParseTreeNode *function);
+
+/* adv2opt.c */
+void OptimizeFunction(ParseContext *c, ParseTreeNode *function);
+
+/* adv2peep.c */
+int OptimizeCode(ParseContext *c, uint8_t *code, int length);
+int OpcodeFormat(int opcode);
+int FormatLength(int fmt);
+
+/* adv2reloc.c */
+void AddCodeItem(ParseContext *c, VMVALUE offset, const char *name, int hasAsm);
+void AddDataItem(ParseContext *c, ItemType type, VMVALUE offset, const char *name);
+void AddReloc(ParseContext *c, FixupType fixupType, VMVALUE offset, int relocType);
+int FindItem(ImageItem *items, int count, VMVALUE offset);
+void AddSelector(ParseContext *c, VMVALUE tag);
+void AddStoredTag(ParseContext *c, VMVALUE tag);
+void BindMethods(ParseContext *c);
+void RelocateImage(ParseContext *c, int *codeMap, int *dataMap);
+void ReplaceCode(ParseContext *c, uint8_t *code, uint8_t *relocs, int size, int *map);
+VMVALUE GetCodeAddress(ParseContext *c, VMVALUE offset);
+void SetCodeAddress(ParseContext *c, VMVALUE offset, VMVALUE value);
+
+/* adv2text.c */
+int CompressText(ParseContext *c, Text *texts, int count, uint8_t *pairs);
+
+/* adv2shake.c */
+void ShakeTree(ParseContext *c);
+
+/* adv2relax.c */
+void RelaxCode(ParseContext *c);
+int ReorderCode(ParseContext *c, int *order, uint8_t *mostlyTaken, int shorten);
+
+/* adv2pgo.c */
+void ApplyProfile(ParseContext *c, const char *name, int shorten);
+
+/* adv2queue.c */
+void StartCodeQueue(ParseContext *c, int threads);
+void StopCodeQueue(ParseContext *c);
+void QueueFunction(ParseContext *c, ParseTreeNode *function, Symbol *symbol, VMVALUE method);
+void FinishFunction(ParseContext *c, Symbol *symbol);
+void FinishMethods(ParseContext *c, VMVALUE start, VMVALUE end);
+void FinishFunctions(ParseContext *c);
+
+/* adv2stats.c */
+void StartStats(ParseContext *c);
+void FreeStats(ParseContext *c);
+int BeginPhase(ParseContext *c, CompilePhase phase);
+void EndPhase(ParseContext *c, int phase);
+void CountAlloc(ParseContext *c, size_t size, int arena);
+uint64_t ClockTime(void);
+uint64_t StatsTime(ParseContext *c);
+void AddThreadTime(ParseContext *c, uint64_t time);
+void AddFileStats(ParseContext *c, const char *name, uint64_t startTime, int lines, size_t size, int cached);
+void ReportStats(ParseContext *c, const char *inputFile, int printReport, const char *jsonFile);
+
 /* adv2gen.c */
+void PrepareFunction(ParseContext *c, ParseTreeNode *function);
 uint8_t *code_functiondef(ParseContext *c, ParseTreeNode *expr, int *pLength);
 int putcbyte(ParseContext *c, int v);
 int putcword(ParseContext *c, VMWORD v);
 int putclong(ParseContext *c, VMVALUE v);
+VMVALUE rd_clong(ParseContext *c, VMUVALUE off);
 void wr_clong(ParseContext *c, VMUVALUE off, VMVALUE v);
 
 #endif
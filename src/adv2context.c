@@ -0,0 +1,967 @@
+/* adv2context.c - the parse context shared by the compiler and the linker
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include "adv2compiler.h"
+#include "adv2vm.h"
+#include "propbinary.h"
+
+extern uint8_t advsys2_run_template_array[];
+extern int advsys2_run_template_size;
+extern uint8_t advsys2_step_template_array[];
+extern int advsys2_step_template_size;
+#ifdef WORDFIRE_SUPPORT
+extern uint8_t wordfire_template_array[];
+#endif
+extern int wordfire_template_size;
+
+/* first tag of a property in an object file (the containment properties come before it) */
+#define FIRSTHASHEDTAG  0x100
+
+/* number of sections in a sectioned image (data, strings, and code) */
+#define IMAGESECTIONS   3
+
+static uint8_t *BuildImage(ParseContext *c, int sectioned, int *pSize);
+static void WriteImage(ParseContext *c, char *name, uint8_t *image, int imageSize);
+static void RunInitializer(ParseContext *c);
+static void AddVocabulary(ParseContext *c);
+static void PrintWords(ParseContext *c);
+static void ConnectAll(ParseContext *c);
+static void PlaceStrings(ParseContext *c);
+static void MoveStrings(ParseContext *c);
+static int IsPlainText(uint8_t *data, int size);
+static void PrintStrings(ParseContext *c);
+static VMVALUE PropertyTag(const char *name);
+static int SymbolRelocType(Symbol *symbol);
+static void GrowSegment(ParseContext *c, uint8_t **pBuf, uint8_t **pFree, uint8_t **pTop, uint8_t **pRelocs, size_t size);
+
+/* InitContext - initialize a parse context with the predefined symbols and an empty image */
+void InitContext(ParseContext *c)
+{
+    memset(c, 0, sizeof(ParseContext));
+    InitArena(&c->globalArena);
+    InitArena(&c->functionArena);
+    InitSymbolTable(c);
+    InitScan(c);
+    AddGlobal(c, "nil", SC_CONSTANT, 0);
+    c->pNextString = &c->strings;
+    c->pNextDataBlock = &c->dataBlocks;
+    c->pNextWord = &c->words;
+    c->wordType = WT_NONE;
+    c->inlineBudget = DEFINLINEBUDGET;
+    c->optimizeLevel = DEFOPTLEVEL;
+    c->mainName = "main";
+    if (!(c->pasm = PasmNewContext()))
+        Abort(c, "insufficient memory");
+
+    //c->wordsSymbol = AddUndefinedSymbol(c, "_words", SC_OBJECT);
+    //c->wordTypesSymbol = AddUndefinedSymbol(c, "_wordTypes", SC_OBJECT);
+
+    /* add the containment properties */
+    c->parentProperty = AddProperty(c, "_parent");
+    c->siblingProperty = AddProperty(c, "_sibling");
+    c->childProperty = AddProperty(c, "_child");
+
+    /* make "loc" a synonym for "parent" */
+    AddGlobal(c, "_loc", SC_CONSTANT, c->parentProperty);
+
+    /* add the boolean values */
+    AddGlobal(c, "true", SC_CONSTANT, 1);
+    AddGlobal(c, "false", SC_CONSTANT, 0);
+
+    /* add the propeller registers */
+    AddSymbol(c, "par",         SC_VARIABLE, COG_BASE + 0x1f0);
+    AddSymbol(c, "cnt",         SC_VARIABLE, COG_BASE + 0x1f1);
+    AddSymbol(c, "ina",         SC_VARIABLE, COG_BASE + 0x1f2);
+    AddSymbol(c, "inb",         SC_VARIABLE, COG_BASE + 0x1f3);
+    AddSymbol(c, "outa",        SC_VARIABLE, COG_BASE + 0x1f4);
+    AddSymbol(c, "outb",        SC_VARIABLE, COG_BASE + 0x1f5);
+    AddSymbol(c, "dira",        SC_VARIABLE, COG_BASE + 0x1f6);
+    AddSymbol(c, "dirb",        SC_VARIABLE, COG_BASE + 0x1f7);
+    AddSymbol(c, "ctra",        SC_VARIABLE, COG_BASE + 0x1f8);
+    AddSymbol(c, "ctrb",        SC_VARIABLE, COG_BASE + 0x1f9);
+    AddSymbol(c, "frqa",        SC_VARIABLE, COG_BASE + 0x1fa);
+    AddSymbol(c, "frqb",        SC_VARIABLE, COG_BASE + 0x1fb);
+    AddSymbol(c, "phsa",        SC_VARIABLE, COG_BASE + 0x1fc);
+    AddSymbol(c, "phsb",        SC_VARIABLE, COG_BASE + 0x1fd);
+    AddSymbol(c, "vcfg",        SC_VARIABLE, COG_BASE + 0x1fe);
+    AddSymbol(c, "vscl",        SC_VARIABLE, COG_BASE + 0x1ff);
+
+    /* the memory spaces start out empty and grow as needed */
+    ReserveCode(c, MINSEGMENT);
+    ReserveData(c, MINSEGMENT);
+
+    /* fake place to return to from main */
+    putcbyte(c, 0); // argument count from fake CALL instruction
+    putcbyte(c, OP_HALT);
+    AddCodeItem(c, 0, NULL, VMFALSE);
+
+    /* make sure no object has a zero offset */
+    AddDataItem(c, IT_DATA, 0, NULL);
+    StoreInitializer(c, 0);
+}
+
+/* FreeContext - free everything a parse context allocated */
+void FreeContext(ParseContext *c)
+{
+    StopCodeQueue(c);
+    FreeStats(c);
+    if (c->pasm)
+        PasmFreeContext(c->pasm);
+    FreeArena(&c->functionArena);
+    FreeArena(&c->globalArena);
+    free(c->codeBuf);
+    free(c->codeRelocs);
+    free(c->dataBuf);
+    free(c->dataRelocs);
+    free(c->token);
+}
+
+/* DefaultOutputName - make an output file name from the input file name and an extension */
+char *DefaultOutputName(ParseContext *c, const char *inputFile, const char *ext)
+{
+    const char *p = strrchr(inputFile, '.');
+    size_t length = p ? (size_t)(p - inputFile) : strlen(inputFile);
+    char *name = (char *)GlobalAlloc(c, length + strlen(ext) + 1);
+    memcpy(name, inputFile, length);
+    strcpy(name + length, ext);
+    return name;
+}
+
+/* BuildProgram - finish a compiled or linked program and write its image */
+void BuildProgram(ParseContext *c, ImageOptions *options)
+{
+    char *outputFile = options->outputFile;
+    uint8_t *template = NULL, *image;
+    int templateSize = 0, imageSize;
+    char *ext = ".dat";
+    int phase;
+
+    if (options->templateName) {
+        if (strcmp(options->templateName, "run") == 0) {
+            template = advsys2_run_template_array;
+            templateSize = advsys2_run_template_size;
+        }
+        else if (strcmp(options->templateName, "step") == 0) {
+            template = advsys2_step_template_array;
+            templateSize = advsys2_step_template_size;
+        }
+#ifdef WORDFIRE_SUPPORT
+        else if (strcmp(options->templateName, "wordfire") == 0) {
+            template = wordfire_template_array;
+            templateSize = wordfire_template_size;
+        }
+#endif
+        else
+            Abort(c, "unknown template name '%s'", options->templateName);
+        ext = ".binary";
+    }
+
+    if (!outputFile)
+        outputFile = DefaultOutputName(c, options->inputFile, ext);
+
+    /* create the vocabulary arrays */
+    phase = BeginPhase(c, PHASE_VOCABULARY);
+    AddVocabulary(c);
+    EndPhase(c, phase);
+
+    /* place strings at the end of data space */
+    phase = BeginPhase(c, PHASE_STRINGS);
+    PlaceStrings(c);
+    EndPhase(c, phase);
+
+    /* link all child objects with their parents and call the methods that can't change directly */
+    phase = BeginPhase(c, PHASE_CONNECT);
+    ConnectAll(c);
+    BindMethods(c);
+    EndPhase(c, phase);
+
+    /* remove everything that can't be reached from main */
+    if (c->optimizeLevel >= 1) {
+        phase = BeginPhase(c, PHASE_SHAKE);
+        ShakeTree(c);
+        EndPhase(c, phase);
+    }
+
+    /* move the strings that are left to read-only string space (the PASM VM can't address it) */
+    if (!template) {
+        phase = BeginPhase(c, PHASE_STRINGS);
+        MoveStrings(c);
+        EndPhase(c, phase);
+    }
+
+    /* use the short literal and branch forms (the PASM VM doesn't have them) */
+    if (c->optimizeLevel >= 1 && !template) {
+        phase = BeginPhase(c, PHASE_RELAX);
+        RelaxCode(c);
+        EndPhase(c, phase);
+    }
+
+    /* arrange code and data to match a training run */
+    if (options->profileName) {
+        phase = BeginPhase(c, PHASE_PROFILE);
+        ApplyProfile(c, options->profileName, c->optimizeLevel >= 1 && !template);
+        EndPhase(c, phase);
+    }
+
+    /* start with the data the initialization function leaves behind */
+    if (c->initName) {
+        phase = BeginPhase(c, PHASE_INITIALIZE);
+        RunInitializer(c);
+        EndPhase(c, phase);
+    }
+
+    if (options->showSymbols || c->debugMode)
+        PrintSymbols(c);
+    if (c->debugMode)
+        PrintStrings(c);
+    PrintWords(c);
+
+    printf("data: %d, code %d, strings: %d\n", (int)(c->dataFree - c->dataBuf), (int)(c->codeFree - c->codeBuf), (int)(c->stringFree - c->stringBuf));
+
+    phase = BeginPhase(c, PHASE_IMAGE);
+    image = BuildImage(c, !template, &imageSize);
+
+    if (template) {
+        uint8_t *binary;
+        int binarySize;
+        if (imageSize > MaxImageSize(template))
+            Abort(c, "image is %d bytes but the '%s' template only has room for %d", imageSize, options->templateName, MaxImageSize(template));
+        if (!(binary = BuildBinary(template, templateSize, image, imageSize, &binarySize)))
+            Abort(c, "insufficient memory");
+        WriteImage(c, outputFile, binary, binarySize);
+    }
+    else {
+        WriteImage(c, outputFile, image, imageSize);
+    }
+    EndPhase(c, phase);
+
+    /* the interpreter reported why the program stopped */
+    if (options->runProgram && !Execute((ImageHdr *)image, image + STACKOFFSET(imageSize), VMFALSE, NULL))
+        longjmp(c->errorTarget, 1);
+}
+
+/* AddVocabulary - create the '_words' and '_wordTypes' arrays */
+static void AddVocabulary(ParseContext *c)
+{
+    Word *word;
+
+    if (c->wordCount == 0)
+        return;
+
+    /* create the '_words' array */
+    AddDataItem(c, IT_DATA, (VMVALUE)(c->dataFree - c->dataBuf), "_words");
+    StoreInitializer(c, c->wordCount);
+    AddGlobal(c, "_words", SC_OBJECT, (VMVALUE)(c->dataFree - c->dataBuf));
+    for (word = c->words; word != NULL; word = word->next) {
+        /* words are matched a character at a time so they stay uncompressed */
+        word->string->indexed = VMTRUE;
+        AddStringRef(c, word->string, FT_DATA, c->dataFree - c->dataBuf);
+        StoreInitializer(c, 0);
+    }
+
+    /* create the '_wordTypes' array */
+    AddDataItem(c, IT_DATA, (VMVALUE)(c->dataFree - c->dataBuf), "_wordTypes");
+    StoreInitializer(c, c->wordCount);
+    AddGlobal(c, "_wordTypes", SC_OBJECT, (VMVALUE)(c->dataFree - c->dataBuf));
+    for (word = c->words; word != NULL; word = word->next) {
+        StoreInitializer(c, word->type);
+    }
+}
+
+/* PrintWords - print the vocabulary */
+static void PrintWords(ParseContext *c)
+{
+    Word *word = c->words;
+    if (word) {
+        printf("%d words:\n", c->wordCount);
+        while (word != NULL) {
+            printf("  %s %d %d\n", word->string->data, word->type, word->string->offset);
+            word = word->next;
+        }
+    }
+}
+
+/* BuildImage - build an image in the legacy layout or as a sectioned image file
+ *
+ * The legacy layout has the data, strings, and code right after the header.
+ * It is what the templates and code run at compile time use. A sectioned
+ * image starts each segment on a page boundary so it can be mapped. Either
+ * one is followed by STACKROOM for running it at compile time.
+ */
+static uint8_t *BuildImage(ParseContext *c, int sectioned, int *pSize)
+{
+    int dataSize = c->dataFree - c->dataBuf;
+    int stringSize = c->stringFree - c->stringBuf;
+    int codeSize = c->codeFree - c->codeBuf;
+    int imageSize;
+    ImageHdr *hdr;
+    Symbol *sym;
+    
+    if (sectioned) {
+        ImageFileHdr *fileHdr;
+        ImageSection *section;
+        int headerSize = sizeof(ImageFileHdr) + IMAGESECTIONS * sizeof(ImageSection);
+        int dataOffset = IMAGE_ALIGNUP(headerSize);
+        int stringOffset = IMAGE_ALIGNUP(dataOffset + dataSize);
+        int codeOffset = IMAGE_ALIGNUP(stringOffset + stringSize);
+        imageSize = codeOffset + codeSize;
+        if (!(fileHdr = (ImageFileHdr *)calloc(1, STACKROOM(imageSize))))
+            ParseError(c, "insufficient memory to build image");
+        memcpy(fileHdr->magic, IMAGE_MAGIC, sizeof(fileHdr->magic));
+        fileHdr->version = IMAGE_VERSION;
+        fileHdr->byteOrder = IMAGE_BYTEORDER;
+        fileHdr->alignment = IMAGE_ALIGN;
+        if (c->optimizeLevel >= 1 || stringSize > 0)
+            fileHdr->flags = IMAGE_HOSTONLY;    /* RelaxCode or MoveStrings ran */
+        fileHdr->sectionCount = IMAGESECTIONS;
+        fileHdr->sectionOffset = sizeof(ImageFileHdr);
+        section = (ImageSection *)(fileHdr + 1);
+        section[0].type = SECTION_DATA;
+        section[0].flags = SECTION_WRITABLE | SECTION_REQUIRED;
+        section[0].offset = dataOffset;
+        section[0].size = dataSize;
+        section[1].type = SECTION_STRINGS;
+        section[1].flags = SECTION_REQUIRED;
+        section[1].offset = stringOffset;
+        section[1].size = stringSize;
+        section[2].type = SECTION_CODE;
+        section[2].flags = SECTION_REQUIRED;
+        section[2].offset = codeOffset;
+        section[2].size = codeSize;
+        hdr = &fileHdr->hdr;
+        hdr->dataOffset = dataOffset;
+        hdr->stringOffset = stringOffset;
+        hdr->codeOffset = codeOffset;
+    }
+    else {
+        imageSize = sizeof(ImageHdr) + dataSize + codeSize + stringSize;
+        if (!(hdr = (ImageHdr *)malloc(STACKROOM(imageSize))))
+            ParseError(c, "insufficient memory to build image");
+        hdr->dataOffset = sizeof(ImageHdr);
+        hdr->stringOffset = hdr->dataOffset + dataSize;
+        hdr->codeOffset = hdr->stringOffset + stringSize;
+    }
+    hdr->dataSize = dataSize;
+    hdr->stringSize = stringSize;
+    hdr->codeSize = codeSize;
+    
+    memcpy((uint8_t *)hdr + hdr->dataOffset, c->dataBuf, dataSize);
+    memcpy((uint8_t *)hdr + hdr->stringOffset, c->stringBuf, stringSize);
+    memcpy((uint8_t *)hdr + hdr->codeOffset, c->codeBuf, codeSize);
+    
+    if (!(sym = FindSymbol(c, c->mainName)))
+        ParseError(c, "no '%s' function", c->mainName);
+    else if (!sym->valueDefined)
+        ParseError(c, "'%s' not defined", c->mainName);
+    else if (sym->storageClass != SC_FUNCTION)
+        ParseError(c, "expecting '%s' to be a function", c->mainName);
+    hdr->mainFunction = sym->v.value;
+    
+    *pSize = imageSize;
+    return (uint8_t *)hdr;
+}
+
+/* RunInitializer - run the initialization function and keep the data it leaves behind
+ *
+ * This runs after everything that moves code or data since the addresses the
+ * function stores aren't known to need relocation. Its code stays in the image.
+ */
+static void RunInitializer(ParseContext *c)
+{
+    ImageHdr *hdr;
+    Symbol *sym;
+    int imageSize;
+    
+    if (!(sym = FindSymbol(c, c->initName)) || !sym->valueDefined || sym->storageClass != SC_FUNCTION)
+        ParseError(c, "initialization function '%s' not defined", c->initName);
+    
+    hdr = (ImageHdr *)BuildImage(c, VMFALSE, &imageSize);
+    hdr->mainFunction = sym->v.value;
+    if (!Initialize(hdr, (uint8_t *)hdr + STACKOFFSET(imageSize), MAXINITSTEPS))
+        ParseError(c, "can't run '%s' at compile time", c->initName);
+    memcpy(c->dataBuf, (uint8_t *)hdr + hdr->dataOffset, hdr->dataSize);
+    free(hdr);
+    
+    printf("init: ran '%s', starting with '%s'\n", c->initName, c->mainName);
+}
+
+static void WriteImage(ParseContext *c, char *name, uint8_t *image, int imageSize)
+{
+    FILE *fp;
+        
+    if (!(fp = fopen(name, "wb")))
+        ParseError(c, "can't create file '%s'", name);
+        
+    if (fwrite(image, 1, imageSize, fp) != imageSize)
+        ParseError(c, "error writing image file");
+        
+    fclose(fp);
+}
+
+static char *storageClassNames[] = {
+    NULL,
+    "a constant",
+    "a variable",
+    "an object",
+    "a function"
+};
+
+/* AddGlobal - add a global symbol to the symbol table */
+Symbol *AddGlobal(ParseContext *c, const char *name, StorageClass storageClass, VMVALUE value)
+{
+    Symbol *sym;
+    
+    /* check to see if the symbol is already defined */
+    if ((sym = FindSymbol(c, name)) != NULL) {
+        Fixup *fixup, *nextFixup;
+        if (sym->valueDefined)
+            ParseError(c, "already defined");
+        else if (storageClass != sym->storageClass)
+            ParseError(c, "expecting %s", storageClassNames[sym->storageClass]);
+        for (fixup = sym->v.fixups; fixup != NULL; fixup = nextFixup) {
+            nextFixup = fixup->next;
+            switch (fixup->type) {
+            case FT_DATA:
+                *(VMVALUE *)&c->dataBuf[fixup->v.offset] = value;
+                break;
+            case FT_CODE:
+                wr_clong(c, fixup->v.offset, value);
+                break;
+            case FT_PTR:
+                // never reached
+                break;
+            }
+            free(fixup);
+        }
+        sym->valueDefined = VMTRUE;
+        sym->v.value = value;
+        return sym;
+    }
+    
+    /* add the symbol */
+    return AddSymbol(c, name, storageClass, value);
+}
+
+/* FindObject - find an object in the symbol table */
+int FindObject(ParseContext *c, const char *name)
+{
+    Symbol *sym;
+
+    if ((sym = FindSymbol(c, name)) != NULL) {
+        if (sym->storageClass != SC_OBJECT)
+            ParseError(c, "not an object");
+        if (!sym->valueDefined)
+            ParseError(c, "object not defined");
+        return sym->v.value;
+    }
+
+    ParseError(c, "object not defined");
+    return NIL; // never reached
+}
+
+/* AddProperty - add a property symbol to the symbol table */
+VMVALUE AddProperty(ParseContext *c, const char *name)
+{
+    Symbol *sym;
+    
+    /* check to see if the symbol is already defined */
+    if ((sym = FindSymbol(c, name)) != NULL) {
+        if (sym->storageClass != SC_CONSTANT)
+            ParseError(c, "not a property or constant");
+        return sym->v.value;
+    }
+    
+    /* add the symbol */
+    ++c->propertyCount;
+    sym = AddSymbol(c, name, SC_CONSTANT, c->objectMode ? PropertyTag(name) : c->propertyCount);
+    sym->property = VMTRUE;
+    return sym->v.value;
+}
+
+/* PropertyTag - get the tag of a property in an object file
+ *
+ * Tags are numbered in the order properties are added when a whole program is
+ * compiled. Separately compiled files can't agree on that order so each tag is
+ * a hash of the property name instead and the linker checks that no two
+ * names have the same tag.
+ */
+static VMVALUE PropertyTag(const char *name)
+{
+    uint64_t hash = HashData(HASHSEED, name, strlen(name));
+    return (VMVALUE)(FIRSTHASHEDTAG + hash % ((uint64_t)P_SHARED - FIRSTHASHEDTAG));
+}
+
+/* AddObject - add an object to the list for parent/sibling/child linking */
+void AddObject(ParseContext *c, VMVALUE object)
+{
+    ObjectListEntry *entry = (ObjectListEntry *)GlobalAlloc(c, sizeof(ObjectListEntry));
+    entry->next = c->objects;
+    entry->object = object;
+    c->objects = entry;
+}
+
+/* getp - get the value of an object property */
+static int getp(ParseContext *c, VMVALUE object, VMVALUE tag, VMVALUE *pValue)
+{
+    ObjectHdr *objectHdr = (ObjectHdr *)(c->dataBuf + object);
+    Property *property = (Property *)(objectHdr + 1);
+    int cnt = objectHdr->nProperties;
+    while (--cnt >= 0) {
+        if ((property->tag & ~P_SHARED) == tag) {
+            *pValue = property->value;
+            return VMTRUE;
+        }
+        ++property;
+    }
+    return VMFALSE;
+}
+
+/* setp - set the value of an object property */
+static int setp(ParseContext *c, VMVALUE object, VMVALUE tag, VMVALUE value)
+{
+    ObjectHdr *objectHdr = (ObjectHdr *)(c->dataBuf + object);
+    Property *property = (Property *)(objectHdr + 1);
+    int cnt = objectHdr->nProperties;
+    while (--cnt >= 0) {
+        if ((property->tag & ~P_SHARED) == tag) {
+            property->value = value;
+            AddReloc(c, FT_DATA, (uint8_t *)&property->value - c->dataBuf, RELOC_DATA);
+            return VMTRUE;
+        }
+        ++property;
+    }
+    return VMFALSE;
+}
+
+/* ConnectAll - link together all children of each parent object */
+static void ConnectAll(ParseContext *c)
+{
+    ObjectListEntry *entry = c->objects;
+    while (entry) {
+        VMVALUE parent, child;
+        if (getp(c, entry->object, c->parentProperty, &parent) && parent) {
+            if (getp(c, parent, c->childProperty, &child)) {
+                setp(c, entry->object, c->siblingProperty, child);
+                setp(c, parent, c->childProperty, entry->object);
+            }
+        }
+        entry = entry->next;
+    }
+}
+
+/* InitSymbolTable - initialize a symbol table */
+void InitSymbolTable(ParseContext *c)
+{
+    c->globals.head = NULL;
+    c->globals.pTail = &c->globals.head;
+    InitHashTable(&c->globals.hash);
+}
+
+/* AddSymbolRef - add a symbol reference */
+int AddSymbolRef(ParseContext *c, Symbol *symbol, FixupType fixupType, VMVALUE offset)
+{
+    Fixup *fixup;
+    if (symbol->pending)
+        FinishFunction(c, symbol);
+    AddReloc(c, fixupType, offset, SymbolRelocType(symbol));
+    if (symbol->valueDefined)
+        return symbol->v.value;
+    fixup = (Fixup *)LocalAlloc(c, sizeof(Fixup));
+    fixup->type = fixupType;
+    fixup->v.offset = offset;
+    fixup->next = symbol->v.fixups;
+    symbol->v.fixups = fixup;
+    return 0;
+}
+
+/* SymbolRelocType - get the relocation type of a reference to a symbol */
+static int SymbolRelocType(Symbol *symbol)
+{
+    switch (symbol->storageClass) {
+    case SC_FUNCTION:
+        return RELOC_CODE;
+    case SC_VARIABLE:
+        if (symbol->valueDefined && (VMUVALUE)symbol->v.value >= COG_BASE)
+            return RELOC_NONE;
+        return RELOC_DATA;
+    case SC_OBJECT:
+        return RELOC_DATA;
+    default:
+        return RELOC_NONE;
+    }
+}
+
+/* AddRawSymbol - add a defined or undefined symbol to a symbol table */
+static Symbol *AddRawSymbol(ParseContext *c, const char *name, StorageClass storageClass)
+{
+    size_t size = sizeof(Symbol) + strlen(name);
+    Symbol *sym;
+    
+    /* allocate the symbol structure */
+    sym = (Symbol *)GlobalAlloc(c, size);
+    memset(sym, 0, sizeof(Symbol));
+    strcpy(sym->name, name);
+    sym->storageClass = storageClass;
+
+    /* add it to the symbol table */
+    *c->globals.pTail = sym;
+    c->globals.pTail = &sym->next;
+    AddHashEntry(c, &c->globals.hash, sym->name, sym);
+    
+    /* return the symbol */
+    return sym;
+}
+
+/* AddUndefinedSymbol - add an undefined symbol to a symbol table */
+Symbol *AddUndefinedSymbol(ParseContext *c, const char *name, StorageClass storageClass)
+{
+    Symbol *sym = AddRawSymbol(c, name, storageClass);
+    sym->valueDefined = VMFALSE;
+    return sym;
+}
+
+/* AddSymbol - add a symbol to a symbol table */
+Symbol *AddSymbol(ParseContext *c, const char *name, StorageClass storageClass, int value)
+{
+    Symbol *sym = AddRawSymbol(c, name, storageClass);
+    sym->valueDefined = VMTRUE;
+    sym->v.value = value;
+    return sym;
+}
+
+/* FindSymbol - find a symbol in a symbol table */
+Symbol *FindSymbol(ParseContext *c, const char *name)
+{
+    return (Symbol *)FindHashEntry(&c->globals.hash, name);
+}
+
+/* PrintSymbols - print a symbol table */
+void PrintSymbols(ParseContext *c)
+{
+    char *storageClassNames[] = { "?", "C", "V", "O", "F" };
+    Symbol *sym;
+    printf("Globals\n");
+    for (sym = c->globals.head; sym != NULL; sym = sym->next)
+        if (sym->valueDefined)
+            printf("  %20s %s %d\n", sym->name, storageClassNames[sym->storageClass], sym->v.value);
+        else
+            printf("  %20s %s (undefined)\n", sym->name, storageClassNames[sym->storageClass]);
+}
+
+/* AddStringRef - add a string reference */
+void AddStringRef(ParseContext *c, String *string, FixupType fixupType, VMVALUE offset)
+{
+    Fixup *fixup = (Fixup *)LocalAlloc(c, sizeof(Fixup));
+    fixup->type = fixupType;
+    fixup->v.offset = offset;
+    fixup->next = string->fixups;
+    string->fixups = fixup;
+    AddReloc(c, fixupType, offset, RELOC_DATA);
+}
+
+/* AddStringPtrRef - add a string reference */
+void AddStringPtrRef(ParseContext *c, String *string, VMVALUE *pOffset)
+{
+    Fixup *fixup = (Fixup *)LocalAlloc(c, sizeof(Fixup));
+    fixup->type = FT_PTR;
+    fixup->v.pOffset = pOffset;
+    fixup->next = string->fixups;
+    string->fixups = fixup;
+}
+
+/* AddString - add a string to the string table */
+String *AddString(ParseContext *c, char *value)
+{
+    String *str;
+    int size;
+    
+    /* check to see if the string is already in the table */
+    if ((str = (String *)FindHashEntry(&c->stringHash, value)) != NULL)
+        return str;
+
+    /* allocate the string structure */
+    size = strlen(value) + 1;
+    str = (String *)GlobalAlloc(c, sizeof(String) + size - 1);
+    memset(str, 0, sizeof(String));
+    str->size = size;
+    strcpy(str->data, value);
+    *c->pNextString = str;
+    c->pNextString = &str->next;
+    AddHashEntry(c, &c->stringHash, str->data, str);
+
+    /* return the string table entry */
+    return str;
+}
+
+/* PlaceStrings - place strings at data space offsets */
+void PlaceStrings(ParseContext *c)
+{
+    String *str;
+    Fixup *fixup, *nextFixup;
+    
+    /* fixup data and code string references */
+    for (str = c->strings; str != NULL; str = str->next) {
+        str->offset = c->dataFree - c->dataBuf;
+        AddDataItem(c, IT_STRING, str->offset, NULL);
+        ReserveData(c, str->size);
+        memcpy(c->dataFree, str->data, str->size);
+        c->dataFree += str->size;
+        for (fixup = str->fixups; fixup != NULL; fixup = nextFixup) {
+            nextFixup = fixup->next;
+            switch (fixup->type) {
+            case FT_DATA:
+                *(VMVALUE *)&c->dataBuf[fixup->v.offset] = str->offset;
+                break;
+            case FT_CODE:
+                wr_clong(c, fixup->v.offset, str->offset);
+                break;
+            case FT_PTR:
+                *fixup->v.pOffset = str->offset;
+                break;
+            }
+            free(fixup);
+        }
+    }
+}
+
+/* MoveStrings - move the strings from data space to string space
+ *
+ * PlaceStrings puts the strings in data space so the tree shaker can remove
+ * the ones that can't be reached like any other data. The rest move to string
+ * space, which isn't copied or changed by a running program. Strings of plain
+ * characters are compressed with a dictionary of pairs at the start of string
+ * space and addressed as TEXT_BASE plus their offsets shifted left to make
+ * room for the index of a character. Strings that are read a byte at a time
+ * or can't be compressed are addressed as STRING_BASE plus their offsets.
+ */
+static void MoveStrings(ParseContext *c)
+{
+    int codeSize = c->codeFree - c->codeBuf;
+    int dataSize = c->dataFree - c->dataBuf;
+    int *dataMap, *ends, *textIndex, textCount = 0, itemCount = 0, pairCount = 0;
+    int stringSize = 0, newOffset = 0, plainBytes = 0, textBytes = 0, offset, start, i, j;
+    uint8_t pairs[TEXT_MAXPAIRS * 2], *indexed, *work, *p;
+    VMVALUE *addrMap, addr;
+    Text *texts;
+    String *str;
+
+    /* find the strings that are read a byte at a time */
+    indexed = (uint8_t *)LocalAlloc(c, dataSize + 1);
+    memset(indexed, 0, dataSize + 1);
+    for (str = c->strings; str != NULL; str = str->next)
+        if (str->indexed && str->offset >= 0 && str->offset < dataSize)
+            indexed[str->offset] = VMTRUE;
+
+    /* find the end of each string and copy the ones that can be compressed */
+    ends = (int *)LocalAlloc(c, (c->dataItemCount + 1) * 2 * sizeof(int));
+    textIndex = ends + c->dataItemCount + 1;
+    texts = (Text *)LocalAlloc(c, (c->dataItemCount + 1) * sizeof(Text));
+    work = (uint8_t *)LocalAlloc(c, dataSize + 1);
+    for (i = 0; i < c->dataItemCount; ++i) {
+        if (c->dataItems[i].type != IT_STRING)
+            continue;
+        start = c->dataItems[i].offset;
+        ends[i] = i + 1 < c->dataItemCount ? c->dataItems[i + 1].offset : dataSize;
+        textIndex[i] = -1;
+        if (!indexed[start] && IsPlainText(c->dataBuf + start, ends[i] - start)) {
+            texts[textCount].data = work + start;
+            texts[textCount].length = ends[i] - start - 1;
+            memcpy(texts[textCount].data, c->dataBuf + start, texts[textCount].length);
+            plainBytes += ends[i] - start;
+            textIndex[i] = textCount++;
+        }
+        ++itemCount;
+    }
+
+    /* build the dictionary and compress the strings with it */
+    if (textCount > 0)
+        pairCount = CompressText(c, texts, textCount, pairs);
+    if (itemCount > 0)
+        stringSize = sizeof(VMVALUE) + pairCount * 2;
+
+    /* assign string space addresses to the bytes of strings */
+    addrMap = (VMVALUE *)LocalAlloc(c, (dataSize + 1) * sizeof(VMVALUE));
+    memset(addrMap, 0, (dataSize + 1) * sizeof(VMVALUE));
+    for (i = 0; i < c->dataItemCount; ++i) {
+        if (c->dataItems[i].type != IT_STRING)
+            continue;
+        start = c->dataItems[i].offset;
+        if (textIndex[i] >= 0 && stringSize < TEXT_MAXOFFSET) {
+            addr = (VMVALUE)(TEXT_BASE | ((VMUVALUE)stringSize << TEXT_INDEX_BITS));
+            stringSize += texts[textIndex[i]].length + 1;
+            textBytes += texts[textIndex[i]].length + 1;
+        }
+        else {
+            textIndex[i] = -1;
+            addr = STRING_BASE + stringSize;
+            stringSize += ends[i] - start;
+        }
+        for (offset = start; offset < ends[i]; ++offset)
+            addrMap[offset] = addr + (offset - start);
+    }
+
+    /* assign new data offsets to everything else */
+    dataMap = (int *)LocalAlloc(c, (dataSize + 1) * sizeof(int));
+    for (offset = 0; offset < dataSize; ++offset)
+        dataMap[offset] = addrMap[offset] ? -1 : newOffset++;
+
+    /* copy the dictionary and the strings */
+    c->stringBuf = (uint8_t *)GlobalAlloc(c, stringSize + 1);
+    c->stringFree = c->stringTop = c->stringBuf + stringSize;
+    if (itemCount > 0) {
+        *(VMVALUE *)c->stringBuf = pairCount;
+        memcpy(c->stringBuf + sizeof(VMVALUE), pairs, pairCount * 2);
+    }
+    for (i = 0; i < c->dataItemCount; ++i) {
+        if (c->dataItems[i].type != IT_STRING)
+            continue;
+        start = c->dataItems[i].offset;
+        addr = addrMap[start];
+        if ((j = textIndex[i]) >= 0) {
+            p = c->stringBuf + (((VMUVALUE)addr & ADDR_OFF_MASK) >> TEXT_INDEX_BITS);
+            memcpy(p, texts[j].data, texts[j].length);
+            p[texts[j].length] = '\0';
+        }
+        else
+            memcpy(c->stringBuf + (addr & ADDR_OFF_MASK), c->dataBuf + start, ends[i] - start);
+    }
+
+    /* point the string addresses in code and data at string space */
+    for (offset = 0; offset < codeSize; ++offset) {
+        if (c->codeRelocs[offset] == RELOC_DATA) {
+            VMVALUE value = GetCodeAddress(c, offset);
+            if (value >= 0 && value < dataSize && addrMap[value]) {
+                SetCodeAddress(c, offset, addrMap[value]);
+                c->codeRelocs[offset] = RELOC_STRING;
+            }
+        }
+    }
+    for (offset = 0; offset < dataSize; ++offset) {
+        if (c->dataRelocs[offset] == RELOC_DATA) {
+            VMVALUE *pValue = (VMVALUE *)&c->dataBuf[offset];
+            if (*pValue >= 0 && *pValue < dataSize && addrMap[*pValue]) {
+                *pValue = addrMap[*pValue];
+                c->dataRelocs[offset] = RELOC_STRING;
+            }
+        }
+    }
+
+    /* the strings that are left are now addressed in string space */
+    for (str = c->strings; str != NULL; str = str->next)
+        if (str->offset >= 0 && str->offset < dataSize)
+            str->offset = addrMap[str->offset] ? addrMap[str->offset] : -1;
+
+    /* remove the strings from data space */
+    RelocateImage(c, NULL, dataMap);
+
+    /* report the compression with the other statistics (-T or -J) */
+    if (c->stats && pairCount > 0)
+        printf("text: compressed %d strings from %d to %d bytes with %d pairs\n",
+               textCount, plainBytes, textBytes + pairCount * 2, pairCount);
+
+    free(indexed);
+    free(ends);
+    free(texts);
+    free(work);
+    free(addrMap);
+    free(dataMap);
+}
+
+/* IsPlainText - check that a string only has characters that can be compressed */
+static int IsPlainText(uint8_t *data, int size)
+{
+    int i;
+    if (size < 1 || size - 1 > TEXT_MAXLENGTH || data[size - 1] != '\0')
+        return VMFALSE;
+    for (i = 0; i < size - 1; ++i)
+        if (data[i] == '\0' || data[i] >= TEXT_FIRSTPAIR)
+            return VMFALSE;
+    return VMTRUE;
+}
+
+static void PrintStrings(ParseContext *c)
+{
+    String *str;
+    for (str = c->strings; str != NULL; str = str->next) {
+        if (((VMUVALUE)str->offset & ~ADDR_OFF_MASK) == TEXT_BASE)
+            printf("t:%d '%s'\n", (int)(((VMUVALUE)str->offset & ADDR_OFF_MASK) >> TEXT_INDEX_BITS), str->data);
+        else if (str->offset >= STRING_BASE)
+            printf("s:%d '%s'\n", str->offset - STRING_BASE, c->stringBuf + str->offset - STRING_BASE);
+        else if (str->offset >= 0)
+            printf("%d '%s'\n", str->offset, c->dataBuf + str->offset);
+    }
+}
+
+/* ReserveCode - make sure there is room for more code */
+void ReserveCode(ParseContext *c, size_t size)
+{
+    if ((size_t)(c->codeTop - c->codeFree) < size)
+        GrowSegment(c, &c->codeBuf, &c->codeFree, &c->codeTop, &c->codeRelocs, size);
+}
+
+/* ReserveData - make sure there is room for more data */
+void ReserveData(ParseContext *c, size_t size)
+{
+    if ((size_t)(c->dataTop - c->dataFree) < size)
+        GrowSegment(c, &c->dataBuf, &c->dataFree, &c->dataTop, &c->dataRelocs, size);
+}
+
+/* GrowSegment - grow a segment and its relocation types to make room for more bytes
+ *
+ * The segment moves so anything that refers to it must use an offset rather
+ * than a pointer if it is kept across something that might add to it.
+ */
+static void GrowSegment(ParseContext *c, uint8_t **pBuf, uint8_t **pFree, uint8_t **pTop, uint8_t **pRelocs, size_t size)
+{
+    size_t used = *pFree - *pBuf;
+    size_t oldSize = *pTop - *pBuf;
+    size_t newSize = oldSize ? oldSize : MINSEGMENT;
+    while (newSize - used < size)
+        newSize *= 2;
+    if (!(*pBuf = (uint8_t *)realloc(*pBuf, newSize)) || !(*pRelocs = (uint8_t *)realloc(*pRelocs, newSize)))
+        Abort(c, "insufficient memory - needed %d bytes", (int)newSize);
+    memset(*pBuf + oldSize, 0, newSize - oldSize);
+    memset(*pRelocs + oldSize, RELOC_NONE, newSize - oldSize);
+    *pFree = *pBuf + used;
+    *pTop = *pBuf + newSize;
+}
+
+/* LocalAlloc - allocate memory from the local heap */
+void *LocalAlloc(ParseContext *c, size_t size)
+{
+    void *data = (void *)malloc(size);
+    if (!data) Abort(c, "insufficient memory - needed %d bytes", size);
+    if (c->stats) CountAlloc(c, size, VMFALSE);
+    return data;
+}
+
+/* GlobalAlloc - allocate memory that lasts until the image is built */
+void *GlobalAlloc(ParseContext *c, size_t size)
+{
+    return ArenaAlloc(c, &c->globalArena, size);
+}
+
+/* FunctionAlloc - allocate memory that lasts until the current function is compiled */
+void *FunctionAlloc(ParseContext *c, size_t size)
+{
+    return ArenaAlloc(c, &c->functionArena, size);
+}
+
+void Abort(ParseContext *c, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    printf("error: ");
+    vprintf(fmt, ap);
+    putchar('\n');
+    va_end(ap);
+    longjmp(c->errorTarget, 1);
+}
@@ -18,10 +18,10 @@ void PrintNode(ParseContext *c, ParseTreeNode *node, int indent)
 	printf("%*s", indent, "");
     switch (node->nodeType) {
     case NodeTypeFunctionDef:
-        printf("FunctionDef: %s\n", node->u.functionDef.name);
-        PrintLocalSymbols(&node->u.functionDef.arguments, "arguments", indent + 2);
-        PrintLocalSymbols(&node->u.functionDef.locals, "locals", indent + 2);
-        PrintNode(c, node->u.functionDef.body, indent + 2);
+        printf("FunctionDef: %s\n", node->u.functionDef->name);
+        PrintLocalSymbols(&node->u.functionDef->arguments, "arguments", indent + 2);
+        PrintLocalSymbols(&node->u.functionDef->locals, "locals", indent + 2);
+        PrintNode(c, node->u.functionDef->body, indent + 2);
         break;
     case NodeTypeIf:
         printf("If\n");
@@ -48,12 +48,18 @@ void PrintNode(ParseContext *c, ParseTreeNode *node, int indent)
         break;
     case NodeTypeFor:
         printf("For\n");
-        printf("%*sinit\n", indent + 2, "");
-        PrintNode(c, node->u.forStatement.init, indent + 4);
-        printf("%*stest\n", indent + 2, "");
-        PrintNode(c, node->u.forStatement.test, indent + 4);
-        printf("%*sincr\n", indent + 2, "");
-        PrintNode(c, node->u.forStatement.incr, indent + 4);
+        if (node->u.forStatement.init) {
+            printf("%*sinit\n", indent + 2, "");
+            PrintNode(c, node->u.forStatement.init, indent + 4);
+        }
+        if (node->u.forStatement.test) {
+            printf("%*stest\n", indent + 2, "");
+            PrintNode(c, node->u.forStatement.test, indent + 4);
+        }
+        if (node->u.forStatement.incr) {
+            printf("%*sincr\n", indent + 2, "");
+            PrintNode(c, node->u.forStatement.incr, indent + 4);
+        }
         PrintNode(c, node->u.forStatement.body, indent + 2);
         break;
     case NodeTypeReturn:
@@ -108,6 +114,21 @@ void PrintNode(ParseContext *c, ParseTreeNode *node, int indent)
         printf("Print\n");
         PrintPrintOpList(c, node->u.printStatement.ops, indent + 2);
         break;
+    case NodeTypeSwitch:
+        {
+            SwitchCase *switchCase;
+            printf("Switch\n");
+            printf("%*sexpr\n", indent + 2, "");
+            PrintNode(c, node->u.switchStatement.expr, indent + 4);
+            for (switchCase = node->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next) {
+                if (switchCase->isDefault)
+                    printf("%*sdefault\n", indent + 2, "");
+                else
+                    printf("%*scase %d\n", indent + 2, "", switchCase->value);
+                PrintNode(c, switchCase->body, indent + 4);
+            }
+        }
+        break;
     case NodeTypeGlobalSymbolRef:
         printf("GlobalSymbolRef: %s\n", node->u.symbolRef.symbol->name);
         break;
@@ -118,7 +139,7 @@ void PrintNode(ParseContext *c, ParseTreeNode *node, int indent)
         printf("NodeTypeArgumentRef: %s\n", node->u.localSymbolRef.symbol->name);
         break;
     case NodeTypeStringLit:
-		printf("StringLit: '%s'\n", c->stringBuf + node->u.stringLit.string->offset);
+		printf("StringLit: '%s'\n", node->u.stringLit.string->data);
         break;
     case NodeTypeIntegerLit:
 		printf("IntegerLit: %d\n",node->u.integerLit.value);
@@ -0,0 +1,84 @@
+/* adv2eval.c - run calls to pure functions at compile time
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+#include "adv2vm.h"
+
+/* EvaluateCall - call a function with constant arguments while folding a constant expression
+ *
+ * Returns false if the node isn't a call to a function that has already been
+ * compiled or if any argument isn't a constant. The function runs in a copy of
+ * code space with no data space, so it can only compute with its arguments,
+ * its locals, and the values returned by other functions it calls. Anything
+ * else is an error. The stack follows the copy so its offsets stay small.
+ */
+int EvaluateCall(ParseContext *c, ParseTreeNode *node, VMVALUE *pValue)
+{
+    ParseTreeNode *fcn = node->u.functionCall.fcn;
+    VMVALUE args[MAXEVALARGS];
+    NodeListEntry *arg;
+    ImageHdr *image;
+    Symbol *symbol;
+    uint8_t *p;
+    int codeSize, imageSize, argc, cnt, ok;
+
+    /* only calls to functions that have been compiled can be evaluated (not the one being parsed) */
+    if (fcn->nodeType != NodeTypeGlobalSymbolRef)
+        return VMFALSE;
+    symbol = fcn->u.symbolRef.symbol;
+    if (symbol->storageClass != SC_FUNCTION || !symbol->valueDefined)
+        return VMFALSE;
+    
+    /* the function and the ones it calls must be linked (the one being parsed never is) */
+    if (symbol->pending)
+        FinishFunction(c, symbol);
+    codeSize = c->codeFree - c->codeBuf;
+    if (symbol->pending || symbol->v.value >= codeSize)
+        return VMFALSE;
+
+    /* the arguments must be constants */
+    argc = 0;
+    for (arg = node->u.functionCall.args; arg != NULL; arg = arg->next) {
+        if (arg->node->nodeType != NodeTypeIntegerLit || argc >= MAXEVALARGS)
+            return VMFALSE;
+        args[argc++] = arg->node->u.integerLit.value;
+    }
+
+    /* copy code space and add main code that makes the call */
+    imageSize = sizeof(ImageHdr) + codeSize + (argc + 1) * (1 + sizeof(VMVALUE)) + 3;
+    image = (ImageHdr *)LocalAlloc(c, STACKROOM(imageSize));
+    memset(image, 0, sizeof(ImageHdr));
+    image->dataOffset = sizeof(ImageHdr);
+    image->codeOffset = sizeof(ImageHdr);
+    image->stringOffset = sizeof(ImageHdr);
+    image->mainFunction = codeSize;
+    p = (uint8_t *)(image + 1);
+    memcpy(p, c->codeBuf, codeSize);
+    p += codeSize;
+
+    /* push the arguments last to first like code_arguments */
+    while (--argc >= 0) {
+        *p++ = OP_LIT;
+        for (cnt = sizeof(VMVALUE); --cnt >= 0; )
+            *p++ = (uint8_t)(args[argc] >> (cnt * 8));
+    }
+    *p++ = OP_LIT;
+    for (cnt = sizeof(VMVALUE); --cnt >= 0; )
+        *p++ = (uint8_t)(symbol->v.value >> (cnt * 8));
+    *p++ = OP_CALL;
+    *p++ = node->u.functionCall.argc;
+    *p++ = OP_HALT;
+    image->codeSize = p - (uint8_t *)(image + 1);
+
+    ok = Evaluate(image, (uint8_t *)image + STACKOFFSET(imageSize), MAXEVALSTEPS, pValue);
+    free(image);
+    if (!ok)
+        ParseError(c, "can't call '%s' at compile time", symbol->name);
+
+    return VMTRUE;
+}
@@ -22,6 +22,9 @@ typedef struct {
     uint8_t *codeTop;
     uint8_t *stringBase;
     uint8_t *stringTop;
+    uint8_t *textPairs;
+    int textPairCount;
+    int textLengths[TEXT_MAXPAIRS];
     VMVALUE *stack;
     VMVALUE *stackTop;
     uint8_t *pc;
@@ -30,6 +33,9 @@ typedef struct {
     VMVALUE tos;
     VMVALUE *efp;
     int device;
+    Profile *profile;
+    int sandbox;        /* limits on code run at compile time */
+    long steps;         /* instructions left before code run at compile time is stopped */
 } Interpreter;
 
 /* stack manipulation macros */
@@ -56,26 +62,114 @@ typedef struct {
 #define Ptr2Off(i, p)   (VMVALUE)(((uint8_t *)(p) - (i)->dataBase))
 #define Off2Ptr(i, o)   ((i)->dataBase + (o))
 
+/* addresses of string constants are offsets in the read-only string segment */
+#define IsStringAddr(a) (((VMUVALUE)(a) & ~ADDR_OFF_MASK) == STRING_BASE)
+#define Addr2Ptr(i, a)  (IsStringAddr(a) ? (i)->stringBase + ((a) & ADDR_OFF_MASK) : Off2Ptr(i, a))
+#define CheckStore(i, a) do {                                  \
+                            if (IsStringAddr(a) || IsTextAddr(a)) \
+                                Abort(i, "can't change a string constant"); \
+                        } while (0)
+
+/* size of the buffer used to print compressed strings */
+#define TEXT_BUFSIZE    64
+
+/* addresses of characters of compressed strings hold the offset of the string and the index of the character */
+#define IsTextAddr(a)   (((VMUVALUE)(a) & ~ADDR_OFF_MASK) == TEXT_BASE)
+
+/* count a conditional branch (the pc is just past the opcode) */
+#define CountBranch(i, t) do {                                  \
+                            if ((i)->profile)                   \
+                                ProfileBranch((i)->profile, (VMVALUE)((i)->pc - 1 - (i)->codeBase), (t)); \
+                        } while (0)
+
+/* sandbox levels for code run at compile time */
+#define SANDBOX_NONE    0   /* normal execution */
+#define SANDBOX_INIT    1   /* no i/o (initializers) */
+#define SANDBOX_PURE    2   /* nothing outside of its own stack frames (constant expressions) */
+
+/* make sure code run at compile time doesn't do something it shouldn't */
+#define Sandbox(i, level, what) do {                            \
+                            if ((i)->sandbox >= (level))        \
+                                Abort(i, "%s isn't allowed at compile time", what); \
+                        } while (0)
+#define CheckAddress(i, o, n) do {                              \
+                            if ((i)->sandbox == SANDBOX_PURE)   \
+                                CheckStackAddress(i, o, n);     \
+                        } while (0)
+
 /* prototypes for local functions */
+static int Interpret(ImageHdr *image, VMVALUE *stack, int debug, Profile *profile, int sandbox, long maxSteps, VMVALUE *pResult);
+static void CheckStackAddress(Interpreter *i, VMVALUE offset, int size);
 static int GetPropertyAddr(Interpreter *i, VMVALUE object, VMVALUE property, VMVALUE **pPtr);
 static void DoSend(Interpreter *i);
 static void Throw(Interpreter *i, VMVALUE value);
 static void DoTrap(Interpreter *i, int op);
+static void InitText(Interpreter *i);
+static int ExpandText(Interpreter *i, VMVALUE addr, int print);
+static VMVALUE TextLong(Interpreter *i, VMVALUE addr);
 static void StackOverflow(Interpreter *i);
 static void Abort(Interpreter *i, const char *fmt, ...);
 static void ShowStack(Interpreter *i);
 
-/* Execute - execute the main code */
-int Execute(ImageHdr *image, int debug)
+/* Execute - execute the main code (counting calls, branches, and property lookups if there is a profile)
+ *
+ * The stack must be right after the image (at STACKOFFSET of its size) so
+ * that the offsets of stack addresses from the data are small and positive
+ * and can't be mistaken for the tagged addresses of strings or text.
+ */
+int Execute(ImageHdr *image, uint8_t *stack, int debug, Profile *profile)
+{
+    return Interpret(image, (VMVALUE *)stack, debug, profile, SANDBOX_NONE, 0, NULL);
+}
+
+/* ExecuteMapped - execute the main code of an image loaded by MapImage
+ *
+ * The stack is the room MapImage left after the image so that the offsets of
+ * stack addresses from the data of the image fit in a VMVALUE.
+ */
+int ExecuteMapped(MappedImage *m, int debug, Profile *profile)
+{
+    return Interpret(m->image, (VMVALUE *)m->stack, debug, profile, SANDBOX_NONE, 0, NULL);
+}
+
+/* Evaluate - run a compile time call and return the value it leaves on the stack
+ *
+ * The main code of the image pushes the arguments and calls the function and
+ * must end with the HALT that ends the call. Anything other than computing
+ * with the function's own arguments and locals is an error, and so is running
+ * for more than maxSteps instructions. The stack of MAXEVALSTACK bytes must
+ * be right after the image (at STACKOFFSET of its size) so that the offsets
+ * of its addresses from the data are small and positive.
+ */
+int Evaluate(ImageHdr *image, uint8_t *stack, long maxSteps, VMVALUE *pResult)
+{
+    return Interpret(image, (VMVALUE *)stack, VMFALSE, NULL, SANDBOX_PURE, maxSteps, pResult);
+}
+
+/* Initialize - run the main code of an image at compile time to initialize its data
+ *
+ * The code can do anything but i/o. The data space of the image is left as
+ * the code left it. The stack goes right after the image like the one for
+ * Evaluate.
+ */
+int Initialize(ImageHdr *image, uint8_t *stack, long maxSteps)
+{
+    return Interpret(image, (VMVALUE *)stack, VMFALSE, NULL, SANDBOX_INIT, maxSteps, NULL);
+}
+
+/* Interpret - execute code starting at the main function */
+static int Interpret(ImageHdr *image, VMVALUE *stack, int debug, Profile *profile, int sandbox, long maxSteps, VMVALUE *pResult)
 {
     Interpreter *i;
     VMVALUE tmp, *p;
     VMWORD tmpw;
     int8_t tmpb;
+    int stackSize = sandbox ? MAXEVALSTACK : MAXSTACK;
+    int watch = debug || sandbox;
     int cnt;
 
     /* allocate the interpreter state */
-    if (!(i = (Interpreter *)malloc(sizeof(Interpreter) + MAXSTACK)))
+    if (!(i = (Interpreter *)malloc(sizeof(Interpreter))))
         return VMFALSE;
 
 	/* setup the new image */
@@ -85,8 +179,9 @@ int Execute(ImageHdr *image, int debug)
 	i->codeTop = i->codeBase + image->codeSize;
 	i->stringBase = (uint8_t *)image + image->stringOffset;
 	i->stringTop = i->stringBase + image->stringSize;
-    i->stack = (VMVALUE *)((uint8_t *)i + sizeof(Interpreter));
-    i->stackTop = (VMVALUE *)((uint8_t *)i->stack + MAXSTACK);
+    i->stack = stack;
+    i->stackTop = (VMVALUE *)((uint8_t *)i->stack + stackSize);
+    InitText(i);
 
     /* initialize */    
     i->pc = i->codeBase + image->mainFunction;
@@ -96,23 +191,43 @@ int Execute(ImageHdr *image, int debug)
     /* set the default i/o device */
     i->device = -1;
     
+    /* count events if collecting a profile */
+    i->profile = profile;
+    
+    /* limit what a compile time call can do */
+    i->sandbox = sandbox;
+    i->steps = maxSteps;
+    
     /* put the address of a HALT on the top of the stack */
     /* codeBase[0] is zero to act as the second byte of a fake CALL instruction */
     /* codeBase[1] is a HALT instruction */
     i->tos = Ptr2Off(i, i->codeBase + 1);
     
-    if (setjmp(i->errorTarget))
+    if (setjmp(i->errorTarget)) {
+        free(i);
         return VMFALSE;
+    }
 
     for (;;) {
-        if (debug) {
-            ShowStack(i);
-            DecodeInstruction(i->codeBase, i->pc);
+        if (watch) {
+            if (debug) {
+                ShowStack(i);
+                DecodeInstruction(i->codeBase, i->pc);
+            }
+            if (i->sandbox && --i->steps < 0)
+                Abort(i, "code run at compile time took too long");
         }
         switch (VMCODEBYTE(i->pc++)) {
         case OP_HALT:
+            /* a call to an undefined function halts at code offset zero */
+            if (i->sandbox == SANDBOX_PURE && i->pc != i->codeTop)
+                Abort(i, "compile time call to a function that isn't defined yet");
+            if (pResult)
+                *pResult = i->tos;
+            free(i);
             return VMTRUE;
         case OP_BRT:
+            CountBranch(i, i->tos != 0);
             for (tmpw = 0, cnt = sizeof(VMWORD); --cnt >= 0; )
                 tmpw = (tmpw << 8) | VMCODEBYTE(i->pc++);
             if (i->tos)
@@ -120,6 +235,7 @@ int Execute(ImageHdr *image, int debug)
             i->tos = Pop(i);
             break;
         case OP_BRTSC:
+            CountBranch(i, i->tos != 0);
             for (tmpw = 0, cnt = sizeof(VMWORD); --cnt >= 0; )
                 tmpw = (tmpw << 8) | VMCODEBYTE(i->pc++);
             if (i->tos)
@@ -128,6 +244,7 @@ int Execute(ImageHdr *image, int debug)
                 i->tos = Pop(i);
             break;
         case OP_BRF:
+            CountBranch(i, !i->tos);
             for (tmpw = 0, cnt = sizeof(VMWORD); --cnt >= 0; )
                 tmpw = (tmpw << 8) | VMCODEBYTE(i->pc++);
             if (!i->tos)
@@ -135,6 +252,7 @@ int Execute(ImageHdr *image, int debug)
             i->tos = Pop(i);
             break;
         case OP_BRFSC:
+            CountBranch(i, !i->tos);
             for (tmpw = 0, cnt = sizeof(VMWORD); --cnt >= 0; )
                 tmpw = (tmpw << 8) | VMCODEBYTE(i->pc++);
             if (!i->tos)
@@ -232,17 +350,23 @@ int Execute(ImageHdr *image, int debug)
             i->tos = tmpb;
             break;
         case OP_LOAD:
-            i->tos = *(VMVALUE *)(i->dataBase + i->tos);
+            CheckAddress(i, i->tos, sizeof(VMVALUE));
+            i->tos = IsTextAddr(i->tos) ? TextLong(i, i->tos) : *(VMVALUE *)Addr2Ptr(i, i->tos);
             break;
         case OP_LOADB:
-            i->tos = *(uint8_t *)(i->dataBase + i->tos);
+            CheckAddress(i, i->tos, 1);
+            i->tos = IsTextAddr(i->tos) ? ExpandText(i, i->tos, VMFALSE) : *(uint8_t *)Addr2Ptr(i, i->tos);
             break;
         case OP_STORE:
             tmp = Pop(i);
+            CheckAddress(i, tmp, sizeof(VMVALUE));
+            CheckStore(i, tmp);
             *(VMVALUE *)(i->dataBase + tmp) = i->tos;
             break;
         case OP_STOREB:
             tmp = Pop(i);
+            CheckAddress(i, tmp, 1);
+            CheckStore(i, tmp);
             *(uint8_t *)(i->dataBase + tmp) = i->tos;
             break;
         case OP_LADDR:
@@ -261,6 +385,8 @@ int Execute(ImageHdr *image, int debug)
         case OP_CALL:
             ++i->pc; // skip over the argument count
             tmp = i->tos;
+            if (i->profile)
+                ProfileCall(i->profile, tmp);
             i->tos = Ptr2Off(i, i->pc);
             i->pc = i->codeBase + tmp;
             break;
@@ -299,17 +425,21 @@ int Execute(ImageHdr *image, int debug)
             *i->sp = tmp;
             break;
         case OP_TRAP:
+            Sandbox(i, SANDBOX_INIT, "i/o");
             DoTrap(i, VMCODEBYTE(i->pc++));
             break;
         case OP_SEND:
+            Sandbox(i, SANDBOX_PURE, "sending a message");
             DoSend(i);
             break;
         case OP_PADDR:
+            Sandbox(i, SANDBOX_PURE, "a property reference");
             if (!GetPropertyAddr(i, Pop(i), i->tos, &p))
                 Throw(i, 1);
             i->tos = Ptr2Off(i, p);
             break;
         case OP_CLASS:
+            Sandbox(i, SANDBOX_PURE, "a class reference");
             i->tos = ((ObjectHdr *)(i->dataBase + i->tos))->class;
             break;
         case OP_TRY:
@@ -333,8 +463,62 @@ int Execute(ImageHdr *image, int debug)
             Throw(i, i->tos);
             break;
         case OP_NATIVE:
+            Sandbox(i, SANDBOX_INIT, "a native instruction");
             ++i->pc;
             break;
+        case OP_JUMPTABLE:
+            for (tmp = 0, cnt = sizeof(VMVALUE); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            for (tmpw = 0, cnt = sizeof(VMWORD); --cnt >= 0; )
+                tmpw = (tmpw << 8) | VMCODEBYTE(i->pc++);
+            tmp = (VMVALUE)((VMUVALUE)i->tos - (VMUVALUE)tmp);
+            if ((VMUVALUE)tmp < (VMUVALUE)tmpw)
+                i->pc += (tmp + 1) * sizeof(VMWORD);
+            for (tmpw = 0, cnt = sizeof(VMWORD); --cnt >= 0; )
+                tmpw = (tmpw << 8) | VMCODEBYTE(i->pc++);
+            i->pc += tmpw;
+            i->tos = Pop(i);
+            break;
+        case OP_WLIT:
+            for (tmp = 0, cnt = sizeof(VMWORD); --cnt >= 0; )
+                tmp = (tmp << 8) | VMCODEBYTE(i->pc++);
+            CPush(i, i->tos);
+            i->tos = tmp;
+            break;
+        case OP_SBRT:
+            CountBranch(i, i->tos != 0);
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            if (i->tos)
+                i->pc += tmpb;
+            i->tos = Pop(i);
+            break;
+        case OP_SBRTSC:
+            CountBranch(i, i->tos != 0);
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            if (i->tos)
+                i->pc += tmpb;
+            else
+                i->tos = Pop(i);
+            break;
+        case OP_SBRF:
+            CountBranch(i, !i->tos);
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            if (!i->tos)
+                i->pc += tmpb;
+            i->tos = Pop(i);
+            break;
+        case OP_SBRFSC:
+            CountBranch(i, !i->tos);
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            if (!i->tos)
+                i->pc += tmpb;
+            else
+                i->tos = Pop(i);
+            break;
+        case OP_SBR:
+            tmpb = (int8_t)VMCODEBYTE(i->pc++);
+            i->pc += tmpb;
+            break;
         default:
             Abort(i, "undefined opcode 0x%02x", VMCODEBYTE(i->pc - 1));
             break;
@@ -342,6 +526,14 @@ int Execute(ImageHdr *image, int debug)
     }
 }
 
+/* CheckStackAddress - make sure a compile time call only loads and stores its arguments and locals */
+static void CheckStackAddress(Interpreter *i, VMVALUE offset, int size)
+{
+    uint8_t *p = (uint8_t *)Off2Ptr(i, offset);
+    if (p < (uint8_t *)i->stack || p + size > (uint8_t *)i->stackTop)
+        Abort(i, "a global variable isn't allowed in a constant expression");
+}
+
 static int GetPropertyAddr(Interpreter *i, VMVALUE object, VMVALUE tag, VMVALUE **pPtr)
 {
     ObjectHdr *hdr = (ObjectHdr *)(i->dataBase + object);
@@ -350,6 +542,8 @@ static int GetPropertyAddr(Interpreter *i, VMVALUE object, VMVALUE tag, VMVALUE
         int nProperties = hdr->nProperties;
         while (--nProperties >= 0) {
             if ((property->tag & ~P_SHARED) == tag) {
+                if (i->profile)
+                    ProfileProperty(i->profile, object, tag);
                 *pPtr = (VMVALUE *)&property->value;
                 return VMTRUE;
             }
@@ -364,13 +558,19 @@ static int GetPropertyAddr(Interpreter *i, VMVALUE object, VMVALUE tag, VMVALUE
 static void DoSend(Interpreter *i)
 {
     VMVALUE obj, prop, *p;
+    uint8_t *site = i->pc - 1;
     ++i->pc; // skip over the argument count
     prop = i->tos;
     i->tos = Ptr2Off(i, i->pc);
     if (!(obj = i->sp[1]))
         obj = i->sp[0];
-    if (GetPropertyAddr(i, obj, prop, &p))
+    if (i->profile)
+        ProfileSend(i->profile, (VMVALUE)(site - i->codeBase), ((ObjectHdr *)(i->dataBase + i->sp[0]))->class);
+    if (GetPropertyAddr(i, obj, prop, &p)) {
+        if (i->profile)
+            ProfileCall(i->profile, *p);
         i->pc = i->codeBase + *p;
+    }
     else
         Throw(i, 1);
 }
@@ -400,7 +600,10 @@ static void DoTrap(Interpreter *i, int op)
         i->tos = Pop(i);
         break;
     case TRAP_PrintStr:
-        printf("%s", (char *)(i->dataBase + i->tos));
+        if (IsTextAddr(i->tos))
+            ExpandText(i, i->tos, VMTRUE);
+        else
+            printf("%s", (char *)Addr2Ptr(i, i->tos));
         i->tos = *i->sp++;
         break;
     case TRAP_PrintInt:
@@ -420,6 +623,79 @@ static void DoTrap(Interpreter *i, int op)
     }
 }
 
+/* InitText - find the dictionary of compressed strings and the number of characters in each pair */
+static void InitText(Interpreter *i)
+{
+    int n;
+    i->textPairCount = 0;
+    i->textPairs = i->stringBase + sizeof(VMVALUE);
+    if (i->stringTop - i->stringBase >= (int)sizeof(VMVALUE))
+        i->textPairCount = *(VMVALUE *)i->stringBase;
+    for (n = 0; n < i->textPairCount; ++n) {
+        uint8_t *pair = i->textPairs + n * 2;
+        i->textLengths[n] = (pair[0] < TEXT_FIRSTPAIR ? 1 : i->textLengths[pair[0] - TEXT_FIRSTPAIR])
+                          + (pair[1] < TEXT_FIRSTPAIR ? 1 : i->textLengths[pair[1] - TEXT_FIRSTPAIR]);
+    }
+}
+
+/* ExpandText - print a compressed string starting at a character or return the character
+ *
+ * The pairs are expanded on a small stack and the characters are written out
+ * a buffer at a time so the string is never copied anywhere. Pairs that end
+ * before the character are skipped without being expanded.
+ */
+static int ExpandText(Interpreter *i, VMVALUE addr, int print)
+{
+    uint8_t stack[TEXT_MAXPAIRS + 1], *p, *pair;
+    char buf[TEXT_BUFSIZE];
+    int skip = addr & TEXT_INDEX_MASK;
+    int sp, code, n = 0;
+
+    for (p = i->stringBase + (((VMUVALUE)addr & ADDR_OFF_MASK) >> TEXT_INDEX_BITS); p < i->stringTop && *p != '\0'; ++p) {
+        stack[0] = *p;
+        sp = 1;
+        while (sp > 0) {
+            code = stack[--sp];
+            if (code < TEXT_FIRSTPAIR) {
+                if (skip > 0)
+                    --skip;
+                else if (!print)
+                    return code;
+                else {
+                    buf[n++] = code;
+                    if (n == TEXT_BUFSIZE) {
+                        fwrite(buf, 1, n, stdout);
+                        n = 0;
+                    }
+                }
+            }
+            else if (skip >= i->textLengths[code - TEXT_FIRSTPAIR])
+                skip -= i->textLengths[code - TEXT_FIRSTPAIR];
+            else {
+                pair = i->textPairs + (code - TEXT_FIRSTPAIR) * 2;
+                stack[sp++] = pair[1];
+                stack[sp++] = pair[0];
+            }
+        }
+    }
+
+    if (n > 0)
+        fwrite(buf, 1, n, stdout);
+
+    return 0;
+}
+
+/* TextLong - get a long from a compressed string one character at a time */
+static VMVALUE TextLong(Interpreter *i, VMVALUE addr)
+{
+    VMVALUE value;
+    uint8_t *p = (uint8_t *)&value;
+    int n;
+    for (n = 0; n < (int)sizeof(VMVALUE); ++n)
+        p[n] = ExpandText(i, addr + n, VMFALSE);
+    return value;
+}
+
 static void StackOverflow(Interpreter *i)
 {
     Abort(i, "stack overflow");
@@ -438,8 +714,12 @@ static void Abort(Interpreter *i, const char *fmt, ...)
 
 static void ShowOffset(Interpreter *i, VMVALUE value)
 {
-    uint8_t *p = (uint8_t *)Off2Ptr(i, value);
-    if (p >= i->dataBase && p < i->dataTop)
+    uint8_t *p = (uint8_t *)Addr2Ptr(i, value);
+    if (IsTextAddr(value))
+        printf("(t:%d+%d)", (int)(((VMUVALUE)value & ADDR_OFF_MASK) >> TEXT_INDEX_BITS), (int)(value & TEXT_INDEX_MASK));
+    else if (IsStringAddr(value))
+        printf("(s:%d)", (int)(p - i->stringBase));
+    else if (p >= i->dataBase && p < i->dataTop)
         printf("(d:%d)", (int)(p - i->dataBase));
     else if (p >= i->codeBase && p < i->codeTop)
         printf("(c:%d-%x)", (int)(p - i->codeBase), (int)(p - i->codeBase));
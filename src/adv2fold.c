@@ -0,0 +1,535 @@
+/* adv2fold.c - constant folding and simplification of parse trees
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <string.h>
+#include "adv2compiler.h"
+
+/* local function prototypes */
+static ParseTreeNode *FoldStatement(ParseContext *c, ParseTreeNode *node);
+static ParseTreeNode *FoldBlock(ParseContext *c, ParseTreeNode *node);
+static ParseTreeNode *FoldLValue(ParseContext *c, ParseTreeNode *node);
+static ParseTreeNode *FoldUnaryOp(ParseContext *c, ParseTreeNode *node);
+static ParseTreeNode *FoldBinaryOp(ParseContext *c, ParseTreeNode *node);
+static ParseTreeNode *FoldShortCircuit(ParseContext *c, ParseTreeNode *node, int isDisjunction);
+static void FoldList(ParseContext *c, NodeListEntry *entry);
+static int IsConstant(ParseTreeNode *node, VMVALUE *pValue);
+static int IsPowerOfTwo(VMVALUE value, int *pShift);
+static int EndsFlow(ParseTreeNode *node);
+static ParseTreeNode *MakeConstant(ParseContext *c, ParseTreeNode *node, VMVALUE value);
+static ParseTreeNode *MakeEmpty(ParseContext *c, ParseTreeNode *node);
+
+/* FoldFunction - fold constants and simplify the body of a function */
+void FoldFunction(ParseContext *c, ParseTreeNode *node)
+{
+    LocalSymbol *local;
+    for (local = node->u.functionDef->locals.head; local != NULL; local = local->next) {
+        if (local->initialValue)
+            local->initialValue = FoldExpr(c, local->initialValue);
+    }
+    node->u.functionDef->body = FoldStatement(c, node->u.functionDef->body);
+}
+
+/* FoldStatement - fold constants in a statement and prune constant branches */
+static ParseTreeNode *FoldStatement(ParseContext *c, ParseTreeNode *node)
+{
+    ParseTreeNode *expr;
+    SwitchCase *switchCase;
+    PrintOp *op;
+    VMVALUE value;
+
+    switch (node->nodeType) {
+    case NodeTypeIf:
+        node->u.ifStatement.test = FoldExpr(c, node->u.ifStatement.test);
+        node->u.ifStatement.thenStatement = FoldStatement(c, node->u.ifStatement.thenStatement);
+        if (node->u.ifStatement.elseStatement)
+            node->u.ifStatement.elseStatement = FoldStatement(c, node->u.ifStatement.elseStatement);
+        if (IsConstant(node->u.ifStatement.test, &value)) {
+            if (value)
+                node = node->u.ifStatement.thenStatement;
+            else if (node->u.ifStatement.elseStatement)
+                node = node->u.ifStatement.elseStatement;
+            else
+                node = MakeEmpty(c, node);
+        }
+        break;
+    case NodeTypeWhile:
+        node->u.whileStatement.test = FoldExpr(c, node->u.whileStatement.test);
+        node->u.whileStatement.body = FoldStatement(c, node->u.whileStatement.body);
+        if (IsConstant(node->u.whileStatement.test, &value) && !value)
+            node = MakeEmpty(c, node);
+        break;
+    case NodeTypeDoWhile:
+        node->u.doWhileStatement.body = FoldStatement(c, node->u.doWhileStatement.body);
+        node->u.doWhileStatement.test = FoldExpr(c, node->u.doWhileStatement.test);
+        break;
+    case NodeTypeFor:
+        if (node->u.forStatement.init)
+            node->u.forStatement.init = FoldExpr(c, node->u.forStatement.init);
+        if (node->u.forStatement.test)
+            node->u.forStatement.test = FoldExpr(c, node->u.forStatement.test);
+        if (node->u.forStatement.incr)
+            node->u.forStatement.incr = FoldExpr(c, node->u.forStatement.incr);
+        node->u.forStatement.body = FoldStatement(c, node->u.forStatement.body);
+        if (node->u.forStatement.test && IsConstant(node->u.forStatement.test, &value)) {
+
+            /* a loop that is never entered only needs its initialization */
+            if (!value) {
+                if ((expr = node->u.forStatement.init) != NULL) {
+                    node->nodeType = NodeTypeExpr;
+                    node->u.exprStatement.expr = expr;
+                }
+                else
+                    node = MakeEmpty(c, node);
+            }
+
+            /* a constant true test is the same as no test at all */
+            else
+                node->u.forStatement.test = NULL;
+        }
+        break;
+    case NodeTypeReturn:
+        if (node->u.returnStatement.value)
+            node->u.returnStatement.value = FoldExpr(c, node->u.returnStatement.value);
+        break;
+    case NodeTypeBlock:
+        node = FoldBlock(c, node);
+        break;
+    case NodeTypeTry:
+        node->u.tryStatement.statement = FoldStatement(c, node->u.tryStatement.statement);
+        node->u.tryStatement.catchStatement = FoldStatement(c, node->u.tryStatement.catchStatement);
+        break;
+    case NodeTypeThrow:
+        node->u.throwStatement.expr = FoldExpr(c, node->u.throwStatement.expr);
+        break;
+    case NodeTypeExpr:
+        node->u.exprStatement.expr = FoldExpr(c, node->u.exprStatement.expr);
+        if (IsPure(node->u.exprStatement.expr))
+            node = MakeEmpty(c, node);
+        break;
+    case NodeTypePrint:
+        for (op = node->u.printStatement.ops; op != NULL; op = op->next) {
+            if (op->expr)
+                op->expr = FoldExpr(c, op->expr);
+        }
+        break;
+    case NodeTypeSwitch:
+        node->u.switchStatement.expr = FoldExpr(c, node->u.switchStatement.expr);
+        for (switchCase = node->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next)
+            switchCase->body = FoldStatement(c, switchCase->body);
+        break;
+    default:
+        break;
+    }
+
+    return node;
+}
+
+/* FoldBlock - fold the statements in a block removing empty and unreachable statements */
+static ParseTreeNode *FoldBlock(ParseContext *c, ParseTreeNode *node)
+{
+    NodeListEntry **pEntry = &node->u.blockStatement.statements;
+    NodeListEntry *entry;
+
+    while ((entry = *pEntry) != NULL) {
+        entry->node = FoldStatement(c, entry->node);
+
+        /* drop statements that generate no code */
+        if (entry->node->nodeType == NodeTypeEmpty)
+            *pEntry = entry->next;
+
+        /* drop statements that can never be reached */
+        else if (EndsFlow(entry->node)) {
+            entry->next = NULL;
+            break;
+        }
+
+        else
+            pEntry = &entry->next;
+    }
+
+    return node;
+}
+
+/* FoldExpr - fold constants and simplify an expression */
+ParseTreeNode *FoldExpr(ParseContext *c, ParseTreeNode *node)
+{
+    VMVALUE value;
+
+    switch (node->nodeType) {
+    case NodeTypePreincrementOp:
+    case NodeTypePostincrementOp:
+        node->u.incrementOp.expr = FoldLValue(c, node->u.incrementOp.expr);
+        break;
+    case NodeTypeCommaOp:
+        node->u.commaOp.left = FoldExpr(c, node->u.commaOp.left);
+        node->u.commaOp.right = FoldExpr(c, node->u.commaOp.right);
+        if (IsPure(node->u.commaOp.left))
+            node = node->u.commaOp.right;
+        break;
+    case NodeTypeUnaryOp:
+        node = FoldUnaryOp(c, node);
+        break;
+    case NodeTypeBinaryOp:
+        node = FoldBinaryOp(c, node);
+        break;
+    case NodeTypeTernaryOp:
+        node->u.ternaryOp.test = FoldExpr(c, node->u.ternaryOp.test);
+        node->u.ternaryOp.thenExpr = FoldExpr(c, node->u.ternaryOp.thenExpr);
+        node->u.ternaryOp.elseExpr = FoldExpr(c, node->u.ternaryOp.elseExpr);
+        if (IsConstant(node->u.ternaryOp.test, &value))
+            node = value ? node->u.ternaryOp.thenExpr : node->u.ternaryOp.elseExpr;
+        break;
+    case NodeTypeAssignmentOp:
+        node->u.binaryOp.left = FoldLValue(c, node->u.binaryOp.left);
+        node->u.binaryOp.right = FoldExpr(c, node->u.binaryOp.right);
+        break;
+    case NodeTypeArrayRef:
+        node->u.arrayRef.array = FoldExpr(c, node->u.arrayRef.array);
+        node->u.arrayRef.index = FoldExpr(c, node->u.arrayRef.index);
+        break;
+    case NodeTypeFunctionCall:
+        node->u.functionCall.fcn = FoldExpr(c, node->u.functionCall.fcn);
+        FoldList(c, node->u.functionCall.args);
+        if (c->evaluateCalls && EvaluateCall(c, node, &value))
+            node = MakeConstant(c, node, value);
+        break;
+    case NodeTypeMethodCall:
+        if (node->u.methodCall.class)
+            node->u.methodCall.class = FoldExpr(c, node->u.methodCall.class);
+        node->u.methodCall.object = FoldExpr(c, node->u.methodCall.object);
+        node->u.methodCall.selector = FoldExpr(c, node->u.methodCall.selector);
+        FoldList(c, node->u.methodCall.args);
+        break;
+    case NodeTypeClassRef:
+        node->u.classRef.object = FoldExpr(c, node->u.classRef.object);
+        break;
+    case NodeTypePropertyRef:
+        node->u.propertyRef.object = FoldExpr(c, node->u.propertyRef.object);
+        node->u.propertyRef.selector = FoldExpr(c, node->u.propertyRef.selector);
+        break;
+    case NodeTypeDisjunction:
+        node = FoldShortCircuit(c, node, VMTRUE);
+        break;
+    case NodeTypeConjunction:
+        node = FoldShortCircuit(c, node, VMFALSE);
+        break;
+    default:
+        break;
+    }
+
+    return node;
+}
+
+/* FoldLValue - fold the subexpressions of an lvalue without replacing the lvalue itself */
+static ParseTreeNode *FoldLValue(ParseContext *c, ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeArrayRef:
+    case NodeTypePropertyRef:
+        node = FoldExpr(c, node);
+        break;
+    default:
+        /* leave anything else for the code generator to check */
+        break;
+    }
+    return node;
+}
+
+/* FoldUnaryOp - fold a unary operator */
+static ParseTreeNode *FoldUnaryOp(ParseContext *c, ParseTreeNode *node)
+{
+    ParseTreeNode *expr;
+    VMVALUE value;
+
+    expr = node->u.unaryOp.expr = FoldExpr(c, node->u.unaryOp.expr);
+
+    if (IsConstant(expr, &value)) {
+        switch (node->u.unaryOp.op) {
+        case OP_NEG:
+            return MakeConstant(c, node, -value);
+        case OP_NOT:
+            return MakeConstant(c, node, !value);
+        case OP_BNOT:
+            return MakeConstant(c, node, ~value);
+        }
+    }
+
+    /* -(-x) and ~(~x) are just x */
+    else if (expr->nodeType == NodeTypeUnaryOp
+         &&  expr->u.unaryOp.op == node->u.unaryOp.op
+         &&  (node->u.unaryOp.op == OP_NEG || node->u.unaryOp.op == OP_BNOT))
+        return expr->u.unaryOp.expr;
+
+    return node;
+}
+
+/* FoldBinaryOp - fold a binary operator */
+static ParseTreeNode *FoldBinaryOp(ParseContext *c, ParseTreeNode *node)
+{
+    ParseTreeNode *left, *right;
+    VMVALUE lvalue, rvalue;
+    int leftConstant, rightConstant, shift;
+
+    left = node->u.binaryOp.left = FoldExpr(c, node->u.binaryOp.left);
+    right = node->u.binaryOp.right = FoldExpr(c, node->u.binaryOp.right);
+    leftConstant = IsConstant(left, &lvalue);
+    rightConstant = IsConstant(right, &rvalue);
+
+    /* evaluate operators with constant operands */
+    if (leftConstant && rightConstant) {
+        switch (node->u.binaryOp.op) {
+        case OP_ADD:
+            return MakeConstant(c, node, (VMVALUE)((VMUVALUE)lvalue + (VMUVALUE)rvalue));
+        case OP_SUB:
+            return MakeConstant(c, node, (VMVALUE)((VMUVALUE)lvalue - (VMUVALUE)rvalue));
+        case OP_MUL:
+            return MakeConstant(c, node, (VMVALUE)((VMUVALUE)lvalue * (VMUVALUE)rvalue));
+        case OP_DIV:
+        case OP_REM:
+            /* division by zero in code is left for the VM, but a constant expression needs a value */
+            if (rvalue == 0) {
+                if (c->evaluateCalls)
+                    ParseError(c, "division by zero in constant expression");
+                break;
+            }
+            if (!(lvalue == (VMVALUE)0x80000000 && rvalue == -1))
+                return MakeConstant(c, node, node->u.binaryOp.op == OP_DIV ? lvalue / rvalue : lvalue % rvalue);
+            break;
+        case OP_BAND:
+            return MakeConstant(c, node, lvalue & rvalue);
+        case OP_BOR:
+            return MakeConstant(c, node, lvalue | rvalue);
+        case OP_BXOR:
+            return MakeConstant(c, node, lvalue ^ rvalue);
+        case OP_SHL:
+            if (rvalue >= 0 && rvalue < 32)
+                return MakeConstant(c, node, (VMVALUE)((VMUVALUE)lvalue << rvalue));
+            break;
+        case OP_SHR:
+            if (rvalue >= 0 && rvalue < 32)
+                return MakeConstant(c, node, lvalue >> rvalue);
+            break;
+        case OP_LT:
+            return MakeConstant(c, node, lvalue < rvalue);
+        case OP_LE:
+            return MakeConstant(c, node, lvalue <= rvalue);
+        case OP_EQ:
+            return MakeConstant(c, node, lvalue == rvalue);
+        case OP_NE:
+            return MakeConstant(c, node, lvalue != rvalue);
+        case OP_GE:
+            return MakeConstant(c, node, lvalue >= rvalue);
+        case OP_GT:
+            return MakeConstant(c, node, lvalue > rvalue);
+        }
+        return node;
+    }
+
+    /* simplify identities with a constant right operand */
+    if (rightConstant) {
+        switch (node->u.binaryOp.op) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_BOR:
+        case OP_BXOR:
+        case OP_SHL:
+        case OP_SHR:
+            if (rvalue == 0)
+                return left;
+            break;
+        case OP_MUL:
+            if (rvalue == 1)
+                return left;
+            else if (rvalue == 0 && IsPure(left))
+                return right;
+            else if (IsPowerOfTwo(rvalue, &shift)) {
+                node->u.binaryOp.op = OP_SHL;
+                right->u.integerLit.value = shift;
+            }
+            break;
+        case OP_DIV:
+            if (rvalue == 1)
+                return left;
+            break;
+        case OP_BAND:
+            if (rvalue == -1)
+                return left;
+            else if (rvalue == 0 && IsPure(left))
+                return right;
+            break;
+        }
+    }
+
+    /* simplify identities with a constant left operand */
+    else if (leftConstant) {
+        switch (node->u.binaryOp.op) {
+        case OP_ADD:
+        case OP_BOR:
+        case OP_BXOR:
+            if (lvalue == 0)
+                return right;
+            break;
+        case OP_MUL:
+            if (lvalue == 1)
+                return right;
+            else if (lvalue == 0 && IsPure(right))
+                return left;
+            else if (IsPowerOfTwo(lvalue, &shift)) {
+                node->u.binaryOp.op = OP_SHL;
+                node->u.binaryOp.left = right;
+                node->u.binaryOp.right = left;
+                left->u.integerLit.value = shift;
+            }
+            break;
+        case OP_BAND:
+            if (lvalue == -1)
+                return right;
+            else if (lvalue == 0 && IsPure(right))
+                return left;
+            break;
+        }
+    }
+
+    return node;
+}
+
+/* FoldShortCircuit - fold a '||' or '&&' expression
+ *
+ * Both operators yield the value of the last operand evaluated so operands can
+ * only be removed when doing so can't change the result. A false operand of '||'
+ * or a true operand of '&&' that isn't the last operand can be removed. A true
+ * operand of '||' or a false operand of '&&' ends the evaluation.
+ */
+static ParseTreeNode *FoldShortCircuit(ParseContext *c, ParseTreeNode *node, int isDisjunction)
+{
+    NodeListEntry **pEntry = &node->u.exprList.exprs;
+    NodeListEntry *entry;
+    VMVALUE value;
+
+    while ((entry = *pEntry) != NULL) {
+        entry->node = FoldExpr(c, entry->node);
+        if (IsConstant(entry->node, &value)) {
+            if ((value != 0) == isDisjunction) {
+                entry->next = NULL;
+                break;
+            }
+            else if (entry->next || (isDisjunction && pEntry != &node->u.exprList.exprs)) {
+                *pEntry = entry->next;
+                continue;
+            }
+        }
+        pEntry = &entry->next;
+    }
+
+    /* replace a single remaining operand with the operand itself */
+    if (node->u.exprList.exprs && !node->u.exprList.exprs->next)
+        return node->u.exprList.exprs->node;
+
+    return node;
+}
+
+/* FoldList - fold each expression in a list */
+static void FoldList(ParseContext *c, NodeListEntry *entry)
+{
+    for (; entry != NULL; entry = entry->next)
+        entry->node = FoldExpr(c, entry->node);
+}
+
+/* IsPure - check to see if an expression can be evaluated without side effects */
+int IsPure(ParseTreeNode *node)
+{
+    NodeListEntry *entry;
+    switch (node->nodeType) {
+    case NodeTypeGlobalSymbolRef:
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+    case NodeTypeStringLit:
+    case NodeTypeIntegerLit:
+    case NodeTypeFunctionLit:
+        return VMTRUE;
+    case NodeTypeUnaryOp:
+        return IsPure(node->u.unaryOp.expr);
+    case NodeTypeBinaryOp:
+        /* division by zero is an error on some targets */
+        if (node->u.binaryOp.op == OP_DIV || node->u.binaryOp.op == OP_REM) {
+            VMVALUE value;
+            if (!IsConstant(node->u.binaryOp.right, &value) || value == 0)
+                return VMFALSE;
+        }
+        return IsPure(node->u.binaryOp.left) && IsPure(node->u.binaryOp.right);
+    case NodeTypeTernaryOp:
+        return IsPure(node->u.ternaryOp.test)
+            && IsPure(node->u.ternaryOp.thenExpr)
+            && IsPure(node->u.ternaryOp.elseExpr);
+    case NodeTypeCommaOp:
+        return IsPure(node->u.commaOp.left) && IsPure(node->u.commaOp.right);
+    case NodeTypeArrayRef:
+        return IsPure(node->u.arrayRef.array) && IsPure(node->u.arrayRef.index);
+    case NodeTypeClassRef:
+        return IsPure(node->u.classRef.object);
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        for (entry = node->u.exprList.exprs; entry != NULL; entry = entry->next)
+            if (!IsPure(entry->node))
+                return VMFALSE;
+        return VMTRUE;
+    default:
+        /* property references can throw, calls and assignments have side effects */
+        return VMFALSE;
+    }
+}
+
+/* IsConstant - check to see if a node is an integer constant */
+static int IsConstant(ParseTreeNode *node, VMVALUE *pValue)
+{
+    if (node->nodeType != NodeTypeIntegerLit)
+        return VMFALSE;
+    *pValue = node->u.integerLit.value;
+    return VMTRUE;
+}
+
+/* IsPowerOfTwo - check for a power of two greater than one */
+static int IsPowerOfTwo(VMVALUE value, int *pShift)
+{
+    int shift;
+    if (value <= 1 || (value & (value - 1)) != 0)
+        return VMFALSE;
+    for (shift = 0; (value >>= 1) != 0; ++shift)
+        ;
+    *pShift = shift;
+    return VMTRUE;
+}
+
+/* EndsFlow - check to see if control can't continue past a statement */
+static int EndsFlow(ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeReturn:
+    case NodeTypeBreak:
+    case NodeTypeContinue:
+    case NodeTypeThrow:
+        return VMTRUE;
+    default:
+        return VMFALSE;
+    }
+}
+
+/* MakeConstant - turn a node into an integer literal */
+static ParseTreeNode *MakeConstant(ParseContext *c, ParseTreeNode *node, VMVALUE value)
+{
+    memset(&node->u, 0, sizeof(node->u));
+    node->nodeType = NodeTypeIntegerLit;
+    node->u.integerLit.value = value;
+    return node;
+}
+
+/* MakeEmpty - turn a statement node into an empty statement */
+static ParseTreeNode *MakeEmpty(ParseContext *c, ParseTreeNode *node)
+{
+    memset(&node->u, 0, sizeof(node->u));
+    node->nodeType = NodeTypeEmpty;
+    return node;
+}
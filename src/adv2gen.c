@@ -4,6 +4,7 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "adv2compiler.h"
 
@@ -21,6 +22,11 @@ static void code_block(ParseContext *c, ParseTreeNode *expr);
 static void code_exprstatement(ParseContext *c, ParseTreeNode *node);
 static void code_asm(ParseContext *c, ParseTreeNode *node);
 static void code_print(ParseContext *c, ParseTreeNode *expr);
+static void code_switch(ParseContext *c, ParseTreeNode *expr);
+static void code_jumptable(ParseContext *c, SwitchCase **cases, int count, int *pDefault);
+static void code_casetree(ParseContext *c, SwitchCase **cases, int count, int *pDefault);
+static void code_integer(ParseContext *c, VMVALUE value);
+static int CompareCases(const void *p1, const void *p2);
 static void code_ternary(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 static void code_symbolref(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 static void code_shortcircuit(ParseContext *c, int op, ParseTreeNode *expr, PVAL *pv);
@@ -31,23 +37,63 @@ static void code_classref(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 static void code_propertyref(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 static void code_lvalue(ParseContext *c, ParseTreeNode *expr, PVAL *pv);
 static void code_rvalue(ParseContext *c, ParseTreeNode *expr);
+static void code_selector(ParseContext *c, ParseTreeNode *expr);
+static int ConstantObject(ParseContext *c, ParseTreeNode *expr, VMVALUE *pObject);
+static int FindConstantProperty(ParseContext *c, VMVALUE object, ParseTreeNode *selector, VMVALUE *pOffset);
+static void code_address(ParseContext *c, int relocType, VMVALUE value);
+static void code_reference(ParseContext *c, CodeRef *ref);
 static void code_dataref(ParseContext *c, PvFcn fcn, PVAL *pv);
 static void code_localref(ParseContext *c, PvFcn fcn, PVAL *pv);
 static void rvalue(ParseContext *c, PVAL *pv);
 static void chklvalue(ParseContext *c, PVAL *pv);
+static void prepare_node(ParseContext *c, ParseTreeNode *node);
+static void prepare_lvalue(ParseContext *c, ParseTreeNode *expr);
 static void PushBlock(ParseContext *c, Block *block, BlockType type);
 static void PopBlock(ParseContext *c);
 
 static int codeaddr(ParseContext *c);
 static void fixupbranch(ParseContext *c, VMUVALUE chn, VMUVALUE val);
 
+/* PrepareFunction - look up what generating code for a function needs from the rest of the program
+ *
+ * Code is generated while parsing continues so the objects and properties a
+ * function uses are found now, as they are when the function is parsed, and
+ * errors are reported while the source position is still at the function.
+ * The properties the function assigns are collected for BindMethods.
+ */
+void PrepareFunction(ParseContext *c, ParseTreeNode *function)
+{
+    FunctionDef *functionDef = function->u.functionDef;
+    LocalSymbol *local;
+    c->storedTagCount = 0;
+    c->dynamicStores = functionDef->dynamicStores;
+    for (local = functionDef->locals.head; local != NULL; local = local->next) {
+        if (local->initialValue)
+            prepare_node(c, local->initialValue);
+    }
+    prepare_node(c, functionDef->body);
+    functionDef->dynamicStores = c->dynamicStores;
+    if ((functionDef->storedTagCount = c->storedTagCount) > 0) {
+        functionDef->storedTags = (VMVALUE *)FunctionAlloc(c, c->storedTagCount * sizeof(VMVALUE));
+        memcpy(functionDef->storedTags, c->storedTags, c->storedTagCount * sizeof(VMVALUE));
+    }
+    c->storedTagCount = 0;
+    c->dynamicStores = VMFALSE;
+}
+
 /* code_functiondef - generate code for a function definition */
 uint8_t *code_functiondef(ParseContext *c, ParseTreeNode *expr, int *pLength)
 {
-    LocalSymbol *local = expr->u.functionDef.locals.head;
-    uint8_t *base = c->codeFree;
+    LocalSymbol *local = expr->u.functionDef->locals.head;
+    int base = codeaddr(c);
+    c->codeRefCount = 0;
+    c->selectorCount = 0;
+    c->dynamicSelectors = VMFALSE;
     putcbyte(c, OP_FRAME);
-    putcbyte(c, expr->u.functionDef.locals.count + expr->u.functionDef.maximumTryDepth + 1);
+    if (expr->u.functionDef->localSlots > 0)
+        putcbyte(c, expr->u.functionDef->localSlots + expr->u.functionDef->maximumTryDepth + 1);
+    else
+        putcbyte(c, expr->u.functionDef->locals.count + expr->u.functionDef->maximumTryDepth + 1);
     while (local) {
         if (local->initialValue) {
             putcbyte(c, OP_LADDR);
@@ -58,10 +104,10 @@ uint8_t *code_functiondef(ParseContext *c, ParseTreeNode *expr, int *pLength)
         }
         local = local->next;
     }
-    code_statement(c, expr->u.functionDef.body);
+    code_statement(c, expr->u.functionDef->body);
     putcbyte(c, OP_RETURNZ);
-    *pLength = c->codeFree - base;
-    return base;
+    *pLength = codeaddr(c) - base;
+    return c->codeBuf + base;
 }
 
 /* code_lvalue - generate code for an l-value expression */
@@ -126,6 +172,9 @@ static void code_statement(ParseContext *c, ParseTreeNode *expr)
     case NodeTypePrint:
         code_print(c, expr);
         break;
+    case NodeTypeSwitch:
+        code_switch(c, expr);
+        break;
     }
 }
 
@@ -159,9 +208,12 @@ static void code_while(ParseContext *c, ParseTreeNode *expr)
     PushBlock(c, &block, BLOCK_WHILE);
     block.cont = block.nxt = codeaddr(c);
     block.contDefined = VMTRUE;
-    code_rvalue(c, expr->u.whileStatement.test);
-    putcbyte(c, OP_BRF);
-    block.end = putcword(c, 0);
+    block.end = 0;
+    if (expr->u.whileStatement.test->nodeType != NodeTypeIntegerLit) {
+        code_rvalue(c, expr->u.whileStatement.test);
+        putcbyte(c, OP_BRF);
+        block.end = putcword(c, 0);
+    }
     code_statement(c, expr->u.whileStatement.body);
     inst = putcbyte(c, OP_BR);
     putcword(c, block.nxt - inst - 1 - sizeof(VMWORD));
@@ -181,9 +233,15 @@ static void code_dowhile(ParseContext *c, ParseTreeNode *expr)
     block.end = 0;
     code_statement(c, expr->u.doWhileStatement.body);
     fixupbranch(c, block.cont, codeaddr(c));
-    code_rvalue(c, expr->u.doWhileStatement.test);
-    inst = putcbyte(c, OP_BRT);
-    putcword(c, block.nxt - inst - 1 - sizeof(VMWORD));
+    if (expr->u.doWhileStatement.test->nodeType != NodeTypeIntegerLit) {
+        code_rvalue(c, expr->u.doWhileStatement.test);
+        inst = putcbyte(c, OP_BRT);
+        putcword(c, block.nxt - inst - 1 - sizeof(VMWORD));
+    }
+    else if (expr->u.doWhileStatement.test->u.integerLit.value) {
+        inst = putcbyte(c, OP_BR);
+        putcword(c, block.nxt - inst - 1 - sizeof(VMWORD));
+    }
     fixupbranch(c, block.end, codeaddr(c));
     PopBlock(c);
 }
@@ -242,6 +300,12 @@ static void code_breakorcontinue(ParseContext *c, ParseTreeNode *expr, int isBre
     int inst;
     for (block = c->block; block != NULL; block = block->next) {
         switch (block->type) {
+        case BLOCK_SWITCH:
+            if (!isBreak)
+                break;
+            inst = putcbyte(c, OP_BR);
+            block->end = putcword(c, block->end);
+            return;
         case BLOCK_FOR:
         case BLOCK_WHILE:
         case BLOCK_DO:
@@ -283,6 +347,134 @@ static void code_try(ParseContext *c, ParseTreeNode *expr)
     fixupbranch(c, end, codeaddr(c));
 }
 
+/* code_switch - generate code for a 'switch' statement
+ *
+ * Dense case values are dispatched through a jump table. Sparse ones use a
+ * binary search of the case values. Case bodies follow the dispatch code in
+ * source order so control falls through from one case to the next.
+ */
+static void code_switch(ParseContext *c, ParseTreeNode *expr)
+{
+    int count = expr->u.switchStatement.caseCount;
+    SwitchCase **cases, *switchCase;
+    int defaultLabel = 0, i;
+    VMUVALUE range;
+    Block block;
+    
+    /* sort the case values */
+    cases = (SwitchCase **)LocalAlloc(c, (count + 1) * sizeof(SwitchCase *));
+    for (i = 0, switchCase = expr->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next) {
+        switchCase->label = 0;
+        if (!switchCase->isDefault)
+            cases[i++] = switchCase;
+    }
+    qsort(cases, count, sizeof(SwitchCase *), CompareCases);
+    
+    /* code the dispatch */
+    code_rvalue(c, expr->u.switchStatement.expr);
+    /* the difference of the extreme case values can overflow a VMVALUE so it is computed unsigned */
+    range = count > 0 ? (VMUVALUE)cases[count - 1]->value - (VMUVALUE)cases[0]->value : 0;
+    if (count >= MINJUMPTABLECASES && range < (VMUVALUE)count * JUMPTABLEDENSITY && range < 0x7fff)
+        code_jumptable(c, cases, count, &defaultLabel);
+    else
+        code_casetree(c, cases, count, &defaultLabel);
+    free(cases);
+    
+    /* code the case bodies */
+    PushBlock(c, &block, BLOCK_SWITCH);
+    for (switchCase = expr->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next) {
+        if (switchCase->isDefault) {
+            fixupbranch(c, defaultLabel, codeaddr(c));
+            defaultLabel = 0;
+        }
+        else
+            fixupbranch(c, switchCase->label, codeaddr(c));
+        code_statement(c, switchCase->body);
+    }
+    
+    /* without a default case, values that don't match skip the switch */
+    fixupbranch(c, defaultLabel, codeaddr(c));
+    fixupbranch(c, block.end, codeaddr(c));
+    PopBlock(c);
+}
+
+/* code_jumptable - code a jump table indexed by the switch value */
+static void code_jumptable(ParseContext *c, SwitchCase **cases, int count, int *pDefault)
+{
+    VMVALUE first = cases[0]->value;
+    int size = cases[count - 1]->value - first + 1;
+    int i, j;
+    putcbyte(c, OP_JUMPTABLE);
+    putclong(c, first);
+    putcword(c, size);
+    *pDefault = putcword(c, *pDefault);
+    for (i = j = 0; i < size; ++i) {
+        if (cases[j]->value == first + i) {
+            cases[j]->label = putcword(c, cases[j]->label);
+            ++j;
+        }
+        else
+            *pDefault = putcword(c, *pDefault);
+    }
+}
+
+/* code_casetree - code a binary search of the sorted case values
+ *
+ * The switch value stays on the stack until a case is selected.
+ */
+static void code_casetree(ParseContext *c, SwitchCase **cases, int count, int *pDefault)
+{
+    int nxt, i;
+    if (count <= MAXLINEARCASES) {
+        for (i = 0; i < count; ++i) {
+            putcbyte(c, OP_DUP);
+            code_integer(c, cases[i]->value);
+            putcbyte(c, OP_EQ);
+            putcbyte(c, OP_BRF);
+            nxt = putcword(c, 0);
+            putcbyte(c, OP_DROP);
+            putcbyte(c, OP_BR);
+            cases[i]->label = putcword(c, cases[i]->label);
+            fixupbranch(c, nxt, codeaddr(c));
+        }
+        putcbyte(c, OP_DROP);
+        putcbyte(c, OP_BR);
+        *pDefault = putcword(c, *pDefault);
+    }
+    else {
+        int half = count / 2;
+        putcbyte(c, OP_DUP);
+        code_integer(c, cases[half]->value);
+        putcbyte(c, OP_GE);
+        putcbyte(c, OP_BRT);
+        nxt = putcword(c, 0);
+        code_casetree(c, cases, half, pDefault);
+        fixupbranch(c, nxt, codeaddr(c));
+        code_casetree(c, cases + half, count - half, pDefault);
+    }
+}
+
+/* code_integer - code an integer constant */
+static void code_integer(ParseContext *c, VMVALUE value)
+{
+    if (value >= -128 && value <= 127) {
+        putcbyte(c, OP_SLIT);
+        putcbyte(c, value);
+    }
+    else {
+        putcbyte(c, OP_LIT);
+        putclong(c, value);
+    }
+}
+
+/* CompareCases - compare the values of two switch cases for qsort */
+static int CompareCases(const void *p1, const void *p2)
+{
+    VMVALUE value1 = (*(SwitchCase **)p1)->value;
+    VMVALUE value2 = (*(SwitchCase **)p2)->value;
+    return value1 < value2 ? -1 : value1 > value2;
+}
+
 /* code_block - generate code for an {} block statement */
 static void code_block(ParseContext *c, ParseTreeNode *expr)
 {
@@ -304,8 +496,7 @@ static void code_exprstatement(ParseContext *c, ParseTreeNode *expr)
 static void code_asm(ParseContext *c, ParseTreeNode *node)
 {
     int length = node->u.asmStatement.length;
-    if (c->codeFree + length >= c->codeTop)
-        Abort(c, "Bytecode buffer overflow");
+    ReserveCode(c, length);
     memcpy(c->codeFree, node->u.asmStatement.code, length);
     c->codeFree += length;
 }
@@ -335,8 +526,7 @@ static void code_print(ParseContext *c, ParseTreeNode *expr)
 /* code_expr - generate code for an expression parse tree */
 static void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 {
-    VMVALUE ival;
-    int offset;
+    CodeRef ref;
     PVAL pv2;
     
     switch (expr->nodeType) {
@@ -354,21 +544,13 @@ static void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
         pv->fcn = code_localref;
         break;
     case NodeTypeStringLit:
-        putcbyte(c, OP_LIT);
-        offset = putclong(c, 0);
-        AddStringRef(c, expr->u.stringLit.string, FT_CODE, offset);
+        ref.type = CR_STRING;
+        ref.v.string = expr->u.stringLit.string;
+        code_reference(c, &ref);
         pv->fcn = NULL;
         break;
     case NodeTypeIntegerLit:
-        ival = expr->u.integerLit.value;
-        if (ival >= -128 && ival <= 127) {
-            putcbyte(c, OP_SLIT);
-            putcbyte(c, ival);
-        }
-        else {
-            putcbyte(c, OP_LIT);
-            putclong(c, ival);
-        }
+        code_integer(c, expr->u.integerLit.value);
         pv->fcn = NULL;
         break;
     case NodeTypeFunctionLit:
@@ -402,6 +584,7 @@ static void code_expr(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
         code_rvalue(c, expr->u.commaOp.left);
         putcbyte(c, OP_DROP);
         code_rvalue(c, expr->u.commaOp.right);
+        pv->fcn = NULL;
         break;
     case NodeTypeBinaryOp:
         code_rvalue(c, expr->u.binaryOp.left);
@@ -478,17 +661,18 @@ static void code_ternary(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 static void code_symbolref(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 {
     Symbol *symbol = expr->u.symbolRef.symbol;
+    CodeRef ref;
+    ref.type = CR_SYMBOL;
+    ref.v.symbol = symbol;
     switch (symbol->storageClass) {
     case SC_VARIABLE:
-        putcbyte(c, OP_LIT);
-        putclong(c, AddSymbolRef(c, symbol, FT_CODE, codeaddr(c)));
+        code_reference(c, &ref);
         pv->fcn = code_dataref;
         pv->type = PVT_LONG;
         break;
     case SC_OBJECT:
     case SC_FUNCTION:
-        putcbyte(c, OP_LIT);
-        putclong(c, AddSymbolRef(c, symbol, FT_CODE, codeaddr(c)));
+        code_reference(c, &ref);
         pv->fcn = NULL;
         break;
     default:
@@ -567,6 +751,8 @@ static void code_call(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 /* code_methodcall - code a method call */
 static void code_methodcall(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 {
+    CodeRef ref;
+    
     /* code each argument expression */
     code_arguments(c, expr->u.methodCall.args);
 
@@ -583,10 +769,16 @@ static void code_methodcall(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
     /* code the object receiving the message */
     code_rvalue(c, expr->u.methodCall.object);
     
-    /* code the selector */
-    code_rvalue(c, expr->u.methodCall.selector);
+    /* code the selector or the property holding the method if it was found at compile time */
+    if (expr->u.methodCall.method) {
+        ref.type = CR_METHOD;
+        ref.v.offset = expr->u.methodCall.method;
+        code_reference(c, &ref);
+    }
+    else
+        code_selector(c, expr->u.methodCall.selector);
 
-    /* code the send operation */
+    /* code the send operation (BindMethods turns it into a call if the method can't change) */
     putcbyte(c, OP_SEND);
     putcbyte(c, expr->u.methodCall.argc + 2);
 
@@ -605,13 +797,265 @@ static void code_classref(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 /* code_propertyref - code a property reference */
 static void code_propertyref(ParseContext *c, ParseTreeNode *expr, PVAL *pv)
 {
-    code_rvalue(c, expr->u.propertyRef.object);
-    code_rvalue(c, expr->u.propertyRef.selector);
-    putcbyte(c, OP_PADDR);
+    /* use the address of the property if it was found at compile time */
+    if (expr->u.propertyRef.offset) {
+        AddSelector(c, expr->u.propertyRef.selector->u.integerLit.value);
+        code_address(c, RELOC_DATA, expr->u.propertyRef.offset);
+    }
+    
+    /* otherwise, look up the property at runtime */
+    else {
+        code_rvalue(c, expr->u.propertyRef.object);
+        code_selector(c, expr->u.propertyRef.selector);
+        putcbyte(c, OP_PADDR);
+    }
+    
     pv->fcn = code_dataref;
     pv->type = PVT_LONG;
 }
 
+/* code_selector - code a property selector and remember which properties are used */
+static void code_selector(ParseContext *c, ParseTreeNode *expr)
+{
+    if (expr->nodeType == NodeTypeIntegerLit)
+        AddSelector(c, expr->u.integerLit.value);
+    else
+        c->dynamicSelectors = VMTRUE;
+    code_rvalue(c, expr);
+}
+
+/* prepare_node - prepare a statement or expression and its children for code generation */
+static void prepare_node(ParseContext *c, ParseTreeNode *node)
+{
+    NodeListEntry *entry;
+    SwitchCase *switchCase;
+    VMVALUE object, offset;
+    PrintOp *op;
+
+    switch (node->nodeType) {
+    case NodeTypeIf:
+        prepare_node(c, node->u.ifStatement.test);
+        prepare_node(c, node->u.ifStatement.thenStatement);
+        if (node->u.ifStatement.elseStatement)
+            prepare_node(c, node->u.ifStatement.elseStatement);
+        break;
+    case NodeTypeWhile:
+        prepare_node(c, node->u.whileStatement.test);
+        prepare_node(c, node->u.whileStatement.body);
+        break;
+    case NodeTypeDoWhile:
+        prepare_node(c, node->u.doWhileStatement.body);
+        prepare_node(c, node->u.doWhileStatement.test);
+        break;
+    case NodeTypeFor:
+        if (node->u.forStatement.init)
+            prepare_node(c, node->u.forStatement.init);
+        if (node->u.forStatement.test)
+            prepare_node(c, node->u.forStatement.test);
+        if (node->u.forStatement.incr)
+            prepare_node(c, node->u.forStatement.incr);
+        prepare_node(c, node->u.forStatement.body);
+        break;
+    case NodeTypeReturn:
+        if (node->u.returnStatement.value)
+            prepare_node(c, node->u.returnStatement.value);
+        break;
+    case NodeTypeBlock:
+        for (entry = node->u.blockStatement.statements; entry != NULL; entry = entry->next)
+            prepare_node(c, entry->node);
+        break;
+    case NodeTypeTry:
+        prepare_node(c, node->u.tryStatement.statement);
+        if (node->u.tryStatement.catchStatement)
+            prepare_node(c, node->u.tryStatement.catchStatement);
+        break;
+    case NodeTypeThrow:
+        prepare_node(c, node->u.throwStatement.expr);
+        break;
+    case NodeTypeExpr:
+        prepare_node(c, node->u.exprStatement.expr);
+        break;
+    case NodeTypePrint:
+        for (op = node->u.printStatement.ops; op != NULL; op = op->next) {
+            if (op->expr)
+                prepare_node(c, op->expr);
+        }
+        break;
+    case NodeTypeSwitch:
+        prepare_node(c, node->u.switchStatement.expr);
+        for (switchCase = node->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next)
+            prepare_node(c, switchCase->body);
+        break;
+    case NodeTypePreincrementOp:
+    case NodeTypePostincrementOp:
+        prepare_lvalue(c, node->u.incrementOp.expr);
+        break;
+    case NodeTypeCommaOp:
+        prepare_node(c, node->u.commaOp.left);
+        prepare_node(c, node->u.commaOp.right);
+        break;
+    case NodeTypeUnaryOp:
+        prepare_node(c, node->u.unaryOp.expr);
+        break;
+    case NodeTypeBinaryOp:
+        prepare_node(c, node->u.binaryOp.left);
+        prepare_node(c, node->u.binaryOp.right);
+        break;
+    case NodeTypeAssignmentOp:
+        prepare_lvalue(c, node->u.binaryOp.left);
+        prepare_node(c, node->u.binaryOp.right);
+        break;
+    case NodeTypeTernaryOp:
+        prepare_node(c, node->u.ternaryOp.test);
+        prepare_node(c, node->u.ternaryOp.thenExpr);
+        prepare_node(c, node->u.ternaryOp.elseExpr);
+        break;
+    case NodeTypeArrayRef:
+        prepare_node(c, node->u.arrayRef.array);
+        prepare_node(c, node->u.arrayRef.index);
+        break;
+    case NodeTypeFunctionCall:
+        for (entry = node->u.functionCall.args; entry != NULL; entry = entry->next)
+            prepare_node(c, entry->node);
+        prepare_node(c, node->u.functionCall.fcn);
+        break;
+    case NodeTypeMethodCall:
+        for (entry = node->u.methodCall.args; entry != NULL; entry = entry->next)
+            prepare_node(c, entry->node);
+        if (node->u.methodCall.class)
+            prepare_node(c, node->u.methodCall.class);
+        prepare_node(c, node->u.methodCall.object);
+        prepare_node(c, node->u.methodCall.selector);
+        
+        /* find a method that can be called directly */
+        if (node->u.methodCall.class)
+            object = ConstantObject(c, node->u.methodCall.class, &object) ? ((ObjectHdr *)(c->dataBuf + object))->class : NIL;
+        else if (!ConstantObject(c, node->u.methodCall.object, &object))
+            object = NIL;
+        node->u.methodCall.method = 0;
+        if (object != NIL
+        &&  FindConstantProperty(c, object, node->u.methodCall.selector, &offset)
+        &&  c->dataRelocs[offset] == RELOC_CODE)
+            node->u.methodCall.method = offset;
+        break;
+    case NodeTypeClassRef:
+        prepare_node(c, node->u.classRef.object);
+        break;
+    case NodeTypePropertyRef:
+        prepare_node(c, node->u.propertyRef.object);
+        prepare_node(c, node->u.propertyRef.selector);
+        
+        /* find a property whose address can be used directly */
+        node->u.propertyRef.offset = 0;
+        if (ConstantObject(c, node->u.propertyRef.object, &object)
+        &&  FindConstantProperty(c, object, node->u.propertyRef.selector, &offset))
+            node->u.propertyRef.offset = offset;
+        break;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        for (entry = node->u.exprList.exprs; entry != NULL; entry = entry->next)
+            prepare_node(c, entry->node);
+        break;
+    default:
+        break;
+    }
+}
+
+/* prepare_lvalue - prepare an expression that is assigned and make sure it is an lvalue */
+static void prepare_lvalue(ParseContext *c, ParseTreeNode *expr)
+{
+    prepare_node(c, expr);
+    switch (expr->nodeType) {
+    case NodeTypeGlobalSymbolRef:
+        if (expr->u.symbolRef.symbol->storageClass == SC_VARIABLE)
+            return;
+        break;
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+    case NodeTypeArrayRef:
+        return;
+    case NodeTypePropertyRef:
+        if (expr->u.propertyRef.selector->nodeType == NodeTypeIntegerLit)
+            AddStoredTag(c, expr->u.propertyRef.selector->u.integerLit.value);
+        else
+            c->dynamicStores = VMTRUE;
+        return;
+    }
+    ParseError(c, "expecting an lvalue");
+}
+
+/* ConstantObject - check for a reference to an object whose definition is complete */
+static int ConstantObject(ParseContext *c, ParseTreeNode *expr, VMVALUE *pObject)
+{
+    Symbol *symbol;
+    if (expr->nodeType != NodeTypeGlobalSymbolRef)
+        return VMFALSE;
+    symbol = expr->u.symbolRef.symbol;
+    if (symbol->storageClass != SC_OBJECT || !symbol->valueDefined)
+        return VMFALSE;
+    *pObject = symbol->v.value;
+    return VMTRUE;
+}
+
+/* FindConstantProperty - find the data offset of a property the way PADDR would at runtime
+ *
+ * Properties are only added to the end of the object being defined so the
+ * addresses of the ones that already exist won't change but a later property
+ * could still hide a class property or replace a copied method. Objects are
+ * only searched once their definition is complete.
+ */
+static int FindConstantProperty(ParseContext *c, VMVALUE object, ParseTreeNode *selector, VMVALUE *pOffset)
+{
+    VMVALUE tag;
+    
+    /* the selector must be a constant */
+    if (selector->nodeType != NodeTypeIntegerLit)
+        return VMFALSE;
+    tag = selector->u.integerLit.value;
+        
+    /* search the object and its classes */
+    while (object != NIL) {
+        ObjectHdr *hdr = (ObjectHdr *)(c->dataBuf + object);
+        Property *property = (Property *)(hdr + 1);
+        int nProperties;
+        if (c->currentObjectSymbol && object == c->currentObjectSymbol->v.value)
+            return VMFALSE;
+        for (nProperties = hdr->nProperties; --nProperties >= 0; ++property) {
+            if ((property->tag & ~P_SHARED) == tag) {
+                *pOffset = (uint8_t *)&property->value - c->dataBuf;
+                return VMTRUE;
+            }
+        }
+        object = hdr->class;
+    }
+    
+    /* not found, let the runtime lookup fail */
+    return VMFALSE;
+}
+
+/* code_address - code a literal code or data address */
+static void code_address(ParseContext *c, int relocType, VMVALUE value)
+{
+    putcbyte(c, OP_LIT);
+    AddReloc(c, FT_CODE, codeaddr(c), relocType);
+    putclong(c, value);
+}
+
+/* code_reference - code a literal address that is filled in when the function is linked
+ *
+ * The operand is the index of the reference until then.
+ */
+static void code_reference(ParseContext *c, CodeRef *ref)
+{
+    if (c->codeRefCount >= c->codeRefMax) {
+        c->codeRefMax = c->codeRefMax ? c->codeRefMax * 2 : 64;
+        if (!(c->codeRefs = (CodeRef *)realloc(c->codeRefs, c->codeRefMax * sizeof(CodeRef))))
+            Abort(c, "insufficient memory");
+    }
+    c->codeRefs[c->codeRefCount] = *ref;
+    code_address(c, RELOC_REF, c->codeRefCount++);
+}
+
 /* code_dataref - compile a data reference */
 static void code_dataref(ParseContext *c, PvFcn fcn, PVAL *pv)
 {
@@ -685,7 +1129,6 @@ static void PopBlock(ParseContext *c)
 
 static VMWORD rd_cword(ParseContext *c, VMUVALUE off);
 static void wr_cword(ParseContext *c, VMUVALUE off, VMWORD v);
-void wr_clong(ParseContext *c, VMUVALUE off, VMVALUE v);
 
 /* codeaddr - get the current code address (actually, offset) */
 static int codeaddr(ParseContext *c)
@@ -697,8 +1140,7 @@ static int codeaddr(ParseContext *c)
 int putcbyte(ParseContext *c, int b)
 {
     int addr = codeaddr(c);
-    if (c->codeFree >= c->codeTop)
-        Abort(c, "insufficient memory");
+    ReserveCode(c, 1);
     *c->codeFree++ = b;
     return addr;
 }
@@ -707,8 +1149,7 @@ int putcbyte(ParseContext *c, int b)
 int putcword(ParseContext *c, VMWORD v)
 {
     int addr = codeaddr(c);
-    if (c->codeFree + sizeof(VMWORD) > c->codeTop)
-        Abort(c, "insufficient memory");
+    ReserveCode(c, sizeof(VMWORD));
     wr_cword(c, addr, v);
     c->codeFree += sizeof(VMWORD);
     return addr;
@@ -718,8 +1159,7 @@ int putcword(ParseContext *c, VMWORD v)
 int putclong(ParseContext *c, VMVALUE v)
 {
     int addr = codeaddr(c);
-    if (c->codeFree + sizeof(VMVALUE) > c->codeTop)
-        Abort(c, "insufficient memory");
+    ReserveCode(c, sizeof(VMVALUE));
     wr_clong(c, addr, v);
     c->codeFree += sizeof(VMVALUE);
     return addr;
@@ -757,6 +1197,16 @@ static void wr_cword(ParseContext *c, VMUVALUE off, VMWORD v)
     }
 }
 
+/* rd_clong - get a code long from the code buffer */
+VMVALUE rd_clong(ParseContext *c, VMUVALUE off)
+{
+    int cnt = sizeof(VMVALUE);
+    VMVALUE v = 0;
+    while (--cnt >= 0)
+        v = (v << 8) | c->codeBuf[off++];
+    return v;
+}
+
 /* wr_clong - put a code word into the code buffer */
 void wr_clong(ParseContext *c, VMUVALUE off, VMVALUE v)
 {
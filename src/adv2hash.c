@@ -0,0 +1,125 @@
+/* adv2hash.c - hash tables for looking up names
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+
+/* local function prototypes */
+static void GrowHashTable(ParseContext *c, HashTable *table);
+static VMUVALUE HashName(const char *name);
+
+/* InitHashTable - initialize an empty hash table */
+void InitHashTable(HashTable *table)
+{
+    table->entries = NULL;
+    table->count = 0;
+    table->size = 0;
+}
+
+/* FreeHashTable - free the entries of a hash table and leave it empty */
+void FreeHashTable(HashTable *table)
+{
+    free(table->entries);
+    InitHashTable(table);
+}
+
+/* FindHashEntry - find the value stored under a name or NULL if there isn't one */
+void *FindHashEntry(HashTable *table, const char *name)
+{
+    VMUVALUE hash;
+    int mask, i;
+
+    if (table->size == 0)
+        return NULL;
+
+    hash = HashName(name);
+    mask = table->size - 1;
+    for (i = hash & mask; table->entries[i].name != NULL; i = (i + 1) & mask) {
+        HashEntry *entry = &table->entries[i];
+        if (entry->hash == hash && strcmp(name, entry->name) == 0)
+            return entry->value;
+    }
+
+    return NULL;
+}
+
+/* AddHashEntry - store a value under a name
+ *
+ * The name isn't copied so it must be part of the value or otherwise last as
+ * long as the table. A name that is already in the table keeps its first
+ * value so lookups find the same entry a walk of the list in insertion order
+ * would.
+ */
+void AddHashEntry(ParseContext *c, HashTable *table, const char *name, void *value)
+{
+    VMUVALUE hash = HashName(name);
+    HashEntry *entry;
+    int mask, i;
+
+    /* keep the table at most half full */
+    if ((table->count + 1) * 2 > table->size)
+        GrowHashTable(c, table);
+
+    /* find the name or an empty slot */
+    mask = table->size - 1;
+    for (i = hash & mask; (entry = &table->entries[i])->name != NULL; i = (i + 1) & mask) {
+        if (entry->hash == hash && strcmp(name, entry->name) == 0)
+            return;
+    }
+
+    entry->hash = hash;
+    entry->name = name;
+    entry->value = value;
+    ++table->count;
+}
+
+/* GrowHashTable - double the size of a hash table */
+static void GrowHashTable(ParseContext *c, HashTable *table)
+{
+    HashEntry *entries = table->entries;
+    int size = table->size, mask, i, j;
+
+    table->size = size ? size * 2 : 16;
+    if (!(table->entries = (HashEntry *)calloc(table->size, sizeof(HashEntry))))
+        Abort(c, "insufficient memory");
+
+    mask = table->size - 1;
+    for (i = 0; i < size; ++i) {
+        if (entries[i].name != NULL) {
+            for (j = entries[i].hash & mask; table->entries[j].name != NULL; j = (j + 1) & mask)
+                ;
+            table->entries[j] = entries[i];
+        }
+    }
+
+    free(entries);
+}
+
+/* HashData - add bytes to a 64 bit hash of a file or other data (FNV-1a)
+ *
+ * Start with HASHSEED to hash data by itself.
+ */
+uint64_t HashData(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (size-- > 0) {
+        hash ^= *p++;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+/* HashName - compute the hash of a name (FNV-1a) */
+static VMUVALUE HashName(const char *name)
+{
+    VMUVALUE hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,344 @@
+/* adv2image.c - reading and checking image files
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef MINGW
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+#include "adv2vm.h"
+
+/* local function prototypes */
+static int CheckSections(uint8_t *buf, long size, const char **pError);
+static int CheckSegment(ImageHdr *hdr, ImageSection *section);
+static int CheckText(uint8_t *buf, const char **pError);
+static int InImage(VMVALUE offset, VMVALUE size, long imageSize);
+
+/* IsSectionedImage - check for the header of a sectioned image */
+int IsSectionedImage(uint8_t *buf, long size)
+{
+    ImageFileHdr *fileHdr = (ImageFileHdr *)buf;
+    return size >= (long)sizeof(ImageFileHdr)
+        && fileHdr->hdr.dataOffset >= (VMVALUE)sizeof(ImageFileHdr)
+        && memcmp(fileHdr->magic, IMAGE_MAGIC, sizeof(fileHdr->magic)) == 0;
+}
+
+/* CheckImage - check that an image in the legacy or the sectioned layout can be run */
+int CheckImage(uint8_t *buf, long size, const char **pError)
+{
+    ImageHdr *hdr = (ImageHdr *)buf;
+
+    if (size < (long)sizeof(ImageHdr)
+    ||  !InImage(hdr->dataOffset, hdr->dataSize, size)
+    ||  !InImage(hdr->stringOffset, hdr->stringSize, size)
+    ||  !InImage(hdr->codeOffset, hdr->codeSize, size)
+    ||  hdr->mainFunction < 0
+    ||  hdr->mainFunction >= hdr->codeSize) {
+        *pError = "not a valid image";
+        return VMFALSE;
+    }
+
+    if (IsSectionedImage(buf, size) && !CheckSections(buf, size, pError))
+        return VMFALSE;
+
+    return CheckText(buf, pError);
+}
+
+/* CheckSections - check the header and section directory of a sectioned image */
+static int CheckSections(uint8_t *buf, long size, const char **pError)
+{
+    ImageFileHdr *fileHdr = (ImageFileHdr *)buf;
+    ImageSection *section;
+    int found = 0, i;
+
+    if (fileHdr->byteOrder != IMAGE_BYTEORDER) {
+        *pError = "image has the wrong byte order";
+        return VMFALSE;
+    }
+    if (fileHdr->version > IMAGE_VERSION) {
+        *pError = "image needs a newer interpreter";
+        return VMFALSE;
+    }
+
+    /* the string segment of version 1 images doesn't start with a text dictionary */
+    if (fileHdr->version < 2 && fileHdr->hdr.stringSize > 0) {
+        *pError = "image was built by an older compiler";
+        return VMFALSE;
+    }
+    if (fileHdr->alignment <= 0
+    ||  fileHdr->sectionCount < 0
+    ||  fileHdr->sectionCount > size / (long)sizeof(ImageSection)
+    ||  !InImage(fileHdr->sectionOffset, fileHdr->sectionCount * sizeof(ImageSection), size)) {
+        *pError = "image has a bad section directory";
+        return VMFALSE;
+    }
+
+    section = (ImageSection *)(buf + fileHdr->sectionOffset);
+    for (i = 0; i < fileHdr->sectionCount; ++i, ++section) {
+        if (!InImage(section->offset, section->size, size) || section->offset % fileHdr->alignment != 0) {
+            *pError = "image has a bad section";
+            return VMFALSE;
+        }
+        switch (section->type) {
+        case SECTION_DATA:
+        case SECTION_STRINGS:
+        case SECTION_CODE:
+            if (!CheckSegment(&fileHdr->hdr, section)) {
+                *pError = "image sections don't match its header";
+                return VMFALSE;
+            }
+            found |= 1 << section->type;
+            break;
+        default:
+            if (section->flags & SECTION_REQUIRED) {
+                *pError = "image needs a newer interpreter";
+                return VMFALSE;
+            }
+            break;
+        }
+    }
+
+    /* the string section is empty in images that keep their strings with the data */
+    if (!(found & (1 << SECTION_DATA)) || !(found & (1 << SECTION_CODE))) {
+        *pError = "image is missing a section";
+        return VMFALSE;
+    }
+
+    return VMTRUE;
+}
+
+/* CheckText - check the dictionary of compressed strings at the start of the string segment
+ *
+ * The interpreter expands pairs on a stack with room for one entry more than
+ * the number of pairs so each pair can only contain earlier pairs.
+ */
+static int CheckText(uint8_t *buf, const char **pError)
+{
+    ImageHdr *hdr = (ImageHdr *)buf;
+    int lengths[TEXT_MAXPAIRS];
+    VMVALUE pairCount;
+    uint8_t *pair;
+    int n, j;
+
+    if (hdr->stringSize == 0)
+        return VMTRUE;
+
+    if (hdr->stringSize < (VMVALUE)sizeof(VMVALUE)
+    ||  (pairCount = *(VMVALUE *)(buf + hdr->stringOffset)) < 0
+    ||  pairCount > TEXT_MAXPAIRS
+    ||  pairCount * 2 > hdr->stringSize - (VMVALUE)sizeof(VMVALUE)) {
+        *pError = "image has a bad text dictionary";
+        return VMFALSE;
+    }
+
+    pair = buf + hdr->stringOffset + sizeof(VMVALUE);
+    for (n = 0; n < pairCount; ++n, pair += 2) {
+        lengths[n] = 0;
+        for (j = 0; j < 2; ++j) {
+            if (pair[j] == 0 || pair[j] >= TEXT_FIRSTPAIR + n) {
+                *pError = "image has a bad text dictionary";
+                return VMFALSE;
+            }
+            lengths[n] += pair[j] < TEXT_FIRSTPAIR ? 1 : lengths[pair[j] - TEXT_FIRSTPAIR];
+        }
+        if (lengths[n] > TEXT_MAXLENGTH) {
+            *pError = "image has a bad text dictionary";
+            return VMFALSE;
+        }
+    }
+
+    return VMTRUE;
+}
+
+/* CheckSegment - check that a section is where the header says its segment is */
+static int CheckSegment(ImageHdr *hdr, ImageSection *section)
+{
+    switch (section->type) {
+    case SECTION_DATA:
+        return section->offset == hdr->dataOffset && section->size == hdr->dataSize;
+    case SECTION_STRINGS:
+        return section->offset == hdr->stringOffset && section->size == hdr->stringSize;
+    case SECTION_CODE:
+        return section->offset == hdr->codeOffset && section->size == hdr->codeSize;
+    }
+    return VMFALSE;
+}
+
+#ifdef MINGW
+
+/* MapImage - read an image file into memory with room for the stack after it */
+int MapImage(const char *name, MappedImage *m, const char **pError)
+{
+    uint8_t *buf;
+    long size, room;
+    FILE *fp;
+
+    if (!(fp = fopen(name, "rb"))) {
+        *pError = "can't open the image";
+        return VMFALSE;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    /* the stack starts on an aligned boundary after the image */
+    room = (size + sizeof(VMVALUE) - 1) & ~(long)(sizeof(VMVALUE) - 1);
+    if (!(buf = (uint8_t *)malloc(room + MAXSTACK))) {
+        *pError = "insufficient memory";
+        fclose(fp);
+        return VMFALSE;
+    }
+
+    if (fread(buf, 1, size, fp) != size) {
+        *pError = "error reading the image";
+        free(buf);
+        fclose(fp);
+        return VMFALSE;
+    }
+
+    fclose(fp);
+
+    if (!CheckImage(buf, size, pError)) {
+        free(buf);
+        return VMFALSE;
+    }
+
+    m->image = (ImageHdr *)buf;
+    m->stack = buf + room;
+    m->mapSize = 0;
+    return VMTRUE;
+}
+
+#else
+
+/* MapImage - map an image file into memory with room for the stack after it
+ *
+ * The image is mapped read-only and private so the code and strings are shared
+ * with every other process running it. Only the data segment can be written,
+ * and only the pages that are written get copied. Images without sections
+ * can't separate their data from their code so all of their pages can be
+ * written. The stack goes in anonymous pages right after the image since the
+ * interpreter refers to stack addresses by their offsets from the data.
+ */
+int MapImage(const char *name, MappedImage *m, const char **pError)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t fileRoom, stackRoom, dataStart, dataEnd;
+    ImageHdr *hdr;
+    struct stat info;
+    uint8_t *base;
+    long size;
+    int fd;
+
+    if ((fd = open(name, O_RDONLY)) < 0) {
+        *pError = "can't open the image";
+        return VMFALSE;
+    }
+
+    if (fstat(fd, &info) != 0 || (size = (long)info.st_size) <= 0) {
+        *pError = "not a valid image";
+        close(fd);
+        return VMFALSE;
+    }
+
+    /* reserve the address space for the image and the stack and map the image over the start of it */
+    fileRoom = ((size_t)size + pageSize - 1) & ~(pageSize - 1);
+    stackRoom = (MAXSTACK + pageSize - 1) & ~(pageSize - 1);
+    if ((base = (uint8_t *)mmap(NULL, fileRoom + stackRoom, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        *pError = "insufficient memory";
+        close(fd);
+        return VMFALSE;
+    }
+    if (mmap(base, (size_t)size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        *pError = "error mapping the image";
+        munmap(base, fileRoom + stackRoom);
+        close(fd);
+        return VMFALSE;
+    }
+    close(fd);
+
+    m->image = hdr = (ImageHdr *)base;
+    m->stack = base + fileRoom;
+    m->mapSize = fileRoom + stackRoom;
+
+    if (!CheckImage(base, size, pError)) {
+        UnmapImage(m);
+        return VMFALSE;
+    }
+
+    /* make the pages of the data segment writable */
+    if (IsSectionedImage(base, size) && ((ImageFileHdr *)base)->alignment % pageSize == 0) {
+        dataStart = hdr->dataOffset;
+        dataEnd = (hdr->dataOffset + hdr->dataSize + pageSize - 1) & ~(pageSize - 1);
+    }
+    else {
+        dataStart = 0;
+        dataEnd = fileRoom;
+    }
+    if (dataEnd > dataStart && mprotect(base + dataStart, dataEnd - dataStart, PROT_READ | PROT_WRITE) != 0) {
+        *pError = "error mapping the image";
+        UnmapImage(m);
+        return VMFALSE;
+    }
+
+    return VMTRUE;
+}
+
+#endif
+
+/* UnmapImage - release an image loaded by MapImage */
+void UnmapImage(MappedImage *m)
+{
+#ifndef MINGW
+    if (m->mapSize) {
+        munmap(m->image, m->mapSize);
+        return;
+    }
+#endif
+    free(m->image);
+}
+
+/* CompactImage - copy an image into the legacy layout without the padding between its sections
+ *
+ * The copy only runs on a legacy interpreter (or the PASM VM) if the image
+ * doesn't have the IMAGE_HOSTONLY flag. The caller has to check that.
+ */
+uint8_t *CompactImage(uint8_t *buf, long size, int *pSize)
+{
+    ImageHdr *hdr = (ImageHdr *)buf, *newHdr;
+    int newSize = sizeof(ImageHdr) + hdr->dataSize + hdr->stringSize + hdr->codeSize;
+    uint8_t *p;
+
+    if (!(newHdr = (ImageHdr *)malloc(newSize)))
+        return NULL;
+
+    newHdr->dataOffset = sizeof(ImageHdr);
+    newHdr->dataSize = hdr->dataSize;
+    newHdr->stringOffset = newHdr->dataOffset + newHdr->dataSize;
+    newHdr->stringSize = hdr->stringSize;
+    newHdr->codeOffset = newHdr->stringOffset + newHdr->stringSize;
+    newHdr->codeSize = hdr->codeSize;
+    newHdr->mainFunction = hdr->mainFunction;
+
+    p = (uint8_t *)newHdr;
+    memcpy(p + newHdr->dataOffset, buf + hdr->dataOffset, hdr->dataSize);
+    memcpy(p + newHdr->stringOffset, buf + hdr->stringOffset, hdr->stringSize);
+    memcpy(p + newHdr->codeOffset, buf + hdr->codeOffset, hdr->codeSize);
+
+    *pSize = newSize;
+    return p;
+}
+
+/* InImage - check that a range of bytes is inside of an image */
+static int InImage(VMVALUE offset, VMVALUE size, long imageSize)
+{
+    return offset >= 0 && size >= 0 && offset <= imageSize && size <= imageSize - offset;
+}
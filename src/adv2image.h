@@ -26,6 +26,61 @@ typedef struct {
     VMVALUE mainFunction;
 } ImageHdr;
 
+/* sectioned image file header
+
+The legacy image is an ImageHdr followed by the data, strings and code. A
+sectioned image starts with the same ImageHdr so anything that only knows the
+legacy layout can still find its segments. It can only run the image if the
+IMAGE_HOSTONLY flag is clear though, since older interpreters know nothing
+of the string segment or the short opcodes. That is only the case for code
+compiled with -O0 that has no strings, so the legacy output path is a
+template (-t), or propbinary, which uses CompactImage and rejects images
+with the flag set. The rest of the header identifies the format and points
+to a directory of sections. Each section starts on an alignment boundary
+that is a multiple of the page size so it can be mapped on its own. Sections
+of unknown types are skipped unless they are marked as required.
+*/
+typedef struct {
+    ImageHdr hdr;               /* offsets of the data, strings and code for legacy loaders */
+    uint8_t magic[4];           /* IMAGE_MAGIC */
+    VMVALUE version;            /* IMAGE_VERSION of the format */
+    VMVALUE byteOrder;          /* IMAGE_BYTEORDER in the byte order of the values in the image */
+    VMVALUE flags;              /* image flags */
+    VMVALUE alignment;          /* alignment of the sections */
+    VMVALUE sectionCount;       /* number of entries in the section directory */
+    VMVALUE sectionOffset;      /* offset of the section directory */
+} ImageFileHdr;
+
+/* section directory entry */
+typedef struct {
+    VMVALUE type;               /* section type */
+    VMVALUE flags;              /* section flags */
+    VMVALUE offset;             /* offset from the start of the image */
+    VMVALUE size;               /* size in bytes */
+} ImageSection;
+
+#define IMAGE_MAGIC         "AdvS"
+#define IMAGE_VERSION       3
+#define IMAGE_BYTEORDER     0x01020304
+#define IMAGE_ALIGN         4096
+
+/* image flags */
+#define IMAGE_HOSTONLY      0x0001  /* uses short opcodes or the string segment (the PASM VM has neither) */
+
+/* round an offset up to the next section boundary */
+#define IMAGE_ALIGNUP(n)    (((n) + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1))
+
+/* section types */
+enum {
+    SECTION_DATA      = 1,
+    SECTION_STRINGS   = 2,
+    SECTION_CODE      = 3
+};
+
+/* section flags */
+#define SECTION_WRITABLE    0x0001  /* changed by a running program */
+#define SECTION_REQUIRED    0x0002  /* a loader that doesn't know the type can't run the image */
+
 /* property structure */
 typedef struct {
     VMVALUE tag;
@@ -105,9 +160,39 @@ fp -> arg 1
 #define OP_TRYEXIT      0x2f    /* exit try code */
 #define OP_THROW        0x30    /* throw an exception */
 #define OP_NATIVE       0x31    /* execute a native instruction */
+#define OP_JUMPTABLE    0x32    /* branch through a table indexed by the top of stack */
+
+/* short forms chosen by the relaxation pass (only used in images for the host interpreter) */
+#define OP_WLIT         0x33    /* load a 16 bit unsigned literal value */
+#define OP_SBRT         0x34    /* branch on true with an 8 bit offset */
+#define OP_SBRTSC       0x35    /* branch on true (for short circuit booleans) with an 8 bit offset */
+#define OP_SBRF         0x36    /* branch on false with an 8 bit offset */
+#define OP_SBRFSC       0x37    /* branch on false (for short circuit booleans) with an 8 bit offset */
+#define OP_SBR          0x38    /* branch unconditionally with an 8 bit offset */
 
 /* memory segment base addresses */
+#define STRING_BASE     0x40000000
 #define COG_BASE	    0x80000000
+#define TEXT_BASE       0xC0000000
+
+/* compressed text
+
+The string segment starts with a dictionary of pairs that compressed strings
+are made of. It is a VMVALUE count of the pairs followed by two bytes for each
+pair. A byte in a compressed string below TEXT_FIRSTPAIR is a character and
+any other byte stands for the two bytes of pair (byte - TEXT_FIRSTPAIR), which
+can themselves be pairs defined before it. Compressed strings end with a zero
+byte. The address of a character of a compressed string is TEXT_BASE plus the
+offset of the string in the string segment shifted left by TEXT_INDEX_BITS
+plus the index of the character in the string. Strings that aren't compressed
+are addressed at STRING_BASE plus their offsets.
+*/
+#define TEXT_FIRSTPAIR  0x80
+#define TEXT_MAXPAIRS   (256 - TEXT_FIRSTPAIR)
+#define TEXT_INDEX_BITS 12
+#define TEXT_INDEX_MASK ((1 << TEXT_INDEX_BITS) - 1)
+#define TEXT_MAXLENGTH  TEXT_INDEX_MASK
+#define TEXT_MAXOFFSET  ((ADDR_OFF_MASK >> TEXT_INDEX_BITS) + 1)
 
 /* address segment offset mask */
 #define ADDR_OFF_MASK   0x3fffffff
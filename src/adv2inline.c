@@ -0,0 +1,692 @@
+/* adv2inline.c - inline expansion of calls to small functions
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+
+/* binding of an argument or local of the called function */
+typedef struct {
+    LocalSymbol *from;          /* argument or local of the called function */
+    ParseTreeNode *value;       /* constant or reference to substitute or NULL */
+    LocalSymbol *to;            /* local of the calling function holding the value */
+} InlineBinding;
+
+/* inline expansion state */
+typedef struct {
+    ParseContext *c;
+    ParseTreeNode *caller;      /* function being compiled */
+    ParseTreeNode *callee;      /* function being expanded */
+    InlineBinding *bindings;
+    int bindingCount;
+    LocalSymbol **temporaries;  /* locals added to the caller in the order they were added */
+    int temporaryCount;
+    int temporaryMax;
+    int temporariesInUse;       /* temporaries holding values of the statement being expanded */
+    LocalSymbol *symbol;        /* symbol being checked by FindAssignment */
+    int found;                  /* FindAssignment found an assignment */
+} InlineState;
+
+/* type of a function that visits a child node */
+typedef void VisitFcn(ParseTreeNode **pNode, InlineState *s);
+
+/* local function prototypes */
+static void VisitChildren(ParseTreeNode *node, VisitFcn *fcn, InlineState *s);
+static void InlineNode(ParseTreeNode **pNode, InlineState *s);
+static int IsStatement(ParseTreeNode *node);
+static ParseTreeNode *ExpandCall(InlineState *s, ParseTreeNode *call, int isStatement);
+static ParseTreeNode *InlineCandidate(ParseContext *c, ParseTreeNode *call);
+static int IsExpressionBody(ParseTreeNode *function, ParseTreeNode **pExpr);
+static int IsStatementBody(ParseTreeNode *node, int loopDepth, int switchDepth, int isLast);
+static int IsSimpleArgument(ParseTreeNode *node, int allPure);
+static int IsAssigned(InlineState *s, LocalSymbol *symbol);
+static void FindAssignment(ParseTreeNode **pNode, InlineState *s);
+static LocalSymbol *AddTemporary(InlineState *s, LocalSymbol *from);
+static ParseTreeNode *MakeAssignment(InlineState *s, LocalSymbol *symbol, ParseTreeNode *value);
+static ParseTreeNode *MakeSequence(ParseContext *c, NodeListEntry *entry, ParseTreeNode *value);
+static ParseTreeNode *CloneNode(InlineState *s, ParseTreeNode *node);
+static void CloneChild(ParseTreeNode **pNode, InlineState *s);
+static NodeListEntry *CloneList(ParseContext *c, NodeListEntry *entry);
+static ParseTreeNode *NewNode(ParseContext *c, int type);
+static NodeListEntry *NewListEntry(ParseContext *c, ParseTreeNode *node);
+
+/* AddInlineCandidate - remember a function that can be expanded inline
+ *
+ * Small functions are candidates unless marked 'noinline'. Functions marked
+ * 'inline' are candidates regardless of their size. Returns true if the
+ * function is a candidate so its parse tree must be kept.
+ */
+int AddInlineCandidate(ParseContext *c, Symbol *symbol, ParseTreeNode *function)
+{
+    switch (function->u.functionDef->inlineHint) {
+    case INLINE_NEVER:
+        return VMFALSE;
+    case INLINE_DEFAULT:
+        if (function->u.functionDef->codeLength > MAXINLINELENGTH)
+            return VMFALSE;
+        break;
+    }
+    if (function->u.functionDef->hasAsm
+    ||  function->u.functionDef->maximumTryDepth > 0
+    ||  !IsStatementBody(function->u.functionDef->body, 0, 0, VMTRUE))
+        return VMFALSE;
+    symbol->inlineFunction = function;
+    return VMTRUE;
+}
+
+/* InlineCalls - expand calls to inline candidates in a function */
+void InlineCalls(ParseContext *c, ParseTreeNode *function)
+{
+    InlineState state, *s = &state;
+    LocalSymbol *local;
+
+    memset(s, 0, sizeof(InlineState));
+    s->c = c;
+    s->caller = function;
+
+    for (local = function->u.functionDef->locals.head; local != NULL; local = local->next) {
+        if (local->initialValue) {
+            InlineNode(&local->initialValue, s);
+            s->temporariesInUse = 0;
+        }
+    }
+    InlineNode(&function->u.functionDef->body, s);
+
+    free(s->temporaries);
+}
+
+/* InlineNode - expand the calls in a statement or expression
+ *
+ * The temporaries of the expansions in a statement are free again once the
+ * statement is done so the expansions in the statements that follow reuse
+ * their frame slots. Expansions within a single statement get their own.
+ */
+static void InlineNode(ParseTreeNode **pNode, InlineState *s)
+{
+    ParseTreeNode *node = *pNode, *expansion;
+    int inUse = s->temporariesInUse;
+
+    /* expand calls in the arguments and subexpressions first */
+    VisitChildren(node, InlineNode, s);
+
+    /* expand a call whose value is discarded */
+    if (node->nodeType == NodeTypeExpr && node->u.exprStatement.expr->nodeType == NodeTypeFunctionCall) {
+        if ((expansion = ExpandCall(s, node->u.exprStatement.expr, VMTRUE)) != NULL)
+            *pNode = expansion;
+    }
+
+    /* expand a call whose value is used */
+    else if (node->nodeType == NodeTypeFunctionCall) {
+        if ((expansion = ExpandCall(s, node, VMFALSE)) != NULL)
+            *pNode = expansion;
+    }
+
+    if (IsStatement(node))
+        s->temporariesInUse = inUse;
+}
+
+/* IsStatement - check for a statement node */
+static int IsStatement(ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeIf:
+    case NodeTypeWhile:
+    case NodeTypeDoWhile:
+    case NodeTypeFor:
+    case NodeTypeReturn:
+    case NodeTypeBreak:
+    case NodeTypeContinue:
+    case NodeTypeBlock:
+    case NodeTypeTry:
+    case NodeTypeThrow:
+    case NodeTypeExpr:
+    case NodeTypeAsm:
+    case NodeTypeEmpty:
+    case NodeTypePrint:
+    case NodeTypeSwitch:
+        return VMTRUE;
+    }
+    return VMFALSE;
+}
+
+/* ExpandCall - expand a single call to an inline candidate
+ *
+ * Arguments that are constants, or caller locals when every argument is pure,
+ * are substituted directly. Other arguments and the locals of the called
+ * function become new locals of the caller. Arguments are evaluated from last
+ * to first just as they are when pushed for a call.
+ */
+static ParseTreeNode *ExpandCall(InlineState *s, ParseTreeNode *call, int isStatement)
+{
+    ParseContext *c = s->c;
+    ParseTreeNode *callee, *returnExpr = NULL, *result, **args;
+    NodeListEntry *entry, *statements, **pNext;
+    LocalSymbol *symbol;
+    int argc, temporaries, slots, growth, allPure, i;
+
+    /* make sure the call can be expanded */
+    if (!(callee = InlineCandidate(s->c, call)))
+        return NULL;
+    argc = call->u.functionCall.argc;
+    if (argc != callee->u.functionDef->arguments.count)
+        return NULL;
+    if (!isStatement && !IsExpressionBody(callee, &returnExpr))
+        return NULL;
+    s->callee = callee;
+
+    /* collect the arguments */
+    args = (ParseTreeNode **)LocalAlloc(c, (argc + 1) * sizeof(ParseTreeNode *));
+    allPure = VMTRUE;
+    for (entry = call->u.functionCall.args, i = 0; entry != NULL; entry = entry->next, ++i) {
+        args[i] = entry->node;
+        if (!IsPure(args[i]))
+            allPure = VMFALSE;
+    }
+
+    /* decide which arguments need temporaries */
+    s->bindingCount = argc + callee->u.functionDef->locals.count;
+    s->bindings = (InlineBinding *)LocalAlloc(c, (s->bindingCount + 1) * sizeof(InlineBinding));
+    memset(s->bindings, 0, (s->bindingCount + 1) * sizeof(InlineBinding));
+    temporaries = callee->u.functionDef->locals.count;
+    for (symbol = callee->u.functionDef->arguments.head, i = 0; symbol != NULL; symbol = symbol->next, ++i) {
+        s->bindings[i].from = symbol;
+        if (IsSimpleArgument(args[i], allPure) && !IsAssigned(s, symbol))
+            s->bindings[i].value = args[i];
+        else
+            ++temporaries;
+    }
+
+    /* check the frame size and the inlining budget (the stack is small so new frame slots count too) */
+    slots = s->temporariesInUse + temporaries - s->temporaryCount;
+    if (slots < 0)
+        slots = 0;
+    if (s->caller->u.functionDef->locals.count + s->caller->u.functionDef->maximumTryDepth + slots > MAXINLINELOCALS) {
+        free(args);
+        free(s->bindings);
+        return NULL;
+    }
+    growth = callee->u.functionDef->codeLength - INLINE_CALL_SAVINGS + temporaries * INLINE_TEMPORARY_COST + slots * INLINE_SLOT_COST;
+    if (growth > 0) {
+        if (growth > c->inlineBudget) {
+            free(args);
+            free(s->bindings);
+            return NULL;
+        }
+        c->inlineBudget -= growth;
+    }
+    if (c->debugMode)
+        printf("inline: %s into %s\n", callee->u.functionDef->name, s->caller->u.functionDef->name);
+
+    /* assign the arguments that need temporaries from last to first */
+    statements = NULL;
+    pNext = &statements;
+    for (i = argc; --i >= 0; ) {
+        if (!s->bindings[i].value) {
+            s->bindings[i].to = AddTemporary(s, s->bindings[i].from);
+            *pNext = NewListEntry(c, MakeAssignment(s, s->bindings[i].to, args[i]));
+            pNext = &(*pNext)->next;
+        }
+    }
+
+    /* initialize the locals of the called function */
+    for (symbol = callee->u.functionDef->locals.head, i = argc; symbol != NULL; symbol = symbol->next, ++i) {
+        s->bindings[i].from = symbol;
+        s->bindings[i].to = AddTemporary(s, symbol);
+        if (symbol->initialValue) {
+            *pNext = NewListEntry(c, MakeAssignment(s, s->bindings[i].to, CloneNode(s, symbol->initialValue)));
+            pNext = &(*pNext)->next;
+        }
+    }
+
+    /* build a block for a call whose value is discarded */
+    if (isStatement) {
+        ParseTreeNode *body = CloneNode(s, callee->u.functionDef->body);
+        NodeListEntry *last = body->u.blockStatement.statements;
+        while (last && last->next)
+            last = last->next;
+        if (last && last->node->nodeType == NodeTypeReturn) {
+            if (last->node->u.returnStatement.value) {
+                ParseTreeNode *expr = last->node->u.returnStatement.value;
+                last->node->nodeType = NodeTypeExpr;
+                last->node->u.exprStatement.expr = expr;
+            }
+            else
+                last->node->nodeType = NodeTypeEmpty;
+        }
+        *pNext = NewListEntry(c, body);
+        result = NewNode(c, NodeTypeBlock);
+        result->u.blockStatement.statements = statements;
+    }
+
+    /* build a comma expression for a call whose value is used */
+    else {
+        if (returnExpr)
+            result = CloneNode(s, returnExpr);
+        else {
+            result = NewNode(c, NodeTypeIntegerLit);
+            result->u.integerLit.value = 0;
+        }
+        result = MakeSequence(c, statements, result);
+    }
+
+    free(args);
+    free(s->bindings);
+    s->bindings = NULL;
+    return result;
+}
+
+/* InlineCandidate - get the function called by a direct call to an inline candidate
+ *
+ * A function becomes a candidate once its code is linked and its length is known.
+ */
+static ParseTreeNode *InlineCandidate(ParseContext *c, ParseTreeNode *call)
+{
+    ParseTreeNode *fcn = call->u.functionCall.fcn;
+    if (fcn->nodeType != NodeTypeGlobalSymbolRef || fcn->u.symbolRef.symbol->storageClass != SC_FUNCTION)
+        return NULL;
+    if (fcn->u.symbolRef.symbol->pending)
+        FinishFunction(c, fcn->u.symbolRef.symbol);
+    return fcn->u.symbolRef.symbol->inlineFunction;
+}
+
+/* IsExpressionBody - check for a function whose body is a single return statement */
+static int IsExpressionBody(ParseTreeNode *function, ParseTreeNode **pExpr)
+{
+    ParseTreeNode *body = function->u.functionDef->body;
+    NodeListEntry *entry;
+    if (body->nodeType != NodeTypeBlock)
+        return VMFALSE;
+    if (!(entry = body->u.blockStatement.statements)) {
+        *pExpr = NULL;
+        return VMTRUE;
+    }
+    if (entry->next || entry->node->nodeType != NodeTypeReturn)
+        return VMFALSE;
+    *pExpr = entry->node->u.returnStatement.value;
+    return VMTRUE;
+}
+
+/* IsStatementBody - check that a function body can be expanded as a block
+ *
+ * The only return allowed is the last statement of the body and there can be
+ * no break outside of a loop or switch and no continue outside of a loop.
+ */
+static int IsStatementBody(ParseTreeNode *node, int loopDepth, int switchDepth, int isLast)
+{
+    NodeListEntry *entry;
+    SwitchCase *switchCase;
+    switch (node->nodeType) {
+    case NodeTypeIf:
+        return IsStatementBody(node->u.ifStatement.thenStatement, loopDepth, switchDepth, VMFALSE)
+            && (!node->u.ifStatement.elseStatement || IsStatementBody(node->u.ifStatement.elseStatement, loopDepth, switchDepth, VMFALSE));
+    case NodeTypeWhile:
+        return IsStatementBody(node->u.whileStatement.body, loopDepth + 1, switchDepth, VMFALSE);
+    case NodeTypeDoWhile:
+        return IsStatementBody(node->u.doWhileStatement.body, loopDepth + 1, switchDepth, VMFALSE);
+    case NodeTypeFor:
+        return IsStatementBody(node->u.forStatement.body, loopDepth + 1, switchDepth, VMFALSE);
+    case NodeTypeSwitch:
+        for (switchCase = node->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next) {
+            if (!IsStatementBody(switchCase->body, loopDepth, switchDepth + 1, VMFALSE))
+                return VMFALSE;
+        }
+        return VMTRUE;
+    case NodeTypeReturn:
+        return isLast && loopDepth == 0 && switchDepth == 0;
+    case NodeTypeBreak:
+        return loopDepth > 0 || switchDepth > 0;
+    case NodeTypeContinue:
+        return loopDepth > 0;
+    case NodeTypeBlock:
+        for (entry = node->u.blockStatement.statements; entry != NULL; entry = entry->next) {
+            if (!IsStatementBody(entry->node, loopDepth, switchDepth, isLast && !entry->next))
+                return VMFALSE;
+        }
+        return VMTRUE;
+    case NodeTypeTry:
+    case NodeTypeAsm:
+        return VMFALSE;
+    default:
+        return VMTRUE;
+    }
+}
+
+/* IsSimpleArgument - check for an argument that can be substituted for each use */
+static int IsSimpleArgument(ParseTreeNode *node, int allPure)
+{
+    switch (node->nodeType) {
+    case NodeTypeIntegerLit:
+    case NodeTypeStringLit:
+        return VMTRUE;
+    case NodeTypeGlobalSymbolRef:
+        switch (node->u.symbolRef.symbol->storageClass) {
+        case SC_OBJECT:
+        case SC_FUNCTION:
+            return VMTRUE;
+        default:
+            return VMFALSE;
+        }
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+        return allPure;
+    default:
+        return VMFALSE;
+    }
+}
+
+/* IsAssigned - check whether the called function assigns to one of its arguments */
+static int IsAssigned(InlineState *s, LocalSymbol *symbol)
+{
+    LocalSymbol *local;
+    s->symbol = symbol;
+    s->found = VMFALSE;
+    for (local = s->callee->u.functionDef->locals.head; local != NULL; local = local->next) {
+        if (local->initialValue)
+            FindAssignment(&local->initialValue, s);
+    }
+    FindAssignment(&s->callee->u.functionDef->body, s);
+    return s->found;
+}
+
+/* FindAssignment - look for an assignment to the symbol being checked */
+static void FindAssignment(ParseTreeNode **pNode, InlineState *s)
+{
+    ParseTreeNode *node = *pNode, *target = NULL;
+    switch (node->nodeType) {
+    case NodeTypeAssignmentOp:
+        target = node->u.binaryOp.left;
+        break;
+    case NodeTypePreincrementOp:
+    case NodeTypePostincrementOp:
+        target = node->u.incrementOp.expr;
+        break;
+    default:
+        break;
+    }
+    if (target && target->nodeType == NodeTypeArgumentRef && target->u.localSymbolRef.symbol == s->symbol)
+        s->found = VMTRUE;
+    else
+        VisitChildren(node, FindAssignment, s);
+}
+
+/* AddTemporary - add a local to the calling function to hold an argument or local */
+static LocalSymbol *AddTemporary(InlineState *s, LocalSymbol *from)
+{
+    LocalSymbolTable *table = &s->caller->u.functionDef->locals;
+    LocalSymbol *sym;
+
+    /* reuse a temporary left by an earlier statement */
+    if (s->temporariesInUse < s->temporaryCount)
+        return s->temporaries[s->temporariesInUse++];
+
+    sym = (LocalSymbol *)FunctionAlloc(s->c, sizeof(LocalSymbol) + strlen(from->name));
+    memset(sym, 0, sizeof(LocalSymbol));
+    strcpy(sym->name, from->name);
+
+    /* place the new local after the try/catch symbols */
+    sym->offset = table->count + s->caller->u.functionDef->maximumTryDepth;
+    *table->pTail = sym;
+    table->pTail = &sym->next;
+    ++table->count;
+
+    /* remember it for the statements that follow */
+    if (s->temporaryCount >= s->temporaryMax) {
+        s->temporaryMax = s->temporaryMax ? s->temporaryMax * 2 : 16;
+        if (!(s->temporaries = (LocalSymbol **)realloc(s->temporaries, s->temporaryMax * sizeof(LocalSymbol *))))
+            Abort(s->c, "insufficient memory");
+    }
+    s->temporaries[s->temporaryCount++] = sym;
+    ++s->temporariesInUse;
+
+    return sym;
+}
+
+/* MakeAssignment - make an assignment of a value to a local */
+static ParseTreeNode *MakeAssignment(InlineState *s, LocalSymbol *symbol, ParseTreeNode *value)
+{
+    ParseTreeNode *node = NewNode(s->c, NodeTypeAssignmentOp);
+    ParseTreeNode *expr = NewNode(s->c, NodeTypeExpr);
+    node->u.binaryOp.op = OP_EQ;
+    node->u.binaryOp.left = NewNode(s->c, NodeTypeLocalSymbolRef);
+    node->u.binaryOp.left->u.localSymbolRef.symbol = symbol;
+    node->u.binaryOp.right = value;
+    expr->u.exprStatement.expr = node;
+    return expr;
+}
+
+/* MakeSequence - make a comma expression that evaluates assignments before a value */
+static ParseTreeNode *MakeSequence(ParseContext *c, NodeListEntry *entry, ParseTreeNode *value)
+{
+    ParseTreeNode *comma;
+    if (!entry)
+        return value;
+    comma = NewNode(c, NodeTypeCommaOp);
+    comma->u.commaOp.left = entry->node->u.exprStatement.expr;
+    comma->u.commaOp.right = MakeSequence(c, entry->next, value);
+    return comma;
+}
+
+/* CloneNode - copy a statement or expression from the called function */
+static ParseTreeNode *CloneNode(InlineState *s, ParseTreeNode *node)
+{
+    ParseTreeNode *copy = NewNode(s->c, node->nodeType);
+    SwitchCase *switchCase, **pNextCase;
+    PrintOp *op, **pNext;
+    int i;
+
+    /* replace references to arguments and locals */
+    switch (node->nodeType) {
+    case NodeTypeArgumentRef:
+    case NodeTypeLocalSymbolRef:
+        for (i = 0; i < s->bindingCount; ++i) {
+            if (s->bindings[i].from == node->u.localSymbolRef.symbol) {
+                if (s->bindings[i].value)
+                    *copy = *s->bindings[i].value;
+                else {
+                    copy->nodeType = NodeTypeLocalSymbolRef;
+                    copy->u.localSymbolRef.symbol = s->bindings[i].to;
+                }
+                return copy;
+            }
+        }
+        Abort(s->c, "inline: unbound symbol '%s'", node->u.localSymbolRef.symbol->name);
+        break;
+    default:
+        break;
+    }
+
+    /* copy the node and its lists */
+    *copy = *node;
+    switch (node->nodeType) {
+    case NodeTypeBlock:
+        copy->u.blockStatement.statements = CloneList(s->c, node->u.blockStatement.statements);
+        break;
+    case NodeTypePrint:
+        pNext = &copy->u.printStatement.ops;
+        for (op = node->u.printStatement.ops; op != NULL; op = op->next) {
+            *pNext = (PrintOp *)FunctionAlloc(s->c, sizeof(PrintOp));
+            **pNext = *op;
+            pNext = &(*pNext)->next;
+        }
+        *pNext = NULL;
+        break;
+    case NodeTypeSwitch:
+        pNextCase = &copy->u.switchStatement.cases;
+        for (switchCase = node->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next) {
+            *pNextCase = (SwitchCase *)FunctionAlloc(s->c, sizeof(SwitchCase));
+            **pNextCase = *switchCase;
+            pNextCase = &(*pNextCase)->next;
+        }
+        *pNextCase = NULL;
+        break;
+    case NodeTypeFunctionCall:
+        copy->u.functionCall.args = CloneList(s->c, node->u.functionCall.args);
+        break;
+    case NodeTypeMethodCall:
+        copy->u.methodCall.args = CloneList(s->c, node->u.methodCall.args);
+        break;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        copy->u.exprList.exprs = CloneList(s->c, node->u.exprList.exprs);
+        break;
+    default:
+        break;
+    }
+
+    /* copy the children */
+    VisitChildren(copy, CloneChild, s);
+    return copy;
+}
+
+/* CloneChild - replace a child of a copied node with a copy */
+static void CloneChild(ParseTreeNode **pNode, InlineState *s)
+{
+    *pNode = CloneNode(s, *pNode);
+}
+
+/* CloneList - copy a node list (the nodes themselves are shared) */
+static NodeListEntry *CloneList(ParseContext *c, NodeListEntry *entry)
+{
+    NodeListEntry *list = NULL, **pNext = &list;
+    for (; entry != NULL; entry = entry->next) {
+        *pNext = NewListEntry(c, entry->node);
+        pNext = &(*pNext)->next;
+    }
+    return list;
+}
+
+/* VisitChildren - call a function for each child of a statement or expression */
+static void VisitChildren(ParseTreeNode *node, VisitFcn *fcn, InlineState *s)
+{
+    NodeListEntry *entry;
+    SwitchCase *switchCase;
+    PrintOp *op;
+
+    switch (node->nodeType) {
+    case NodeTypeIf:
+        (*fcn)(&node->u.ifStatement.test, s);
+        (*fcn)(&node->u.ifStatement.thenStatement, s);
+        if (node->u.ifStatement.elseStatement)
+            (*fcn)(&node->u.ifStatement.elseStatement, s);
+        break;
+    case NodeTypeWhile:
+        (*fcn)(&node->u.whileStatement.test, s);
+        (*fcn)(&node->u.whileStatement.body, s);
+        break;
+    case NodeTypeDoWhile:
+        (*fcn)(&node->u.doWhileStatement.body, s);
+        (*fcn)(&node->u.doWhileStatement.test, s);
+        break;
+    case NodeTypeFor:
+        if (node->u.forStatement.init)
+            (*fcn)(&node->u.forStatement.init, s);
+        if (node->u.forStatement.test)
+            (*fcn)(&node->u.forStatement.test, s);
+        if (node->u.forStatement.incr)
+            (*fcn)(&node->u.forStatement.incr, s);
+        (*fcn)(&node->u.forStatement.body, s);
+        break;
+    case NodeTypeReturn:
+        if (node->u.returnStatement.value)
+            (*fcn)(&node->u.returnStatement.value, s);
+        break;
+    case NodeTypeBlock:
+        for (entry = node->u.blockStatement.statements; entry != NULL; entry = entry->next)
+            (*fcn)(&entry->node, s);
+        break;
+    case NodeTypeTry:
+        (*fcn)(&node->u.tryStatement.statement, s);
+        (*fcn)(&node->u.tryStatement.catchStatement, s);
+        break;
+    case NodeTypeThrow:
+        (*fcn)(&node->u.throwStatement.expr, s);
+        break;
+    case NodeTypeExpr:
+        (*fcn)(&node->u.exprStatement.expr, s);
+        break;
+    case NodeTypePrint:
+        for (op = node->u.printStatement.ops; op != NULL; op = op->next) {
+            if (op->expr)
+                (*fcn)(&op->expr, s);
+        }
+        break;
+    case NodeTypeSwitch:
+        (*fcn)(&node->u.switchStatement.expr, s);
+        for (switchCase = node->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next)
+            (*fcn)(&switchCase->body, s);
+        break;
+    case NodeTypePreincrementOp:
+    case NodeTypePostincrementOp:
+        (*fcn)(&node->u.incrementOp.expr, s);
+        break;
+    case NodeTypeCommaOp:
+        (*fcn)(&node->u.commaOp.left, s);
+        (*fcn)(&node->u.commaOp.right, s);
+        break;
+    case NodeTypeUnaryOp:
+        (*fcn)(&node->u.unaryOp.expr, s);
+        break;
+    case NodeTypeBinaryOp:
+    case NodeTypeAssignmentOp:
+        (*fcn)(&node->u.binaryOp.left, s);
+        (*fcn)(&node->u.binaryOp.right, s);
+        break;
+    case NodeTypeTernaryOp:
+        (*fcn)(&node->u.ternaryOp.test, s);
+        (*fcn)(&node->u.ternaryOp.thenExpr, s);
+        (*fcn)(&node->u.ternaryOp.elseExpr, s);
+        break;
+    case NodeTypeArrayRef:
+        (*fcn)(&node->u.arrayRef.array, s);
+        (*fcn)(&node->u.arrayRef.index, s);
+        break;
+    case NodeTypeFunctionCall:
+        (*fcn)(&node->u.functionCall.fcn, s);
+        for (entry = node->u.functionCall.args; entry != NULL; entry = entry->next)
+            (*fcn)(&entry->node, s);
+        break;
+    case NodeTypeMethodCall:
+        if (node->u.methodCall.class)
+            (*fcn)(&node->u.methodCall.class, s);
+        (*fcn)(&node->u.methodCall.object, s);
+        (*fcn)(&node->u.methodCall.selector, s);
+        for (entry = node->u.methodCall.args; entry != NULL; entry = entry->next)
+            (*fcn)(&entry->node, s);
+        break;
+    case NodeTypeClassRef:
+        (*fcn)(&node->u.classRef.object, s);
+        break;
+    case NodeTypePropertyRef:
+        (*fcn)(&node->u.propertyRef.object, s);
+        (*fcn)(&node->u.propertyRef.selector, s);
+        break;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        for (entry = node->u.exprList.exprs; entry != NULL; entry = entry->next)
+            (*fcn)(&entry->node, s);
+        break;
+    default:
+        break;
+    }
+}
+
+/* NewNode - allocate a new parse tree node */
+static ParseTreeNode *NewNode(ParseContext *c, int type)
+{
+    ParseTreeNode *node = (ParseTreeNode *)FunctionAlloc(c, sizeof(ParseTreeNode));
+    memset(node, 0, sizeof(ParseTreeNode));
+    node->nodeType = type;
+    return node;
+}
+
+/* NewListEntry - allocate a new node list entry */
+static NodeListEntry *NewListEntry(ParseContext *c, ParseTreeNode *node)
+{
+    NodeListEntry *entry = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
+    entry->node = node;
+    entry->next = NULL;
+    return entry;
+}
@@ -10,18 +10,24 @@
 #include <setjmp.h>
 #include <string.h>
 #include <ctype.h>
+#include <signal.h>
 #include "adv2vm.h"
 
+/* profile being collected */
+static Profile *profile = NULL;
+static char *profileFile = NULL;
+
+static void SaveProfile(void);
+static void Interrupted(int sig);
 static void Usage(void);
 
 int main(int argc, char *argv[])
 {
     char *infile = NULL;
     int debug = VMFALSE;
-    int imageSize;
-    ImageHdr *image;
-    FILE *fp;
-    int i;
+    const char *error;
+    MappedImage m;
+    int status, i;
     
     /* get the arguments */
     for(i = 1; i < argc; ++i) {
@@ -32,6 +38,14 @@ int main(int argc, char *argv[])
             case 'd':   // enable debug mode
                 debug = VMTRUE;
                 break;
+            case 'p':   // write an execution profile
+                if (argv[i][2])
+                    profileFile = &argv[i][2];
+                else if (++i < argc)
+                    profileFile = argv[i];
+                else
+                    Usage();
+                break;
             default:
                 Usage();
                 break;
@@ -49,36 +63,47 @@ int main(int argc, char *argv[])
     if (!infile)
         Usage();
         
-    if (!(fp = fopen(infile, "rb"))) {
-        printf("error: can't open '%s'\n", infile);
-        return 1;
-    }
-        
-    fseek(fp, 0, SEEK_END);
-    imageSize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    
-    if (!(image = (ImageHdr *)malloc(imageSize))) {
-        printf("error: insufficient memory\n");
+    if (!MapImage(infile, &m, &error)) {
+        printf("error: %s '%s'\n", error, infile);
         return 1;
     }
     
-    if (fread(image, 1, imageSize, fp) != imageSize) {
-        printf("error: error reading image\n");
-        return 1;
+    /* a training run of an interactive program is usually ended with an interrupt */
+    if (profileFile) {
+        profile = NewProfile(m.image);
+        signal(SIGINT, Interrupted);
+        signal(SIGTERM, Interrupted);
     }
     
-    fclose(fp);
+    status = ExecuteMapped(&m, debug, profile) ? 0 : 1;
     
-    Execute(image, debug);
+    SaveProfile();
     
-    free(image);
+    UnmapImage(&m);
     
-    return 0;
+    return status;
 }
   
+/* SaveProfile - write the profile if one is being collected */
+static void SaveProfile(void)
+{
+    if (profile) {
+        if (!WriteProfile(profile, profileFile))
+            printf("error: can't write '%s'\n", profileFile);
+        FreeProfile(profile);
+        profile = NULL;
+    }
+}
+
+/* Interrupted - write the profile collected so far when the program is interrupted */
+static void Interrupted(int sig)
+{
+    SaveProfile();
+    exit(1);
+}
+
 static void Usage(void)
 {
-    printf("usage: adv2int [ -d ] <file>\n");
+    printf("usage: adv2int [ -d ] [ -p <profile-file> ] <file>\n");
     exit(1);
 }
@@ -0,0 +1,136 @@
+/* adv2ld.c - link object files written by adv2com -c into an image
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "adv2compiler.h"
+
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    ParseContext context;
+    ParseContext *c = &context;
+    ImageOptions options;
+    char **objectFiles;
+    int objectCount = 0;
+    int i;
+
+    /* initialize the parse context */
+    InitContext(c);
+    memset(&options, 0, sizeof(ImageOptions));
+    objectFiles = (char **)LocalAlloc(c, argc * sizeof(char *));
+
+    /* get the arguments */
+    for(i = 1; i < argc; ++i) {
+
+        /* handle switches */
+        if(argv[i][0] == '-') {
+            switch(argv[i][1]) {
+            case 'd':   // enable debug mode
+                c->debugMode = VMTRUE;
+                break;
+            case 'e':   // set the function the image starts with
+                if (argv[i][2])
+                    c->mainName = &argv[i][2];
+                else if (++i < argc)
+                    c->mainName = argv[i];
+                else
+                    Usage();
+                break;
+            case 'I':   // run an initialization function at link time
+                if (argv[i][2])
+                    c->initName = &argv[i][2];
+                else if (++i < argc)
+                    c->initName = argv[i];
+                else
+                    Usage();
+                break;
+            case 'O':   // set the optimization level
+                if (argv[i][2])
+                    c->optimizeLevel = atoi(&argv[i][2]);
+                else if (++i < argc)
+                    c->optimizeLevel = atoi(argv[i]);
+                else
+                    Usage();
+                break;
+            case 'P':   // arrange code and data using a profile
+                if (argv[i][2])
+                    options.profileName = &argv[i][2];
+                else if (++i < argc)
+                    options.profileName = argv[i];
+                else
+                    Usage();
+                break;
+            case 'o':
+                if(argv[i][2])
+                    options.outputFile = &argv[i][2];
+                else if(++i < argc)
+                    options.outputFile = argv[i];
+                else
+                    Usage();
+                break;
+            case 'r':   // run program after linking
+                options.runProgram = VMTRUE;
+                break;
+            case 's':   // show the global symbol table
+                options.showSymbols = VMTRUE;
+                break;
+            case 't':
+                if(argv[i][2])
+                    options.templateName = &argv[i][2];
+                else if(++i < argc)
+                    options.templateName = argv[i];
+                else
+                    Usage();
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+
+        /* handle the object filenames */
+        else
+            objectFiles[objectCount++] = argv[i];
+    }
+
+    if (objectCount == 0)
+        Usage();
+    options.inputFile = objectFiles[0];
+
+    if (setjmp(c->errorTarget))
+        return 1;
+
+    /* add the object files in order */
+    for (i = 0; i < objectCount; ++i)
+        LinkObject(c, objectFiles[i]);
+    CheckLinkedSymbols(c);
+
+    /* build the image the way the compiler does */
+    BuildProgram(c, &options);
+
+    free(objectFiles);
+    FreeContext(c);
+
+    return 0;
+}
+
+static void Usage(void)
+{
+#ifdef WORDFIRE_SUPPORT
+    printf("\
+usage: adv2ld [ -d ] [ -O <level> ] [ -P <profile-file> ] [ -I <init-function> ] [ -e <entry-function> ] [ -o <output-file> ] [ -t <template-name> ] [ -s ] [ -r ] <object-file>...\n\
+       templates: run, step, wordfire\n");
+#else
+    printf("\
+usage: adv2ld [ -d ] [ -O <level> ] [ -P <profile-file> ] [ -I <init-function> ] [ -e <entry-function> ] [ -o <output-file> ] [ -t <template-name> ] [ -s ] [ -r ] <object-file>...\n\
+       templates: run, step\n");
+#endif
+    exit(1);
+}
@@ -0,0 +1,1232 @@
+/* adv2module.c - cached modules for included files and relocatable object files
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "adv2compiler.h"
+
+/* module file format */
+#define MODULE_MAGIC    "ADV2MOD"
+#define MODULE_VERSION  4
+#define MODULE_EXT      ".adm"
+
+/* object file format (a module of a whole file that the linker relocates) */
+#define OBJECT_MAGIC    "ADV2OBJ"
+
+/* file compiled as part of a module */
+typedef struct {
+    char *name;
+    uint64_t hash;
+} ModuleFile;
+
+/* module being recorded while its file is compiled */
+struct Module {
+    char *path;                     /* name of the module file */
+    uint64_t key;                   /* hash of the file and everything it was compiled after */
+    int codeStart;                  /* code and data space used before the module */
+    int dataStart;
+    uint8_t *code;                  /* code and data before the module (to find what it changed) */
+    uint8_t *codeRelocs;
+    uint8_t *data;
+    uint8_t *dataRelocs;
+    Symbol **pFirstSymbol;          /* where the first symbol added by the module is linked */
+    Symbol **undefined;             /* symbols that weren't defined before the module */
+    Fixup **undefinedFixups;        /* their fixups before the module */
+    int undefinedCount;
+    String **pFirstString;          /* where the first string added by the module is linked */
+    String **strings;               /* strings added before the module */
+    Fixup **stringFixups;           /* their fixups before the module */
+    int stringCount;
+    Word **pFirstWord;              /* where the first word added by the module is linked */
+    ObjectListEntry *objects;       /* objects added before the module */
+    int codeItemCount;              /* items added before the module */
+    int dataItemCount;
+    int pasmSerial;                 /* native assembler symbol definitions before the module */
+    ModuleFile *files;              /* files included by the module */
+    int fileCount;
+    int fileMax;
+};
+
+/* module file being written */
+typedef struct {
+    ParseContext *c;
+    uint8_t *buf;
+    size_t size;
+    size_t max;
+} ModuleWriter;
+
+/* module file being read */
+typedef struct {
+    uint8_t *p;
+    uint8_t *end;
+    int error;
+    VMVALUE codeStart;              /* code and data space used before and after the module */
+    VMVALUE codeEnd;
+    VMVALUE dataStart;
+    VMVALUE dataEnd;
+} ModuleReader;
+
+/* size of the module file header (magic, version, key, and checksum) */
+#define HEADERSIZE  (sizeof(MODULE_MAGIC) + sizeof(int32_t) + 2 * sizeof(uint64_t))
+
+/* local function prototypes */
+static int AtEndOfLine(ParseContext *c);
+static char *ModulePath(ParseContext *c, const char *name);
+static uint64_t ModuleKey(ParseContext *c, const char *name, uint64_t hash);
+static void AddModuleFile(ParseContext *c, Module *m, const char *name, uint64_t hash);
+static void AddFileToModules(ParseContext *c, ParseFile *f, const char *name, uint64_t hash);
+static Module *NewModule(ParseContext *c);
+static int WriteModule(ParseContext *c, Module *m, const char *magic, uint64_t exitHash);
+static void WriteSymbol(ModuleWriter *w, Symbol *sym);
+static void WriteFixups(ModuleWriter *w, Fixup *fixup);
+static void WriteSpace(ModuleWriter *w, uint8_t *buf, uint8_t *relocs, int start, int end);
+static void WritePatches(ModuleWriter *w, uint8_t *old, uint8_t *oldRelocs, uint8_t *buf, uint8_t *relocs, int size);
+static void WriteItems(ModuleWriter *w, ImageItem *items, int first, int count);
+static void WriteNativeSymbol(void *cookie, const char *name, uint32_t value);
+static void PutBytes(ModuleWriter *w, const void *data, size_t size);
+static void PutInt(ModuleWriter *w, VMVALUE value);
+static void PutHash(ModuleWriter *w, uint64_t value);
+static void PutString(ModuleWriter *w, const char *str);
+static void ApplyModule(ParseContext *c, ModuleReader *r);
+static void ApplyObject(ParseContext *c, ModuleReader *r, const char *name);
+static void LinkSymbol(ParseContext *c, ModuleReader *r, const char *name, VMVALUE codeBias, VMVALUE dataBias);
+static void ResolveFixups(ParseContext *c, Symbol *sym, Fixup *fixup);
+static void LinkWord(ParseContext *c, int type, const char *data);
+static int CompareTags(const void *p1, const void *p2);
+static Fixup *ReadFixups(ParseContext *c, ModuleReader *r, VMVALUE codeBias, VMVALUE dataBias);
+static void FreeFixups(Fixup *fixup);
+static void ReadSpace(ParseContext *c, ModuleReader *r, FixupType type);
+static void RelocateSpace(ParseContext *c, FixupType type, VMVALUE start, VMVALUE codeBias, VMVALUE dataBias);
+static void ReadPatches(ModuleReader *r, uint8_t *buf, uint8_t *relocs, int size);
+static void ReadItems(ParseContext *c, ModuleReader *r, FixupType type, VMVALUE bias);
+static uint8_t *GetBytes(ModuleReader *r, size_t size);
+static VMVALUE GetInt(ModuleReader *r);
+static uint64_t GetHash(ModuleReader *r);
+static char *GetString(ModuleReader *r);
+static uint8_t *ReadFile(const char *name, size_t *pSize);
+static void FreeModule(Module *m);
+
+/* LoadModule - load the cached module of an included file
+ *
+ * The module is used only if it was written after compiling the same file
+ * with the same options following the same tokens and the files it included
+ * haven't changed. Loading it leaves everything as compiling the file would
+ * except that its functions can't be expanded inline by the code that follows.
+ * Returns true if the module was loaded.
+ */
+int LoadModule(ParseContext *c, const char *name)
+{
+    ModuleReader reader, *r = &reader;
+    uint8_t *buf = NULL;
+    uint64_t hash, key;
+    char *path = NULL;
+    int loaded = VMFALSE;
+    size_t size;
+
+    if (!AtEndOfLine(c) || !HashFile(c, name, &hash))
+        return VMFALSE;
+    key = ModuleKey(c, name, hash);
+
+    /* read the module file and check that it matches */
+    path = ModulePath(c, name);
+    if ((buf = ReadFile(path, &size)) != NULL && size >= HEADERSIZE) {
+        uint8_t *magic, *body;
+        uint64_t moduleKey, checksum;
+        VMVALUE version;
+        int count, i;
+
+        r->p = buf;
+        r->end = buf + size;
+        r->error = VMFALSE;
+        magic = GetBytes(r, sizeof(MODULE_MAGIC));
+        version = GetInt(r);
+        moduleKey = GetHash(r);
+        checksum = GetHash(r);
+        body = r->p;
+        if (memcmp(magic, MODULE_MAGIC, sizeof(MODULE_MAGIC)) == 0
+        &&  version == MODULE_VERSION
+        &&  moduleKey == key
+        &&  checksum == HashData(HASHSEED, body, r->end - body)) {
+
+            /* the module must start where the file would (once the functions before it are linked) */
+            GetHash(r);
+            r->codeStart = GetInt(r);
+            r->codeEnd = GetInt(r);
+            r->dataStart = GetInt(r);
+            r->dataEnd = GetInt(r);
+            FinishFunctions(c);
+            if (r->codeStart == c->codeFree - c->codeBuf && r->codeEnd >= r->codeStart
+            &&  r->dataStart == c->dataFree - c->dataBuf && r->dataEnd >= r->dataStart) {
+
+                /* and the files it included must not have changed */
+                loaded = VMTRUE;
+                for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+                    char *fileName = GetString(r);
+                    uint64_t fileHash = GetHash(r), currentHash;
+                    if (!fileName || !HashFile(c, fileName, &currentHash) || currentHash != fileHash)
+                        loaded = VMFALSE;
+                }
+                if (r->error)
+                    loaded = VMFALSE;
+            }
+
+            /* add what the module defines */
+            if (loaded) {
+                r->p = body;
+                AddIncludedFile(c, name);
+                AddFileToModules(c, c->currentFile, name, hash);
+                ApplyModule(c, r);
+                if (r->error)
+                    Abort(c, "module '%s' is corrupt", path);
+                printf("module: loaded '%s'\n", path);
+            }
+        }
+    }
+
+    free(buf);
+    free(path);
+    return loaded;
+}
+
+/* BeginModule - start recording the module of the file that was just pushed
+ *
+ * The module is written when the end of the file is reached between
+ * declarations. It isn't recorded if something follows the include statement
+ * on the same line since that is compiled before the file.
+ */
+void BeginModule(ParseContext *c, const char *name)
+{
+    ParseFile *f = c->currentFile;
+    uint64_t hash;
+    Module *m;
+
+    if (!AtEndOfLine(c))
+        return;
+
+    /* tell the modules being recorded that they include this file */
+    hash = HashData(HASHSEED, f->text, f->size);
+    AddFileToModules(c, f->next, name, hash);
+
+    m = NewModule(c);
+    m->path = ModulePath(c, name);
+    m->key = ModuleKey(c, name, hash);
+    f->module = m;
+}
+
+/* EndModule - finish recording the module of a file that has been compiled
+ *
+ * The functions the file defined stop being inline candidates so that the code
+ * that follows is the same whether the file was compiled or its module loaded.
+ */
+void EndModule(ParseContext *c, ParseFile *f)
+{
+    Module *m = f->module;
+    Symbol *sym;
+    int i;
+
+    /* the module includes the code of every function the file defined */
+    FinishFunctions(c);
+
+    for (i = 0; i < m->undefinedCount; ++i)
+        m->undefined[i]->inlineFunction = NULL;
+    for (sym = *m->pFirstSymbol; sym != NULL; sym = sym->next)
+        sym->inlineFunction = NULL;
+
+    /* a file that ends inside of a declaration can't be a module */
+    if (c->atDeclaration && WriteModule(c, m, MODULE_MAGIC, c->tokenHash))
+        printf("module: wrote '%s'\n", m->path);
+
+    FreeModule(m);
+    f->module = NULL;
+}
+
+/* BeginObject - start recording everything that compiling a file adds to the parse context */
+Module *BeginObject(ParseContext *c)
+{
+    return NewModule(c);
+}
+
+/* EndObject - write the object file of a file that has been compiled
+ *
+ * An object file is a module that starts with an empty program. The linker
+ * relocates it to follow the files linked before it.
+ */
+void EndObject(ParseContext *c, Module *m, const char *name)
+{
+    m->path = (char *)LocalAlloc(c, strlen(name) + 1);
+    strcpy(m->path, name);
+    if (!WriteModule(c, m, OBJECT_MAGIC, 0))
+        Abort(c, "can't write object file '%s'", name);
+    printf("object: wrote '%s', data: %d, code %d\n", name, (int)(c->dataFree - c->dataBuf) - m->dataStart, (int)(c->codeFree - c->codeBuf) - m->codeStart);
+    FreeModule(m);
+}
+
+/* NewModule - start a module by remembering what is already in the parse context */
+static Module *NewModule(ParseContext *c)
+{
+    Symbol *sym;
+    String *str;
+    Module *m;
+    int i;
+
+    /* the functions before the module must be linked first */
+    FinishFunctions(c);
+
+    m = (Module *)LocalAlloc(c, sizeof(Module));
+    memset(m, 0, sizeof(Module));
+
+    /* remember the code and data that are already there */
+    m->codeStart = c->codeFree - c->codeBuf;
+    m->code = (uint8_t *)LocalAlloc(c, m->codeStart + 1);
+    m->codeRelocs = (uint8_t *)LocalAlloc(c, m->codeStart + 1);
+    memcpy(m->code, c->codeBuf, m->codeStart);
+    memcpy(m->codeRelocs, c->codeRelocs, m->codeStart);
+    m->dataStart = c->dataFree - c->dataBuf;
+    m->data = (uint8_t *)LocalAlloc(c, m->dataStart + 1);
+    m->dataRelocs = (uint8_t *)LocalAlloc(c, m->dataStart + 1);
+    memcpy(m->data, c->dataBuf, m->dataStart);
+    memcpy(m->dataRelocs, c->dataRelocs, m->dataStart);
+
+    /* remember the symbols that can still be defined */
+    m->pFirstSymbol = c->globals.pTail;
+    for (sym = c->globals.head; sym != NULL; sym = sym->next)
+        if (!sym->valueDefined)
+            ++m->undefinedCount;
+    m->undefined = (Symbol **)LocalAlloc(c, (m->undefinedCount + 1) * sizeof(Symbol *));
+    m->undefinedFixups = (Fixup **)LocalAlloc(c, (m->undefinedCount + 1) * sizeof(Fixup *));
+    for (sym = c->globals.head, i = 0; sym != NULL; sym = sym->next)
+        if (!sym->valueDefined) {
+            m->undefined[i] = sym;
+            m->undefinedFixups[i++] = sym->v.fixups;
+        }
+
+    /* remember the strings and their references */
+    m->pFirstString = c->pNextString;
+    for (str = c->strings; str != NULL; str = str->next)
+        ++m->stringCount;
+    m->strings = (String **)LocalAlloc(c, (m->stringCount + 1) * sizeof(String *));
+    m->stringFixups = (Fixup **)LocalAlloc(c, (m->stringCount + 1) * sizeof(Fixup *));
+    for (str = c->strings, i = 0; str != NULL; str = str->next, ++i) {
+        m->strings[i] = str;
+        m->stringFixups[i] = str->fixups;
+    }
+
+    m->pFirstWord = c->pNextWord;
+    m->objects = c->objects;
+    m->codeItemCount = c->codeItemCount;
+    m->dataItemCount = c->dataItemCount;
+    m->pasmSerial = PasmSerial(c->pasm);
+
+    return m;
+}
+
+/* AtEndOfLine - check for nothing but spaces or a comment on the rest of the line */
+static int AtEndOfLine(ParseContext *c)
+{
+    char *p = c->linePtr;
+    while (p < c->lineEnd && isspace(*p))
+        ++p;
+    return p >= c->lineEnd || (p[0] == '/' && p[1] == '/');
+}
+
+/* ModulePath - get the name of the module file of an included file */
+static char *ModulePath(ParseContext *c, const char *name)
+{
+    char *path = (char *)LocalAlloc(c, strlen(name) + sizeof(MODULE_EXT));
+    strcpy(path, name);
+    strcat(path, MODULE_EXT);
+    return path;
+}
+
+/* ModuleKey - get the key a module must match to be used
+ *
+ * The tokens read so far determine everything compiled before the file.
+ */
+static uint64_t ModuleKey(ParseContext *c, const char *name, uint64_t hash)
+{
+    VMVALUE options[4];
+    uint64_t key = HashData(HASHSEED, name, strlen(name));
+    options[0] = MODULE_VERSION;
+    options[1] = c->optimizeLevel;
+    options[2] = c->inlineBudget;
+    options[3] = c->objectMode;
+    key = HashData(key, options, sizeof(options));
+    key = HashData(key, &hash, sizeof(hash));
+    return HashData(key, &c->tokenHash, sizeof(c->tokenHash));
+}
+
+/* AddModuleFile - add a file to those a module depends on */
+static void AddModuleFile(ParseContext *c, Module *m, const char *name, uint64_t hash)
+{
+    ModuleFile *file;
+    if (m->fileCount >= m->fileMax) {
+        m->fileMax = m->fileMax ? m->fileMax * 2 : 8;
+        if (!(m->files = (ModuleFile *)realloc(m->files, m->fileMax * sizeof(ModuleFile))))
+            Abort(c, "insufficient memory");
+    }
+    file = &m->files[m->fileCount++];
+    file->name = (char *)LocalAlloc(c, strlen(name) + 1);
+    strcpy(file->name, name);
+    file->hash = hash;
+}
+
+/* AddFileToModules - add a file to the modules being recorded by a file and the files that included it */
+static void AddFileToModules(ParseContext *c, ParseFile *f, const char *name, uint64_t hash)
+{
+    for (; f != NULL; f = f->next)
+        if (f->module)
+            AddModuleFile(c, f->module, name, hash);
+}
+
+/* WriteModule - write a module or object file
+ *
+ * The module holds everything that compiling the file added to or changed in
+ * the parse context. Returns true if the file was written.
+ */
+static int WriteModule(ParseContext *c, Module *m, const char *magic, uint64_t exitHash)
+{
+    ModuleWriter writer, *w = &writer;
+    ObjectListEntry *entry;
+    uint64_t checksum;
+    int written = VMFALSE;
+    Symbol *sym;
+    String *str;
+    Word *word;
+    int count, i;
+    FILE *fp;
+
+    memset(w, 0, sizeof(ModuleWriter));
+    w->c = c;
+
+    /* header (the checksum is filled in at the end) */
+    PutBytes(w, magic, sizeof(MODULE_MAGIC));
+    PutInt(w, MODULE_VERSION);
+    PutHash(w, m->key);
+    PutHash(w, 0);
+
+    /* where the module starts and ends */
+    PutHash(w, exitHash);
+    PutInt(w, m->codeStart);
+    PutInt(w, c->codeFree - c->codeBuf);
+    PutInt(w, m->dataStart);
+    PutInt(w, c->dataFree - c->dataBuf);
+
+    /* files that must not change */
+    PutInt(w, m->fileCount);
+    for (i = 0; i < m->fileCount; ++i) {
+        PutString(w, m->files[i].name);
+        PutHash(w, m->files[i].hash);
+    }
+
+    PutInt(w, c->propertyCount);
+    PutInt(w, c->inlineBudget);
+
+    /* code and data added and changed */
+    WriteSpace(w, c->codeBuf, c->codeRelocs, m->codeStart, c->codeFree - c->codeBuf);
+    WriteSpace(w, c->dataBuf, c->dataRelocs, m->dataStart, c->dataFree - c->dataBuf);
+    WritePatches(w, m->code, m->codeRelocs, c->codeBuf, c->codeRelocs, m->codeStart);
+    WritePatches(w, m->data, m->dataRelocs, c->dataBuf, c->dataRelocs, m->dataStart);
+
+    /* symbols defined or referenced */
+    for (count = 0, i = 0; i < m->undefinedCount; ++i)
+        if (m->undefined[i]->valueDefined || m->undefined[i]->v.fixups != m->undefinedFixups[i])
+            ++count;
+    for (sym = *m->pFirstSymbol; sym != NULL; sym = sym->next)
+        ++count;
+    PutInt(w, count);
+    for (i = 0; i < m->undefinedCount; ++i)
+        if (m->undefined[i]->valueDefined || m->undefined[i]->v.fixups != m->undefinedFixups[i])
+            WriteSymbol(w, m->undefined[i]);
+    for (sym = *m->pFirstSymbol; sym != NULL; sym = sym->next)
+        WriteSymbol(w, sym);
+
+    /* strings added or referenced */
+    for (count = 0, i = 0; i < m->stringCount; ++i)
+        if (m->strings[i]->fixups != m->stringFixups[i])
+            ++count;
+    for (str = *m->pFirstString; str != NULL; str = str->next)
+        ++count;
+    PutInt(w, count);
+    for (i = 0; i < m->stringCount; ++i)
+        if (m->strings[i]->fixups != m->stringFixups[i]) {
+            PutString(w, m->strings[i]->data);
+            WriteFixups(w, m->strings[i]->fixups);
+        }
+    for (str = *m->pFirstString; str != NULL; str = str->next) {
+        PutString(w, str->data);
+        WriteFixups(w, str->fixups);
+    }
+
+    /* words added */
+    for (count = 0, word = *m->pFirstWord; word != NULL; word = word->next)
+        ++count;
+    PutInt(w, count);
+    for (word = *m->pFirstWord; word != NULL; word = word->next) {
+        PutInt(w, word->type);
+        PutString(w, word->string->data);
+    }
+
+    /* objects added (in the order they were added) */
+    for (count = 0, entry = c->objects; entry != m->objects; entry = entry->next)
+        ++count;
+    PutInt(w, count);
+    while (--count >= 0) {
+        for (entry = c->objects, i = 0; i < count; ++i)
+            entry = entry->next;
+        PutInt(w, entry->object);
+    }
+
+    /* items added */
+    WriteItems(w, c->codeItems, m->codeItemCount, c->codeItemCount);
+    WriteItems(w, c->dataItems, m->dataItemCount, c->dataItemCount);
+
+    /* native assembler labels defined */
+    PutInt(w, PasmSymbols(c->pasm, m->pasmSerial, NULL, NULL));
+    PasmSymbols(c->pasm, m->pasmSerial, WriteNativeSymbol, w);
+
+    /* fill in the checksum and write the file */
+    checksum = HashData(HASHSEED, w->buf + HEADERSIZE, w->size - HEADERSIZE);
+    memcpy(w->buf + HEADERSIZE - sizeof(uint64_t), &checksum, sizeof(uint64_t));
+    if ((fp = fopen(m->path, "wb")) != NULL) {
+        written = fwrite(w->buf, 1, w->size, fp) == w->size;
+        if (fclose(fp) != 0)
+            written = VMFALSE;
+    }
+    free(w->buf);
+    return written;
+}
+
+/* WriteSymbol - write a symbol and its value or fixups */
+static void WriteSymbol(ModuleWriter *w, Symbol *sym)
+{
+    PutString(w, sym->name);
+    PutInt(w, sym->storageClass);
+    PutInt(w, sym->property);
+    PutInt(w, sym->valueDefined);
+    if (sym->valueDefined)
+        PutInt(w, sym->v.value);
+    else
+        WriteFixups(w, sym->v.fixups);
+}
+
+/* WriteFixups - write the fixups of a symbol or string */
+static void WriteFixups(ModuleWriter *w, Fixup *fixup)
+{
+    Fixup *f;
+    int count = 0;
+    for (f = fixup; f != NULL; f = f->next)
+        ++count;
+    PutInt(w, count);
+    for (f = fixup; f != NULL; f = f->next) {
+        PutInt(w, f->type);
+        PutInt(w, f->v.offset);
+    }
+}
+
+/* WriteSpace - write the code or data added by a module and their relocation types */
+static void WriteSpace(ModuleWriter *w, uint8_t *buf, uint8_t *relocs, int start, int end)
+{
+    PutBytes(w, buf + start, end - start);
+    PutBytes(w, relocs + start, end - start);
+}
+
+/* WritePatches - write the bytes a module changed in the code or data before it */
+static void WritePatches(ModuleWriter *w, uint8_t *old, uint8_t *oldRelocs, uint8_t *buf, uint8_t *relocs, int size)
+{
+    int count = 0, i;
+    for (i = 0; i < size; ++i)
+        if (old[i] != buf[i] || oldRelocs[i] != relocs[i])
+            ++count;
+    PutInt(w, count);
+    for (i = 0; i < size; ++i)
+        if (old[i] != buf[i] || oldRelocs[i] != relocs[i]) {
+            PutInt(w, i);
+            PutBytes(w, &buf[i], 1);
+            PutBytes(w, &relocs[i], 1);
+        }
+}
+
+/* WriteItems - write the code or data items added by a module */
+static void WriteItems(ModuleWriter *w, ImageItem *items, int first, int count)
+{
+    int i;
+    PutInt(w, count - first);
+    for (i = first; i < count; ++i) {
+        ImageItem *item = &items[i];
+        PutInt(w, item->type);
+        PutInt(w, item->offset);
+        PutInt(w, item->name != NULL);
+        if (item->name)
+            PutString(w, item->name);
+        PutInt(w, item->hasAsm);
+        PutInt(w, item->dynamicSelectors);
+        PutInt(w, item->selectorCount);
+        PutBytes(w, item->selectors, item->selectorCount * sizeof(VMVALUE));
+        PutInt(w, item->dynamicStores);
+        PutInt(w, item->storedTagCount);
+        PutBytes(w, item->storedTags, item->storedTagCount * sizeof(VMVALUE));
+    }
+}
+
+/* WriteNativeSymbol - write a native assembler label */
+static void WriteNativeSymbol(void *cookie, const char *name, uint32_t value)
+{
+    ModuleWriter *w = (ModuleWriter *)cookie;
+    PutString(w, name);
+    PutInt(w, (VMVALUE)value);
+}
+
+/* PutBytes - add bytes to a module file */
+static void PutBytes(ModuleWriter *w, const void *data, size_t size)
+{
+    if (w->size + size > w->max) {
+        while (w->size + size > w->max)
+            w->max = w->max ? w->max * 2 : 4096;
+        if (!(w->buf = (uint8_t *)realloc(w->buf, w->max)))
+            Abort(w->c, "insufficient memory");
+    }
+    if (size > 0)
+        memcpy(w->buf + w->size, data, size);
+    w->size += size;
+}
+
+/* PutInt - add an integer to a module file */
+static void PutInt(ModuleWriter *w, VMVALUE value)
+{
+    PutBytes(w, &value, sizeof(VMVALUE));
+}
+
+/* PutHash - add a hash to a module file */
+static void PutHash(ModuleWriter *w, uint64_t value)
+{
+    PutBytes(w, &value, sizeof(uint64_t));
+}
+
+/* PutString - add a string to a module file */
+static void PutString(ModuleWriter *w, const char *str)
+{
+    int size = strlen(str) + 1;
+    PutInt(w, size);
+    PutBytes(w, str, size);
+}
+
+/* ApplyModule - add what a module defines to the parse context */
+static void ApplyModule(ParseContext *c, ModuleReader *r)
+{
+    int count, i;
+
+    c->tokenHash = GetHash(r);
+    r->codeStart = GetInt(r);
+    r->codeEnd = GetInt(r);
+    r->dataStart = GetInt(r);
+    r->dataEnd = GetInt(r);
+
+    /* the files the module included are now included */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        char *name = GetString(r);
+        uint64_t hash = GetHash(r);
+        if (name) {
+            AddIncludedFile(c, name);
+            AddFileToModules(c, c->currentFile, name, hash);
+        }
+    }
+
+    c->propertyCount = GetInt(r);
+    c->inlineBudget = GetInt(r);
+
+    /* code and data */
+    ReadSpace(c, r, FT_CODE);
+    ReadSpace(c, r, FT_DATA);
+    ReadPatches(r, c->codeBuf, c->codeRelocs, r->codeStart);
+    ReadPatches(r, c->dataBuf, c->dataRelocs, r->dataStart);
+
+    /* symbols */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        char *name = GetString(r);
+        StorageClass storageClass = (StorageClass)GetInt(r);
+        int property = GetInt(r);
+        Symbol *sym;
+        if (!name)
+            break;
+        if (!(sym = FindSymbol(c, name)))
+            sym = AddUndefinedSymbol(c, name, storageClass);
+        sym->storageClass = storageClass;
+        sym->property = property;
+        sym->inlineFunction = NULL;
+        if (GetInt(r)) {
+            if (!sym->valueDefined)
+                FreeFixups(sym->v.fixups);
+            sym->valueDefined = VMTRUE;
+            sym->v.value = GetInt(r);
+        }
+        else {
+            FreeFixups(sym->v.fixups);
+            sym->v.fixups = ReadFixups(c, r, 0, 0);
+        }
+    }
+
+    /* strings */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        char *data = GetString(r);
+        String *str;
+        if (!data)
+            break;
+        str = AddString(c, data);
+        FreeFixups(str->fixups);
+        str->fixups = ReadFixups(c, r, 0, 0);
+    }
+
+    /* words */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        int type = GetInt(r);
+        char *data = GetString(r);
+        Word *word;
+        if (!data)
+            break;
+        word = (Word *)GlobalAlloc(c, sizeof(Word));
+        word->type = type;
+        word->string = AddString(c, data);
+        word->next = NULL;
+        *c->pNextWord = word;
+        c->pNextWord = &word->next;
+        ++c->wordCount;
+    }
+
+    /* objects */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i)
+        AddObject(c, GetInt(r));
+
+    /* items */
+    ReadItems(c, r, FT_CODE, 0);
+    ReadItems(c, r, FT_DATA, 0);
+
+    /* native assembler labels */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        char *name = GetString(r);
+        VMVALUE value = GetInt(r);
+        if (name && !PasmDefineSymbol(c->pasm, name, (uint32_t)value))
+            Abort(c, "insufficient memory");
+    }
+}
+
+/* LinkObject - add an object file to the program being linked
+ *
+ * The code and data of the object file follow what has already been linked
+ * and the addresses it stores are moved to match.
+ */
+void LinkObject(ParseContext *c, const char *name)
+{
+    ModuleReader reader, *r = &reader;
+    uint8_t *buf, *magic, *body;
+    uint64_t checksum;
+    VMVALUE version;
+    size_t size;
+
+    if (!(buf = ReadFile(name, &size)))
+        Abort(c, "can't open '%s'", name);
+
+    /* check the header */
+    r->p = buf;
+    r->end = buf + size;
+    r->error = VMFALSE;
+    magic = GetBytes(r, sizeof(OBJECT_MAGIC));
+    version = GetInt(r);
+    GetHash(r);
+    checksum = GetHash(r);
+    body = r->p;
+    if (r->error || memcmp(magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC)) != 0) {
+        free(buf);
+        Abort(c, "'%s' is not an object file", name);
+    }
+    if (version != MODULE_VERSION) {
+        free(buf);
+        Abort(c, "'%s' was written by a different version of the compiler", name);
+    }
+    if (checksum != HashData(HASHSEED, body, r->end - body)) {
+        free(buf);
+        Abort(c, "object file '%s' is corrupt", name);
+    }
+
+    ApplyObject(c, r, name);
+    free(buf);
+    if (r->error)
+        Abort(c, "object file '%s' is corrupt", name);
+}
+
+/* CheckLinkedSymbols - check that every symbol is defined and that every property has its own tag */
+void CheckLinkedSymbols(ParseContext *c)
+{
+    Symbol *sym, **properties;
+    int undefined = 0, count = 0, i;
+
+    /* the vocabulary arrays are added when the image is built */
+    for (sym = c->globals.head; sym != NULL; sym = sym->next) {
+        if (sym->valueDefined) {
+            if (sym->property)
+                ++count;
+        }
+        else if (c->wordCount == 0 || (strcmp(sym->name, "_words") != 0 && strcmp(sym->name, "_wordTypes") != 0)) {
+            printf("error: undefined symbol '%s'\n", sym->name);
+            ++undefined;
+        }
+    }
+    if (undefined > 0)
+        Abort(c, "%d undefined symbol%s", undefined, undefined == 1 ? "" : "s");
+
+    /* property tags are hashes of their names so two names could have the same tag */
+    properties = (Symbol **)LocalAlloc(c, (count + 1) * sizeof(Symbol *));
+    for (sym = c->globals.head, i = 0; sym != NULL; sym = sym->next)
+        if (sym->valueDefined && sym->property)
+            properties[i++] = sym;
+    qsort(properties, count, sizeof(Symbol *), CompareTags);
+    for (i = 1; i < count; ++i) {
+        if (properties[i]->v.value == properties[i - 1]->v.value) {
+            const char *name1 = properties[i - 1]->name, *name2 = properties[i]->name;
+            free(properties);
+            Abort(c, "properties '%s' and '%s' have the same tag - rename one of them", name1, name2);
+        }
+    }
+    free(properties);
+    c->propertyCount = count;
+}
+
+/* ApplyObject - add what an object file defines to the program being linked */
+static void ApplyObject(ParseContext *c, ModuleReader *r, const char *name)
+{
+    VMVALUE codeBias, dataBias, codeStart, dataStart;
+    int count, i;
+
+    GetHash(r);
+    r->codeStart = GetInt(r);
+    r->codeEnd = GetInt(r);
+    r->dataStart = GetInt(r);
+    r->dataEnd = GetInt(r);
+    if (r->codeEnd < r->codeStart || r->dataEnd < r->dataStart) {
+        r->error = VMTRUE;
+        return;
+    }
+
+    /* the object file follows what has already been linked */
+    codeStart = c->codeFree - c->codeBuf;
+    dataStart = c->dataFree - c->dataBuf;
+    codeBias = codeStart - r->codeStart;
+    dataBias = dataStart - r->dataStart;
+
+    /* object files don't depend on the files they included */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        GetString(r);
+        GetHash(r);
+    }
+    GetInt(r);
+    GetInt(r);
+
+    /* code and data */
+    ReadSpace(c, r, FT_CODE);
+    ReadSpace(c, r, FT_DATA);
+    if (r->error)
+        return;
+    RelocateSpace(c, FT_CODE, codeStart, codeBias, dataBias);
+    RelocateSpace(c, FT_DATA, dataStart, codeBias, dataBias);
+
+    /* an object file can't change the program it follows */
+    if (GetInt(r) != 0 || GetInt(r) != 0)
+        Abort(c, "'%s' changes code or data that it doesn't define", name);
+
+    /* symbols */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i)
+        LinkSymbol(c, r, name, codeBias, dataBias);
+
+    /* strings */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        char *data = GetString(r);
+        Fixup *fixups, *fixup;
+        String *str;
+        if (!data)
+            break;
+        str = AddString(c, data);
+        if ((fixups = ReadFixups(c, r, codeBias, dataBias)) != NULL) {
+            for (fixup = fixups; fixup->next != NULL; fixup = fixup->next)
+                ;
+            fixup->next = str->fixups;
+            str->fixups = fixups;
+        }
+    }
+
+    /* words */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        int type = GetInt(r);
+        char *data = GetString(r);
+        if (data)
+            LinkWord(c, type, data);
+    }
+
+    /* objects */
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i)
+        AddObject(c, GetInt(r) + dataBias);
+
+    /* items */
+    ReadItems(c, r, FT_CODE, codeBias);
+    ReadItems(c, r, FT_DATA, dataBias);
+
+    /* the native assembler labels were only needed to compile the file */
+}
+
+/* LinkSymbol - add a symbol that an object file defines or references
+ *
+ * A function or object can be defined by only one file. A constant or property
+ * can be defined by every file that includes it as long as the values agree.
+ * References to symbols the file didn't define are resolved when the symbol
+ * is defined by any file.
+ */
+static void LinkSymbol(ParseContext *c, ModuleReader *r, const char *file, VMVALUE codeBias, VMVALUE dataBias)
+{
+    char *name = GetString(r);
+    StorageClass storageClass = (StorageClass)GetInt(r);
+    int property = GetInt(r);
+    Fixup *fixups, *fixup;
+    VMVALUE value;
+    Symbol *sym;
+
+    if (!name)
+        return;
+    sym = FindSymbol(c, name);
+
+    /* resolve a reference now or when the symbol is defined */
+    if (!GetInt(r)) {
+        if (!(fixups = ReadFixups(c, r, codeBias, dataBias)))
+            return;
+        if (!sym)
+            sym = AddUndefinedSymbol(c, name, storageClass);
+        if (sym->valueDefined) {
+            ResolveFixups(c, sym, fixups);
+            FreeFixups(fixups);
+        }
+        else {
+            for (fixup = fixups; fixup->next != NULL; fixup = fixup->next)
+                ;
+            fixup->next = sym->v.fixups;
+            sym->v.fixups = fixups;
+        }
+        return;
+    }
+
+    /* move the value of a definition */
+    value = GetInt(r);
+    switch (storageClass) {
+    case SC_FUNCTION:
+        value += codeBias;
+        break;
+    case SC_VARIABLE:
+        if ((VMUVALUE)value >= COG_BASE)
+            break;
+        /* fall through */
+    case SC_OBJECT:
+        value += dataBias;
+        break;
+    default:
+        break;
+    }
+
+    if (!sym) {
+        sym = AddSymbol(c, name, storageClass, value);
+        sym->property = property;
+    }
+    else if (sym->valueDefined) {
+        if (storageClass != SC_CONSTANT || sym->storageClass != SC_CONSTANT || value != sym->v.value)
+            Abort(c, "'%s' in '%s' is already defined", name, file);
+    }
+    else {
+        fixups = sym->v.fixups;
+        sym->storageClass = storageClass;
+        sym->property = property;
+        sym->valueDefined = VMTRUE;
+        sym->v.value = value;
+        ResolveFixups(c, sym, fixups);
+        FreeFixups(fixups);
+    }
+}
+
+/* ResolveFixups - store the value of a symbol defined by another object file
+ *
+ * A file refers to a symbol it doesn't define as an object. The code for that
+ * is the same as the code for a function or a constant but not a variable.
+ */
+static void ResolveFixups(ParseContext *c, Symbol *sym, Fixup *fixup)
+{
+    int relocType;
+    switch (sym->storageClass) {
+    case SC_FUNCTION:
+        relocType = RELOC_CODE;
+        break;
+    case SC_OBJECT:
+        relocType = RELOC_DATA;
+        break;
+    case SC_CONSTANT:
+        relocType = RELOC_NONE;
+        break;
+    default:
+        Abort(c, "variable '%s' can only be used by the file that defines it", sym->name);
+        return;
+    }
+    for (; fixup != NULL; fixup = fixup->next) {
+        switch (fixup->type) {
+        case FT_DATA:
+            *(VMVALUE *)&c->dataBuf[fixup->v.offset] = sym->v.value;
+            c->dataRelocs[fixup->v.offset] = relocType;
+            break;
+        case FT_CODE:
+            wr_clong(c, fixup->v.offset, sym->v.value);
+            c->codeRelocs[fixup->v.offset] = relocType;
+            break;
+        case FT_PTR:
+            // never reached
+            break;
+        }
+    }
+}
+
+/* LinkWord - add a vocabulary word from an object file */
+static void LinkWord(ParseContext *c, int type, const char *data)
+{
+    Word *word;
+    for (word = c->words; word != NULL; word = word->next) {
+        if (strcmp(data, word->string->data) == 0) {
+            if (type != word->type)
+                Abort(c, "word '%s' has different types in different files", data);
+            return;
+        }
+    }
+    word = (Word *)GlobalAlloc(c, sizeof(Word));
+    word->type = type;
+    word->string = AddString(c, (char *)data);
+    word->next = NULL;
+    *c->pNextWord = word;
+    c->pNextWord = &word->next;
+    ++c->wordCount;
+}
+
+/* CompareTags - compare the tags of two properties */
+static int CompareTags(const void *p1, const void *p2)
+{
+    VMVALUE tag1 = (*(Symbol **)p1)->v.value;
+    VMVALUE tag2 = (*(Symbol **)p2)->v.value;
+    return tag1 < tag2 ? -1 : tag1 > tag2;
+}
+
+/* ReadFixups - read the fixups of a symbol or string and move them by the code or data bias */
+static Fixup *ReadFixups(ParseContext *c, ModuleReader *r, VMVALUE codeBias, VMVALUE dataBias)
+{
+    Fixup *fixups = NULL, **pNext = &fixups;
+    int count, i;
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        Fixup *fixup = (Fixup *)LocalAlloc(c, sizeof(Fixup));
+        fixup->type = (FixupType)GetInt(r);
+        fixup->v.offset = GetInt(r) + (fixup->type == FT_CODE ? codeBias : dataBias);
+        if (fixup->v.offset < 0 || fixup->v.offset + (VMVALUE)sizeof(VMVALUE) > (fixup->type == FT_CODE ? c->codeFree - c->codeBuf : c->dataFree - c->dataBuf))
+            r->error = VMTRUE;
+        fixup->next = NULL;
+        *pNext = fixup;
+        pNext = &fixup->next;
+    }
+    return fixups;
+}
+
+/* FreeFixups - free a list of fixups */
+static void FreeFixups(Fixup *fixup)
+{
+    Fixup *next;
+    for (; fixup != NULL; fixup = next) {
+        next = fixup->next;
+        free(fixup);
+    }
+}
+
+/* ReadSpace - read the code or data added by a module and their relocation types */
+static void ReadSpace(ParseContext *c, ModuleReader *r, FixupType type)
+{
+    int size = (type == FT_CODE ? r->codeEnd - r->codeStart : r->dataEnd - r->dataStart);
+    uint8_t *data = GetBytes(r, size), *relocs = GetBytes(r, size);
+    if (r->error)
+        return;
+    if (type == FT_CODE) {
+        ReserveCode(c, size);
+        memcpy(c->codeFree, data, size);
+        memcpy(c->codeRelocs + (c->codeFree - c->codeBuf), relocs, size);
+        c->codeFree += size;
+    }
+    else {
+        ReserveData(c, size);
+        memcpy(c->dataFree, data, size);
+        memcpy(c->dataRelocs + (c->dataFree - c->dataBuf), relocs, size);
+        c->dataFree += size;
+    }
+}
+
+/* RelocateSpace - move the addresses stored in the code or data read from an object file */
+static void RelocateSpace(ParseContext *c, FixupType type, VMVALUE start, VMVALUE codeBias, VMVALUE dataBias)
+{
+    VMVALUE end, offset;
+    if (type == FT_CODE) {
+        end = (c->codeFree - c->codeBuf) - (VMVALUE)sizeof(VMVALUE);
+        for (offset = start; offset <= end; ++offset)
+            if (c->codeRelocs[offset] != RELOC_NONE)
+                SetCodeAddress(c, offset, GetCodeAddress(c, offset) + (RELOC_TYPE(c->codeRelocs[offset]) == RELOC_CODE ? codeBias : dataBias));
+    }
+    else {
+        end = (c->dataFree - c->dataBuf) - (VMVALUE)sizeof(VMVALUE);
+        for (offset = start; offset <= end; ++offset)
+            if (c->dataRelocs[offset] != RELOC_NONE)
+                *(VMVALUE *)&c->dataBuf[offset] += (c->dataRelocs[offset] == RELOC_CODE ? codeBias : dataBias);
+    }
+}
+
+/* ReadPatches - read the bytes a module changed in the code or data before it */
+static void ReadPatches(ModuleReader *r, uint8_t *buf, uint8_t *relocs, int size)
+{
+    int count, i;
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        VMVALUE offset = GetInt(r);
+        uint8_t *patch = GetBytes(r, 2);
+        if (r->error || offset < 0 || offset >= size)
+            r->error = VMTRUE;
+        else {
+            buf[offset] = patch[0];
+            relocs[offset] = patch[1];
+        }
+    }
+}
+
+/* ReadItems - read the code or data items added by a module and move them by a bias */
+static void ReadItems(ParseContext *c, ModuleReader *r, FixupType type, VMVALUE bias)
+{
+    int count, i;
+    for (count = GetInt(r), i = 0; !r->error && i < count; ++i) {
+        ItemType itemType = (ItemType)GetInt(r);
+        VMVALUE offset = GetInt(r);
+        char *name = GetInt(r) ? GetString(r) : NULL;
+        int hasAsm = GetInt(r);
+        int dynamicSelectors = GetInt(r);
+        int selectorCount = GetInt(r);
+        uint8_t *selectors = GetBytes(r, selectorCount * sizeof(VMVALUE));
+        int dynamicStores = GetInt(r);
+        int storedTagCount = GetInt(r);
+        uint8_t *storedTags = GetBytes(r, storedTagCount * sizeof(VMVALUE));
+        if (r->error)
+            break;
+        if (type == FT_CODE) {
+            VMVALUE tag;
+            int j;
+            c->selectorCount = 0;
+            c->dynamicSelectors = dynamicSelectors;
+            for (j = 0; j < selectorCount; ++j) {
+                memcpy(&tag, &selectors[j * sizeof(VMVALUE)], sizeof(VMVALUE));
+                AddSelector(c, tag);
+            }
+            c->storedTagCount = 0;
+            c->dynamicStores = dynamicStores;
+            for (j = 0; j < storedTagCount; ++j) {
+                memcpy(&tag, &storedTags[j * sizeof(VMVALUE)], sizeof(VMVALUE));
+                AddStoredTag(c, tag);
+            }
+            AddCodeItem(c, offset + bias, name, hasAsm);
+            c->selectorCount = 0;
+            c->dynamicSelectors = VMFALSE;
+            c->storedTagCount = 0;
+            c->dynamicStores = VMFALSE;
+        }
+        else
+            AddDataItem(c, itemType, offset + bias, name);
+    }
+}
+
+/* GetBytes - get bytes from a module file */
+static uint8_t *GetBytes(ModuleReader *r, size_t size)
+{
+    uint8_t *data = r->p;
+    if (r->error || size > (size_t)(r->end - r->p)) {
+        r->error = VMTRUE;
+        return NULL;
+    }
+    r->p += size;
+    return data;
+}
+
+/* GetInt - get an integer from a module file */
+static VMVALUE GetInt(ModuleReader *r)
+{
+    uint8_t *data = GetBytes(r, sizeof(VMVALUE));
+    VMVALUE value = 0;
+    if (data)
+        memcpy(&value, data, sizeof(VMVALUE));
+    return value;
+}
+
+/* GetHash - get a hash from a module file */
+static uint64_t GetHash(ModuleReader *r)
+{
+    uint8_t *data = GetBytes(r, sizeof(uint64_t));
+    uint64_t value = 0;
+    if (data)
+        memcpy(&value, data, sizeof(uint64_t));
+    return value;
+}
+
+/* GetString - get a string from a module file or NULL if it is corrupt */
+static char *GetString(ModuleReader *r)
+{
+    VMVALUE size = GetInt(r);
+    char *str;
+    if (size <= 0 || !(str = (char *)GetBytes(r, size)) || str[size - 1] != '\0') {
+        r->error = VMTRUE;
+        return NULL;
+    }
+    return str;
+}
+
+/* ReadFile - read a whole file into memory */
+static uint8_t *ReadFile(const char *name, size_t *pSize)
+{
+    uint8_t *buf;
+    long size;
+    FILE *fp;
+
+    if (!(fp = fopen(name, "rb")))
+        return NULL;
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0
+    ||  !(buf = (uint8_t *)malloc(size + 1))) {
+        fclose(fp);
+        return NULL;
+    }
+    if (fread(buf, 1, size, fp) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+
+    *pSize = size;
+    return buf;
+}
+
+/* FreeModule - free a module that was being recorded */
+static void FreeModule(Module *m)
+{
+    int i;
+    for (i = 0; i < m->fileCount; ++i)
+        free(m->files[i].name);
+    free(m->files);
+    free(m->path);
+    free(m->code);
+    free(m->codeRelocs);
+    free(m->data);
+    free(m->dataRelocs);
+    free(m->undefined);
+    free(m->undefinedFixups);
+    free(m->strings);
+    free(m->stringFixups);
+    free(m);
+}
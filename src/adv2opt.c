@@ -0,0 +1,1465 @@
+/* adv2opt.c - dataflow optimizations on the parse tree of a function
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+
+/* bit set word */
+typedef uint32_t SetWord;
+#define SETBITS             32
+#define SETWORDS(n)         (((n) + SETBITS - 1) / SETBITS)
+#define SETBIT(s, i)        ((s)[(i) / SETBITS] |= (SetWord)1 << ((i) % SETBITS))
+#define CLEARBIT(s, i)      ((s)[(i) / SETBITS] &= ~((SetWord)1 << ((i) % SETBITS)))
+#define TESTBIT(s, i)       (((s)[(i) / SETBITS] >> ((i) % SETBITS)) & 1)
+
+/* event types (the references a function makes to its variables and to memory in evaluation order) */
+typedef enum {
+    EV_READ,            /* load of a local or argument */
+    EV_UPDATE,          /* load of a local or argument that is about to be updated */
+    EV_WRITE,           /* store to a local or argument */
+    EV_LOAD,            /* load of a property or array element */
+    EV_CLOBBER          /* call, send, trap, or store to memory */
+} EventType;
+
+/* event */
+typedef struct {
+    EventType type;
+    int var;                    /* read, update, write - index of the variable */
+    ParseTreeNode **pNode;      /* reference, assignment, or load node */
+    LocalSymbol *init;          /* write - local whose initializer is stored or NULL */
+    ParseTreeNode *value;       /* write - value stored by a simple copy or NULL */
+    int fact;                   /* write, load - index of the fact generated or -1 */
+    int parent;                 /* load - index of the enclosing load or -1 */
+    SetWord *uses;              /* load - variables the load depends on */
+} Event;
+
+/* basic block */
+typedef struct {
+    int first;                  /* index of the first event */
+    int count;                  /* number of events */
+    int *succs;                 /* successor blocks */
+    int succCount;
+    int succMax;
+    int *preds;                 /* predecessor blocks */
+    int predCount;
+    int reachable;              /* block can be reached from the function entry */
+} BasicBlock;
+
+/* break and continue target */
+typedef struct OptTarget OptTarget;
+struct OptTarget {
+    OptTarget *next;
+    int isLoop;                 /* loop (break and continue) or switch (break only) */
+    int breakBlock;
+    int continueBlock;
+};
+
+/* loop whose test can have invariant loads hoisted */
+typedef struct OptLoop OptLoop;
+struct OptLoop {
+    OptLoop *next;
+    ParseTreeNode **pStatement; /* slot holding the loop statement */
+    int header;                 /* block that starts evaluating the test */
+    int lastBlock;              /* last block of the loop (the blocks from header to here) */
+};
+
+/* available fact analysis (copies or loads) */
+typedef struct {
+    int factCount;
+    int *events;                /* event generating each fact */
+    SetWord **killByVar;        /* facts killed by a write to each variable */
+    int killByClobber;          /* all facts are killed by a call, send, trap, or store to memory */
+    SetWord **in;               /* facts available at the start of each block */
+} Availability;
+
+/* optimizer state */
+typedef struct {
+    ParseContext *c;
+    ParseTreeNode *function;
+    LocalSymbol **vars;         /* arguments followed by locals */
+    int varCount;
+    int argCount;
+    int varWords;               /* words in a variable set */
+    BasicBlock *blocks;
+    int blockCount;
+    int blockMax;
+    Event *events;
+    int eventCount;
+    int eventMax;
+    int current;                /* block receiving new events */
+    int *order;                 /* reachable blocks in reverse postorder */
+    int orderCount;
+    OptTarget *targets;
+    OptLoop *loops;
+    int copies;                 /* statistics */
+    int deadStores;
+    int hoisted;
+    int reused;
+} OptState;
+
+/* local function prototypes */
+static void Build(OptState *s);
+static void FreeGraph(OptState *s);
+static void BuildStatement(OptState *s, ParseTreeNode **pNode);
+static void BuildExpr(OptState *s, ParseTreeNode **pNode);
+static void BuildLValue(OptState *s, ParseTreeNode **pNode);
+static void BuildUpdate(OptState *s, ParseTreeNode **pNode);
+static void BuildArguments(OptState *s, NodeListEntry *entry);
+static void BuildBranch(OptState *s, ParseTreeNode **pThen, ParseTreeNode **pElse, int isStatement);
+static void BuildLoad(OptState *s, ParseTreeNode **pNode, int mark);
+static int NewBlock(OptState *s);
+static void Enter(OptState *s, int block);
+static void Edge(OptState *s, int from, int to);
+static Event *AddEvent(OptState *s, EventType type, int var, ParseTreeNode **pNode);
+static void PushTarget(OptState *s, OptTarget *target, int isLoop, int breakBlock, int continueBlock);
+static void AddLoop(OptState *s, ParseTreeNode **pStatement, int header);
+static void Order(OptState *s);
+static int VarIndex(OptState *s, LocalSymbol *symbol);
+static int IsVariable(ParseTreeNode *node);
+static int IsCopyValue(ParseTreeNode *node);
+static int IsLoadOperand(ParseTreeNode *node);
+static int IsCandidateLoad(ParseTreeNode *node);
+static int SameLoad(ParseTreeNode *a, ParseTreeNode *b);
+static void AddUses(OptState *s, ParseTreeNode *node, SetWord *uses);
+static SetWord **Liveness(OptState *s, SetWord ***pOut);
+static void Available(OptState *s, Availability *a, EventType type);
+static void Transfer(OptState *s, Availability *a, SetWord *set, Event *event);
+static void FreeAvailability(OptState *s, Availability *a);
+static int PropagateCopies(OptState *s);
+static int EliminateDeadStores(OptState *s);
+static void HoistInvariants(OptState *s);
+static void ReuseLoads(OptState *s);
+static int IsPerformed(OptState *s, int *match, int e);
+static void ShareSlots(OptState *s);
+static LocalSymbol *AddTemporary(OptState *s);
+static ParseTreeNode *MakeLocalRef(OptState *s, LocalSymbol *symbol);
+static ParseTreeNode *MakeAssignment(OptState *s, LocalSymbol *symbol, ParseTreeNode *value);
+static ParseTreeNode *CopyNode(OptState *s, ParseTreeNode *node);
+static ParseTreeNode *NewNode(ParseContext *c, int type);
+static NodeListEntry *NewListEntry(ParseContext *c, ParseTreeNode *node);
+static SetWord *NewSet(OptState *s, int words);
+static SetWord **NewSets(OptState *s, int count, int words);
+static void FreeSets(SetWord **sets, int count);
+
+/* OptimizeFunction - apply the dataflow optimizations to a function
+ *
+ * The references a function makes to its arguments, locals, and memory are
+ * collected in evaluation order into basic blocks that mirror the branches the
+ * code generator emits. Copies of variables and constants are propagated
+ * into later uses, stores to variables that are never read again are removed,
+ * property and array loads that can't change within a loop are computed
+ * before the loop, loads that are repeated without an intervening store or
+ * call reuse the first value, and locals whose values are never needed at
+ * the same time share frame slots. Functions with asm or try statements are
+ * left alone.
+ */
+void OptimizeFunction(ParseContext *c, ParseTreeNode *function)
+{
+    OptState state, *s = &state;
+    int pass;
+
+    if (function->u.functionDef->hasAsm || function->u.functionDef->maximumTryDepth > 0)
+        return;
+
+    /* initialize the optimizer state */
+    memset(s, 0, sizeof(OptState));
+    s->c = c;
+    s->function = function;
+
+    /* remove copies and the stores they leave behind */
+    for (pass = 0; pass < MAXOPTPASSES; ++pass) {
+        int changed;
+        Build(s);
+        changed = PropagateCopies(s);
+        FreeGraph(s);
+        Build(s);
+        changed |= EliminateDeadStores(s);
+        FreeGraph(s);
+        if (!changed)
+            break;
+    }
+
+    /* avoid loading the same value more than once */
+    Build(s);
+    HoistInvariants(s);
+    FreeGraph(s);
+    Build(s);
+    ReuseLoads(s);
+    FreeGraph(s);
+
+    /* share frame slots between locals */
+    Build(s);
+    ShareSlots(s);
+    FreeGraph(s);
+
+    if (c->debugMode) {
+        printf("opt: %s %d copies, %d dead stores, %d loads hoisted, %d loads reused",
+               function->u.functionDef->name, s->copies, s->deadStores, s->hoisted, s->reused);
+        if (function->u.functionDef->localSlots > 0)
+            printf(", %d locals in %d slots", function->u.functionDef->locals.count, function->u.functionDef->localSlots);
+        printf("\n");
+    }
+
+}
+
+/* Build - collect the events and basic blocks of the function */
+static void Build(OptState *s)
+{
+    ParseTreeNode *function = s->function;
+    LocalSymbol *symbol;
+    int i;
+
+    /* number the arguments and locals */
+    s->argCount = function->u.functionDef->arguments.count;
+    s->varCount = s->argCount + function->u.functionDef->locals.count;
+    s->varWords = SETWORDS(s->varCount);
+    s->vars = (LocalSymbol **)LocalAlloc(s->c, (s->varCount + 1) * sizeof(LocalSymbol *));
+    i = 0;
+    for (symbol = function->u.functionDef->arguments.head; symbol != NULL; symbol = symbol->next)
+        s->vars[i++] = symbol;
+    for (symbol = function->u.functionDef->locals.head; symbol != NULL; symbol = symbol->next)
+        s->vars[i++] = symbol;
+
+    /* the entry block stores the initial values of the locals */
+    s->current = -1;
+    Enter(s, NewBlock(s));
+    for (symbol = function->u.functionDef->locals.head; symbol != NULL; symbol = symbol->next) {
+        if (symbol->initialValue) {
+            Event *event;
+            BuildExpr(s, &symbol->initialValue);
+            event = AddEvent(s, EV_WRITE, VarIndex(s, symbol), &symbol->initialValue);
+            event->init = symbol;
+            if (IsCopyValue(symbol->initialValue))
+                event->value = symbol->initialValue;
+        }
+    }
+
+    /* add the body */
+    BuildStatement(s, &function->u.functionDef->body);
+
+    /* find the predecessors and the reachable blocks */
+    for (i = 0; i < s->blockCount; ++i) {
+        BasicBlock *block = &s->blocks[i];
+        int j;
+        for (j = 0; j < block->succCount; ++j)
+            ++s->blocks[block->succs[j]].predCount;
+    }
+    for (i = 0; i < s->blockCount; ++i) {
+        BasicBlock *block = &s->blocks[i];
+        block->preds = (int *)LocalAlloc(s->c, (block->predCount + 1) * sizeof(int));
+        block->predCount = 0;
+    }
+    for (i = 0; i < s->blockCount; ++i) {
+        BasicBlock *block = &s->blocks[i];
+        int j;
+        for (j = 0; j < block->succCount; ++j) {
+            BasicBlock *succ = &s->blocks[block->succs[j]];
+            succ->preds[succ->predCount++] = i;
+        }
+    }
+    Order(s);
+}
+
+/* FreeGraph - free the events and basic blocks */
+static void FreeGraph(OptState *s)
+{
+    OptLoop *loop, *nextLoop;
+    int i;
+    for (i = 0; i < s->eventCount; ++i)
+        free(s->events[i].uses);
+    for (i = 0; i < s->blockCount; ++i) {
+        free(s->blocks[i].succs);
+        free(s->blocks[i].preds);
+    }
+    for (loop = s->loops; loop != NULL; loop = nextLoop) {
+        nextLoop = loop->next;
+        free(loop);
+    }
+    free(s->events);
+    free(s->blocks);
+    free(s->order);
+    free(s->vars);
+    s->events = NULL;
+    s->eventCount = s->eventMax = 0;
+    s->blocks = NULL;
+    s->blockCount = s->blockMax = 0;
+    s->order = NULL;
+    s->orderCount = 0;
+    s->vars = NULL;
+    s->loops = NULL;
+}
+
+/* BuildStatement - collect the events of a statement */
+static void BuildStatement(OptState *s, ParseTreeNode **pNode)
+{
+    ParseTreeNode *node = *pNode;
+    int exitBlock, header, body, cont, dispatch, last;
+    NodeListEntry *entry;
+    SwitchCase *switchCase;
+    OptTarget target, *t;
+    PrintOp *op;
+
+    switch (node->nodeType) {
+    case NodeTypeIf:
+        BuildExpr(s, &node->u.ifStatement.test);
+        BuildBranch(s, &node->u.ifStatement.thenStatement, node->u.ifStatement.elseStatement ? &node->u.ifStatement.elseStatement : NULL, VMTRUE);
+        break;
+    case NodeTypeWhile:
+        exitBlock = NewBlock(s);
+        header = NewBlock(s);
+        Edge(s, s->current, header);
+        Enter(s, header);
+        if (node->u.whileStatement.test->nodeType != NodeTypeIntegerLit) {
+            BuildExpr(s, &node->u.whileStatement.test);
+            Edge(s, s->current, exitBlock);
+        }
+        body = NewBlock(s);
+        Edge(s, s->current, body);
+        Enter(s, body);
+        PushTarget(s, &target, VMTRUE, exitBlock, header);
+        BuildStatement(s, &node->u.whileStatement.body);
+        s->targets = target.next;
+        Edge(s, s->current, header);
+        if (node->u.whileStatement.test->nodeType != NodeTypeIntegerLit)
+            AddLoop(s, pNode, header);
+        Enter(s, exitBlock);
+        break;
+    case NodeTypeDoWhile:
+        exitBlock = NewBlock(s);
+        body = NewBlock(s);
+        cont = NewBlock(s);
+        Edge(s, s->current, body);
+        Enter(s, body);
+        PushTarget(s, &target, VMTRUE, exitBlock, cont);
+        BuildStatement(s, &node->u.doWhileStatement.body);
+        s->targets = target.next;
+        Edge(s, s->current, cont);
+        Enter(s, cont);
+        if (node->u.doWhileStatement.test->nodeType != NodeTypeIntegerLit) {
+            BuildExpr(s, &node->u.doWhileStatement.test);
+            Edge(s, s->current, body);
+            Edge(s, s->current, exitBlock);
+        }
+        else if (node->u.doWhileStatement.test->u.integerLit.value)
+            Edge(s, s->current, body);
+        else
+            Edge(s, s->current, exitBlock);
+        Enter(s, exitBlock);
+        break;
+    case NodeTypeFor:
+        if (node->u.forStatement.init)
+            BuildExpr(s, &node->u.forStatement.init);
+        exitBlock = NewBlock(s);
+        header = NewBlock(s);
+        cont = NewBlock(s);
+        Edge(s, s->current, header);
+        Enter(s, header);
+        if (node->u.forStatement.test) {
+            BuildExpr(s, &node->u.forStatement.test);
+            Edge(s, s->current, exitBlock);
+        }
+        body = NewBlock(s);
+        Edge(s, s->current, body);
+        Enter(s, body);
+        PushTarget(s, &target, VMTRUE, exitBlock, node->u.forStatement.incr ? cont : header);
+        BuildStatement(s, &node->u.forStatement.body);
+        s->targets = target.next;
+        Edge(s, s->current, cont);
+        Enter(s, cont);
+        if (node->u.forStatement.incr)
+            BuildExpr(s, &node->u.forStatement.incr);
+        Edge(s, s->current, header);
+        if (node->u.forStatement.test)
+            AddLoop(s, pNode, header);
+        Enter(s, exitBlock);
+        break;
+    case NodeTypeReturn:
+        if (node->u.returnStatement.value)
+            BuildExpr(s, &node->u.returnStatement.value);
+        Enter(s, NewBlock(s));
+        break;
+    case NodeTypeBreak:
+    case NodeTypeContinue:
+        for (t = s->targets; t != NULL; t = t->next) {
+            if (node->nodeType == NodeTypeBreak) {
+                Edge(s, s->current, t->breakBlock);
+                break;
+            }
+            else if (t->isLoop) {
+                Edge(s, s->current, t->continueBlock);
+                break;
+            }
+        }
+        Enter(s, NewBlock(s));
+        break;
+    case NodeTypeBlock:
+        for (entry = node->u.blockStatement.statements; entry != NULL; entry = entry->next)
+            BuildStatement(s, &entry->node);
+        break;
+    case NodeTypeThrow:
+        BuildExpr(s, &node->u.throwStatement.expr);
+        Enter(s, NewBlock(s));
+        break;
+    case NodeTypeExpr:
+        BuildExpr(s, &node->u.exprStatement.expr);
+        break;
+    case NodeTypePrint:
+        for (op = node->u.printStatement.ops; op != NULL; op = op->next) {
+            if (op->expr)
+                BuildExpr(s, &op->expr);
+            AddEvent(s, EV_CLOBBER, -1, NULL);
+        }
+        break;
+    case NodeTypeSwitch:
+        BuildExpr(s, &node->u.switchStatement.expr);
+        dispatch = s->current;
+        exitBlock = NewBlock(s);
+        last = -1;
+        PushTarget(s, &target, VMFALSE, exitBlock, -1);
+        for (switchCase = node->u.switchStatement.cases; switchCase != NULL; switchCase = switchCase->next) {
+            body = NewBlock(s);
+            Edge(s, dispatch, body);
+            Edge(s, last, body);
+            Enter(s, body);
+            BuildStatement(s, &switchCase->body);
+            last = s->current;
+            if (switchCase->isDefault)
+                dispatch = -1;
+        }
+        s->targets = target.next;
+        Edge(s, dispatch, exitBlock);
+        Edge(s, last, exitBlock);
+        Enter(s, exitBlock);
+        break;
+    case NodeTypeTry:
+    case NodeTypeAsm:
+        /* functions containing these aren't optimized */
+        AddEvent(s, EV_CLOBBER, -1, NULL);
+        break;
+    default:
+        break;
+    }
+}
+
+/* BuildBranch - collect the events of the two arms of an 'if' statement or '?:' expression */
+static void BuildBranch(OptState *s, ParseTreeNode **pThen, ParseTreeNode **pElse, int isStatement)
+{
+    int test = s->current, thenBlock, elseBlock, join;
+    thenBlock = NewBlock(s);
+    elseBlock = pElse ? NewBlock(s) : -1;
+    join = NewBlock(s);
+    Edge(s, test, thenBlock);
+    Edge(s, test, pElse ? elseBlock : join);
+    Enter(s, thenBlock);
+    if (isStatement)
+        BuildStatement(s, pThen);
+    else
+        BuildExpr(s, pThen);
+    Edge(s, s->current, join);
+    if (pElse) {
+        Enter(s, elseBlock);
+        if (isStatement)
+            BuildStatement(s, pElse);
+        else
+            BuildExpr(s, pElse);
+        Edge(s, s->current, join);
+    }
+    Enter(s, join);
+}
+
+/* BuildExpr - collect the events of an expression in the order the code generator evaluates it */
+static void BuildExpr(OptState *s, ParseTreeNode **pNode)
+{
+    ParseTreeNode *node = *pNode;
+    NodeListEntry *entry;
+    int mark = s->eventCount, end;
+    Event *event;
+
+    switch (node->nodeType) {
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+        AddEvent(s, EV_READ, VarIndex(s, node->u.localSymbolRef.symbol), pNode);
+        break;
+    case NodeTypePreincrementOp:
+    case NodeTypePostincrementOp:
+        BuildUpdate(s, &node->u.incrementOp.expr);
+        break;
+    case NodeTypeCommaOp:
+        BuildExpr(s, &node->u.commaOp.left);
+        BuildExpr(s, &node->u.commaOp.right);
+        break;
+    case NodeTypeUnaryOp:
+        BuildExpr(s, &node->u.unaryOp.expr);
+        break;
+    case NodeTypeBinaryOp:
+        BuildExpr(s, &node->u.binaryOp.left);
+        BuildExpr(s, &node->u.binaryOp.right);
+        break;
+    case NodeTypeTernaryOp:
+        BuildExpr(s, &node->u.ternaryOp.test);
+        BuildBranch(s, &node->u.ternaryOp.thenExpr, &node->u.ternaryOp.elseExpr, VMFALSE);
+        break;
+    case NodeTypeAssignmentOp:
+        if (!IsVariable(node->u.binaryOp.left)) {
+            BuildLValue(s, &node->u.binaryOp.left);
+            BuildExpr(s, &node->u.binaryOp.right);
+            AddEvent(s, EV_CLOBBER, -1, NULL);
+        }
+        else {
+            int var = VarIndex(s, node->u.binaryOp.left->u.localSymbolRef.symbol);
+            if (node->u.binaryOp.op != OP_EQ)
+                AddEvent(s, EV_UPDATE, var, &node->u.binaryOp.left);
+            BuildExpr(s, &node->u.binaryOp.right);
+            event = AddEvent(s, EV_WRITE, var, pNode);
+            if (node->u.binaryOp.op == OP_EQ && IsCopyValue(node->u.binaryOp.right)
+            &&  (!IsVariable(node->u.binaryOp.right) || node->u.binaryOp.right->u.localSymbolRef.symbol != s->vars[var]))
+                event->value = node->u.binaryOp.right;
+        }
+        break;
+    case NodeTypeArrayRef:
+        BuildExpr(s, &node->u.arrayRef.array);
+        BuildExpr(s, &node->u.arrayRef.index);
+        BuildLoad(s, pNode, mark);
+        break;
+    case NodeTypeFunctionCall:
+        BuildArguments(s, node->u.functionCall.args);
+        BuildExpr(s, &node->u.functionCall.fcn);
+        AddEvent(s, EV_CLOBBER, -1, NULL);
+        break;
+    case NodeTypeMethodCall:
+        BuildArguments(s, node->u.methodCall.args);
+        if (node->u.methodCall.class)
+            BuildExpr(s, &node->u.methodCall.class);
+        BuildExpr(s, &node->u.methodCall.object);
+        BuildExpr(s, &node->u.methodCall.selector);
+        AddEvent(s, EV_CLOBBER, -1, NULL);
+        break;
+    case NodeTypeClassRef:
+        BuildExpr(s, &node->u.classRef.object);
+        break;
+    case NodeTypePropertyRef:
+        BuildExpr(s, &node->u.propertyRef.object);
+        BuildExpr(s, &node->u.propertyRef.selector);
+        BuildLoad(s, pNode, mark);
+        break;
+    case NodeTypeDisjunction:
+    case NodeTypeConjunction:
+        entry = node->u.exprList.exprs;
+        BuildExpr(s, &entry->node);
+        end = NewBlock(s);
+        while ((entry = entry->next) != NULL) {
+            int next = NewBlock(s);
+            Edge(s, s->current, end);
+            Edge(s, s->current, next);
+            Enter(s, next);
+            BuildExpr(s, &entry->node);
+        }
+        Edge(s, s->current, end);
+        Enter(s, end);
+        break;
+    default:
+        break;
+    }
+}
+
+/* BuildLValue - collect the events of computing the address of a memory location */
+static void BuildLValue(OptState *s, ParseTreeNode **pNode)
+{
+    ParseTreeNode *node = *pNode;
+    switch (node->nodeType) {
+    case NodeTypeArrayRef:
+        BuildExpr(s, &node->u.arrayRef.array);
+        BuildExpr(s, &node->u.arrayRef.index);
+        break;
+    case NodeTypePropertyRef:
+        BuildExpr(s, &node->u.propertyRef.object);
+        BuildExpr(s, &node->u.propertyRef.selector);
+        break;
+    default:
+        break;
+    }
+}
+
+/* BuildUpdate - collect the events of incrementing or decrementing a variable or memory location */
+static void BuildUpdate(OptState *s, ParseTreeNode **pNode)
+{
+    if (IsVariable(*pNode)) {
+        int var = VarIndex(s, (*pNode)->u.localSymbolRef.symbol);
+        AddEvent(s, EV_UPDATE, var, pNode);
+        AddEvent(s, EV_WRITE, var, NULL);
+    }
+    else {
+        BuildLValue(s, pNode);
+        AddEvent(s, EV_CLOBBER, -1, NULL);
+    }
+}
+
+/* BuildArguments - collect the events of the arguments of a call (they are evaluated from last to first) */
+static void BuildArguments(OptState *s, NodeListEntry *entry)
+{
+    if (entry) {
+        BuildArguments(s, entry->next);
+        BuildExpr(s, &entry->node);
+    }
+}
+
+/* BuildLoad - add a load that could be reused and link the loads it contains to it */
+static void BuildLoad(OptState *s, ParseTreeNode **pNode, int mark)
+{
+    Event *event;
+    int i;
+    if (!IsCandidateLoad(*pNode))
+        return;
+    event = AddEvent(s, EV_LOAD, -1, pNode);
+    event->uses = NewSet(s, s->varWords);
+    AddUses(s, *pNode, event->uses);
+    for (i = mark; i < s->eventCount - 1; ++i) {
+        if (s->events[i].type == EV_LOAD && s->events[i].parent < 0)
+            s->events[i].parent = s->eventCount - 1;
+    }
+}
+
+/* NewBlock - allocate a new basic block */
+static int NewBlock(OptState *s)
+{
+    BasicBlock *block;
+    if (s->blockCount >= s->blockMax) {
+        s->blockMax = s->blockMax ? s->blockMax * 2 : 32;
+        if (!(s->blocks = (BasicBlock *)realloc(s->blocks, s->blockMax * sizeof(BasicBlock))))
+            Abort(s->c, "insufficient memory");
+    }
+    block = &s->blocks[s->blockCount];
+    memset(block, 0, sizeof(BasicBlock));
+    block->first = -1;
+    return s->blockCount++;
+}
+
+/* Enter - start adding events to a block (each block is entered only once so its events are contiguous) */
+static void Enter(OptState *s, int block)
+{
+    s->blocks[block].first = s->eventCount;
+    s->current = block;
+}
+
+/* Edge - add an edge between two blocks */
+static void Edge(OptState *s, int from, int to)
+{
+    BasicBlock *block;
+    if (from < 0 || to < 0)
+        return;
+    block = &s->blocks[from];
+    if (block->succCount >= block->succMax) {
+        block->succMax = block->succMax ? block->succMax * 2 : 2;
+        if (!(block->succs = (int *)realloc(block->succs, block->succMax * sizeof(int))))
+            Abort(s->c, "insufficient memory");
+    }
+    block->succs[block->succCount++] = to;
+}
+
+/* AddEvent - add an event to the current block */
+static Event *AddEvent(OptState *s, EventType type, int var, ParseTreeNode **pNode)
+{
+    Event *event;
+    if (s->eventCount >= s->eventMax) {
+        s->eventMax = s->eventMax ? s->eventMax * 2 : 64;
+        if (!(s->events = (Event *)realloc(s->events, s->eventMax * sizeof(Event))))
+            Abort(s->c, "insufficient memory");
+    }
+    event = &s->events[s->eventCount++];
+    memset(event, 0, sizeof(Event));
+    event->type = type;
+    event->var = var;
+    event->pNode = pNode;
+    event->fact = -1;
+    event->parent = -1;
+    ++s->blocks[s->current].count;
+    return event;
+}
+
+/* PushTarget - push a break and continue target */
+static void PushTarget(OptState *s, OptTarget *target, int isLoop, int breakBlock, int continueBlock)
+{
+    target->isLoop = isLoop;
+    target->breakBlock = breakBlock;
+    target->continueBlock = continueBlock;
+    target->next = s->targets;
+    s->targets = target;
+}
+
+/* AddLoop - remember a loop whose blocks run from the header to the last block allocated */
+static void AddLoop(OptState *s, ParseTreeNode **pStatement, int header)
+{
+    OptLoop *loop = (OptLoop *)LocalAlloc(s->c, sizeof(OptLoop));
+    loop->pStatement = pStatement;
+    loop->header = header;
+    loop->lastBlock = s->blockCount - 1;
+    loop->next = s->loops;
+    s->loops = loop;
+}
+
+/* Order - find the reachable blocks in reverse postorder */
+static void Order(OptState *s)
+{
+    int *stack = (int *)LocalAlloc(s->c, (s->blockCount + 1) * sizeof(int));
+    int *next = (int *)LocalAlloc(s->c, (s->blockCount + 1) * sizeof(int));
+    int depth = 0, i;
+
+    s->order = (int *)LocalAlloc(s->c, (s->blockCount + 1) * sizeof(int));
+    s->orderCount = s->blockCount;
+    memset(next, 0, (s->blockCount + 1) * sizeof(int));
+
+    /* depth first search from the entry block */
+    stack[depth++] = 0;
+    s->blocks[0].reachable = VMTRUE;
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        BasicBlock *block = &s->blocks[b];
+        if (next[b] < block->succCount) {
+            int succ = block->succs[next[b]++];
+            if (!s->blocks[succ].reachable) {
+                s->blocks[succ].reachable = VMTRUE;
+                stack[depth++] = succ;
+            }
+        }
+        else {
+            s->order[--s->orderCount] = b;
+            --depth;
+        }
+    }
+
+    /* move the order to the start of the array */
+    for (i = 0; s->orderCount + i < s->blockCount; ++i)
+        s->order[i] = s->order[s->orderCount + i];
+    s->orderCount = i;
+
+    free(stack);
+    free(next);
+}
+
+/* VarIndex - get the index of an argument or local */
+static int VarIndex(OptState *s, LocalSymbol *symbol)
+{
+    int i;
+    for (i = 0; i < s->varCount; ++i)
+        if (s->vars[i] == symbol)
+            return i;
+    Abort(s->c, "opt: unknown symbol '%s'", symbol->name);
+    return -1;
+}
+
+/* IsVariable - check for a reference to an argument or local */
+static int IsVariable(ParseTreeNode *node)
+{
+    return node->nodeType == NodeTypeLocalSymbolRef || node->nodeType == NodeTypeArgumentRef;
+}
+
+/* IsCopyValue - check for a value that can be substituted for a variable it was stored in */
+static int IsCopyValue(ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeIntegerLit:
+    case NodeTypeStringLit:
+    case NodeTypeFunctionLit:
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+        return VMTRUE;
+    case NodeTypeGlobalSymbolRef:
+        switch (node->u.symbolRef.symbol->storageClass) {
+        case SC_OBJECT:
+        case SC_FUNCTION:
+            return VMTRUE;
+        default:
+            return VMFALSE;
+        }
+    default:
+        return VMFALSE;
+    }
+}
+
+/* IsLoadOperand - check for an operand of a load that could be reused */
+static int IsLoadOperand(ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+    case NodeTypeGlobalSymbolRef:
+    case NodeTypeIntegerLit:
+        return VMTRUE;
+    default:
+        return IsCandidateLoad(node);
+    }
+}
+
+/* IsCandidateLoad - check for a load whose value could be reused
+ *
+ * Properties of constant objects are found at compile time and don't need to be reused.
+ */
+static int IsCandidateLoad(ParseTreeNode *node)
+{
+    switch (node->nodeType) {
+    case NodeTypePropertyRef:
+        if (node->u.propertyRef.object->nodeType == NodeTypeGlobalSymbolRef
+        &&  node->u.propertyRef.object->u.symbolRef.symbol->storageClass == SC_OBJECT)
+            return VMFALSE;
+        return node->u.propertyRef.selector->nodeType == NodeTypeIntegerLit
+            && IsLoadOperand(node->u.propertyRef.object);
+    case NodeTypeArrayRef:
+        return IsLoadOperand(node->u.arrayRef.array) && IsLoadOperand(node->u.arrayRef.index);
+    default:
+        return VMFALSE;
+    }
+}
+
+/* SameLoad - check whether two loads or load operands always compute the same address */
+static int SameLoad(ParseTreeNode *a, ParseTreeNode *b)
+{
+    if (a->nodeType != b->nodeType)
+        return VMFALSE;
+    switch (a->nodeType) {
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+        return a->u.localSymbolRef.symbol == b->u.localSymbolRef.symbol;
+    case NodeTypeGlobalSymbolRef:
+        return a->u.symbolRef.symbol == b->u.symbolRef.symbol;
+    case NodeTypeIntegerLit:
+        return a->u.integerLit.value == b->u.integerLit.value;
+    case NodeTypePropertyRef:
+        return SameLoad(a->u.propertyRef.object, b->u.propertyRef.object)
+            && SameLoad(a->u.propertyRef.selector, b->u.propertyRef.selector);
+    case NodeTypeArrayRef:
+        return a->u.arrayRef.type == b->u.arrayRef.type
+            && SameLoad(a->u.arrayRef.array, b->u.arrayRef.array)
+            && SameLoad(a->u.arrayRef.index, b->u.arrayRef.index);
+    default:
+        return VMFALSE;
+    }
+}
+
+/* AddUses - add the variables a load depends on to a set */
+static void AddUses(OptState *s, ParseTreeNode *node, SetWord *uses)
+{
+    switch (node->nodeType) {
+    case NodeTypeLocalSymbolRef:
+    case NodeTypeArgumentRef:
+        SETBIT(uses, VarIndex(s, node->u.localSymbolRef.symbol));
+        break;
+    case NodeTypePropertyRef:
+        AddUses(s, node->u.propertyRef.object, uses);
+        break;
+    case NodeTypeArrayRef:
+        AddUses(s, node->u.arrayRef.array, uses);
+        AddUses(s, node->u.arrayRef.index, uses);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Liveness - find the variables that may be read before being written at the start and end of each block */
+static SetWord **Liveness(OptState *s, SetWord ***pOut)
+{
+    SetWord **in = NewSets(s, s->blockCount, s->varWords);
+    SetWord **out = NewSets(s, s->blockCount, s->varWords);
+    SetWord *live = NewSet(s, s->varWords);
+    int changed, i, j, k;
+
+    do {
+        changed = VMFALSE;
+        for (i = s->orderCount; --i >= 0; ) {
+            int b = s->order[i];
+            BasicBlock *block = &s->blocks[b];
+
+            /* the variables live at the end are the ones live at the start of a successor */
+            for (j = 0; j < block->succCount; ++j)
+                for (k = 0; k < s->varWords; ++k)
+                    out[b][k] |= in[block->succs[j]][k];
+
+            /* work back through the block */
+            memcpy(live, out[b], s->varWords * sizeof(SetWord));
+            for (j = block->count; --j >= 0; ) {
+                Event *event = &s->events[block->first + j];
+                switch (event->type) {
+                case EV_READ:
+                case EV_UPDATE:
+                    SETBIT(live, event->var);
+                    break;
+                case EV_WRITE:
+                    CLEARBIT(live, event->var);
+                    break;
+                default:
+                    break;
+                }
+            }
+            if (memcmp(live, in[b], s->varWords * sizeof(SetWord)) != 0) {
+                memcpy(in[b], live, s->varWords * sizeof(SetWord));
+                changed = VMTRUE;
+            }
+        }
+    } while (changed);
+
+    free(live);
+    *pOut = out;
+    return in;
+}
+
+
+/* Available - find the copies or loads that are available at the start of each block
+ *
+ * A fact is available if it was generated on every path to the block and
+ * nothing on the path since then killed it.
+ */
+static void Available(OptState *s, Availability *a, EventType type)
+{
+    SetWord **out, *set;
+    int words, changed, i, j, k;
+
+    /* number the facts */
+    memset(a, 0, sizeof(Availability));
+    a->events = (int *)LocalAlloc(s->c, (s->eventCount + 1) * sizeof(int));
+    for (i = 0; i < s->eventCount; ++i) {
+        Event *event = &s->events[i];
+        if (event->type == type && (type != EV_WRITE || event->value != NULL)) {
+            event->fact = a->factCount;
+            a->events[a->factCount++] = i;
+        }
+    }
+    words = SETWORDS(a->factCount);
+
+    /* find the facts killed by writing each variable */
+    a->killByVar = NewSets(s, s->varCount, words);
+    for (i = 0; i < a->factCount; ++i) {
+        Event *event = &s->events[a->events[i]];
+        if (type == EV_WRITE) {
+            SETBIT(a->killByVar[event->var], i);
+            if (IsVariable(event->value))
+                SETBIT(a->killByVar[VarIndex(s, event->value->u.localSymbolRef.symbol)], i);
+        }
+        else {
+            for (j = 0; j < s->varCount; ++j)
+                if (TESTBIT(event->uses, j))
+                    SETBIT(a->killByVar[j], i);
+        }
+    }
+    a->killByClobber = type == EV_LOAD;
+
+    /* everything is available at the end of a block until shown otherwise */
+    a->in = NewSets(s, s->blockCount, words);
+    out = NewSets(s, s->blockCount, words);
+    for (i = 0; i < s->blockCount; ++i)
+        for (k = 0; k < a->factCount; ++k)
+            SETBIT(out[i], k);
+
+    /* find the facts available at the start of each block */
+    set = NewSet(s, words);
+    do {
+        changed = VMFALSE;
+        for (i = 0; i < s->orderCount; ++i) {
+            int b = s->order[i];
+            BasicBlock *block = &s->blocks[b];
+
+            /* nothing is available at the function entry */
+            if (b == 0)
+                memset(a->in[b], 0, words * sizeof(SetWord));
+            else {
+                for (k = 0; k < words; ++k)
+                    a->in[b][k] = ~(SetWord)0;
+                for (j = 0; j < block->predCount; ++j) {
+                    int p = block->preds[j];
+                    if (s->blocks[p].reachable)
+                        for (k = 0; k < words; ++k)
+                            a->in[b][k] &= out[p][k];
+                }
+            }
+
+            /* apply the events of the block */
+            memcpy(set, a->in[b], words * sizeof(SetWord));
+            for (j = 0; j < block->count; ++j)
+                Transfer(s, a, set, &s->events[block->first + j]);
+            if (memcmp(set, out[b], words * sizeof(SetWord)) != 0) {
+                memcpy(out[b], set, words * sizeof(SetWord));
+                changed = VMTRUE;
+            }
+        }
+    } while (changed);
+
+    FreeSets(out, s->blockCount);
+    free(set);
+}
+
+/* Transfer - update the available facts for an event */
+static void Transfer(OptState *s, Availability *a, SetWord *set, Event *event)
+{
+    int words = SETWORDS(a->factCount), i;
+    switch (event->type) {
+    case EV_WRITE:
+        for (i = 0; i < words; ++i)
+            set[i] &= ~a->killByVar[event->var][i];
+        break;
+    case EV_CLOBBER:
+        if (a->killByClobber)
+            memset(set, 0, words * sizeof(SetWord));
+        break;
+    default:
+        break;
+    }
+    if (event->fact >= 0)
+        SETBIT(set, event->fact);
+}
+
+/* FreeAvailability - free the results of an availability analysis */
+static void FreeAvailability(OptState *s, Availability *a)
+{
+    FreeSets(a->killByVar, s->varCount);
+    FreeSets(a->in, s->blockCount);
+    free(a->events);
+}
+
+/* PropagateCopies - replace reads of variables holding copies with the values copied
+ *
+ * A copied object can become the receiver of a send, which then finds its
+ * method at compile time. That is safe because BindMethods only calls the
+ * method directly if the property holding it is never assigned.
+ */
+static int PropagateCopies(OptState *s)
+{
+    Availability availability, *a = &availability;
+    SetWord *set;
+    int changed = VMFALSE, i, j, k;
+
+    Available(s, a, EV_WRITE);
+    set = NewSet(s, SETWORDS(a->factCount));
+
+    for (i = 0; i < s->orderCount; ++i) {
+        int b = s->order[i];
+        BasicBlock *block = &s->blocks[b];
+        memcpy(set, a->in[b], SETWORDS(a->factCount) * sizeof(SetWord));
+        for (j = 0; j < block->count; ++j) {
+            Event *event = &s->events[block->first + j];
+            if (event->type == EV_READ) {
+                for (k = 0; k < a->factCount; ++k) {
+                    Event *copy = &s->events[a->events[k]];
+                    if (TESTBIT(set, k) && copy->var == event->var) {
+                        *event->pNode = CopyNode(s, copy->value);
+                        ++s->copies;
+                        changed = VMTRUE;
+                        break;
+                    }
+                }
+            }
+            Transfer(s, a, set, event);
+        }
+    }
+
+    free(set);
+    FreeAvailability(s, a);
+    return changed;
+}
+
+/* EliminateDeadStores - remove stores to variables that are never read again */
+static int EliminateDeadStores(OptState *s)
+{
+    SetWord **in, **out, *live;
+    int changed = VMFALSE, i, j;
+
+    in = Liveness(s, &out);
+    live = NewSet(s, s->varWords);
+
+    for (i = 0; i < s->orderCount; ++i) {
+        int b = s->order[i];
+        BasicBlock *block = &s->blocks[b];
+        memcpy(live, out[b], s->varWords * sizeof(SetWord));
+        for (j = block->count; --j >= 0; ) {
+            Event *event = &s->events[block->first + j];
+            switch (event->type) {
+            case EV_READ:
+            case EV_UPDATE:
+                SETBIT(live, event->var);
+                break;
+            case EV_WRITE:
+                if (!TESTBIT(live, event->var) && event->pNode) {
+                    ParseTreeNode *node = *event->pNode;
+
+                    /* drop the initializer of a local if it has no side effects */
+                    if (event->init) {
+                        if (IsPure(node)) {
+                            event->init->initialValue = NULL;
+                            ++s->deadStores;
+                            changed = VMTRUE;
+                        }
+                    }
+
+                    /* replace a simple assignment with the value assigned */
+                    else if (node->u.binaryOp.op == OP_EQ) {
+                        *event->pNode = node->u.binaryOp.right;
+                        ++s->deadStores;
+                        changed = VMTRUE;
+                    }
+                }
+                CLEARBIT(live, event->var);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    free(live);
+    FreeSets(in, s->blockCount);
+    FreeSets(out, s->blockCount);
+    return changed;
+}
+
+/* HoistInvariants - load values used by loop tests before the loop when they can't change within it
+ *
+ * Only loops without calls, sends, traps, or stores to memory are considered
+ * and only loads the test always performs are moved. The test is evaluated at
+ * least once so the load is never performed when it otherwise wouldn't be.
+ */
+static void HoistInvariants(OptState *s)
+{
+    SetWord *written = NewSet(s, s->varWords);
+    OptLoop *loop;
+    int b, i, j;
+
+    for (loop = s->loops; loop != NULL; loop = loop->next) {
+        BasicBlock *header = &s->blocks[loop->header];
+        NodeListEntry *hoisted = NULL, **pNext = &hoisted;
+        ParseTreeNode *statement = *loop->pStatement;
+        int clobbered = VMFALSE;
+
+        /* find the variables written in the loop */
+        memset(written, 0, s->varWords * sizeof(SetWord));
+        for (b = loop->header; b <= loop->lastBlock; ++b) {
+            BasicBlock *block = &s->blocks[b];
+            for (j = 0; j < block->count; ++j) {
+                Event *event = &s->events[block->first + j];
+                if (event->type == EV_CLOBBER)
+                    clobbered = VMTRUE;
+                else if (event->type == EV_WRITE)
+                    SETBIT(written, event->var);
+            }
+        }
+        if (clobbered)
+            continue;
+
+        /* hoist the outermost invariant loads in the part of the test that is always evaluated */
+        for (j = 0; j < header->count; ++j) {
+            Event *event = &s->events[header->first + j];
+            ParseTreeNode *assignment;
+            LocalSymbol *temporary;
+            int invariant = VMTRUE, parentInvariant = VMFALSE;
+            if (event->type != EV_LOAD)
+                continue;
+            for (i = 0; i < s->varWords; ++i)
+                if (event->uses[i] & written[i])
+                    invariant = VMFALSE;
+            if (event->parent >= 0) {
+                parentInvariant = VMTRUE;
+                for (i = 0; i < s->varWords; ++i)
+                    if (s->events[event->parent].uses[i] & written[i])
+                        parentInvariant = VMFALSE;
+            }
+            if (!invariant || parentInvariant || !(temporary = AddTemporary(s)))
+                continue;
+            assignment = MakeAssignment(s, temporary, *event->pNode);
+            *event->pNode = MakeLocalRef(s, temporary);
+            ++s->hoisted;
+
+            /* evaluate the load in the 'for' initializer or before the 'while' statement */
+            if (statement->nodeType == NodeTypeFor) {
+                if (statement->u.forStatement.init) {
+                    ParseTreeNode *comma = NewNode(s->c, NodeTypeCommaOp);
+                    comma->u.commaOp.left = statement->u.forStatement.init;
+                    comma->u.commaOp.right = assignment;
+                    assignment = comma;
+                }
+                statement->u.forStatement.init = assignment;
+            }
+            else {
+                ParseTreeNode *expr = NewNode(s->c, NodeTypeExpr);
+                expr->u.exprStatement.expr = assignment;
+                *pNext = NewListEntry(s->c, expr);
+                pNext = &(*pNext)->next;
+            }
+        }
+
+        /* replace the 'while' statement with a block starting with the hoisted loads */
+        if (hoisted) {
+            ParseTreeNode *block = NewNode(s->c, NodeTypeBlock);
+            *pNext = NewListEntry(s->c, statement);
+            block->u.blockStatement.statements = hoisted;
+            *loop->pStatement = block;
+        }
+    }
+
+    free(written);
+}
+
+/* ReuseLoads - reuse the value of a load instead of repeating it
+ *
+ * A load can reuse an earlier load of the same location if the earlier load
+ * happens on every path to it with no call, send, trap, or store to memory
+ * and no store to a variable the address depends on in between. The first
+ * load saves its value in a temporary that the later loads read instead.
+ */
+static void ReuseLoads(OptState *s)
+{
+    Availability availability, *a = &availability;
+    int *match, *source;
+    LocalSymbol **temporaries;
+    SetWord *set;
+    int words, pass, i, j, k;
+
+    Available(s, a, EV_LOAD);
+    words = SETWORDS(a->factCount);
+    set = NewSet(s, words);
+    match = (int *)LocalAlloc(s->c, (s->eventCount + 1) * sizeof(int));
+    source = (int *)LocalAlloc(s->c, (s->eventCount + 1) * sizeof(int));
+    temporaries = (LocalSymbol **)LocalAlloc(s->c, (s->eventCount + 1) * sizeof(LocalSymbol *));
+    for (i = 0; i < s->eventCount; ++i) {
+        match[i] = VMFALSE;
+        source[i] = -1;
+        temporaries[i] = NULL;
+    }
+
+    /* find the loads that match an available load and then choose the load to reuse for each
+     *
+     * A load inside a load that will be replaced isn't performed so it can't be
+     * reused and doesn't need to be replaced itself.
+     */
+    for (pass = 0; pass < 2; ++pass) {
+        for (i = 0; i < s->orderCount; ++i) {
+            int b = s->order[i];
+            BasicBlock *block = &s->blocks[b];
+            memcpy(set, a->in[b], words * sizeof(SetWord));
+            for (j = 0; j < block->count; ++j) {
+                int e = block->first + j;
+                Event *event = &s->events[e];
+                if (event->type == EV_LOAD && (pass == 0 || (match[e] && IsPerformed(s, match, e)))) {
+                    for (k = 0; k < a->factCount; ++k) {
+                        int f = a->events[k];
+                        if (TESTBIT(set, k) && SameLoad(*s->events[f].pNode, *event->pNode)
+                        &&  (pass == 0 || IsPerformed(s, match, f))) {
+                            if (pass == 0)
+                                match[e] = VMTRUE;
+                            else
+                                source[e] = source[f] >= 0 ? source[f] : f;
+                            break;
+                        }
+                    }
+                }
+                Transfer(s, a, set, event);
+            }
+        }
+    }
+
+    /* save the value of each load that is reused and read it back instead of repeating the load */
+    for (i = 0; i < s->eventCount; ++i) {
+        int f = source[i];
+        if (f >= 0) {
+            if (!temporaries[f]) {
+                if (!(temporaries[f] = AddTemporary(s)))
+                    continue;
+                *s->events[f].pNode = MakeAssignment(s, temporaries[f], *s->events[f].pNode);
+            }
+            *s->events[i].pNode = MakeLocalRef(s, temporaries[f]);
+            ++s->reused;
+        }
+    }
+
+    free(temporaries);
+    free(source);
+    free(match);
+    free(set);
+    FreeAvailability(s, a);
+}
+
+/* IsPerformed - check that no load containing a load will be replaced */
+static int IsPerformed(OptState *s, int *match, int e)
+{
+    for (e = s->events[e].parent; e >= 0; e = s->events[e].parent)
+        if (match[e])
+            return VMFALSE;
+    return VMTRUE;
+}
+
+/* ShareSlots - let locals whose values are never needed at the same time share a frame slot */
+static void ShareSlots(OptState *s)
+{
+    ParseTreeNode *function = s->function;
+    SetWord **in, **out, **interferes, *live;
+    int *colors, slotCount = 0, i, j, k;
+    LocalSymbol *symbol;
+
+    if (function->u.functionDef->locals.count < 2)
+        return;
+
+    in = Liveness(s, &out);
+    live = NewSet(s, s->varWords);
+    interferes = NewSets(s, s->varCount, s->varWords);
+
+    /* a variable interferes with every variable that is live when it is written */
+    for (i = 0; i < s->orderCount; ++i) {
+        int b = s->order[i];
+        BasicBlock *block = &s->blocks[b];
+        memcpy(live, out[b], s->varWords * sizeof(SetWord));
+        for (j = block->count; --j >= 0; ) {
+            Event *event = &s->events[block->first + j];
+            switch (event->type) {
+            case EV_READ:
+            case EV_UPDATE:
+                SETBIT(live, event->var);
+                break;
+            case EV_WRITE:
+                for (k = 0; k < s->varCount; ++k) {
+                    if (k != event->var && TESTBIT(live, k)) {
+                        SETBIT(interferes[event->var], k);
+                        SETBIT(interferes[k], event->var);
+                    }
+                }
+                CLEARBIT(live, event->var);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    /* a local that may be read before it is written keeps its own slot */
+    for (i = s->argCount; i < s->varCount; ++i) {
+        if (TESTBIT(in[0], i)) {
+            for (k = 0; k < s->varCount; ++k) {
+                if (k != i) {
+                    SETBIT(interferes[i], k);
+                    SETBIT(interferes[k], i);
+                }
+            }
+        }
+    }
+
+    /* give each local the lowest slot not used by a local it interferes with */
+    colors = (int *)LocalAlloc(s->c, s->varCount * sizeof(int));
+    for (i = s->argCount; i < s->varCount; ++i) {
+        int color = 0;
+        for (j = s->argCount; j < i; ++j) {
+            if (TESTBIT(interferes[i], j) && colors[j] == color) {
+                ++color;
+                j = s->argCount - 1;
+            }
+        }
+        colors[i] = color;
+        if (color >= slotCount)
+            slotCount = color + 1;
+    }
+
+    /* use the new slots if some are shared */
+    if (slotCount < function->u.functionDef->locals.count) {
+        for (symbol = function->u.functionDef->locals.head, i = s->argCount; symbol != NULL; symbol = symbol->next, ++i)
+            symbol->offset = colors[i];
+        function->u.functionDef->localSlots = slotCount;
+    }
+
+    free(colors);
+    free(live);
+    FreeSets(interferes, s->varCount);
+    FreeSets(in, s->blockCount);
+    FreeSets(out, s->blockCount);
+}
+
+/* AddTemporary - add a local to hold a value computed by the optimizer */
+static LocalSymbol *AddTemporary(OptState *s)
+{
+    LocalSymbolTable *table = &s->function->u.functionDef->locals;
+    static char name[] = "(temp)";
+    LocalSymbol *sym;
+
+    if (table->count >= MAXOPTLOCALS)
+        return NULL;
+
+    sym = (LocalSymbol *)FunctionAlloc(s->c, sizeof(LocalSymbol) + strlen(name));
+    memset(sym, 0, sizeof(LocalSymbol));
+    strcpy(sym->name, name);
+
+    /* functions with try statements aren't optimized so there are no catch symbols to skip */
+    sym->offset = table->count;
+    *table->pTail = sym;
+    table->pTail = &sym->next;
+    ++table->count;
+
+    return sym;
+}
+
+/* MakeLocalRef - make a reference to a local */
+static ParseTreeNode *MakeLocalRef(OptState *s, LocalSymbol *symbol)
+{
+    ParseTreeNode *node = NewNode(s->c, NodeTypeLocalSymbolRef);
+    node->u.localSymbolRef.symbol = symbol;
+    return node;
+}
+
+/* MakeAssignment - make an expression that assigns a value to a local */
+static ParseTreeNode *MakeAssignment(OptState *s, LocalSymbol *symbol, ParseTreeNode *value)
+{
+    ParseTreeNode *node = NewNode(s->c, NodeTypeAssignmentOp);
+    node->u.binaryOp.op = OP_EQ;
+    node->u.binaryOp.left = MakeLocalRef(s, symbol);
+    node->u.binaryOp.right = value;
+    return node;
+}
+
+/* CopyNode - copy a constant or variable reference */
+static ParseTreeNode *CopyNode(OptState *s, ParseTreeNode *node)
+{
+    ParseTreeNode *copy = NewNode(s->c, node->nodeType);
+    *copy = *node;
+    return copy;
+}
+
+/* NewNode - allocate a new parse tree node */
+static ParseTreeNode *NewNode(ParseContext *c, int type)
+{
+    ParseTreeNode *node = (ParseTreeNode *)FunctionAlloc(c, sizeof(ParseTreeNode));
+    memset(node, 0, sizeof(ParseTreeNode));
+    node->nodeType = type;
+    return node;
+}
+
+/* NewListEntry - allocate a new node list entry */
+static NodeListEntry *NewListEntry(ParseContext *c, ParseTreeNode *node)
+{
+    NodeListEntry *entry = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
+    entry->node = node;
+    entry->next = NULL;
+    return entry;
+}
+
+/* NewSet - allocate an empty set */
+static SetWord *NewSet(OptState *s, int words)
+{
+    SetWord *set = (SetWord *)LocalAlloc(s->c, (words + 1) * sizeof(SetWord));
+    memset(set, 0, (words + 1) * sizeof(SetWord));
+    return set;
+}
+
+/* NewSets - allocate an array of empty sets */
+static SetWord **NewSets(OptState *s, int count, int words)
+{
+    SetWord **sets = (SetWord **)LocalAlloc(s->c, (count + 1) * sizeof(SetWord *));
+    int i;
+    for (i = 0; i < count; ++i)
+        sets[i] = NewSet(s, words);
+    return sets;
+}
+
+/* FreeSets - free an array of sets */
+static void FreeSets(SetWord **sets, int count)
+{
+    int i;
+    for (i = 0; i < count; ++i)
+        free(sets[i]);
+    free(sets);
+}
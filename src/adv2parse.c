@@ -12,17 +12,28 @@
 #include "adv2vm.h"
 #include "adv2vmdebug.h"
 
+/* NATIVE instruction waiting to be assembled with the rest of its block */
+typedef struct NativeLine NativeLine;
+struct NativeLine {
+    NativeLine *next;
+    int lineNumber;
+    int offset;                 /* code address of the instruction */
+    char text[1];               /* source text (the rest of the line) */
+};
+
 /* local function prototypes */
 static void ParseInclude(ParseContext *c);
-static void ParseDef(ParseContext *c);
+static void ParseDef(ParseContext *c, int inlineHint);
 static void ParseConstantDef(ParseContext *c, char *name);
-static void ParseFunctionDef(ParseContext *c, char *name);
+static void ParseFunctionDef(ParseContext *c, char *name, int inlineHint);
 static void ParseVar(ParseContext *c);
 static void ParseObject(ParseContext *c, char *name);
 static void ParseProperty(ParseContext *c);
 static ParseTreeNode *ParseFunction(ParseContext *c, char *name);
 static ParseTreeNode *ParseMethod(ParseContext *c, char *name);
+static ParseTreeNode *NewFunctionDef(ParseContext *c, char *name);
 static ParseTreeNode *ParseFunctionBody(ParseContext *c, ParseTreeNode *node, int offset);
+static void CompileFunction(ParseContext *c, ParseTreeNode *node, Symbol *symbol, VMVALUE method);
 static void ParseWords(ParseContext *c, int type);
 static ParseTreeNode *ParseIf(ParseContext *c);
 static ParseTreeNode *ParseWhile(ParseContext *c);
@@ -36,9 +47,12 @@ static ParseTreeNode *ParseTry(ParseContext *c);
 static ParseTreeNode *ParseThrow(ParseContext *c);
 static ParseTreeNode *ParseExprStatement(ParseContext *c);
 static ParseTreeNode *ParseEmpty(ParseContext *c);
+static void AssembleNative(ParseContext *c, NativeLine *lines, int count);
 static ParseTreeNode *ParseAsm(ParseContext *c);
 static ParseTreeNode *ParsePrint(ParseContext *c, int newline);
+static ParseTreeNode *ParseSwitch(ParseContext *c);
 static VMVALUE ParseIntegerLiteralExpr(ParseContext *c);
+static ParseTreeNode *ParseConstantExpr(ParseContext *c);
 static VMVALUE ParseConstantLiteralExpr(ParseContext *c, FixupType fixupType, VMVALUE offset);
 static ParseTreeNode *ParseExpr(ParseContext *c);
 static ParseTreeNode *ParseAssignmentExpr(ParseContext *c);
@@ -81,15 +95,27 @@ void ParseDeclarations(ParseContext *c)
 {
     char name[MAXTOKEN];
     int tkn, type;
+    int phase = BeginPhase(c, PHASE_PARSE);
     
     /* parse declarations */
-    while ((tkn = GetToken(c)) != T_EOF) {
+    for (;;) {
+        c->atDeclaration = VMTRUE;
+        tkn = GetToken(c);
+        c->atDeclaration = VMFALSE;
         switch (tkn) {
         case T_INCLUDE:
             ParseInclude(c);
             break;
         case T_DEF:
-            ParseDef(c);
+            ParseDef(c, INLINE_DEFAULT);
+            break;
+        case T_INLINE:
+            FRequire(c, T_DEF);
+            ParseDef(c, INLINE_ALWAYS);
+            break;
+        case T_NOINLINE:
+            FRequire(c, T_DEF);
+            ParseDef(c, INLINE_NEVER);
             break;
         case T_VAR:
             ParseVar(c);
@@ -108,6 +134,9 @@ void ParseDeclarations(ParseContext *c)
             ParseProperty(c);
             break;
         case T_EOF:
+            /* the program isn't complete until the code of every function is linked */
+            FinishFunctions(c);
+            EndPhase(c, phase);
             return;
         default:
             ParseError(c, "unknown declaration");
@@ -119,16 +148,40 @@ void ParseDeclarations(ParseContext *c)
 /* ParseInclude - parse the 'INCLUDE' statement */
 static void ParseInclude(ParseContext *c)
 {
-    char name[MAXTOKEN];
+    char name[FILENAME_MAX];
     FRequire(c, T_STRING);
+    if (strlen(c->token) >= sizeof(name))
+        ParseError(c, "include file name too long");
     strcpy(name, c->token);
     FRequire(c, ';');
+    
+    /* a file is only included once */
+    if (FindHashEntry(&c->includeHash, name))
+        return;
+    
+    /* use the cached module of the file if it hasn't changed */
+    if (c->useModules) {
+        uint64_t startTime = StatsTime(c);
+        int phase = BeginPhase(c, PHASE_MODULE);
+        int loaded = LoadModule(c, name);
+        EndPhase(c, phase);
+        if (loaded) {
+            AddFileStats(c, name, startTime, 0, 0, VMTRUE);
+            return;
+        }
+    }
+        
     if (!PushFile(c, name))
         ParseError(c, "include file not found: %s", name);
+    if (c->useModules) {
+        int phase = BeginPhase(c, PHASE_MODULE);
+        BeginModule(c, name);
+        EndPhase(c, phase);
+    }
 }
 
 /* ParseDef - parse the 'def' statement */
-static void ParseDef(ParseContext *c)
+static void ParseDef(ParseContext *c, int inlineHint)
 {
     char name[MAXTOKEN];
     int tkn;
@@ -138,13 +191,16 @@ static void ParseDef(ParseContext *c)
     strcpy(name, c->token);
 
     /* check for a constant definition */
-    if ((tkn = GetToken(c)) == '=')
+    if ((tkn = GetToken(c)) == '=') {
+        if (inlineHint != INLINE_DEFAULT)
+            ParseError(c, "only functions can be inline or noinline");
         ParseConstantDef(c, name);
+    }
 
     /* otherwise, assume a function definition */
     else {
         SaveToken(c, tkn);
-        ParseFunctionDef(c, name);
+        ParseFunctionDef(c, name, inlineHint);
     }
 }
 
@@ -156,29 +212,49 @@ static void ParseConstantDef(ParseContext *c, char *name)
 }
 
 /* ParseFunctionDef - parse a 'def <name> () {}' statement */
-static void ParseFunctionDef(ParseContext *c, char *name)
+static void ParseFunctionDef(ParseContext *c, char *name, int inlineHint)
 {
     ParseTreeNode *node;
-    uint8_t *code;
-    int codeLength;
+    Symbol *symbol;
     
-    /* enter the function name in the global symbol table */
-    AddGlobal(c, name, SC_FUNCTION, (VMVALUE)(c->codeFree - c->codeBuf));
+    /* enter the function name in the global symbol table (its address is known once its code is linked) */
+    symbol = AddGlobal(c, name, SC_FUNCTION, 0);
+    symbol->pending = VMTRUE;
     
     node = ParseFunction(c, name);
+    node->u.functionDef->inlineHint = inlineHint;
+    CompileFunction(c, node, symbol, 0);
+}
+
+/* CompileFunction - optimize a function or method and queue it for code generation
+ *
+ * The symbol is NULL for methods. Their address is stored in the property
+ * at the data offset 'method' once their code is linked.
+ */
+static void CompileFunction(ParseContext *c, ParseTreeNode *node, Symbol *symbol, VMVALUE method)
+{
+    int phase = BeginPhase(c, PHASE_OPTIMIZE);
+    
+    if (c->optimizeLevel >= 1)
+        InlineCalls(c, node);
+    FoldFunction(c, node);
+    if (c->optimizeLevel >= 2) {
+        OptimizeFunction(c, node);
+        FoldFunction(c, node);
+    }
     if (c->debugMode)
         PrintNode(c, node, 0);
     
-    code = code_functiondef(c, node, &codeLength);
-    if (c->debugMode)
-        DecodeFunction(c->codeBuf, code, codeLength);
+    PrepareFunction(c, node);
+    EndPhase(c, phase);
+    
+    QueueFunction(c, node, symbol, method);
 }
 
 /* StoreInitializer - store a data initializer */
 void StoreInitializer(ParseContext *c, VMVALUE value)
 {
-    if (c->dataFree + sizeof(VMVALUE) > c->dataTop)
-        ParseError(c, "insufficient data space");
+    ReserveData(c, sizeof(VMVALUE));
     *(VMVALUE *)c->dataFree = value;
     c->dataFree += sizeof(VMVALUE);
 }
@@ -187,24 +263,25 @@ void StoreInitializer(ParseContext *c, VMVALUE value)
 static void ParseAndStoreInitializer(ParseContext *c)
 {
     VMVALUE offset = c->dataFree - c->dataBuf;
-    if (c->dataFree + sizeof(VMVALUE) > c->dataTop)
-        ParseError(c, "insufficient data space");
-    *(VMVALUE *)c->dataFree = ParseConstantLiteralExpr(c, FT_DATA, offset);
-    c->dataFree += sizeof(VMVALUE);
+    StoreInitializer(c, ParseConstantLiteralExpr(c, FT_DATA, offset));
 }
 
-/* AddNestedArraySymbolRef - add a symbol reference */
+/* AddNestedArraySymbolRef - add a symbol reference
+ *
+ * References to defined symbols are remembered too so that their relocations
+ * can be recorded once the nested array is placed.
+ */
 int AddNestedArraySymbolRef(ParseContext *c, DataBlock *dataBlock, Symbol *symbol, VMVALUE offset)
 {
     SymbolDataFixup *fixup;
-    if (symbol->valueDefined)
-        return symbol->v.value;
     fixup = (SymbolDataFixup *)LocalAlloc(c, sizeof(SymbolDataFixup));
     fixup->symbol = symbol;
     fixup->offset = offset;
     fixup->next = dataBlock->symbolFixups;
     dataBlock->symbolFixups = fixup;
-    return 0;
+    if (symbol->pending)
+        FinishFunction(c, symbol);
+    return symbol->valueDefined ? symbol->v.value : 0;
 }
 
 /* AddNestedArrayStringRef - add a string reference */
@@ -221,7 +298,7 @@ void AddNestedArrayStringRef(ParseContext *c, DataBlock *dataBlock, String *stri
 /* ParseNestedArrayConstantLiteralExpr - parse a constant literal expression (including objects and functions) */
 static VMVALUE ParseNestedArrayConstantLiteralExpr(ParseContext *c, DataBlock *dataBlock, VMVALUE offset)
 {
-    ParseTreeNode *expr = ParseAssignmentExpr(c);
+    ParseTreeNode *expr = ParseConstantExpr(c);
     VMVALUE value = NIL;
     switch (expr->nodeType) {
     case NodeTypeIntegerLit:
@@ -237,12 +314,7 @@ static VMVALUE ParseNestedArrayConstantLiteralExpr(ParseContext *c, DataBlock *d
         switch (expr->u.symbolRef.symbol->storageClass) {
         case SC_OBJECT:
         case SC_FUNCTION:
-            if (expr->u.symbolRef.symbol->valueDefined)
-                value = expr->u.symbolRef.symbol->v.value;
-            else {
-                AddNestedArraySymbolRef(c, dataBlock, expr->u.symbolRef.symbol, offset);
-                value = 0;
-            }
+            value = AddNestedArraySymbolRef(c, dataBlock, expr->u.symbolRef.symbol, offset);
             break;
         default:
             ParseError(c, "expecting a constant expression, object, or function");
@@ -259,16 +331,13 @@ static VMVALUE ParseNestedArrayConstantLiteralExpr(ParseContext *c, DataBlock *d
 /* ParseAndStoreNestedArrayInitializer - parse and store a data initializer */
 static void ParseAndStoreNestedArrayInitializer(ParseContext *c, DataBlock *dataBlock, VMVALUE offset)
 {
-    if (c->dataFree + sizeof(VMVALUE) > c->dataTop)
-        ParseError(c, "insufficient data space");
-    *(VMVALUE *)c->dataFree = ParseNestedArrayConstantLiteralExpr(c, dataBlock, offset);
-    c->dataFree += sizeof(VMVALUE);
+    StoreInitializer(c, ParseNestedArrayConstantLiteralExpr(c, dataBlock, offset));
 }
 
 /* ParseNestedArray - parse a nested array */
 static void ParseNestedArray(ParseContext *c, DataBlock *parent, VMVALUE parentOffset)
 {
-    uint8_t *arrayBase = c->dataFree;
+    VMVALUE arrayBase = c->dataFree - c->dataBuf;
     DataBlock *dataBlock;
     VMVALUE size = 0;
     int tkn;
@@ -280,26 +349,26 @@ static void ParseNestedArray(ParseContext *c, DataBlock *parent, VMVALUE parentO
     
     do {
         if ((tkn = GetToken(c)) == '{') {
-            VMVALUE offset = c->dataFree - arrayBase;
+            VMVALUE offset = c->dataFree - c->dataBuf - arrayBase;
             StoreInitializer(c, 0);
             ParseNestedArray(c, dataBlock, offset);
         }
         else {
             SaveToken(c, tkn);
-            ParseAndStoreNestedArrayInitializer(c, dataBlock, c->dataFree - arrayBase);
+            ParseAndStoreNestedArrayInitializer(c, dataBlock, c->dataFree - c->dataBuf - arrayBase);
         }
         ++size;
     } while ((tkn = GetToken(c)) == ',');
     Require(c, tkn, '}');
     
     dataBlock->size = size;
-    dataBlock->data = LocalAlloc(c, c->dataFree - arrayBase);
-    memcpy(dataBlock->data, arrayBase, c->dataFree - arrayBase);
+    dataBlock->data = LocalAlloc(c, c->dataFree - c->dataBuf - arrayBase);
+    memcpy(dataBlock->data, c->dataBuf + arrayBase, c->dataFree - c->dataBuf - arrayBase);
     
     *c->pNextDataBlock = dataBlock;
     c->pNextDataBlock = &dataBlock->next;
     
-    c->dataFree = arrayBase;
+    c->dataFree = c->dataBuf + arrayBase;
 }
 
 /* PlaceNestedArrays - place nested arrays in data memory */
@@ -315,20 +384,24 @@ static void PlaceNestedArrays(ParseContext *c)
         VMVALUE sizeInBytes = block->size * sizeof(VMVALUE);
     
         /* store the array size at array[-1] */
+        AddDataItem(c, IT_DATA, (VMVALUE)(c->dataFree - c->dataBuf), NULL);
         StoreInitializer(c, block->size);
         
         /* copy the array data */
         block->offset = c->dataFree - c->dataBuf;
-        if (c->dataFree + sizeInBytes > c->dataTop)
-            ParseError(c, "insufficient data space - needed %d bytes", sizeInBytes);
+        ReserveData(c, sizeInBytes);
         memcpy(c->dataFree, block->data, sizeInBytes);
         c->dataFree += sizeInBytes;
         
         /* store the pointer to the nested array in the parent array */
-        if (block->parent)
+        if (block->parent) {
             *(VMVALUE *)(c->dataBuf + block->parent->offset + block->parentOffset) = block->offset;
-        else
+            AddReloc(c, FT_DATA, block->parent->offset + block->parentOffset, RELOC_DATA);
+        }
+        else {
             *(VMVALUE *)(c->dataBuf + block->parentOffset) = block->offset;
+            AddReloc(c, FT_DATA, block->parentOffset, RELOC_DATA);
+        }
         
         /* copy the fixups to the symbol fixup lists */
         symbolFixup = block->symbolFixups;
@@ -373,11 +446,12 @@ static void ParseVar(ParseContext *c)
     do {
         FRequire(c, T_IDENTIFIER);
         if ((tkn = GetToken(c)) == '[') {
-            VMVALUE *sizePtr;
+            VMVALUE sizeOffset;
             int declaredSize, remaining;
             VMVALUE value = 0;
             
-            sizePtr = (VMVALUE *)c->dataFree;
+            sizeOffset = c->dataFree - c->dataBuf;
+            AddDataItem(c, IT_DATA, (VMVALUE)(c->dataFree - c->dataBuf), c->token);
             StoreInitializer(c, 0);
             AddGlobal(c, c->token, SC_OBJECT, (VMVALUE)(c->dataFree - c->dataBuf));
             
@@ -429,9 +503,10 @@ static void ParseVar(ParseContext *c)
                 
             PlaceNestedArrays(c);
             
-            *sizePtr = declaredSize;
+            *(VMVALUE *)(c->dataBuf + sizeOffset) = declaredSize;
         }
         else {
+            AddDataItem(c, IT_DATA, (VMVALUE)(c->dataFree - c->dataBuf), c->token);
             AddGlobal(c, c->token, SC_VARIABLE, (VMVALUE)(c->dataFree - c->dataBuf));
             SaveToken(c, tkn);
             if ((tkn = GetToken(c)) == '=')
@@ -448,7 +523,7 @@ static void ParseVar(ParseContext *c)
 /* ParseObject - parse the 'object' statement */
 static void ParseObject(ParseContext *c, char *className)
 {
-    VMVALUE class, object;
+    VMVALUE class, object, offset, value;
     char name[MAXTOKEN], pname[MAXTOKEN];
     ParseTreeNode *node;
     ObjectHdr *objectHdr;
@@ -460,9 +535,9 @@ static void ParseObject(ParseContext *c, char *className)
     strcpy(name, c->token);
     
     /* allocate space for an object header and initialize */
-    if (c->dataFree + sizeof(ObjectHdr) > c->dataTop)
-        ParseError(c, "insufficient data space");
+    ReserveData(c, sizeof(ObjectHdr));
     object = (VMVALUE)(c->dataFree - c->dataBuf);
+    AddDataItem(c, IT_OBJECT, object, name);
     c->currentObjectSymbol = AddGlobal(c, name, SC_OBJECT, object);
     objectHdr = (ObjectHdr *)c->dataFree;
     c->dataFree += sizeof(ObjectHdr);
@@ -477,16 +552,25 @@ static void ParseObject(ParseContext *c, char *className)
         VMVALUE nProperties;
         class = FindObject(c, className);
         objectHdr->class = class;
+        
+        /* the addresses of the class methods must be known before they are copied */
+        classHdr = (ObjectHdr *)(c->dataBuf + class);
+        FinishMethods(c, class, class + sizeof(ObjectHdr) + classHdr->nProperties * sizeof(Property));
+        
+        AddReloc(c, FT_DATA, object, RELOC_DATA);
+        ReserveData(c, ((ObjectHdr *)(c->dataBuf + class))->nProperties * sizeof(Property));
+        objectHdr = (ObjectHdr *)(c->dataBuf + object);
+        property = (Property *)(objectHdr + 1);
         classHdr = (ObjectHdr *)(c->dataBuf + class);
         srcProperty = (Property *)(classHdr + 1);
         for (nProperties = classHdr->nProperties; --nProperties >= 0; ++srcProperty) {
             if (!(srcProperty->tag & P_SHARED)) {
-                if ((uint8_t *)property + sizeof(Property) > c->dataTop)
-                    ParseError(c, "insufficient data space");
+                AddReloc(c, FT_DATA, (uint8_t *)&property->value - c->dataBuf, c->dataRelocs[(uint8_t *)&srcProperty->value - c->dataBuf]);
                 *property++ = *srcProperty;
                 ++objectHdr->nProperties;
             }
         }
+        c->dataFree = (uint8_t *)property;
     }
     else {
         objectHdr->class = NIL;
@@ -509,6 +593,11 @@ static void ParseObject(ParseContext *c, char *className)
         /* check to see if the property name is one of the vocabulary words */
         wordType = FindWordType(pname);
         
+        /* make room for a new property (parsing a value may have moved data space) */
+        ReserveData(c, sizeof(Property));
+        objectHdr = (ObjectHdr *)(c->dataBuf + object);
+        property = (Property *)(objectHdr + 1) + objectHdr->nProperties;
+        
         /* find a property copied from the class */
         for (p = (Property *)(objectHdr + 1); p < property; ++p) {
             if ((p->tag & ~P_SHARED) == tag) {
@@ -518,39 +607,40 @@ static void ParseObject(ParseContext *c, char *className)
             }
         }
         
+        /* a method defined earlier for the same property must be linked before its value is replaced */
+        if (p < property)
+            FinishMethods(c, (uint8_t *)&p->value - c->dataBuf, (uint8_t *)&p->value - c->dataBuf + sizeof(VMVALUE));
+        
         /* add a new property if one wasn't found that was copied from the class */
-        if (p >= property) {
-            if ((uint8_t *)property + sizeof(Property) > c->dataTop)
-                ParseError(c, "insufficient data space");
+        else {
             p = property;
             p->tag = tag | flags;
             ++objectHdr->nProperties;
             ++property;
+            
+            /* keep nested arrays from being parsed over the properties */
+            c->dataFree = (uint8_t *)property;
         }
+        offset = (uint8_t *)&p->value - c->dataBuf;
+        AddReloc(c, FT_DATA, offset, RELOC_NONE);
         
         /* handle methods */
         if ((tkn = GetToken(c)) == T_METHOD) {
-            uint8_t *code;
-            int codeLength;
             node = ParseMethod(c, pname);
-            if (c->debugMode)
-                PrintNode(c, node, 0);
-            code = code_functiondef(c, node, &codeLength);
-            if (c->debugMode)
-                DecodeFunction(c->codeBuf, code, codeLength);
-            p->value = (VMVALUE)(code - c->codeBuf);
+            AddReloc(c, FT_DATA, offset, RELOC_CODE);
+            CompileFunction(c, node, NULL, offset);
         }
         
         /* handle values */
         else {
-            VMVALUE offset = (uint8_t *)&p->value - c->dataBuf;
             c->wordType = wordType;
             if (tkn == '{') {
                 ParseNestedArray(c, NULL, offset);
             }
             else {
                 SaveToken(c, tkn);
-                p->value = ParseConstantLiteralExpr(c, FT_DATA, offset);
+                value = ParseConstantLiteralExpr(c, FT_DATA, offset);
+                *(VMVALUE *)(c->dataBuf + offset) = value;
             }
             c->wordType = WT_NONE;
         }
@@ -558,10 +648,11 @@ static void ParseObject(ParseContext *c, char *className)
         FRequire(c, ';');
     }
     
-    PlaceNestedArrays(c);
-    
     /* move the free pointer past the new object */
-    c->dataFree = (uint8_t *)property;
+    objectHdr = (ObjectHdr *)(c->dataBuf + object);
+    c->dataFree = (uint8_t *)((Property *)(objectHdr + 1) + objectHdr->nProperties);
+    
+    PlaceNestedArrays(c);
     
     /* not in an object definition anymore */
     c->currentObjectSymbol = NULL;
@@ -581,38 +672,40 @@ static void ParseProperty(ParseContext *c)
 /* ParseFunction - parse a function definition */
 static ParseTreeNode *ParseFunction(ParseContext *c, char *name)
 {
-    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeFunctionDef);
-    
-    c->currentFunction = node;
-    node->u.functionDef.name = (char *)LocalAlloc(c, strlen(name) + 1);
-    strcpy(node->u.functionDef.name, name);
-    InitLocalSymbolTable(&node->u.functionDef.arguments);
-    InitLocalSymbolTable(&node->u.functionDef.locals);
-    c->trySymbols = NULL;
-    c->currentTryDepth = 0;
-    c->block = NULL;
-    
+    ParseTreeNode *node = NewFunctionDef(c, name);
     return ParseFunctionBody(c, node, 0);
 }
 
 /* ParseMethod - parse a method definition */
 static ParseTreeNode *ParseMethod(ParseContext *c, char *name)
+{
+    ParseTreeNode *node = NewFunctionDef(c, name);
+    
+    AddLocalSymbol(c, &node->u.functionDef->arguments, "self", 0);
+    AddLocalSymbol(c, &node->u.functionDef->arguments, "(dummy)", 1);
+    
+    return ParseFunctionBody(c, node, 2);
+}
+
+/* NewFunctionDef - start parsing a function or method */
+static ParseTreeNode *NewFunctionDef(ParseContext *c, char *name)
 {
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeFunctionDef);
+    FunctionDef *function = (FunctionDef *)FunctionAlloc(c, sizeof(FunctionDef));
+    
+    memset(function, 0, sizeof(FunctionDef));
+    function->name = (char *)FunctionAlloc(c, strlen(name) + 1);
+    strcpy(function->name, name);
+    InitLocalSymbolTable(&function->arguments);
+    InitLocalSymbolTable(&function->locals);
+    node->u.functionDef = function;
     
     c->currentFunction = node;
-    node->u.functionDef.name = (char *)LocalAlloc(c, strlen(name) + 1);
-    strcpy(node->u.functionDef.name, name);
-    InitLocalSymbolTable(&node->u.functionDef.arguments);
-    InitLocalSymbolTable(&node->u.functionDef.locals);
     c->trySymbols = NULL;
     c->currentTryDepth = 0;
     c->block = NULL;
     
-    AddLocalSymbol(c, &node->u.functionDef.arguments, "self", 0);
-    AddLocalSymbol(c, &node->u.functionDef.arguments, "(dummy)", 1);
-    
-    return ParseFunctionBody(c, node, 2);
+    return node;
 }
 
 /* ParseFunctionBody - parse a function argument list and body */
@@ -627,7 +720,7 @@ static ParseTreeNode *ParseFunctionBody(ParseContext *c, ParseTreeNode *node, in
         SaveToken(c, tkn);
         do {
             FRequire(c, T_IDENTIFIER);
-            AddLocalSymbol(c, &node->u.functionDef.arguments, c->token, offset++);
+            AddLocalSymbol(c, &node->u.functionDef->arguments, c->token, offset++);
         } while ((tkn = GetToken(c)) == ',');
     }
     Require(c, tkn, ')');
@@ -637,7 +730,7 @@ static ParseTreeNode *ParseFunctionBody(ParseContext *c, ParseTreeNode *node, in
         do {
             LocalSymbol *symbol;
             FRequire(c, T_IDENTIFIER);
-            symbol = AddLocalSymbol(c, &node->u.functionDef.locals, c->token, localOffset++);
+            symbol = AddLocalSymbol(c, &node->u.functionDef->locals, c->token, localOffset++);
             if ((tkn = GetToken(c)) == '=') {
                 symbol->initialValue = ParseAssignmentExpr(c);
             }
@@ -650,7 +743,11 @@ static ParseTreeNode *ParseFunctionBody(ParseContext *c, ParseTreeNode *node, in
     SaveToken(c, tkn);
 
     /* parse the function body */
-    node->u.functionDef.body = ParseBlock(c);
+    node->u.functionDef->body = ParseBlock(c);
+    
+    /* locals are only looked up by name while parsing */
+    FreeHashTable(&node->u.functionDef->arguments.hash);
+    FreeHashTable(&node->u.functionDef->locals.hash);
     
     /* not compiling a function anymore */
     c->currentFunction = NULL;
@@ -713,6 +810,9 @@ ParseTreeNode *ParseStatement(ParseContext *c)
     case T_PRINTLN:
         node = ParsePrint(c, tkn == T_PRINTLN);
         break;
+    case T_SWITCH:
+        node = ParseSwitch(c);
+        break;
     case '{':
         node = ParseBlock(c);
         break;
@@ -862,11 +962,11 @@ static ParseTreeNode *ParseTry(ParseContext *c)
     
     if ((tkn = GetToken(c)) == T_CATCH) {
         LocalSymbol *sym;
-        if (++c->currentTryDepth > c->currentFunction->u.functionDef.maximumTryDepth)
-            c->currentFunction->u.functionDef.maximumTryDepth = c->currentTryDepth;
+        if (++c->currentTryDepth > c->currentFunction->u.functionDef->maximumTryDepth)
+            c->currentFunction->u.functionDef->maximumTryDepth = c->currentTryDepth;
         FRequire(c, '(');
         FRequire(c, T_IDENTIFIER);
-        sym = MakeLocalSymbol(c, c->token, c->currentFunction->u.functionDef.locals.count + c->currentTryDepth - 1);
+        sym = MakeLocalSymbol(c, c->token, c->currentFunction->u.functionDef->locals.count + c->currentTryDepth - 1);
         sym->next = c->trySymbols;
         c->trySymbols = sym;
         FRequire(c, ')');
@@ -887,6 +987,58 @@ static ParseTreeNode *ParseTry(ParseContext *c)
     return node;
 }
 
+/* ParseSwitch - parse the 'switch' statement */
+static ParseTreeNode *ParseSwitch(ParseContext *c)
+{
+    ParseTreeNode *node = NewParseTreeNode(c, NodeTypeSwitch);
+    SwitchCase **pNextCase = &node->u.switchStatement.cases;
+    SwitchCase *switchCase = NULL, *other;
+    NodeListEntry **pNextStatement = NULL;
+    int tkn;
+    
+    /* parse the switch expression */
+    FRequire(c, '(');
+    node->u.switchStatement.expr = ParseExpr(c);
+    FRequire(c, ')');
+    FRequire(c, '{');
+    
+    /* parse the cases */
+    while ((tkn = GetToken(c)) != '}') {
+        switch (tkn) {
+        case T_CASE:
+        case T_DEFAULT:
+            switchCase = (SwitchCase *)FunctionAlloc(c, sizeof(SwitchCase));
+            memset(switchCase, 0, sizeof(SwitchCase));
+            if (tkn == T_CASE) {
+                switchCase->value = ParseIntegerLiteralExpr(c);
+                ++node->u.switchStatement.caseCount;
+            }
+            else
+                switchCase->isDefault = VMTRUE;
+            for (other = node->u.switchStatement.cases; other != NULL; other = other->next) {
+                if (other->isDefault && switchCase->isDefault)
+                    ParseError(c, "duplicate default case");
+                else if (!other->isDefault && !switchCase->isDefault && other->value == switchCase->value)
+                    ParseError(c, "duplicate case value %d", switchCase->value);
+            }
+            FRequire(c, ':');
+            switchCase->body = NewParseTreeNode(c, NodeTypeBlock);
+            pNextStatement = &switchCase->body->u.blockStatement.statements;
+            *pNextCase = switchCase;
+            pNextCase = &switchCase->next;
+            break;
+        default:
+            if (!switchCase)
+                ParseError(c, "expecting case or default");
+            SaveToken(c, tkn);
+            AddNodeToList(c, &pNextStatement, ParseStatement(c));
+            break;
+        }
+    }
+    
+    return node;
+}
+
 /* ParseThrow - parse the 'throw' statement */
 static ParseTreeNode *ParseThrow(ParseContext *c)
 {
@@ -915,14 +1067,20 @@ static ParseTreeNode *ParseEmpty(ParseContext *c)
 static ParseTreeNode *ParseAsm(ParseContext *c)
 {
     ParseTreeNode *node = NewParseTreeNode(c, NodeTypeAsm);
-    uint8_t *start = c->codeFree;
-    int length, tkn;
-    uint32_t value;
+    NativeLine *natives = NULL, **pNextNative = &natives, *native;
+    int start, length, nativeCount = 0, tkn;
     OTDEF *def;
     char *p;
     
     FRequire(c, '{');
     
+    /* the instructions are assembled at the end of code space so nothing can be linked there meanwhile */
+    FinishFunctions(c);
+    start = c->codeFree - c->codeBuf;
+    
+    /* hand-coded instructions are left alone by the peephole optimizer */
+    c->currentFunction->u.functionDef->hasAsm = VMTRUE;
+    
     /* parse each assembly instruction */
     while ((tkn = GetToken(c)) != '}') {
     
@@ -933,6 +1091,10 @@ static ParseTreeNode *ParseAsm(ParseContext *c)
         for (def = OpcodeTable; def->name != NULL; ++def) {
             if (strcasecmp(c->token, def->name) == 0) {
                 putcbyte(c, def->code);
+                
+                /* any property could be assigned through an address the instructions compute */
+                if (def->code == OP_PADDR || def->code == OP_STORE || def->code == OP_STOREB)
+                    c->currentFunction->u.functionDef->dynamicStores = VMTRUE;
                 switch (def->fmt) {
                 case FMT_NONE:
                     break;
@@ -947,17 +1109,28 @@ static ParseTreeNode *ParseAsm(ParseContext *c)
                     putcword(c, ParseIntegerLiteralExpr(c));
                     break;
                 case FMT_NATIVE:
-                    for (p = c->linePtr; *p != '\0' && isspace(*p); ++p)
+                    for (p = c->linePtr; *p != '\n' && isspace(*p); ++p)
                         ;
                     if (isdigit(*p))
                         putcword(c, ParseIntegerLiteralExpr(c));
                     else {
-                        if (!PasmAssemble1(c->linePtr, &value))
-                            ParseError(c, "native assembly failed");
-                        putclong(c, (VMVALUE)value);
-                        for (p = c->linePtr; *p != '\0' && *p != '\n'; ++p)
-                            ;
-                        c->linePtr = p;
+                        int len = (int)(c->lineEnd - c->linePtr);
+                        
+                        /* the rest of the line is the instruction (the source text isn't terminated) */
+                        native = (NativeLine *)FunctionAlloc(c, sizeof(NativeLine) + len);
+                        memcpy(native->text, c->linePtr, len);
+                        native->text[len] = '\0';
+                        if (c->useModules)
+                            c->tokenHash = HashData(c->tokenHash, native->text, len);
+                        
+                        /* it is assembled with the rest of the block */
+                        native->lineNumber = c->currentFile->lineNumber;
+                        native->offset = putclong(c, 0);
+                        native->next = NULL;
+                        *pNextNative = native;
+                        pNextNative = &native->next;
+                        ++nativeCount;
+                        c->linePtr = c->lineEnd - 1;
                     }
                     break;
                 default:
@@ -971,16 +1144,41 @@ static ParseTreeNode *ParseAsm(ParseContext *c)
             ParseError(c, "undefined opcode");
     }
     
+    /* assemble the native instructions together so they can refer to each other's labels */
+    if (nativeCount > 0)
+        AssembleNative(c, natives, nativeCount);
+    
     /* store the code */
-    length = c->codeFree - start;
-    node->u.asmStatement.code = LocalAlloc(c, length);
+    length = c->codeFree - c->codeBuf - start;
+    node->u.asmStatement.code = FunctionAlloc(c, length);
     node->u.asmStatement.length = length;
-    memcpy(node->u.asmStatement.code, start, length);
-    c->codeFree = start;
+    memcpy(node->u.asmStatement.code, c->codeBuf + start, length);
+    c->codeFree = c->codeBuf + start;
     
     return node;
 }
 
+/* AssembleNative - assemble the NATIVE instructions of an 'ASM {}' statement and store them */
+static void AssembleNative(ParseContext *c, NativeLine *lines, int count)
+{
+    char **text = (char **)FunctionAlloc(c, count * sizeof(char *));
+    int *lineNumbers = (int *)FunctionAlloc(c, count * sizeof(int));
+    uint32_t *values = (uint32_t *)FunctionAlloc(c, count * sizeof(uint32_t));
+    NativeLine *line;
+    int i;
+    
+    for (line = lines, i = 0; line != NULL; line = line->next, ++i) {
+        text[i] = line->text;
+        lineNumbers[i] = line->lineNumber;
+    }
+    
+    if (!PasmAssemble(c->pasm, text, lineNumbers, count, values))
+        ParseError(c, "native assembly failed");
+    
+    for (line = lines, i = 0; line != NULL; line = line->next, ++i)
+        wr_clong(c, line->offset, (VMVALUE)values[i]);
+}
+
 /* ParsePrint - handle the 'PRINT' statement */
 static ParseTreeNode *ParsePrint(ParseContext *c, int newline)
 {
@@ -994,7 +1192,7 @@ static ParseTreeNode *ParsePrint(ParseContext *c, int newline)
         do {
             switch (tkn = GetToken(c)) {
             case '#':
-                op = LocalAlloc(c, sizeof(PrintOp));
+                op = FunctionAlloc(c, sizeof(PrintOp));
                 op->trap = TRAP_PrintStr;
                 op->expr = ParseAssignmentExpr(c);
                 op->next = NULL;
@@ -1006,7 +1204,7 @@ static ParseTreeNode *ParsePrint(ParseContext *c, int newline)
                 expr = ParseAssignmentExpr(c);
                 switch (expr->nodeType) {
                 case NodeTypeStringLit:
-                    op = LocalAlloc(c, sizeof(PrintOp));
+                    op = FunctionAlloc(c, sizeof(PrintOp));
                     op->trap = TRAP_PrintStr;
                     op->expr = expr;
                     op->next = NULL;
@@ -1014,7 +1212,7 @@ static ParseTreeNode *ParsePrint(ParseContext *c, int newline)
                     pNext = &op->next;
                     break;
                 default:
-                    op = LocalAlloc(c, sizeof(PrintOp));
+                    op = FunctionAlloc(c, sizeof(PrintOp));
                     op->trap = TRAP_PrintInt;
                     op->expr = expr;
                     op->next = NULL;
@@ -1029,7 +1227,7 @@ static ParseTreeNode *ParsePrint(ParseContext *c, int newline)
     }
     
     if (newline) {
-        op = LocalAlloc(c, sizeof(PrintOp));
+        op = FunctionAlloc(c, sizeof(PrintOp));
         op->trap = TRAP_PrintNL;
         op->expr = NULL;
         op->next = NULL;
@@ -1043,17 +1241,27 @@ static ParseTreeNode *ParsePrint(ParseContext *c, int newline)
 /* ParseIntegerLiteralExpr - parse an integer literal expression */
 static VMVALUE ParseIntegerLiteralExpr(ParseContext *c)
 {
-    ParseTreeNode *expr = ParseAssignmentExpr(c);
+    ParseTreeNode *expr = ParseConstantExpr(c);
     VMVALUE value;
     if (!IsIntegerLit(expr, &value))
         ParseError(c, "expecting a constant expression");
     return value;
 }
 
+/* ParseConstantExpr - parse and fold an expression running calls to functions that are already defined */
+static ParseTreeNode *ParseConstantExpr(ParseContext *c)
+{
+    ParseTreeNode *expr = ParseAssignmentExpr(c);
+    c->evaluateCalls = VMTRUE;
+    expr = FoldExpr(c, expr);
+    c->evaluateCalls = VMFALSE;
+    return expr;
+}
+
 /* ParseConstantLiteralExpr - parse a constant literal expression (including objects and functions) */
 static VMVALUE ParseConstantLiteralExpr(ParseContext *c, FixupType fixupType, VMVALUE offset)
 {
-    ParseTreeNode *expr = ParseAssignmentExpr(c);
+    ParseTreeNode *expr = ParseConstantExpr(c);
     VMVALUE value = NIL;
     switch (expr->nodeType) {
     case NodeTypeIntegerLit:
@@ -1184,12 +1392,12 @@ static ParseTreeNode *ParseExpr1(ParseContext *c)
     if ((tkn = GetToken(c)) == T_OR) {
         ParseTreeNode *node2 = NewParseTreeNode(c, NodeTypeDisjunction);
         NodeListEntry *entry, **pLast;
-        node2->u.exprList.exprs = entry = (NodeListEntry *)LocalAlloc(c, sizeof(NodeListEntry));
+        node2->u.exprList.exprs = entry = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
         entry->node = node;
         entry->next = NULL;
         pLast = &entry->next;
         do {
-            entry = (NodeListEntry *)LocalAlloc(c, sizeof(NodeListEntry));
+            entry = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
             entry->node = ParseExpr2(c);
             entry->next = NULL;
             *pLast = entry;
@@ -1210,12 +1418,12 @@ static ParseTreeNode *ParseExpr2(ParseContext *c)
     if ((tkn = GetToken(c)) == T_AND) {
         ParseTreeNode *node2 = NewParseTreeNode(c, NodeTypeConjunction);
         NodeListEntry *entry, **pLast;
-        node2->u.exprList.exprs = entry = (NodeListEntry *)LocalAlloc(c, sizeof(NodeListEntry));
+        node2->u.exprList.exprs = entry = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
         entry->node = node;
         entry->next = NULL;
         pLast = &entry->next;
         do {
-            entry = (NodeListEntry *)LocalAlloc(c, sizeof(NodeListEntry));
+            entry = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
             entry->node = ParseExpr2(c);
             entry->next = NULL;
             *pLast = entry;
@@ -1436,19 +1644,17 @@ static ParseTreeNode *ParseExpr10(ParseContext *c)
     while ((tkn = GetToken(c)) == '*' || tkn == '/' || tkn == '%') {
         VMVALUE value, value2;
         expr2 = ParseExpr11(c);
-        if (IsIntegerLit(expr, &value) && IsIntegerLit(expr2, &value2)) {
+        
+        /* division by zero is left for FoldExpr (an error in a constant expression but not in code) */
+        if (IsIntegerLit(expr, &value) && IsIntegerLit(expr2, &value2) && (tkn == '*' || value2 != 0)) {
             switch (tkn) {
             case '*':
                 expr->u.integerLit.value = value * value2;
                 break;
             case '/':
-                if (expr2->u.integerLit.value == 0)
-                    ParseError(c, "division by zero in constant expression");
                 expr->u.integerLit.value = value / value2;
                 break;
             case '%':
-                if (value2 == 0)
-                    ParseError(c, "division by zero in constant expression");
                 expr->u.integerLit.value = value % value2;
                 break;
             default:
@@ -1591,7 +1797,7 @@ static ParseTreeNode *ParseCall(ParseContext *c, ParseTreeNode *functionNode)
         SaveToken(c, tkn);
         do {
             NodeListEntry *actual;
-            actual = (NodeListEntry *)LocalAlloc(c, sizeof(NodeListEntry));
+            actual = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
             actual->node = ParseAssignmentExpr(c);
             actual->next = NULL;
             *pLast = actual;
@@ -1637,7 +1843,7 @@ static ParseTreeNode *ParseMethodCall(ParseContext *c, ParseTreeNode *object, Pa
         node->u.methodCall.class = NewParseTreeNode(c, NodeTypeGlobalSymbolRef);
         node->u.methodCall.class->u.symbolRef.symbol = c->currentObjectSymbol;
         node->u.methodCall.object = NewParseTreeNode(c, NodeTypeArgumentRef);
-        node->u.methodCall.object->u.localSymbolRef.symbol = FindLocalSymbol(&c->currentFunction->u.functionDef.arguments, "self");
+        node->u.methodCall.object->u.localSymbolRef.symbol = FindLocalSymbol(&c->currentFunction->u.functionDef->arguments, "self");
     }
     else {
         node->u.methodCall.class = NULL;
@@ -1651,7 +1857,7 @@ static ParseTreeNode *ParseMethodCall(ParseContext *c, ParseTreeNode *object, Pa
         SaveToken(c, tkn);
         do {
             NodeListEntry *actual;
-            actual = (NodeListEntry *)LocalAlloc(c, sizeof(NodeListEntry));
+            actual = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
             actual->node = ParseAssignmentExpr(c);
             actual->next = NULL;
             *pLast = actual;
@@ -1687,6 +1893,9 @@ static ParseTreeNode *ParsePropertyRef(ParseContext *c, ParseTreeNode *object)
     }
     else if (tkn == T_BYTE) {
         FRequire(c, '[');
+        /* keep strings that are read a byte at a time uncompressed */
+        if (object->nodeType == NodeTypeStringLit)
+            object->u.stringLit.string->indexed = VMTRUE;
         node = ParseArrayReference(c, object, PVT_BYTE);
     }
     else {
@@ -1765,13 +1974,13 @@ static ParseTreeNode *GetSymbolRef(ParseContext *c, char *name)
     }
     
     /* handle local variables within a function */
-    if (c->currentFunction && (localSymbol = FindLocalSymbol(&c->currentFunction->u.functionDef.locals, name)) != NULL) {
+    if (c->currentFunction && (localSymbol = FindLocalSymbol(&c->currentFunction->u.functionDef->locals, name)) != NULL) {
         node->nodeType = NodeTypeLocalSymbolRef;
         node->u.localSymbolRef.symbol = localSymbol;
     }
 
     /* handle function arguments */
-    else if (c->currentFunction && (localSymbol = FindLocalSymbol(&c->currentFunction->u.functionDef.arguments, name)) != NULL) {
+    else if (c->currentFunction && (localSymbol = FindLocalSymbol(&c->currentFunction->u.functionDef->arguments, name)) != NULL) {
         node->nodeType = NodeTypeArgumentRef;
         node->u.localSymbolRef.symbol = localSymbol;
     }
@@ -1836,7 +2045,7 @@ static ParseTreeNode *MakeIntegerLitNode(ParseContext *c, VMVALUE value)
 /* NewParseTreeNode - allocate a new parse tree node */
 static ParseTreeNode *NewParseTreeNode(ParseContext *c, int type)
 {
-    ParseTreeNode *node = (ParseTreeNode *)LocalAlloc(c, sizeof(ParseTreeNode));
+    ParseTreeNode *node = (ParseTreeNode *)FunctionAlloc(c, sizeof(ParseTreeNode));
     memset(node, 0, sizeof(ParseTreeNode));
     node->nodeType = type;
     return node;
@@ -1845,7 +2054,7 @@ static ParseTreeNode *NewParseTreeNode(ParseContext *c, int type)
 /* AddNodeToList - add a node to a parse tree node list */
 static void AddNodeToList(ParseContext *c, NodeListEntry ***ppNextEntry, ParseTreeNode *node)
 {
-    NodeListEntry *entry = (NodeListEntry *)LocalAlloc(c, sizeof(NodeListEntry));
+    NodeListEntry *entry = (NodeListEntry *)FunctionAlloc(c, sizeof(NodeListEntry));
     entry->node = node;
     entry->next = NULL;
     **ppNextEntry = entry;
@@ -1858,6 +2067,7 @@ static void InitLocalSymbolTable(LocalSymbolTable *table)
     table->head = NULL;
     table->pTail = &table->head;
     table->count = 0;
+    InitHashTable(&table->hash);
 }
 
 /* AddLocalSymbol - add a symbol to a local symbol table */
@@ -1867,6 +2077,7 @@ static LocalSymbol *AddLocalSymbol(ParseContext *c, LocalSymbolTable *table, con
     *table->pTail = sym;
     table->pTail = &sym->next;
     ++table->count;
+    AddHashEntry(c, &table->hash, sym->name, sym);
     return sym;
 }
 
@@ -1874,7 +2085,7 @@ static LocalSymbol *AddLocalSymbol(ParseContext *c, LocalSymbolTable *table, con
 static LocalSymbol *MakeLocalSymbol(ParseContext *c, const char *name, int offset)
 {
     size_t size = sizeof(LocalSymbol) + strlen(name);
-    LocalSymbol *sym = (LocalSymbol *)LocalAlloc(c, size);
+    LocalSymbol *sym = (LocalSymbol *)FunctionAlloc(c, size);
     memset(sym, 0, sizeof(LocalSymbol));
     strcpy(sym->name, name);
     sym->offset = offset;
@@ -1884,13 +2095,7 @@ static LocalSymbol *MakeLocalSymbol(ParseContext *c, const char *name, int offse
 /* FindLocalSymbol - find a symbol in a local symbol table */
 static LocalSymbol *FindLocalSymbol(LocalSymbolTable *table, const char *name)
 {
-    LocalSymbol *sym = table->head;
-    while (sym) {
-        if (strcmp(name, sym->name) == 0)
-            return sym;
-        sym = sym->next;
-    }
-    return NULL;
+    return (LocalSymbol *)FindHashEntry(&table->hash, name);
 }
 
 /* PrintLocalSymbols - print a symbol table */
@@ -1945,7 +2150,7 @@ static void AddWord(ParseContext *c, int type, String *string)
         }
         word = word->next;
     }
-    word = (Word *)LocalAlloc(c, sizeof(Word));
+    word = (Word *)GlobalAlloc(c, sizeof(Word));
     word->type = type;
     word->string = string;
     word->next = NULL;
@@ -47,10 +47,27 @@ enum {
 /* forward types */
 typedef struct Symbol Symbol;
 
+/* hash table entry */
+typedef struct {
+    const char *name;
+    void *value;
+} HashEntry;
+
+/* hash table (open addressing with names compared without regard to case) */
+typedef struct {
+    HashEntry *entries;
+    int count;
+    int size;
+} HashTable;
+
+/* initial size of a hash table (must be a power of two) */
+#define HASHSIZE    64
+
 /* symbol table */
 typedef struct {
     Symbol *head;
     Symbol **pTail;
+    HashTable hash;
 } SymbolTable;
 
 /* symbol types */
@@ -64,14 +81,18 @@ struct Symbol {
     Symbol *next;
     SymbolType type;
     VMVALUE value;
+    int serial;                     /* definition number (later definitions have larger numbers) */
     char name[1];
 };
 
 typedef void RewindFcn(void *cookie);
 typedef int GetLineFcn(void *cookie, char *buf, int len, int *pLineNumber);
+typedef void PasmSymbolFcn(void *cookie, const char *name, uint32_t value);
 
-/* parse context */
-typedef struct {
+/* parse context (it lasts for a whole compile so symbols carry over from one block to the next) */
+typedef struct PasmContext PasmContext;
+typedef struct PasmContext ParseContext;
+struct PasmContext {
     jmp_buf errorTarget;            /* error target */
     RewindFcn *rewind;              /* scan - function to rewind to the start of the source program */
     GetLineFcn *getLine;            /* scan - function to get a line from the source program */
@@ -79,15 +100,18 @@ typedef struct {
     char lineBuf[MAXLINE];          /* scan - line buffer */
     char *linePtr;                  /* scan - pointer to the current character */
     int lineNumber;                 /* scan - current line number */
-    int savedToken;               /* scan - lookahead token */
+    int savedToken;                 /* scan - lookahead token */
     int tokenOffset;                /* scan - offset to the start of the current token */
     char token[MAXTOKEN];           /* scan - current token string */
     VMVALUE value;                  /* scan - current token integer value */
     int inComment;                  /* scan - inside of a slash/star comment */
+    HashTable opcodes;              /* opcode definitions by name */
+    HashTable fields;               /* conditional and effect definitions by name */
     SymbolTable globals;            /* global symbol table */
     SymbolTable locals;             /* local symbol table */
+    int serial;                     /* number of symbol definitions so far */
     int pass;                       /* current pass number */
-} ParseContext;
+};
 
 /* operand types */
 enum {
@@ -254,6 +278,8 @@ static FieldDef fieldDefs[] = {
 {   NULL,           0,              0,                  0               }
 };
 
+static int InitAssembler(ParseContext *c);
+static void FreeAssembler(ParseContext *c);
 static int Assemble(ParseContext *c);
 static void ParseFile(ParseContext *c, int pass);
 static VMVALUE ParseExpr(ParseContext *c);
@@ -286,12 +312,18 @@ static int BinaryNumberToken(ParseContext *c);
 static int StringToken(ParseContext *c);
 static int CharToken(ParseContext *c);
 static void ParseError(ParseContext *c, char *fmt, ...);
-static OpDef *FindOpcode(char *name);
-static FieldDef *FindField(char *name);
+static OpDef *FindOpcode(ParseContext *c, char *name);
+static FieldDef *FindField(ParseContext *c, char *name);
 static void InitSymbolTable(SymbolTable *table);
 static Symbol *AddSymbol(ParseContext *c, const char *name, SymbolType type, VMVALUE value);
 static Symbol *FindSymbol(ParseContext *c, const char *name);
 static void EmptySymbolTable(SymbolTable *table);
+static void InitHashTable(HashTable *table);
+static void *FindHashEntry(HashTable *table, const char *name);
+static void AddHashEntry(ParseContext *c, HashTable *table, const char *name, void *value);
+static void FreeHashTable(HashTable *table);
+static uint32_t HashName(const char *name);
+static void *Allocate(ParseContext *c, size_t size);
 #ifdef MAIN
 static void DumpSymbols(SymbolTable *table);
 #endif
@@ -327,6 +359,11 @@ int main(int argc, char *argv[])
     
     /* initialize the parse context */
     memset(&context, 0, sizeof(context));
+    if (!InitAssembler(&context)) {
+        fprintf(stderr, "error: insufficient memory\n");
+        fclose(sourceInfo.fp);
+        return 1;
+    }
     
     /* setup the parser callbacks */
     context.rewind = SourceRewind;
@@ -335,6 +372,7 @@ int main(int argc, char *argv[])
     
     /* assemble the file */
     Assemble(&context);
+    FreeAssembler(&context);
     
     /* close the source file */
     fclose(sourceInfo.fp);
@@ -363,68 +401,137 @@ static void putcword(ParseContext *c, VMVALUE w)
 #else
 
 typedef struct {
-    char *line;
-    int lineNumber;
-    int eof;
-    uint32_t *pValue;
+    char **lines;
+    int *lineNumbers;
+    int count;
+    int index;
+    uint32_t *values;
 } SourceInfo;
 
-int PasmAssemble1(char *line, uint32_t *pValue)
+/* PasmNewContext - make the assembler context of a compile */
+PasmContext *PasmNewContext(void)
+{
+    ParseContext *c;
+    if (!(c = (ParseContext *)malloc(sizeof(ParseContext))))
+        return NULL;
+    memset(c, 0, sizeof(ParseContext));
+    if (!InitAssembler(c)) {
+        FreeAssembler(c);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* PasmFreeContext - free an assembler context */
+void PasmFreeContext(PasmContext *c)
+{
+    FreeAssembler(c);
+    free(c);
+}
+
+/* PasmAssemble - assemble a block of lines with one instruction on each
+ *
+ * Labels count instructions from the start of the block. Global labels stay
+ * defined for the blocks that follow. A line with only a label or a comment
+ * assembles to zero.
+ */
+int PasmAssemble(PasmContext *c, char **lines, int *lineNumbers, int count, uint32_t *values)
 {
-    ParseContext context;
     SourceInfo sourceInfo;
 
     /* setup the source */
-    sourceInfo.line = line;
-    sourceInfo.lineNumber = 1;
-    sourceInfo.eof = FALSE;
-    sourceInfo.pValue = pValue;
+    sourceInfo.lines = lines;
+    sourceInfo.lineNumbers = lineNumbers;
+    sourceInfo.count = count;
+    sourceInfo.index = 0;
+    sourceInfo.values = values;
+    memset(values, 0, count * sizeof(uint32_t));
 
-    /* initialize the parse context */
-    memset(&context, 0, sizeof(context));
-    
     /* setup the parser callbacks */
-    context.rewind = SourceRewind;
-    context.getLine = SourceGetLine;
-    context.getLineCookie = &sourceInfo;
-    
-    /* assemble the line */
-    return Assemble(&context);
+    c->rewind = SourceRewind;
+    c->getLine = SourceGetLine;
+    c->getLineCookie = &sourceInfo;
+
+    /* assemble the block */
+    return Assemble(c);
+}
+
+/* PasmSerial - get the number of symbol definitions so far */
+int PasmSerial(PasmContext *c)
+{
+    return c->serial;
+}
+
+/* PasmSymbols - call a function for each global symbol defined after a given definition number
+ *
+ * The function can be NULL to just count the symbols.
+ */
+int PasmSymbols(PasmContext *c, int serial, PasmSymbolFcn *fcn, void *cookie)
+{
+    Symbol *sym;
+    int count = 0;
+    for (sym = c->globals.head; sym != NULL; sym = sym->next)
+        if (sym->type == SYMBOL_VALUE && sym->serial > serial) {
+            if (fcn)
+                (*fcn)(cookie, sym->name, (uint32_t)sym->value);
+            ++count;
+        }
+    return count;
+}
+
+/* PasmDefineSymbol - define or redefine a global symbol */
+int PasmDefineSymbol(PasmContext *c, const char *name, uint32_t value)
+{
+    if (setjmp(c->errorTarget) != 0)
+        return FALSE;
+    AddSymbol(c, name, SYMBOL_VALUE, (VMVALUE)value);
+    return TRUE;
 }
 
 static void SourceRewind(void *cookie)
 {
     SourceInfo *info = (SourceInfo *)cookie;
-    info->line = info->line;
-    info->eof = FALSE;
+    info->index = 0;
 }
 
 static int SourceGetLine(void *cookie, char *buf, int len, int *pLineNumber)
 {
     SourceInfo *info = (SourceInfo *)cookie;
-    if (info->eof)
+    if (info->index >= info->count)
         return FALSE;
-    strncpy(buf, info->line, len);
+    strncpy(buf, info->lines[info->index], len);
     buf[len - 1] = '\0';
-    *pLineNumber = info->lineNumber;
-    info->eof = TRUE;
+    *pLineNumber = info->lineNumbers[info->index++];
 	return TRUE;
 }
 
 static void putcword(ParseContext *c, VMVALUE w)
 {
     SourceInfo *info = (SourceInfo *)c->getLineCookie;
-    *info->pValue = w;
+    info->values[info->index - 1] = w;
 }
 
 #endif
 
-static int Assemble(ParseContext *c)
+/* InitAssembler - build the lookup tables and add the initial globals */
+static int InitAssembler(ParseContext *c)
 {
+    OpDef *odef;
+    FieldDef *fdef;
+
 	/* setup an error target */
     if (setjmp(c->errorTarget) != 0)
         return FALSE;
 
+    /* hash the opcodes and fields */
+    InitHashTable(&c->opcodes);
+    for (odef = opcodeDefs; odef->opname != NULL; ++odef)
+        AddHashEntry(c, &c->opcodes, odef->opname, odef);
+    InitHashTable(&c->fields);
+    for (fdef = fieldDefs; fdef->keyword != NULL; ++fdef)
+        AddHashEntry(c, &c->fields, fdef->keyword, fdef);
+
     /* initialize the symbol tables */
     InitSymbolTable(&c->globals);
     InitSymbolTable(&c->locals);
@@ -460,7 +567,26 @@ static int Assemble(ParseContext *c)
     AddSymbol(c, "phsb",        SYMBOL_VALUE, 0x1fd);
     AddSymbol(c, "vcfg",        SYMBOL_VALUE, 0x1fe);
     AddSymbol(c, "vscl",        SYMBOL_VALUE, 0x1ff);
-    
+
+    return TRUE;
+}
+
+/* FreeAssembler - free the lookup tables and symbols */
+static void FreeAssembler(ParseContext *c)
+{
+    FreeHashTable(&c->opcodes);
+    FreeHashTable(&c->fields);
+    EmptySymbolTable(&c->globals);
+    EmptySymbolTable(&c->locals);
+}
+
+/* Assemble - assemble the source in two passes */
+static int Assemble(ParseContext *c)
+{
+	/* setup an error target */
+    if (setjmp(c->errorTarget) != 0)
+        return FALSE;
+
     ParseFile(c, 1);
     (*c->rewind)(c->getLineCookie);
     ParseFile(c, 2);
@@ -478,6 +604,7 @@ static void ParseFile(ParseContext *c, int pass)
     
     /* store the pass number */
     c->pass = pass;
+    c->inComment = FALSE;
     
     /* get the next line */
     while (GetLine(c)) {
@@ -491,10 +618,10 @@ static void ParseFile(ParseContext *c, int pass)
         if ((tkn = GetIdentifier(c, "expecting a label, a conditional, or an opcode")) != T_EOL) {
         
             /* check for an opcode */
-            if (!(odef = FindOpcode(c->token))) {
+            if (!(odef = FindOpcode(c, c->token))) {
             
                 /* check for a conditional */
-                if (!(fdef = FindField(c->token))) {
+                if (!(fdef = FindField(c, c->token))) {
                 
                     /* handle a label */
                     AddSymbol(c, c->token, SYMBOL_VALUE, lc);
@@ -504,21 +631,21 @@ static void ParseFile(ParseContext *c, int pass)
                         continue;
                         
                     /* check again for an opcode */
-                    if (!(odef = FindOpcode(c->token))) {
+                    if (!(odef = FindOpcode(c, c->token))) {
                     
                         /* check for a conditional */
-                        if (!(fdef = FindField(c->token)))
+                        if (!(fdef = FindField(c, c->token)))
                             ParseError(c, "Expecting a conditional or an opcode");
                             
                         /* get an opcode */
-                        if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c->token)))
+                        if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c, c->token)))
                             ParseError(c, "Expecting an opcode");
                     }
                 }
                 
                 /* parse an opcode after a conditional */
                 else {
-                    if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c->token)))
+                    if ((tkn = GetIdentifier(c, "expecting an opcode")) == T_EOL || !(odef = FindOpcode(c, c->token)))
                         ParseError(c, "Expecting an opcode");
                 }
             }
@@ -568,7 +695,7 @@ static void ParseFile(ParseContext *c, int pass)
             
             /* parse any flag operations */
             while ((tkn = GetIdentifier(c, "expecting effects")) != T_EOL) {
-                if (!(fdef = FindField(c->token)) || fdef->type != FIELD_EFFECT)
+                if (!(fdef = FindField(c, c->token)) || fdef->type != FIELD_EFFECT)
                     ParseError(c, "expecting effects");
                 inst = (inst & ~fdef->mask) | fdef->value;
                 if ((tkn = GetToken(c)) != ',')
@@ -737,9 +864,8 @@ static VMVALUE ParsePrimary(ParseContext *c)
         expr = c->value;
         break;
     case T_IDENTIFIER:
-        if (!(sym = FindSymbol(c, c->token)))
-            sym = AddSymbol(c, c->token, SYMBOL_UNDEF, 0);
-        expr = sym->value;
+        /* symbols that aren't defined yet are zero on the first pass */
+        expr = (sym = FindSymbol(c, c->token)) != NULL ? sym->value : 0;
         break;
     default:
         ParseError(c, "Expecting a primary expression");
@@ -1211,27 +1337,15 @@ static void ParseError(ParseContext *c, char *fmt, ...)
 }
 
 /* FindOpcode - find an opcode definition */
-static OpDef *FindOpcode(char *name)
+static OpDef *FindOpcode(ParseContext *c, char *name)
 {
-    OpDef *def = opcodeDefs;
-    while (def->opname != NULL) {
-        if (strcasecmp(name, def->opname) == 0)
-            return def;
-        ++def;
-    }
-    return NULL;
+    return (OpDef *)FindHashEntry(&c->opcodes, name);
 }
 
 /* FindField - find a field definition */
-static FieldDef *FindField(char *name)
+static FieldDef *FindField(ParseContext *c, char *name)
 {
-    FieldDef *def = fieldDefs;
-    while (def->keyword != NULL) {
-        if (strcasecmp(name, def->keyword) == 0)
-            return def;
-        ++def;
-    }
-    return NULL;
+    return (FieldDef *)FindHashEntry(&c->fields, name);
 }
 
 /* InitSymbolTable - initialize an assembler symbol table */
@@ -1239,9 +1353,10 @@ static void InitSymbolTable(SymbolTable *table)
 {
     table->head = NULL;
     table->pTail = &table->head;
+    InitHashTable(&table->hash);
 }
 
-/* AddSymbol - add symbol to the assembler symbol table */
+/* AddSymbol - add a symbol to the assembler symbol table or redefine it */
 static Symbol *AddSymbol(ParseContext *c, const char *name, SymbolType type, VMVALUE value)
 {
     size_t size = sizeof(Symbol) + strlen(name);
@@ -1256,17 +1371,20 @@ static Symbol *AddSymbol(ParseContext *c, const char *name, SymbolType type, VMV
         table = &c->globals;
     }
 
-    /* allocate the symbol structure */
-    if (!(sym = (Symbol *)malloc(size)))
-        ParseError(c, "insufficient memory");
-    strcpy(sym->name, name);
+    /* allocate the symbol structure unless it is already there */
+    if (!(sym = (Symbol *)FindHashEntry(&table->hash, name))) {
+        sym = (Symbol *)Allocate(c, size);
+        strcpy(sym->name, name);
+        sym->next = NULL;
+        AddHashEntry(c, &table->hash, sym->name, sym);
+
+        /* add it to the symbol table */
+        *table->pTail = sym;
+        table->pTail = &sym->next;
+    }
     sym->type = type;
     sym->value = value;
-    sym->next = NULL;
-
-    /* add it to the symbol table */
-    *table->pTail = sym;
-    table->pTail = &sym->next;
+    sym->serial = ++c->serial;
     
     /* return the symbol */
     return sym;
@@ -1278,19 +1396,11 @@ static Symbol *FindSymbol(ParseContext *c, const char *name)
     Symbol *sym;
     
     /* check the local symbol table */
-    for (sym = c->locals.head; sym != NULL; sym = sym->next) {
-        if (strcasecmp(name, sym->name) == 0)
-            return sym;
-    }
+    if ((sym = (Symbol *)FindHashEntry(&c->locals.hash, name)) != NULL)
+        return sym;
     
     /* check the global symbol table */
-    for (sym = c->globals.head; sym != NULL; sym = sym->next) {
-        if (strcasecmp(name, sym->name) == 0)
-            return sym;
-    }
-    
-    /* not found */
-    return NULL;
+    return (Symbol *)FindHashEntry(&c->globals.hash, name);
 }
 
 /* EmptySymbolTable - empty and reinitialize a symbol table */
@@ -1301,9 +1411,89 @@ static void EmptySymbolTable(SymbolTable *table)
         next = sym->next;
         free(sym);
     }
+    FreeHashTable(&table->hash);
     InitSymbolTable(table);
 }
 
+/* InitHashTable - initialize an empty hash table */
+static void InitHashTable(HashTable *table)
+{
+    table->entries = NULL;
+    table->count = 0;
+    table->size = 0;
+}
+
+/* FindHashEntry - find the value stored under a name */
+static void *FindHashEntry(HashTable *table, const char *name)
+{
+    uint32_t mask = table->size - 1;
+    uint32_t i;
+    
+    if (table->count == 0)
+        return NULL;
+    
+    for (i = HashName(name) & mask; table->entries[i].name != NULL; i = (i + 1) & mask)
+        if (strcasecmp(table->entries[i].name, name) == 0)
+            return table->entries[i].value;
+    
+    /* not found */
+    return NULL;
+}
+
+/* AddHashEntry - store a value under a name that isn't in the table yet */
+static void AddHashEntry(ParseContext *c, HashTable *table, const char *name, void *value)
+{
+    uint32_t mask, i;
+    
+    /* keep the table no more than half full */
+    if ((table->count + 1) * 2 > table->size) {
+        HashTable old = *table;
+        table->size = old.size ? old.size * 2 : HASHSIZE;
+        table->entries = (HashEntry *)Allocate(c, table->size * sizeof(HashEntry));
+        memset(table->entries, 0, table->size * sizeof(HashEntry));
+        table->count = 0;
+        for (i = 0; i < (uint32_t)old.size; ++i)
+            if (old.entries[i].name != NULL)
+                AddHashEntry(c, table, old.entries[i].name, old.entries[i].value);
+        free(old.entries);
+    }
+    
+    /* store the value in the first free entry */
+    mask = table->size - 1;
+    for (i = HashName(name) & mask; table->entries[i].name != NULL; i = (i + 1) & mask)
+        ;
+    table->entries[i].name = name;
+    table->entries[i].value = value;
+    ++table->count;
+}
+
+/* FreeHashTable - free the entries of a hash table */
+static void FreeHashTable(HashTable *table)
+{
+    free(table->entries);
+    InitHashTable(table);
+}
+
+/* HashName - hash a name without regard to case (FNV-1a) */
+static uint32_t HashName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash ^= (uint8_t)tolower((uint8_t)*name++);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Allocate - allocate memory or report an error */
+static void *Allocate(ParseContext *c, size_t size)
+{
+    void *data;
+    if (!(data = malloc(size)))
+        ParseError(c, "insufficient memory");
+    return data;
+}
+
 #ifdef MAIN
 
 /* DumpSymbols - dump an assembler symbol table */
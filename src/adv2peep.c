@@ -0,0 +1,521 @@
+/* adv2peep.c - peephole optimizer for generated bytecode
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+#include "adv2vmdebug.h"
+
+/* decoded instruction */
+typedef struct {
+    int offset;         /* offset of the instruction in the original code */
+    int newOffset;      /* offset of the instruction in the optimized code */
+    int opcode;         /* opcode */
+    VMVALUE operand;    /* operand for byte and long formats */
+    int target;         /* index of the target instruction for branches */
+    int *targets;       /* indices of the default and case targets of a jump table */
+    int targetCount;    /* number of jump table targets */
+    int isTarget;       /* number of branches targeting this instruction */
+    int reloc;          /* relocation type of a long operand */
+    int isDeleted;      /* instruction has been removed */
+} PeepInstruction;
+
+/* peephole optimizer state */
+typedef struct {
+    ParseContext *c;
+    uint8_t *code;
+    int length;
+    PeepInstruction *insts;
+    int count;
+} PeepState;
+
+/* local function prototypes */
+static int DecodeCode(PeepState *s, int length);
+static int ApplyRules(PeepState *s);
+static int FinalTarget(PeepState *s, int target);
+static int Resolve(PeepState *s, int i);
+static int NextLive(PeepState *s, int i);
+static void CountTargets(PeepState *s);
+static void Delete(PeepState *s, int i);
+static int EncodeCode(PeepState *s);
+static void FreeInstructions(PeepState *s);
+static int IsBranch(int opcode);
+static int IsConditionalBranch(int opcode);
+static int IsUnconditionalTransfer(int opcode);
+static int SwappedOp(int opcode);
+static int InstructionLength(PeepInstruction *inst);
+
+/* OptimizeCode - remove waste from the code generated for a function
+ *
+ * Returns the new length of the code. Code that can't be decoded is left alone.
+ */
+int OptimizeCode(ParseContext *c, uint8_t *code, int length)
+{
+    PeepState state, *s = &state;
+    int newLength;
+
+    s->c = c;
+    s->code = code;
+    s->length = length;
+    s->insts = (PeepInstruction *)LocalAlloc(c, (length + 1) * sizeof(PeepInstruction));
+    s->count = 0;
+
+    /* decode the function into a list of instructions */
+    if (!DecodeCode(s, length)) {
+        FreeInstructions(s);
+        return length;
+    }
+
+    /* apply the rules until nothing changes */
+    do {
+        CountTargets(s);
+    } while (ApplyRules(s));
+
+    /* reencode the instructions */
+    newLength = EncodeCode(s);
+    c->codeFree = code + newLength;
+
+    FreeInstructions(s);
+    return newLength;
+}
+
+/* DecodeCode - decode a function into a list of instructions */
+static int DecodeCode(PeepState *s, int length)
+{
+    ParseContext *c = s->c;
+    int *index, offset, i;
+
+    /* map code offsets to instruction indices */
+    index = (int *)LocalAlloc(c, (length + 1) * sizeof(int));
+    for (i = 0; i <= length; ++i)
+        index[i] = -1;
+
+    /* decode each instruction */
+    for (offset = 0; offset < length; ) {
+        PeepInstruction *inst = &s->insts[s->count];
+        int fmt, cnt;
+        memset(inst, 0, sizeof(PeepInstruction));
+        inst->offset = offset;
+        inst->opcode = s->code[offset];
+        if ((fmt = OpcodeFormat(inst->opcode)) < 0 || fmt == FMT_NATIVE || offset + FormatLength(fmt) > length) {
+            free(index);
+            return VMFALSE;
+        }
+        switch (fmt) {
+        case FMT_BYTE:
+            inst->operand = s->code[offset + 1];
+            break;
+        case FMT_SBYTE:
+            inst->operand = (int8_t)s->code[offset + 1];
+            break;
+        case FMT_LONG:
+            for (cnt = 1; cnt <= sizeof(VMVALUE); ++cnt)
+                inst->operand = (inst->operand << 8) | s->code[offset + cnt];
+            inst->reloc = c->codeRelocs[s->code - c->codeBuf + offset + 1];
+            break;
+        case FMT_BR:
+            inst->operand = (VMWORD)((s->code[offset + 1] << 8) | s->code[offset + 2]);
+            break;
+        case FMT_JUMPTABLE:
+            for (cnt = 1; cnt <= sizeof(VMVALUE); ++cnt)
+                inst->operand = (inst->operand << 8) | s->code[offset + cnt];
+            inst->targetCount = ((s->code[offset + cnt] << 8) | s->code[offset + cnt + 1]) + 1;
+            inst->targets = (int *)LocalAlloc(c, inst->targetCount * sizeof(int));
+            break;
+        }
+        index[offset] = s->count++;
+        if (offset + InstructionLength(inst) > length) {
+            free(index);
+            return VMFALSE;
+        }
+        offset += InstructionLength(inst);
+    }
+
+    /* find the target of each branch */
+    for (i = 0; i < s->count; ++i) {
+        PeepInstruction *inst = &s->insts[i];
+        if (IsBranch(inst->opcode)) {
+            offset = inst->offset + 1 + sizeof(VMWORD) + inst->operand;
+            if (offset < 0 || offset >= length || index[offset] < 0) {
+                free(index);
+                return VMFALSE;
+            }
+            inst->target = index[offset];
+        }
+        else if (inst->opcode == OP_JUMPTABLE) {
+            uint8_t *p = s->code + inst->offset + FormatLength(FMT_JUMPTABLE);
+            int j;
+            for (j = 0; j < inst->targetCount; ++j, p += sizeof(VMWORD)) {
+                offset = (p - s->code) + sizeof(VMWORD) + (VMWORD)((p[0] << 8) | p[1]);
+                if (offset < 0 || offset >= length || index[offset] < 0) {
+                    free(index);
+                    return VMFALSE;
+                }
+                inst->targets[j] = index[offset];
+            }
+        }
+    }
+
+    free(index);
+    return VMTRUE;
+}
+
+/* ApplyRules - make one pass over the instructions applying the peephole rules */
+static int ApplyRules(PeepState *s)
+{
+    int changed = VMFALSE;
+    int i, next, target;
+
+    for (i = NextLive(s, -1); i < s->count; i = NextLive(s, i)) {
+        PeepInstruction *inst = &s->insts[i];
+        next = NextLive(s, i);
+
+        /* jump table entries that point to branches go straight to the final target */
+        if (inst->opcode == OP_JUMPTABLE) {
+            int j;
+            for (j = 0; j < inst->targetCount; ++j) {
+                if ((target = FinalTarget(s, inst->targets[j])) != inst->targets[j]) {
+                    inst->targets[j] = target;
+                    changed = VMTRUE;
+                }
+            }
+        }
+
+        if (IsBranch(inst->opcode) && inst->opcode != OP_TRY) {
+
+            /* branches to branches go straight to the final target */
+            target = FinalTarget(s, inst->target);
+            if (target != inst->target) {
+                inst->target = target;
+                changed = VMTRUE;
+            }
+
+            /* a branch to a return is the return itself */
+            if (inst->opcode == OP_BR && target < s->count
+            &&  (s->insts[target].opcode == OP_RETURN || s->insts[target].opcode == OP_RETURNZ)) {
+                inst->opcode = s->insts[target].opcode;
+                changed = VMTRUE;
+            }
+
+            /* branches to the next instruction */
+            else if (target == next) {
+                if (inst->opcode == OP_BR) {
+                    Delete(s, i);
+                    changed = VMTRUE;
+                    continue;
+                }
+                else if (inst->opcode == OP_BRT || inst->opcode == OP_BRF) {
+                    inst->opcode = OP_DROP;
+                    changed = VMTRUE;
+                }
+            }
+
+            /* a conditional branch around an unconditional branch is an inverted branch */
+            else if ((inst->opcode == OP_BRT || inst->opcode == OP_BRF)
+                 &&  next < s->count && s->insts[next].opcode == OP_BR && !s->insts[next].isTarget
+                 &&  target == NextLive(s, next)) {
+                inst->opcode = (inst->opcode == OP_BRT ? OP_BRF : OP_BRT);
+                inst->target = s->insts[next].target;
+                Delete(s, next);
+                changed = VMTRUE;
+                continue;
+            }
+        }
+
+        if (next >= s->count)
+            break;
+
+        /* instructions following an unconditional transfer can't be reached */
+        if (IsUnconditionalTransfer(inst->opcode) && !s->insts[next].isTarget) {
+            Delete(s, next);
+            changed = VMTRUE;
+            continue;
+        }
+
+        /* the remaining rules combine an instruction with the next one */
+        if (s->insts[next].isTarget)
+            continue;
+
+        switch (inst->opcode) {
+        case OP_LIT:
+        case OP_SLIT:
+        case OP_LADDR:
+        case OP_DUP:
+            /* a value pushed only to be dropped */
+            if (s->insts[next].opcode == OP_DROP) {
+                Delete(s, i);
+                Delete(s, next);
+                changed = VMTRUE;
+            }
+
+            /* returning zero */
+            else if (inst->opcode == OP_SLIT && inst->operand == 0 && s->insts[next].opcode == OP_RETURN) {
+                Delete(s, i);
+                s->insts[next].opcode = OP_RETURNZ;
+                changed = VMTRUE;
+            }
+            break;
+        case OP_NOT:
+            /* branch on the opposite condition instead of negating the value */
+            if (IsConditionalBranch(s->insts[next].opcode) && s->insts[next].opcode != OP_BRTSC && s->insts[next].opcode != OP_BRFSC) {
+                s->insts[next].opcode = (s->insts[next].opcode == OP_BRT ? OP_BRF : OP_BRT);
+                Delete(s, i);
+                changed = VMTRUE;
+            }
+            break;
+        case OP_SWAP:
+            /* commutative operators don't care about operand order */
+            if (SwappedOp(s->insts[next].opcode) >= 0) {
+                s->insts[next].opcode = SwappedOp(s->insts[next].opcode);
+                Delete(s, i);
+                changed = VMTRUE;
+            }
+            break;
+        }
+    }
+
+    return changed;
+}
+
+/* FinalTarget - follow a chain of unconditional branches to its final target */
+static int FinalTarget(PeepState *s, int target)
+{
+    int limit;
+    target = Resolve(s, target);
+    for (limit = s->count; --limit >= 0 && target < s->count && s->insts[target].opcode == OP_BR; ) {
+        int final = Resolve(s, s->insts[target].target);
+        if (final == target)
+            break;
+        target = final;
+    }
+    return target;
+}
+
+/* Resolve - find the first live instruction at or after an instruction */
+static int Resolve(PeepState *s, int i)
+{
+    while (i < s->count && s->insts[i].isDeleted)
+        ++i;
+    return i;
+}
+
+/* NextLive - find the next live instruction after an instruction */
+static int NextLive(PeepState *s, int i)
+{
+    return Resolve(s, i + 1);
+}
+
+/* CountTargets - count the live branches to each instruction */
+static void CountTargets(PeepState *s)
+{
+    int i;
+    for (i = 0; i < s->count; ++i)
+        s->insts[i].isTarget = 0;
+    for (i = 0; i < s->count; ++i) {
+        PeepInstruction *inst = &s->insts[i];
+        if (!inst->isDeleted && IsBranch(inst->opcode)) {
+            inst->target = Resolve(s, inst->target);
+            if (inst->target < s->count)
+                ++s->insts[inst->target].isTarget;
+        }
+        else if (!inst->isDeleted && inst->opcode == OP_JUMPTABLE) {
+            int j;
+            for (j = 0; j < inst->targetCount; ++j) {
+                inst->targets[j] = Resolve(s, inst->targets[j]);
+                if (inst->targets[j] < s->count)
+                    ++s->insts[inst->targets[j]].isTarget;
+            }
+        }
+    }
+}
+
+/* Delete - remove an instruction */
+static void Delete(PeepState *s, int i)
+{
+    int next;
+    s->insts[i].isDeleted = VMTRUE;
+    
+    /* branches to a deleted instruction now go to the next one */
+    if (s->insts[i].isTarget && (next = NextLive(s, i)) < s->count)
+        s->insts[next].isTarget += s->insts[i].isTarget;
+}
+
+/* EncodeCode - write the optimized instructions back into the code buffer */
+static int EncodeCode(PeepState *s)
+{
+    uint8_t *relocs;
+    int offset, i, cnt;
+
+    /* assign the new offsets (the extra entry marks the end of the code) */
+    for (offset = 0, i = 0; i < s->count; ++i) {
+        PeepInstruction *inst = &s->insts[i];
+        inst->newOffset = offset;
+        if (!inst->isDeleted)
+            offset += InstructionLength(inst);
+    }
+    s->insts[s->count].newOffset = offset;
+    
+    /* the relocations move with their instructions */
+    relocs = s->c->codeRelocs + (s->code - s->c->codeBuf);
+    memset(relocs, RELOC_NONE, s->length);
+
+    /* write the instructions */
+    for (i = 0; i < s->count; ++i) {
+        PeepInstruction *inst = &s->insts[i];
+        uint8_t *p = s->code + inst->newOffset;
+        VMVALUE value;
+        if (inst->isDeleted)
+            continue;
+        *p++ = inst->opcode;
+        switch (OpcodeFormat(inst->opcode)) {
+        case FMT_BYTE:
+        case FMT_SBYTE:
+            *p++ = inst->operand;
+            break;
+        case FMT_LONG:
+            for (value = inst->operand, cnt = sizeof(VMVALUE); --cnt >= 0; value >>= 8)
+                p[cnt] = value;
+            relocs[inst->newOffset + 1] = inst->reloc;
+            break;
+        case FMT_BR:
+            value = s->insts[Resolve(s, inst->target)].newOffset - (inst->newOffset + 1 + sizeof(VMWORD));
+            p[0] = value >> 8;
+            p[1] = value;
+            break;
+        case FMT_JUMPTABLE:
+            for (value = inst->operand, cnt = sizeof(VMVALUE); --cnt >= 0; value >>= 8)
+                p[cnt] = value;
+            p += sizeof(VMVALUE);
+            *p++ = (inst->targetCount - 1) >> 8;
+            *p++ = inst->targetCount - 1;
+            for (cnt = 0; cnt < inst->targetCount; ++cnt, p += sizeof(VMWORD)) {
+                value = s->insts[Resolve(s, inst->targets[cnt])].newOffset - (p + sizeof(VMWORD) - s->code);
+                p[0] = value >> 8;
+                p[1] = value;
+            }
+            break;
+        }
+    }
+
+    return offset;
+}
+
+/* FreeInstructions - free the decoded instructions */
+static void FreeInstructions(PeepState *s)
+{
+    int i;
+    for (i = 0; i < s->count; ++i)
+        free(s->insts[i].targets);
+    free(s->insts);
+}
+
+/* IsBranch - check for an instruction with a branch offset */
+static int IsBranch(int opcode)
+{
+    return OpcodeFormat(opcode) == FMT_BR;
+}
+
+/* IsConditionalBranch - check for a conditional branch */
+static int IsConditionalBranch(int opcode)
+{
+    switch (opcode) {
+    case OP_BRT:
+    case OP_BRTSC:
+    case OP_BRF:
+    case OP_BRFSC:
+        return VMTRUE;
+    default:
+        return VMFALSE;
+    }
+}
+
+/* IsUnconditionalTransfer - check for an instruction that never continues with the next one */
+static int IsUnconditionalTransfer(int opcode)
+{
+    switch (opcode) {
+    case OP_BR:
+    case OP_RETURN:
+    case OP_RETURNZ:
+    case OP_THROW:
+    case OP_JUMPTABLE:
+        return VMTRUE;
+    default:
+        return VMFALSE;
+    }
+}
+
+/* SwappedOp - get the operator that gives the same result with its operands swapped */
+static int SwappedOp(int opcode)
+{
+    switch (opcode) {
+    case OP_ADD:
+    case OP_MUL:
+    case OP_BAND:
+    case OP_BOR:
+    case OP_BXOR:
+    case OP_EQ:
+    case OP_NE:
+        return opcode;
+    case OP_LT:
+        return OP_GT;
+    case OP_LE:
+        return OP_GE;
+    case OP_GE:
+        return OP_LE;
+    case OP_GT:
+        return OP_LT;
+    default:
+        return -1;
+    }
+}
+
+/* OpcodeFormat - get the operand format of an opcode */
+int OpcodeFormat(int opcode)
+{
+    static int formats[256];
+    static int initialized = VMFALSE;
+    if (!initialized) {
+        OTDEF *def;
+        int i;
+        for (i = 0; i < 256; ++i)
+            formats[i] = -1;
+        for (def = OpcodeTable; def->name != NULL; ++def)
+            formats[def->code] = def->fmt;
+        initialized = VMTRUE;
+    }
+    return formats[opcode & 0xff];
+}
+
+/* FormatLength - get the length of an instruction with a given operand format */
+int FormatLength(int fmt)
+{
+    switch (fmt) {
+    case FMT_BYTE:
+    case FMT_SBYTE:
+    case FMT_SBR:
+        return 2;
+    case FMT_WORD:
+        return 1 + sizeof(VMWORD);
+    case FMT_LONG:
+    case FMT_NATIVE:
+        return 1 + sizeof(VMVALUE);
+    case FMT_BR:
+        return 1 + sizeof(VMWORD);
+    case FMT_JUMPTABLE:
+        return 1 + sizeof(VMVALUE) + sizeof(VMWORD);
+    default:
+        return 1;
+    }
+}
+
+/* InstructionLength - get the length of a decoded instruction */
+static int InstructionLength(PeepInstruction *inst)
+{
+    int fmt = OpcodeFormat(inst->opcode);
+    if (fmt == FMT_JUMPTABLE)
+        return FormatLength(fmt) + inst->targetCount * sizeof(VMWORD);
+    return FormatLength(fmt);
+}
@@ -0,0 +1,320 @@
+/* adv2pgo.c - arrange code and data using a profile collected by adv2int
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+#include "adv2vm.h"
+
+/* number of times a property was found in an object */
+typedef struct {
+    VMVALUE object;
+    VMVALUE tag;
+    VMUVALUE count;
+} PropertyCount;
+
+/* something being sorted by its count */
+typedef struct {
+    int index;
+    VMUVALUE count;
+} Ranking;
+
+/* profile state */
+typedef struct {
+    ParseContext *c;
+    int codeSize;
+    int dataSize;
+    VMUVALUE *calls;            /* calls to each code offset */
+    uint8_t *mostlyTaken;       /* branches at each code offset that are usually taken */
+    PropertyCount *properties;  /* property counts sorted by object and tag */
+    int propertyCount;
+    int propertyMax;
+    int sendCount;              /* send sites with receiver classes (not used yet) */
+    int hotFunctions;
+    int hotObjects;
+    int reorderedObjects;
+} ProfileState;
+
+/* local function prototypes */
+static int ReadProfile(ProfileState *s, const char *name);
+static void AddPropertyCount(ProfileState *s, VMVALUE object, VMVALUE tag, VMUVALUE count);
+static VMUVALUE FindPropertyCount(ProfileState *s, VMVALUE object, VMVALUE tag);
+static void ArrangeData(ProfileState *s);
+static VMUVALUE ArrangeProperties(ProfileState *s, VMVALUE object, int *map);
+static void ArrangeObjects(ProfileState *s, int first, int end, Ranking *ranks, int *map);
+static int ArrangeCode(ProfileState *s, int shorten);
+static int CompareProperties(const void *p1, const void *p2);
+static int CompareRankings(const void *p1, const void *p2);
+
+/* ApplyProfile - arrange code and data to match a training run
+ *
+ * The profile is written by adv2int -p when running the image built from the
+ * same program with the same options but without a profile. Its offsets refer
+ * to that image so a profile that doesn't match the code is ignored. The
+ * properties of each object are put in order of use for the linear search
+ * made by GetPropertyAddr and the objects that are used the most are moved
+ * together. The functions that are called are moved to the start of code space
+ * with the most frequently called first and branches that are usually taken
+ * are inverted. Short branch forms are only used if shorten is true.
+ */
+void ApplyProfile(ParseContext *c, const char *name, int shorten)
+{
+    ProfileState state, *s = &state;
+    int inverted;
+
+    memset(s, 0, sizeof(ProfileState));
+    s->c = c;
+    s->codeSize = c->codeFree - c->codeBuf;
+    s->dataSize = c->dataFree - c->dataBuf;
+    s->calls = (VMUVALUE *)LocalAlloc(c, (s->codeSize + 1) * sizeof(VMUVALUE));
+    memset(s->calls, 0, (s->codeSize + 1) * sizeof(VMUVALUE));
+    s->mostlyTaken = (uint8_t *)LocalAlloc(c, s->codeSize + 1);
+    memset(s->mostlyTaken, 0, s->codeSize + 1);
+
+    if (ReadProfile(s, name)) {
+        ArrangeData(s);
+        inverted = ArrangeCode(s, shorten);
+        printf("pgo: %d hot functions, %d branches inverted, %d hot objects, %d objects with reordered properties\n",
+               s->hotFunctions, inverted, s->hotObjects, s->reorderedObjects);
+    }
+
+    free(s->calls);
+    free(s->mostlyTaken);
+    free(s->properties);
+}
+
+/* ReadProfile - read the counts from a profile file */
+static int ReadProfile(ProfileState *s, const char *name)
+{
+    ParseContext *c = s->c;
+    int codeSize, dataSize, offset, object, tag;
+    unsigned int checksum, count, notTaken;
+    char line[100];
+    FILE *fp;
+
+    if (!(fp = fopen(name, "r")))
+        ParseError(c, "can't open profile '%s'", name);
+
+    /* make sure the profile was collected from this code */
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, "adv2 profile\n") != 0
+    ||  !fgets(line, sizeof(line), fp) || sscanf(line, "image %d %d %u", &codeSize, &dataSize, &checksum) != 3) {
+        printf("warning: '%s' is not a profile, ignoring it\n", name);
+        fclose(fp);
+        return VMFALSE;
+    }
+    if (codeSize != s->codeSize || dataSize != s->dataSize || checksum != ProfileChecksum(c->codeBuf, codeSize)) {
+        printf("warning: profile '%s' doesn't match this program, ignoring it\n", name);
+        fclose(fp);
+        return VMFALSE;
+    }
+
+    /* read the counts */
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "call %d %u", &offset, &count) == 2) {
+            if (offset >= 0 && offset < codeSize)
+                s->calls[offset] += count;
+        }
+        else if (sscanf(line, "branch %d %u %u", &offset, &count, &notTaken) == 3) {
+            if (offset >= 0 && offset < codeSize)
+                s->mostlyTaken[offset] = count > notTaken;
+        }
+        else if (sscanf(line, "property %d %d %u", &object, &tag, &count) == 3)
+            AddPropertyCount(s, object, tag, count);
+        else if (sscanf(line, "send %d %d %u", &offset, &object, &count) == 3)
+            ++s->sendCount;
+    }
+    fclose(fp);
+
+    /* sort the property counts for searching */
+    if (s->propertyCount > 0)
+        qsort(s->properties, s->propertyCount, sizeof(PropertyCount), CompareProperties);
+
+    return VMTRUE;
+}
+
+/* AddPropertyCount - add a property count from the profile */
+static void AddPropertyCount(ProfileState *s, VMVALUE object, VMVALUE tag, VMUVALUE count)
+{
+    PropertyCount *property;
+    if (s->propertyCount >= s->propertyMax) {
+        s->propertyMax = s->propertyMax ? s->propertyMax * 2 : 64;
+        if (!(s->properties = (PropertyCount *)realloc(s->properties, s->propertyMax * sizeof(PropertyCount))))
+            Abort(s->c, "insufficient memory");
+    }
+    property = &s->properties[s->propertyCount++];
+    property->object = object;
+    property->tag = tag;
+    property->count = count;
+}
+
+/* FindPropertyCount - find the number of times a property was found in an object */
+static VMUVALUE FindPropertyCount(ProfileState *s, VMVALUE object, VMVALUE tag)
+{
+    PropertyCount key, *property;
+    if (s->propertyCount == 0)
+        return 0;
+    key.object = object;
+    key.tag = tag;
+    property = (PropertyCount *)bsearch(&key, s->properties, s->propertyCount, sizeof(PropertyCount), CompareProperties);
+    return property ? property->count : 0;
+}
+
+/* ArrangeData - put the properties and objects that are used the most first */
+static void ArrangeData(ProfileState *s)
+{
+    ParseContext *c = s->c;
+    Ranking *ranks;
+    int *map, first, end, i;
+
+    map = (int *)LocalAlloc(c, (s->dataSize + 1) * sizeof(int));
+    for (i = 0; i < s->dataSize; ++i)
+        map[i] = i;
+
+    /* order the properties of each object */
+    ranks = (Ranking *)LocalAlloc(c, (c->dataItemCount + 1) * sizeof(Ranking));
+    for (i = 0; i < c->dataItemCount; ++i) {
+        ranks[i].index = i;
+        ranks[i].count = 0;
+        if (c->dataItems[i].type == IT_OBJECT)
+            ranks[i].count = ArrangeProperties(s, c->dataItems[i].offset, map);
+    }
+
+    /* order the objects within each run of adjacent objects */
+    for (first = 0; first < c->dataItemCount; first = end) {
+        for (end = first; end < c->dataItemCount && c->dataItems[end].type == IT_OBJECT; ++end)
+            ;
+        if (end > first)
+            ArrangeObjects(s, first, end, ranks, map);
+        else
+            ++end;
+    }
+
+    RelocateImage(c, NULL, map);
+    free(ranks);
+    free(map);
+}
+
+/* ArrangeProperties - order the properties of an object by use and return the total use */
+static VMUVALUE ArrangeProperties(ProfileState *s, VMVALUE object, int *map)
+{
+    ParseContext *c = s->c;
+    ObjectHdr *objectHdr = (ObjectHdr *)(c->dataBuf + object);
+    Property *property = (Property *)(objectHdr + 1);
+    int nProperties = objectHdr->nProperties, i, j;
+    VMUVALUE total = 0;
+    Ranking *ranks;
+
+    if (nProperties <= 0)
+        return 0;
+
+    ranks = (Ranking *)LocalAlloc(c, nProperties * sizeof(Ranking));
+    for (i = 0; i < nProperties; ++i) {
+        ranks[i].index = i;
+        ranks[i].count = FindPropertyCount(s, object, property[i].tag & ~P_SHARED);
+        total += ranks[i].count;
+    }
+    qsort(ranks, nProperties, sizeof(Ranking), CompareRankings);
+
+    /* move each property to its new slot */
+    for (i = 0; i < nProperties; ++i) {
+        int from = (uint8_t *)&property[ranks[i].index] - c->dataBuf;
+        int to = (uint8_t *)&property[i] - c->dataBuf;
+        for (j = 0; j < sizeof(Property); ++j)
+            map[from + j] = to + j;
+    }
+    for (i = 0; i < nProperties && ranks[i].index == i; ++i)
+        ;
+    if (i < nProperties)
+        ++s->reorderedObjects;
+
+    free(ranks);
+    return total;
+}
+
+/* ArrangeObjects - move the objects used the most to the start of a run of objects
+ *
+ * Runs ending beyond 64k are left alone so addresses in short literals still fit.
+ */
+static void ArrangeObjects(ProfileState *s, int first, int end, Ranking *ranks, int *map)
+{
+    ImageItem *items = s->c->dataItems;
+    int runEnd = end < s->c->dataItemCount ? items[end].offset : s->dataSize;
+    int offset, i, j;
+
+    if (runEnd > 0xffff)
+        return;
+
+    qsort(&ranks[first], end - first, sizeof(Ranking), CompareRankings);
+
+    /* move each object to its new place keeping the order of its properties */
+    offset = items[first].offset;
+    for (i = first; i < end; ++i) {
+        int n = ranks[i].index;
+        int start = items[n].offset;
+        int size = (n + 1 < s->c->dataItemCount ? items[n + 1].offset : s->dataSize) - start;
+        for (j = start; j < start + size; ++j)
+            map[j] += offset - start;
+        offset += size;
+        if (ranks[i].count > 0)
+            ++s->hotObjects;
+    }
+}
+
+/* ArrangeCode - move the functions that are called the most to the start of code space */
+static int ArrangeCode(ProfileState *s, int shorten)
+{
+    ParseContext *c = s->c;
+    Ranking *ranks;
+    int *order, count, inverted, i;
+
+    ranks = (Ranking *)LocalAlloc(c, (c->codeItemCount + 1) * sizeof(Ranking));
+    order = (int *)LocalAlloc(c, (c->codeItemCount + 1) * sizeof(int));
+
+    /* the code at offset zero stays first */
+    for (i = 0; i < c->codeItemCount; ++i) {
+        ranks[i].index = i;
+        ranks[i].count = c->codeItems[i].offset == 0 ? 0 : s->calls[c->codeItems[i].offset];
+    }
+    qsort(ranks, c->codeItemCount, sizeof(Ranking), CompareRankings);
+
+    /* the functions that weren't called keep their order */
+    count = 0;
+    order[count++] = 0;
+    for (i = 0; i < c->codeItemCount && ranks[i].count > 0; ++i) {
+        order[count++] = ranks[i].index;
+        ++s->hotFunctions;
+    }
+    for (i = 1; i < c->codeItemCount; ++i) {
+        if (s->calls[c->codeItems[i].offset] == 0)
+            order[count++] = i;
+    }
+
+    inverted = ReorderCode(c, order, s->mostlyTaken, shorten);
+
+    free(ranks);
+    free(order);
+    return inverted;
+}
+
+/* CompareProperties - compare property counts by object and tag */
+static int CompareProperties(const void *p1, const void *p2)
+{
+    const PropertyCount *property1 = (const PropertyCount *)p1;
+    const PropertyCount *property2 = (const PropertyCount *)p2;
+    if (property1->object != property2->object)
+        return property1->object < property2->object ? -1 : 1;
+    return property1->tag < property2->tag ? -1 : property1->tag > property2->tag;
+}
+
+/* CompareRankings - compare rankings by count (highest first) keeping ties in their original order */
+static int CompareRankings(const void *p1, const void *p2)
+{
+    const Ranking *rank1 = (const Ranking *)p1;
+    const Ranking *rank2 = (const Ranking *)p2;
+    if (rank1->count != rank2->count)
+        return rank1->count > rank2->count ? -1 : 1;
+    return rank1->index < rank2->index ? -1 : rank1->index > rank2->index;
+}
@@ -0,0 +1,212 @@
+/* adv2prof.c - execution profile collected by the interpreter
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "adv2vm.h"
+
+/* profile entry types for counts that are kept in the hash table */
+#define PE_PROPERTY     1   /* property tag found in an object */
+#define PE_SEND         2   /* receiver class seen at a send site */
+
+/* hash table entry */
+typedef struct {
+    int type;
+    VMVALUE key1;
+    VMVALUE key2;
+    VMUVALUE count;
+} ProfileEntry;
+
+/* profile structure */
+struct Profile {
+    VMUVALUE checksum;      /* checksum of the code the profile was collected from */
+    int codeSize;
+    int dataSize;
+    VMUVALUE *calls;        /* calls to each code offset */
+    VMUVALUE *taken;        /* times the branch at each code offset was taken */
+    VMUVALUE *notTaken;     /* times the branch at each code offset wasn't taken */
+    ProfileEntry *entries;  /* property and send counts */
+    int entryCount;
+    int entryMax;           /* always a power of two */
+};
+
+/* local function prototypes */
+static void CountEntry(Profile *profile, int type, VMVALUE key1, VMVALUE key2);
+static void GrowEntries(Profile *profile);
+static VMUVALUE HashEntry(int type, VMVALUE key1, VMVALUE key2);
+static void *ProfileAlloc(size_t size);
+
+/* NewProfile - create an empty profile for an image */
+Profile *NewProfile(ImageHdr *image)
+{
+    Profile *profile = (Profile *)ProfileAlloc(sizeof(Profile));
+    int codeSize = image->codeSize;
+    profile->checksum = ProfileChecksum((uint8_t *)image + image->codeOffset, codeSize);
+    profile->codeSize = codeSize;
+    profile->dataSize = image->dataSize;
+    profile->calls = (VMUVALUE *)ProfileAlloc((codeSize + 1) * sizeof(VMUVALUE));
+    profile->taken = (VMUVALUE *)ProfileAlloc((codeSize + 1) * sizeof(VMUVALUE));
+    profile->notTaken = (VMUVALUE *)ProfileAlloc((codeSize + 1) * sizeof(VMUVALUE));
+    profile->entryMax = 256;
+    profile->entries = (ProfileEntry *)ProfileAlloc(profile->entryMax * sizeof(ProfileEntry));
+    return profile;
+}
+
+/* FreeProfile - free a profile */
+void FreeProfile(Profile *profile)
+{
+    free(profile->calls);
+    free(profile->taken);
+    free(profile->notTaken);
+    free(profile->entries);
+    free(profile);
+}
+
+/* ProfileCall - count a call to a function or method */
+void ProfileCall(Profile *profile, VMVALUE target)
+{
+    if (target >= 0 && target < profile->codeSize)
+        ++profile->calls[target];
+}
+
+/* ProfileBranch - count a conditional branch being taken or not */
+void ProfileBranch(Profile *profile, VMVALUE site, int taken)
+{
+    if (site >= 0 && site < profile->codeSize) {
+        if (taken)
+            ++profile->taken[site];
+        else
+            ++profile->notTaken[site];
+    }
+}
+
+/* ProfileProperty - count a property found in an object */
+void ProfileProperty(Profile *profile, VMVALUE object, VMVALUE tag)
+{
+    CountEntry(profile, PE_PROPERTY, object, tag);
+}
+
+/* ProfileSend - count the class of the receiver of a send */
+void ProfileSend(Profile *profile, VMVALUE site, VMVALUE class)
+{
+    CountEntry(profile, PE_SEND, site, class);
+}
+
+/* WriteProfile - write a profile as text
+ *
+ * The offsets are those of the image the profile was collected from so it can
+ * only be used to compile the same program with the same options.
+ */
+int WriteProfile(Profile *profile, const char *name)
+{
+    FILE *fp;
+    int i;
+
+    if (!(fp = fopen(name, "w")))
+        return VMFALSE;
+
+    fprintf(fp, "adv2 profile\n");
+    fprintf(fp, "image %d %d %u\n", profile->codeSize, profile->dataSize, (unsigned)profile->checksum);
+    for (i = 0; i < profile->codeSize; ++i) {
+        if (profile->calls[i])
+            fprintf(fp, "call %d %u\n", i, (unsigned)profile->calls[i]);
+        if (profile->taken[i] || profile->notTaken[i])
+            fprintf(fp, "branch %d %u %u\n", i, (unsigned)profile->taken[i], (unsigned)profile->notTaken[i]);
+    }
+    for (i = 0; i < profile->entryMax; ++i) {
+        ProfileEntry *entry = &profile->entries[i];
+        switch (entry->type) {
+        case PE_PROPERTY:
+            fprintf(fp, "property %d %d %u\n", entry->key1, entry->key2, (unsigned)entry->count);
+            break;
+        case PE_SEND:
+            fprintf(fp, "send %d %d %u\n", entry->key1, entry->key2, (unsigned)entry->count);
+            break;
+        }
+    }
+
+    fclose(fp);
+    return VMTRUE;
+}
+
+/* ProfileChecksum - compute the checksum that identifies the code a profile belongs to (FNV-1a) */
+VMUVALUE ProfileChecksum(const uint8_t *code, int size)
+{
+    VMUVALUE hash = 2166136261u;
+    while (--size >= 0) {
+        hash ^= *code++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* CountEntry - count an event in the hash table */
+static void CountEntry(Profile *profile, int type, VMVALUE key1, VMVALUE key2)
+{
+    int mask = profile->entryMax - 1;
+    int i = HashEntry(type, key1, key2) & mask;
+    ProfileEntry *entry;
+
+    /* find the entry or an empty slot */
+    while ((entry = &profile->entries[i])->type != 0) {
+        if (entry->type == type && entry->key1 == key1 && entry->key2 == key2) {
+            ++entry->count;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    /* add a new entry keeping the table at most half full */
+    entry->type = type;
+    entry->key1 = key1;
+    entry->key2 = key2;
+    entry->count = 1;
+    if (++profile->entryCount * 2 > profile->entryMax)
+        GrowEntries(profile);
+}
+
+/* GrowEntries - double the size of the hash table */
+static void GrowEntries(Profile *profile)
+{
+    ProfileEntry *entries = profile->entries;
+    int count = profile->entryMax, i;
+
+    profile->entryMax *= 2;
+    profile->entries = (ProfileEntry *)ProfileAlloc(profile->entryMax * sizeof(ProfileEntry));
+
+    for (i = 0; i < count; ++i) {
+        if (entries[i].type != 0) {
+            int mask = profile->entryMax - 1;
+            int j = HashEntry(entries[i].type, entries[i].key1, entries[i].key2) & mask;
+            while (profile->entries[j].type != 0)
+                j = (j + 1) & mask;
+            profile->entries[j] = entries[i];
+        }
+    }
+
+    free(entries);
+}
+
+/* HashEntry - compute the hash of a hash table key */
+static VMUVALUE HashEntry(int type, VMVALUE key1, VMVALUE key2)
+{
+    VMUVALUE hash = (VMUVALUE)type;
+    hash = hash * 31 + (VMUVALUE)key1;
+    hash = hash * 31 + (VMUVALUE)key2;
+    return hash ^ (hash >> 16);
+}
+
+/* ProfileAlloc - allocate zeroed memory for a profile */
+static void *ProfileAlloc(size_t size)
+{
+    void *p;
+    if (!(p = calloc(1, size))) {
+        printf("error: insufficient memory\n");
+        exit(1);
+    }
+    return p;
+}
@@ -0,0 +1,471 @@
+/* adv2queue.c - generate the code of functions on a pool of threads
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#ifndef MINGW
+#include <unistd.h>
+#endif
+#include "adv2compiler.h"
+#include "adv2vmdebug.h"
+
+/* code generation job states */
+enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE
+};
+
+/* function waiting for its code to be generated or linked */
+typedef struct CodeJob CodeJob;
+struct CodeJob {
+    CodeJob *next;
+    ParseTreeNode *function;    /* parse tree of the function */
+    Symbol *symbol;             /* function symbol or NULL for a method */
+    VMVALUE method;             /* data offset of the property holding a method */
+    Arena arena;                /* memory of the parse tree */
+    int state;                  /* queued, running, or done */
+    int failed;                 /* code generation failed (the error has been reported) */
+    uint8_t *code;              /* code of the function starting at offset zero */
+    uint8_t *relocs;            /* relocation types of the code */
+    int length;                 /* length of the code */
+    int generatedLength;        /* length of the code before the peephole optimizer */
+    CodeRef *refs;              /* addresses to fill in when the code is linked */
+    VMVALUE *selectors;         /* constant selectors used by the code */
+    int selectorCount;          /* number of constant selectors */
+    int dynamicSelectors;       /* code uses computed selectors */
+    uint64_t threadTime;        /* time a thread spent generating the code (when timing) */
+};
+
+/* code generation queue */
+struct CodeQueue {
+    ParseContext *c;            /* parse context the code is linked into */
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      /* a job was queued or the threads are stopping */
+    pthread_cond_t done;        /* a job was done */
+    pthread_t *threads;         /* threads generating code */
+    ParseContext **generators;  /* context of each thread and one for the main thread */
+    int threadCount;            /* number of threads (zero if code is generated as it is linked) */
+    int stopping;               /* the threads are stopping */
+    CodeJob *jobs;              /* jobs that haven't been linked (in the order they were queued) */
+    CodeJob **pNextJob;         /* place to store the next job */
+    CodeJob *nextJob;           /* next job to generate code for */
+    int jobCount;               /* number of jobs that haven't been linked */
+    int maxJobs;                /* most jobs to keep before linking the oldest */
+    int timing;                 /* measure the time the threads spend generating code */
+};
+
+/* local function prototypes */
+static int ProcessorCount(void);
+static ParseContext *NewGenerator(ParseContext *c);
+static void FreeGenerator(ParseContext *g);
+static void *CodeThread(void *data);
+static void FinishJobs(ParseContext *c, CodeJob *last);
+static void GenerateCode(ParseContext *g, CodeJob *job);
+static void LinkCode(ParseContext *c, CodeJob *job);
+static void FreeJob(CodeJob *job);
+
+/* StartCodeQueue - start the threads that generate code
+ *
+ * Zero threads means one for each processor. With one thread, or in debug
+ * mode, code is generated on the main thread as it is linked. Functions are
+ * linked in the order they are queued no matter how many threads there are so
+ * the compiler output doesn't depend on the number of threads.
+ */
+void StartCodeQueue(ParseContext *c, int threads)
+{
+    CodeQueue *q;
+    pthread_attr_t attr;
+    int i;
+
+    if (threads <= 0)
+        threads = ProcessorCount();
+    if (threads > MAXCODETHREADS)
+        threads = MAXCODETHREADS;
+    if (threads <= 1 || c->debugMode)
+        threads = 0;
+
+    q = (CodeQueue *)LocalAlloc(c, sizeof(CodeQueue));
+    memset(q, 0, sizeof(CodeQueue));
+    q->c = c;
+    q->pNextJob = &q->jobs;
+    q->maxJobs = c->debugMode ? 0 : MAXQUEUEDFUNCTIONS;
+    q->timing = c->stats != NULL;
+    c->codeQueue = q;
+    q->generators = (ParseContext **)LocalAlloc(c, (threads + 1) * sizeof(ParseContext *));
+    for (i = 0; i <= threads; ++i)
+        q->generators[i] = NewGenerator(c);
+
+    if (threads > 0) {
+
+        /* the opcode formats are initialized on first use */
+        OpcodeFormat(OP_HALT);
+
+        pthread_mutex_init(&q->lock, NULL);
+        pthread_cond_init(&q->queued, NULL);
+        pthread_cond_init(&q->done, NULL);
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, CODETHREADSTACKSIZE);
+        q->threads = (pthread_t *)LocalAlloc(c, threads * sizeof(pthread_t));
+        for (q->threadCount = 0; q->threadCount < threads; ++q->threadCount) {
+            if (pthread_create(&q->threads[q->threadCount], &attr, CodeThread, q->generators[q->threadCount + 1]) != 0)
+                break;
+        }
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/* StopCodeQueue - link the functions still in the queue and stop the threads */
+void StopCodeQueue(ParseContext *c)
+{
+    CodeQueue *q = c->codeQueue;
+    int i;
+
+    if (!q)
+        return;
+    FinishFunctions(c);
+
+    if (q->threads) {
+        pthread_mutex_lock(&q->lock);
+        q->stopping = VMTRUE;
+        pthread_cond_broadcast(&q->queued);
+        pthread_mutex_unlock(&q->lock);
+        for (i = 0; i < q->threadCount; ++i)
+            pthread_join(q->threads[i], NULL);
+        pthread_cond_destroy(&q->done);
+        pthread_cond_destroy(&q->queued);
+        pthread_mutex_destroy(&q->lock);
+        free(q->threads);
+    }
+
+    for (i = 0; i <= q->threadCount; ++i)
+        FreeGenerator(q->generators[i]);
+    free(q->generators);
+    free(q);
+    c->codeQueue = NULL;
+}
+
+/* QueueFunction - queue a function whose parse tree is ready for code generation
+ *
+ * The parse tree moves from the function arena to the job. The symbol is NULL
+ * for a method whose address is stored in the property at the data offset
+ * 'method' instead.
+ */
+void QueueFunction(ParseContext *c, ParseTreeNode *function, Symbol *symbol, VMVALUE method)
+{
+    CodeQueue *q = c->codeQueue;
+    CodeJob *job;
+
+    job = (CodeJob *)LocalAlloc(c, sizeof(CodeJob));
+    memset(job, 0, sizeof(CodeJob));
+    job->function = function;
+    job->symbol = symbol;
+    job->method = method;
+    InitArena(&job->arena);
+    RetainArena(&c->functionArena, &job->arena);
+    job->state = JOB_QUEUED;
+
+    if (q->threads)
+        pthread_mutex_lock(&q->lock);
+    *q->pNextJob = job;
+    q->pNextJob = &job->next;
+    if (!q->nextJob)
+        q->nextJob = job;
+    ++q->jobCount;
+    if (q->threads) {
+        pthread_cond_signal(&q->queued);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    /* keep the parse trees waiting to be linked from piling up */
+    if (q->jobCount > q->maxJobs)
+        FinishJobs(c, q->jobs);
+}
+
+/* FinishFunction - link the code of a function and every function queued before it
+ *
+ * Nothing happens if the function isn't in the queue (it may still be being parsed).
+ */
+void FinishFunction(ParseContext *c, Symbol *symbol)
+{
+    CodeQueue *q = c->codeQueue;
+    CodeJob *job;
+    if (!q)
+        return;
+    for (job = q->jobs; job != NULL; job = job->next) {
+        if (job->symbol == symbol) {
+            FinishJobs(c, job);
+            break;
+        }
+    }
+}
+
+/* FinishMethods - link the code of every method stored in a range of data space */
+void FinishMethods(ParseContext *c, VMVALUE start, VMVALUE end)
+{
+    CodeQueue *q = c->codeQueue;
+    CodeJob *job, *last = NULL;
+    if (!q)
+        return;
+    for (job = q->jobs; job != NULL; job = job->next) {
+        if (!job->symbol && job->method >= start && job->method < end)
+            last = job;
+    }
+    if (last)
+        FinishJobs(c, last);
+}
+
+/* FinishFunctions - link the code of every function in the queue */
+void FinishFunctions(ParseContext *c)
+{
+    CodeQueue *q = c->codeQueue;
+    CodeJob *last;
+    if (!q || !q->jobs)
+        return;
+    for (last = q->jobs; last->next != NULL; last = last->next)
+        ;
+    FinishJobs(c, last);
+}
+
+/* FinishJobs - link the jobs at the head of the queue through the last one
+ *
+ * The main thread generates the code for a job no thread has started rather
+ * than wait for one.
+ */
+static void FinishJobs(ParseContext *c, CodeJob *last)
+{
+    CodeQueue *q = c->codeQueue;
+    CodeJob *job;
+    int phase;
+    do {
+        phase = BeginPhase(c, PHASE_GENERATE);
+        if (q->threads)
+            pthread_mutex_lock(&q->lock);
+        job = q->jobs;
+        if (!(q->jobs = job->next))
+            q->pNextJob = &q->jobs;
+        --q->jobCount;
+        if (job->state == JOB_QUEUED) {
+            q->nextJob = job->next;
+            job->state = JOB_RUNNING;
+            if (q->threads)
+                pthread_mutex_unlock(&q->lock);
+            GenerateCode(q->generators[0], job);
+        }
+        else {
+            while (job->state != JOB_DONE)
+                pthread_cond_wait(&q->done, &q->lock);
+            pthread_mutex_unlock(&q->lock);
+        }
+        EndPhase(c, phase);
+        
+        phase = BeginPhase(c, PHASE_LINK);
+        LinkCode(c, job);
+        EndPhase(c, phase);
+        FreeJob(job);
+    } while (job != last);
+}
+
+/* CodeThread - generate code for queued jobs until the queue stops */
+static void *CodeThread(void *data)
+{
+    ParseContext *g = (ParseContext *)data;
+    CodeQueue *q = g->codeQueue;
+    uint64_t startTime = 0;
+    CodeJob *job;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->nextJob && !q->stopping)
+            pthread_cond_wait(&q->queued, &q->lock);
+        if (!(job = q->nextJob))
+            break;
+        q->nextJob = job->next;
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&q->lock);
+
+        if (q->timing)
+            startTime = ClockTime();
+        GenerateCode(g, job);
+        if (q->timing)
+            job->threadTime = ClockTime() - startTime;
+
+        pthread_mutex_lock(&q->lock);
+        job->state = JOB_DONE;
+        pthread_cond_broadcast(&q->done);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return NULL;
+}
+
+/* GenerateCode - generate and optimize the code of a job into the code space of a generator
+ *
+ * Nothing but the job and the generator are changed so this can run on any
+ * thread. The code is copied into the job once it is complete.
+ */
+static void GenerateCode(ParseContext *g, CodeJob *job)
+{
+    FunctionDef *function = job->function->u.functionDef;
+    uint8_t *code;
+    int length;
+
+    if (setjmp(g->errorTarget)) {
+        job->failed = VMTRUE;
+        return;
+    }
+
+    g->codeFree = g->codeBuf;
+    g->block = NULL;
+    code = code_functiondef(g, job->function, &length);
+    job->generatedLength = length;
+    if (!function->hasAsm && g->optimizeLevel >= 1)
+        length = OptimizeCode(g, code, length);
+
+    /* move the code and the references into the job */
+    job->code = (uint8_t *)LocalAlloc(g, length + 1);
+    job->relocs = (uint8_t *)LocalAlloc(g, length + 1);
+    memcpy(job->code, code, length);
+    memcpy(job->relocs, g->codeRelocs, length);
+    job->length = length;
+    job->refs = g->codeRefs;
+    g->codeRefs = NULL;
+    g->codeRefMax = 0;
+    if ((job->selectorCount = g->selectorCount) > 0) {
+        job->selectors = (VMVALUE *)LocalAlloc(g, g->selectorCount * sizeof(VMVALUE));
+        memcpy(job->selectors, g->selectors, g->selectorCount * sizeof(VMVALUE));
+    }
+    job->dynamicSelectors = g->dynamicSelectors;
+
+    /* the next function starts with no relocations */
+    memset(g->codeRelocs, RELOC_NONE, job->generatedLength);
+}
+
+/* LinkCode - add the code of a job to the end of code space and fill in its addresses */
+static void LinkCode(ParseContext *c, CodeJob *job)
+{
+    FunctionDef *function = job->function->u.functionDef;
+    VMVALUE base, offset;
+    CodeRef *ref;
+    int i;
+
+    /* the error was reported when the code was generated */
+    if (job->failed)
+        longjmp(c->errorTarget, 1);
+    if (job->threadTime)
+        AddThreadTime(c, job->threadTime);
+
+    /* add the code and its relocations */
+    base = c->codeFree - c->codeBuf;
+    ReserveCode(c, job->length);
+    memcpy(c->codeFree, job->code, job->length);
+    memcpy(c->codeRelocs + base, job->relocs, job->length);
+    c->codeFree += job->length;
+
+    /* the address of the function is known now */
+    if (job->symbol) {
+        job->symbol->v.value = base;
+        job->symbol->pending = VMFALSE;
+    }
+    else
+        *(VMVALUE *)(c->dataBuf + job->method) = base;
+
+    /* fill in the symbol, string, and method addresses */
+    for (i = 0; i < job->length; ++i) {
+        if (job->relocs[i] != RELOC_REF)
+            continue;
+        offset = base + i;
+        ref = &job->refs[rd_clong(c, offset)];
+        switch (ref->type) {
+        case CR_SYMBOL:
+            wr_clong(c, offset, AddSymbolRef(c, ref->v.symbol, FT_CODE, offset));
+            break;
+        case CR_STRING:
+            wr_clong(c, offset, 0);
+            AddStringRef(c, ref->v.string, FT_CODE, offset);
+            break;
+        case CR_METHOD:
+            wr_clong(c, offset, ref->v.offset);
+            AddReloc(c, FT_CODE, offset, RELOC_METHOD);
+            break;
+        }
+        i += sizeof(VMVALUE) - 1;
+    }
+
+    /* add the code item with the selectors the code uses and the properties it assigns */
+    c->selectorCount = 0;
+    c->dynamicSelectors = job->dynamicSelectors;
+    for (i = 0; i < job->selectorCount; ++i)
+        AddSelector(c, job->selectors[i]);
+    c->storedTagCount = 0;
+    c->dynamicStores = function->dynamicStores;
+    for (i = 0; i < function->storedTagCount; ++i)
+        AddStoredTag(c, function->storedTags[i]);
+    AddCodeItem(c, base, function->name, function->hasAsm);
+    c->selectorCount = 0;
+    c->dynamicSelectors = VMFALSE;
+    c->storedTagCount = 0;
+    c->dynamicStores = VMFALSE;
+
+    if (c->debugMode) {
+        if (!function->hasAsm && c->optimizeLevel >= 1)
+            printf("peephole: %s %d -> %d bytes\n", function->name, job->generatedLength, job->length);
+        DecodeFunction(c->codeBuf, c->codeBuf + base, job->length);
+    }
+
+    /* the parse tree is freed unless calls to the function can be expanded inline */
+    function->codeLength = job->length;
+    if (job->symbol && AddInlineCandidate(c, job->symbol, job->function))
+        RetainArena(&job->arena, &c->globalArena);
+    else
+        RecycleArena(&job->arena, &c->functionArena);
+}
+
+/* FreeJob - free a job that has been linked */
+static void FreeJob(CodeJob *job)
+{
+    free(job->code);
+    free(job->relocs);
+    free(job->refs);
+    free(job->selectors);
+    free(job);
+}
+
+/* NewGenerator - make a context for generating code on a thread */
+static ParseContext *NewGenerator(ParseContext *c)
+{
+    ParseContext *g = (ParseContext *)LocalAlloc(c, sizeof(ParseContext));
+    memset(g, 0, sizeof(ParseContext));
+    g->codeQueue = c->codeQueue;
+    g->optimizeLevel = c->optimizeLevel;
+    g->debugMode = c->debugMode;
+    ReserveCode(g, MINSEGMENT);
+    return g;
+}
+
+/* FreeGenerator - free a code generation context */
+static void FreeGenerator(ParseContext *g)
+{
+    free(g->codeBuf);
+    free(g->codeRelocs);
+    free(g->codeRefs);
+    free(g->selectors);
+    free(g);
+}
+
+/* ProcessorCount - get the number of processors */
+static int ProcessorCount(void)
+{
+#ifdef MINGW
+    char *count = getenv("NUMBER_OF_PROCESSORS");
+    return count ? atoi(count) : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
@@ -0,0 +1,650 @@
+/* adv2relax.c - choose the shortest encoding for literals and branches and reorder code
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+#include "adv2vmdebug.h"
+
+/* decoded instruction */
+typedef struct {
+    int offset;         /* offset of the instruction in the original code or -1 if it was added */
+    int newOffset;      /* offset of the instruction in the relaxed code */
+    int length;         /* length of the instruction in the original code */
+    int opcode;         /* opcode in the relaxed code */
+    VMVALUE operand;    /* operand of a literal */
+    int reloc;          /* relocation type of a literal */
+    int target;         /* index of the target instruction for branches */
+    int *targets;       /* indices of the default and case targets of a jump table */
+    int targetCount;    /* number of jump table targets */
+    int isRaw;          /* code that is copied without being decoded */
+    int inverted;       /* branch that has already been inverted */
+} RelaxInstruction;
+
+/* relaxation state */
+typedef struct {
+    ParseContext *c;
+    RelaxInstruction *insts;
+    int count;
+    int max;
+    int *index;         /* index of the instruction at each code offset or -1 */
+    int *itemFirst;     /* index of the first instruction of each function (and the end) */
+    int itemCount;
+    int literals;       /* number of literals shortened */
+    int branches;       /* number of branches shortened */
+    int inverted;       /* number of branches inverted */
+    int shorten;        /* use the short forms */
+} RelaxState;
+
+/* local function prototypes */
+static void InitRelax(RelaxState *s, ParseContext *c, int *order);
+static void DecodeItem(RelaxState *s, int start, int end, int isRaw);
+static int FindTargets(RelaxState *s, int first, int start, int end);
+static int FindTarget(RelaxState *s, int offset, int start, int end);
+static void ShortenLiterals(RelaxState *s);
+static void LengthenBranches(RelaxState *s);
+static void InvertBranches(RelaxState *s, int first, int end, int *next, uint8_t *mostlyTaken);
+static void Reorder(RelaxState *s, int *layout);
+static int ShortenBranches(RelaxState *s);
+static int Finish(RelaxState *s);
+static int Layout(RelaxState *s);
+static int *BuildMap(RelaxState *s, int codeSize);
+static void EncodeCode(RelaxState *s, uint8_t *code, uint8_t *relocs, int *map, int codeSize);
+static VMVALUE MapAddress(int *map, int size, VMVALUE offset);
+static void PutValue(uint8_t *p, VMVALUE value, int size);
+static int ShortBranch(int opcode);
+static int LongBranch(int opcode);
+static int CanFallThrough(RelaxInstruction *inst);
+static int IsLiteral(int opcode);
+static int InstructionLength(RelaxInstruction *inst);
+
+/* RelaxCode - use the shortest encoding for each literal and branch
+ *
+ * Literals that fit in 16 bits become WLIT (or SLIT if they fit in 8 bits and
+ * aren't addresses) and branches whose targets are within reach of an 8 bit
+ * offset use the short branch opcodes. Shortening an instruction never moves
+ * two other instructions apart so the branches are shortened until nothing
+ * changes. Functions containing asm instructions are moved without being
+ * changed. The short forms are only understood by the host interpreter.
+ */
+void RelaxCode(ParseContext *c)
+{
+    RelaxState state, *s = &state;
+    int codeSize = c->codeFree - c->codeBuf;
+    int newCodeSize;
+
+    InitRelax(s, c, NULL);
+    ShortenLiterals(s);
+    newCodeSize = Finish(s);
+
+    /* report the savings with the other statistics (-T or -J) */
+    if (c->stats)
+        printf("relax: shortened %d literals and %d branches (%d code bytes)\n",
+               s->literals, s->branches, codeSize - newCodeSize);
+}
+
+/* ReorderCode - move functions and the arms of branches to match how the code is used
+ *
+ * The functions are placed in the order given by the array of code item
+ * indices. A conditional branch that is usually taken is inverted and the code
+ * it usually skips is moved to the end of the function so that the common
+ * path falls through. The code may already use the short forms. The branches
+ * are relaxed again once everything has been moved if shorten is true. Returns
+ * the number of branches inverted.
+ */
+int ReorderCode(ParseContext *c, int *order, uint8_t *mostlyTaken, int shorten)
+{
+    RelaxState state, *s = &state;
+    int *next, i;
+
+    InitRelax(s, c, order);
+    LengthenBranches(s);
+    s->shorten = shorten;
+
+    /* move the code the usually taken branches skip */
+    next = (int *)LocalAlloc(c, (s->max + 1) * sizeof(int));
+    for (i = 0; i < s->itemCount; ++i) {
+        int first = s->itemFirst[i], end = s->itemFirst[i + 1], j;
+        for (j = first; j < end; ++j)
+            next[j] = j + 1 < end ? j + 1 : -1;
+        if (end > first && !s->insts[first].isRaw)
+            InvertBranches(s, first, end, next, mostlyTaken);
+    }
+
+    /* put the instructions in their new order */
+    Reorder(s, next);
+    free(next);
+
+    /* code addresses might not fit in 16 bits if the code grew */
+    if (Layout(s) > 0xffff) {
+        for (i = 0; i < s->count; ++i) {
+            RelaxInstruction *inst = &s->insts[i];
+            if (!inst->isRaw && inst->opcode == OP_WLIT && inst->reloc == RELOC_CODE)
+                inst->opcode = OP_LIT;
+        }
+    }
+
+    Finish(s);
+    return s->inverted;
+}
+
+/* InitRelax - decode the functions in the order given or in address order if there is no order */
+static void InitRelax(RelaxState *s, ParseContext *c, int *order)
+{
+    int codeSize = c->codeFree - c->codeBuf;
+    int i;
+
+    /* initialize the relaxation state (inverting branches can add an instruction for each one) */
+    memset(s, 0, sizeof(RelaxState));
+    s->c = c;
+    s->shorten = VMTRUE;
+    s->max = codeSize * 2 + 1;
+    s->insts = (RelaxInstruction *)LocalAlloc(c, (s->max + 1) * sizeof(RelaxInstruction));
+    s->index = (int *)LocalAlloc(c, (codeSize + 1) * sizeof(int));
+    s->itemFirst = (int *)LocalAlloc(c, (c->codeItemCount + 1) * sizeof(int));
+    for (i = 0; i <= codeSize; ++i)
+        s->index[i] = -1;
+
+    /* decode each function */
+    for (i = 0; i < c->codeItemCount; ++i) {
+        int n = order ? order[i] : i;
+        ImageItem *item = &c->codeItems[n];
+        int end = n + 1 < c->codeItemCount ? c->codeItems[n + 1].offset : codeSize;
+        s->itemFirst[s->itemCount++] = s->count;
+        DecodeItem(s, item->offset, end, item->hasAsm);
+    }
+    s->itemFirst[s->itemCount] = s->count;
+}
+
+/* Finish - shorten the branches, reencode the code, and move everything that points into it
+ *
+ * Returns the new size of code space.
+ */
+static int Finish(RelaxState *s)
+{
+    ParseContext *c = s->c;
+    int codeSize = c->codeFree - c->codeBuf;
+    int newCodeSize, *map, i;
+    uint8_t *code, *relocs;
+
+    /* the extra entry marks the end of the code */
+    memset(&s->insts[s->count], 0, sizeof(RelaxInstruction));
+    s->insts[s->count].offset = codeSize;
+
+    /* choose the short branch forms */
+    while (s->shorten && ShortenBranches(s))
+        ;
+    newCodeSize = Layout(s);
+    if (newCodeSize > codeSize)
+        ReserveCode(c, newCodeSize - codeSize);
+
+    /* reencode the code and move everything that points into it */
+    map = BuildMap(s, codeSize);
+    code = (uint8_t *)LocalAlloc(c, newCodeSize + 1);
+    relocs = (uint8_t *)LocalAlloc(c, newCodeSize + 1);
+    memset(relocs, RELOC_NONE, newCodeSize + 1);
+    EncodeCode(s, code, relocs, map, codeSize);
+    ReplaceCode(c, code, relocs, newCodeSize, map);
+    free(code);
+    free(relocs);
+    free(map);
+
+    for (i = 0; i < s->count; ++i)
+        free(s->insts[i].targets);
+    free(s->insts);
+    free(s->index);
+    free(s->itemFirst);
+
+    return newCodeSize;
+}
+
+/* DecodeItem - decode the instructions of a function or copy it as a block */
+static void DecodeItem(RelaxState *s, int start, int end, int isRaw)
+{
+    ParseContext *c = s->c;
+    int first = s->count;
+    RelaxInstruction *inst;
+    int offset;
+
+    /* decode each instruction */
+    for (offset = start; !isRaw && offset < end; offset += inst->length) {
+        uint8_t *p = c->codeBuf + offset;
+        int fmt, cnt;
+        inst = &s->insts[s->count];
+        memset(inst, 0, sizeof(RelaxInstruction));
+        inst->offset = offset;
+        inst->opcode = *p;
+        if ((fmt = OpcodeFormat(inst->opcode)) < 0 || offset + FormatLength(fmt) > end) {
+            isRaw = VMTRUE;
+            break;
+        }
+        switch (fmt) {
+        case FMT_LONG:
+            for (cnt = 1; cnt <= sizeof(VMVALUE); ++cnt)
+                inst->operand = (inst->operand << 8) | p[cnt];
+            inst->reloc = c->codeRelocs[offset + 1];
+            break;
+        case FMT_WORD:
+            inst->operand = (p[1] << 8) | p[2];
+            inst->reloc = RELOC_TYPE(c->codeRelocs[offset + 1]);
+            break;
+        case FMT_SBYTE:
+            inst->operand = (int8_t)p[1];
+            break;
+        case FMT_JUMPTABLE:
+            cnt = 1 + sizeof(VMVALUE);
+            inst->targetCount = ((p[cnt] << 8) | p[cnt + 1]) + 1;
+            inst->targets = (int *)LocalAlloc(c, inst->targetCount * sizeof(int));
+            break;
+        }
+        inst->length = InstructionLength(inst);
+        s->index[offset] = s->count++;
+        if (offset + inst->length > end)
+            isRaw = VMTRUE;
+    }
+
+    /* find the branch targets */
+    if (!isRaw && !FindTargets(s, first, start, end))
+        isRaw = VMTRUE;
+
+    /* code that can't be decoded is copied as a block */
+    if (isRaw && end > start) {
+        while (s->count > first)
+            free(s->insts[--s->count].targets);
+        for (offset = start; offset < end; ++offset)
+            s->index[offset] = -1;
+        inst = &s->insts[s->count];
+        memset(inst, 0, sizeof(RelaxInstruction));
+        inst->offset = start;
+        inst->length = end - start;
+        inst->isRaw = VMTRUE;
+        s->index[start] = s->count++;
+    }
+}
+
+/* FindTargets - find the targets of the branches in a function */
+static int FindTargets(RelaxState *s, int first, int start, int end)
+{
+    uint8_t *code = s->c->codeBuf;
+    int i, j;
+
+    for (i = first; i < s->count; ++i) {
+        RelaxInstruction *inst = &s->insts[i];
+        uint8_t *p = code + inst->offset;
+        switch (OpcodeFormat(inst->opcode)) {
+        case FMT_BR:
+            inst->target = FindTarget(s, inst->offset + 1 + sizeof(VMWORD) + (VMWORD)((p[1] << 8) | p[2]), start, end);
+            if (inst->target < 0)
+                return VMFALSE;
+            break;
+        case FMT_SBR:
+            inst->target = FindTarget(s, inst->offset + FormatLength(FMT_SBR) + (int8_t)p[1], start, end);
+            if (inst->target < 0)
+                return VMFALSE;
+            break;
+        case FMT_JUMPTABLE:
+            p += FormatLength(FMT_JUMPTABLE);
+            for (j = 0; j < inst->targetCount; ++j, p += sizeof(VMWORD)) {
+                inst->targets[j] = FindTarget(s, (p - code) + sizeof(VMWORD) + (VMWORD)((p[0] << 8) | p[1]), start, end);
+                if (inst->targets[j] < 0)
+                    return VMFALSE;
+            }
+            break;
+        }
+    }
+
+    return VMTRUE;
+}
+
+/* FindTarget - find the instruction at a branch target within a function */
+static int FindTarget(RelaxState *s, int offset, int start, int end)
+{
+    return offset >= start && offset < end ? s->index[offset] : -1;
+}
+
+/* ShortenLiterals - use the short literal forms for small values
+ *
+ * Code addresses can only move down so one that fits in 16 bits now will still
+ * fit after relaxation.
+ */
+static void ShortenLiterals(RelaxState *s)
+{
+    int i;
+    for (i = 0; i < s->count; ++i) {
+        RelaxInstruction *inst = &s->insts[i];
+        if (inst->isRaw || inst->opcode != OP_LIT)
+            continue;
+        if (inst->reloc == RELOC_NONE && inst->operand >= -128 && inst->operand <= 127)
+            inst->opcode = OP_SLIT;
+        else if (inst->operand >= 0 && inst->operand <= 0xffff)
+            inst->opcode = OP_WLIT;
+        else
+            continue;
+        ++s->literals;
+    }
+}
+
+/* LengthenBranches - go back to the long branch forms before moving code */
+static void LengthenBranches(RelaxState *s)
+{
+    int i;
+    for (i = 0; i < s->count; ++i) {
+        RelaxInstruction *inst = &s->insts[i];
+        int opcode;
+        if (!inst->isRaw && (opcode = LongBranch(inst->opcode)) >= 0)
+            inst->opcode = opcode;
+    }
+}
+
+/* InvertBranches - invert the usually taken branches of a function
+ *
+ * The instructions of the function are kept in a list. The code skipped by a
+ * usually taken forward branch is moved to the end of the list and the branch
+ * is inverted to jump to it. A branch back to the original target is added
+ * after the moved code if it can fall through. Nothing can be added after the
+ * end of a function that can fall through into the next one.
+ */
+static void InvertBranches(RelaxState *s, int first, int end, int *next, uint8_t *mostlyTaken)
+{
+    int tail = end - 1, k;
+
+    if (CanFallThrough(&s->insts[tail]))
+        return;
+
+    for (k = first; k >= 0; k = next[k]) {
+        RelaxInstruction *inst = &s->insts[k];
+        int target = inst->target, start, last, i;
+
+        /* only invert forward conditional branches that are usually taken */
+        if ((inst->opcode != OP_BRT && inst->opcode != OP_BRF) || inst->inverted
+        ||  inst->offset < 0 || !mostlyTaken[inst->offset])
+            continue;
+
+        /* find the code the branch skips */
+        for (last = -1, i = next[k]; i >= 0 && i != target; i = next[i])
+            last = i;
+        if (i < 0 || last < 0 || s->count >= s->max)
+            continue;
+
+        /* move it to the end of the function */
+        start = next[k];
+        next[k] = target;
+        next[tail] = start;
+        if (CanFallThrough(&s->insts[last])) {
+            RelaxInstruction *br = &s->insts[s->count];
+            memset(br, 0, sizeof(RelaxInstruction));
+            br->offset = -1;
+            br->opcode = OP_BR;
+            br->target = target;
+            next[last] = s->count;
+            tail = s->count++;
+        }
+        else
+            tail = last;
+        next[tail] = -1;
+
+        /* branch to the moved code instead */
+        inst->opcode = inst->opcode == OP_BRT ? OP_BRF : OP_BRT;
+        inst->target = start;
+        inst->inverted = VMTRUE;
+        ++s->inverted;
+    }
+}
+
+/* Reorder - put the instructions in the order of the function lists */
+static void Reorder(RelaxState *s, int *next)
+{
+    RelaxInstruction *insts;
+    int *position, count = 0, i, j;
+
+    /* find the new position of each instruction */
+    position = (int *)LocalAlloc(s->c, s->count * sizeof(int));
+    for (i = 0; i < s->itemCount; ++i) {
+        if (s->itemFirst[i] < s->itemFirst[i + 1]) {
+            for (j = s->itemFirst[i]; j >= 0; j = next[j])
+                position[j] = count++;
+        }
+    }
+
+    /* move the instructions and update the branch targets */
+    insts = (RelaxInstruction *)LocalAlloc(s->c, (s->max + 1) * sizeof(RelaxInstruction));
+    for (i = 0; i < s->count; ++i) {
+        RelaxInstruction *inst = &insts[position[i]];
+        *inst = s->insts[i];
+        switch (inst->isRaw ? FMT_NONE : OpcodeFormat(inst->opcode)) {
+        case FMT_BR:
+        case FMT_SBR:
+            inst->target = position[inst->target];
+            break;
+        case FMT_JUMPTABLE:
+            for (j = 0; j < inst->targetCount; ++j)
+                inst->targets[j] = position[inst->targets[j]];
+            break;
+        }
+    }
+    free(s->insts);
+    s->insts = insts;
+    free(position);
+}
+
+/* ShortenBranches - use the short branch forms for branches with nearby targets
+ *
+ * Returns true if any branch was shortened. The offsets are computed from the
+ * layout at the start of the pass. Shortening other branches during the pass
+ * can only bring targets closer so the short offsets stay in range.
+ */
+static int ShortenBranches(RelaxState *s)
+{
+    int changed = VMFALSE;
+    int i;
+
+    Layout(s);
+
+    for (i = 0; i < s->count; ++i) {
+        RelaxInstruction *inst = &s->insts[i];
+        int opcode, target, offset;
+        if (inst->isRaw || (opcode = ShortBranch(inst->opcode)) < 0)
+            continue;
+
+        /* a forward target moves back by the byte saved by the branch itself */
+        target = s->insts[inst->target].newOffset;
+        if (target > inst->newOffset)
+            --target;
+        offset = target - (inst->newOffset + FormatLength(FMT_SBR));
+
+        if (offset >= -128 && offset <= 127) {
+            inst->opcode = opcode;
+            ++s->branches;
+            changed = VMTRUE;
+        }
+    }
+
+    return changed;
+}
+
+/* Layout - assign the new offsets (the extra entry marks the end of the code) */
+static int Layout(RelaxState *s)
+{
+    int offset = 0, i;
+    for (i = 0; i < s->count; ++i) {
+        s->insts[i].newOffset = offset;
+        offset += InstructionLength(&s->insts[i]);
+    }
+    s->insts[s->count].newOffset = offset;
+    return offset;
+}
+
+/* BuildMap - map each instruction and each byte of undecoded code to its new offset */
+static int *BuildMap(RelaxState *s, int codeSize)
+{
+    int *map = (int *)LocalAlloc(s->c, (codeSize + 1) * sizeof(int));
+    int offset, i;
+
+    for (offset = 0; offset < codeSize; ++offset)
+        map[offset] = -1;
+
+    for (i = 0; i < s->count; ++i) {
+        RelaxInstruction *inst = &s->insts[i];
+        if (inst->offset < 0)
+            continue;
+        if (inst->isRaw) {
+            for (offset = 0; offset < inst->length; ++offset)
+                map[inst->offset + offset] = inst->newOffset + offset;
+        }
+        else
+            map[inst->offset] = inst->newOffset;
+    }
+
+    return map;
+}
+
+/* EncodeCode - write the relaxed instructions and their relocations */
+static void EncodeCode(RelaxState *s, uint8_t *code, uint8_t *relocs, int *map, int codeSize)
+{
+    ParseContext *c = s->c;
+    int i, cnt;
+
+    for (i = 0; i < s->count; ++i) {
+        RelaxInstruction *inst = &s->insts[i];
+        uint8_t *old = inst->offset >= 0 ? c->codeBuf + inst->offset : NULL;
+        uint8_t *p = code + inst->newOffset;
+        VMVALUE value;
+
+        /* copy code that can't be decoded and update the code addresses it contains */
+        if (inst->isRaw) {
+            memcpy(p, old, inst->length);
+            memcpy(relocs + inst->newOffset, c->codeRelocs + inst->offset, inst->length);
+            for (cnt = 0; cnt < inst->length; ++cnt)
+                if (c->codeRelocs[inst->offset + cnt] == RELOC_CODE)
+                    PutValue(p + cnt, MapAddress(map, codeSize, rd_clong(c, inst->offset + cnt)), sizeof(VMVALUE));
+            continue;
+        }
+
+        *p++ = inst->opcode;
+        switch (OpcodeFormat(inst->opcode)) {
+        case FMT_LONG:
+        case FMT_WORD:
+        case FMT_SBYTE:
+            if (!IsLiteral(*old)) {
+                memcpy(p, old + 1, inst->length - 1);
+                break;
+            }
+            value = inst->operand;
+            if (inst->reloc == RELOC_CODE)
+                value = MapAddress(map, codeSize, value);
+            PutValue(p, value, InstructionLength(inst) - 1);
+            if (inst->reloc != RELOC_NONE)
+                relocs[inst->newOffset + 1] = inst->opcode == OP_WLIT ? inst->reloc | RELOC_SHORT : inst->reloc;
+            break;
+        case FMT_BR:
+        case FMT_SBR:
+            value = s->insts[inst->target].newOffset - (inst->newOffset + InstructionLength(inst));
+            PutValue(p, value, InstructionLength(inst) - 1);
+            break;
+        case FMT_JUMPTABLE:
+            memcpy(p, old + 1, FormatLength(FMT_JUMPTABLE) - 1);
+            p += FormatLength(FMT_JUMPTABLE) - 1;
+            for (cnt = 0; cnt < inst->targetCount; ++cnt, p += sizeof(VMWORD))
+                PutValue(p, s->insts[inst->targets[cnt]].newOffset - (p + sizeof(VMWORD) - code), sizeof(VMWORD));
+            break;
+        default:
+            memcpy(p, old + 1, inst->length - 1);
+            break;
+        }
+    }
+}
+
+/* MapAddress - map a code address to its new offset */
+static VMVALUE MapAddress(int *map, int size, VMVALUE offset)
+{
+    if (offset < 0 || offset >= size)
+        return offset;
+    return map[offset] >= 0 ? map[offset] : NIL;
+}
+
+/* PutValue - store a big endian value */
+static void PutValue(uint8_t *p, VMVALUE value, int size)
+{
+    while (--size >= 0) {
+        p[size] = value;
+        value >>= 8;
+    }
+}
+
+/* ShortBranch - get the short form of a branch or -1 if there isn't one */
+static int ShortBranch(int opcode)
+{
+    switch (opcode) {
+    case OP_BRT:
+        return OP_SBRT;
+    case OP_BRTSC:
+        return OP_SBRTSC;
+    case OP_BRF:
+        return OP_SBRF;
+    case OP_BRFSC:
+        return OP_SBRFSC;
+    case OP_BR:
+        return OP_SBR;
+    default:
+        return -1;
+    }
+}
+
+/* LongBranch - get the long form of a short branch or -1 if it isn't one */
+static int LongBranch(int opcode)
+{
+    switch (opcode) {
+    case OP_SBRT:
+        return OP_BRT;
+    case OP_SBRTSC:
+        return OP_BRTSC;
+    case OP_SBRF:
+        return OP_BRF;
+    case OP_SBRFSC:
+        return OP_BRFSC;
+    case OP_SBR:
+        return OP_BR;
+    default:
+        return -1;
+    }
+}
+
+/* CanFallThrough - check whether execution can continue with the next instruction */
+static int CanFallThrough(RelaxInstruction *inst)
+{
+    if (inst->isRaw)
+        return VMTRUE;
+    switch (inst->opcode) {
+    case OP_BR:
+    case OP_SBR:
+    case OP_RETURN:
+    case OP_RETURNZ:
+    case OP_THROW:
+    case OP_JUMPTABLE:
+    case OP_HALT:
+        return VMFALSE;
+    default:
+        return VMTRUE;
+    }
+}
+
+/* IsLiteral - check for an instruction whose operand is a literal value */
+static int IsLiteral(int opcode)
+{
+    return opcode == OP_LIT || opcode == OP_WLIT || opcode == OP_SLIT;
+}
+
+/* InstructionLength - get the length of an instruction in the relaxed code */
+static int InstructionLength(RelaxInstruction *inst)
+{
+    int fmt;
+    if (inst->isRaw)
+        return inst->length;
+    fmt = OpcodeFormat(inst->opcode);
+    if (fmt == FMT_JUMPTABLE)
+        return FormatLength(fmt) + inst->targetCount * sizeof(VMWORD);
+    return FormatLength(fmt);
+}
@@ -0,0 +1,440 @@
+/* adv2reloc.c - image items and relocation
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+
+/* local function prototypes */
+static ImageItem *NewItem(ParseContext *c, ImageItem **pItems, int *pCount, int *pMax);
+static char *CopyName(ParseContext *c, const char *name);
+static VMVALUE MapOffset(int *map, int size, VMVALUE offset);
+static int MapSize(int *map, int size);
+static int CompareItems(const void *p1, const void *p2);
+static void AddTag(ParseContext *c, VMVALUE **pTags, int *pCount, int *pMax, VMVALUE tag);
+static int CompareTags(const void *p1, const void *p2);
+static void UpdateItems(ImageItem *items, int *pCount, int *map, int size);
+static void UpdateDataAddresses(ParseContext *c, int *codeMap, int codeSize, int *dataMap, int dataSize);
+static void UpdateReferences(ParseContext *c, int *codeMap, int codeSize, int *dataMap, int dataSize);
+
+/* AddCodeItem - start a new code item at the current function or method
+ *
+ * The constant selectors collected while generating the code and the property
+ * tags the code assigns are copied into the item. Code containing asm
+ * instructions may compute selectors that can't be seen.
+ */
+void AddCodeItem(ParseContext *c, VMVALUE offset, const char *name, int hasAsm)
+{
+    ImageItem *item = NewItem(c, &c->codeItems, &c->codeItemCount, &c->codeItemMax);
+    item->type = IT_CODE;
+    item->offset = offset;
+    item->name = CopyName(c, name);
+    item->hasAsm = hasAsm;
+    item->dynamicSelectors = hasAsm || c->dynamicSelectors;
+    if ((item->selectorCount = c->selectorCount) > 0) {
+        item->selectors = (VMVALUE *)LocalAlloc(c, c->selectorCount * sizeof(VMVALUE));
+        memcpy(item->selectors, c->selectors, c->selectorCount * sizeof(VMVALUE));
+    }
+    item->dynamicStores = c->dynamicStores;
+    if ((item->storedTagCount = c->storedTagCount) > 0) {
+        item->storedTags = (VMVALUE *)LocalAlloc(c, c->storedTagCount * sizeof(VMVALUE));
+        memcpy(item->storedTags, c->storedTags, c->storedTagCount * sizeof(VMVALUE));
+    }
+}
+
+/* AddDataItem - start a new data item */
+void AddDataItem(ParseContext *c, ItemType type, VMVALUE offset, const char *name)
+{
+    ImageItem *item = NewItem(c, &c->dataItems, &c->dataItemCount, &c->dataItemMax);
+    item->type = type;
+    item->offset = offset;
+    item->name = CopyName(c, name);
+}
+
+/* NewItem - add an item to the end of an item array */
+static ImageItem *NewItem(ParseContext *c, ImageItem **pItems, int *pCount, int *pMax)
+{
+    ImageItem *item;
+    if (*pCount >= *pMax) {
+        *pMax = *pMax ? *pMax * 2 : 256;
+        if (!(*pItems = (ImageItem *)realloc(*pItems, *pMax * sizeof(ImageItem))))
+            Abort(c, "insufficient memory");
+    }
+    item = &(*pItems)[(*pCount)++];
+    memset(item, 0, sizeof(ImageItem));
+    return item;
+}
+
+/* CopyName - make a copy of an item name */
+static char *CopyName(ParseContext *c, const char *name)
+{
+    char *copy;
+    if (!name)
+        return NULL;
+    copy = (char *)GlobalAlloc(c, strlen(name) + 1);
+    strcpy(copy, name);
+    return copy;
+}
+
+/* AddReloc - remember the kind of address stored at a code or data offset */
+void AddReloc(ParseContext *c, FixupType fixupType, VMVALUE offset, int relocType)
+{
+    int end = offset + sizeof(VMVALUE);
+
+    /* the address itself may not have been stored yet */
+    switch (fixupType) {
+    case FT_CODE:
+        if (end > c->codeFree - c->codeBuf)
+            ReserveCode(c, end - (c->codeFree - c->codeBuf));
+        c->codeRelocs[offset] = relocType;
+        break;
+    case FT_DATA:
+        if (end > c->dataFree - c->dataBuf)
+            ReserveData(c, end - (c->dataFree - c->dataBuf));
+        c->dataRelocs[offset] = relocType;
+        break;
+    case FT_PTR:
+        break;
+    }
+}
+
+/* FindItem - find the index of the item containing an offset */
+int FindItem(ImageItem *items, int count, VMVALUE offset)
+{
+    int lo = 0, hi = count - 1;
+    if (count == 0 || offset < items[0].offset)
+        return -1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (items[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* AddSelector - remember a property tag used as a constant selector by the current function */
+void AddSelector(ParseContext *c, VMVALUE tag)
+{
+    AddTag(c, &c->selectors, &c->selectorCount, &c->selectorMax, tag);
+}
+
+/* AddStoredTag - remember a property tag assigned with a constant selector by the current function */
+void AddStoredTag(ParseContext *c, VMVALUE tag)
+{
+    AddTag(c, &c->storedTags, &c->storedTagCount, &c->storedTagMax, tag);
+}
+
+/* AddTag - add a property tag to a set of tags */
+static void AddTag(ParseContext *c, VMVALUE **pTags, int *pCount, int *pMax, VMVALUE tag)
+{
+    int i;
+    for (i = 0; i < *pCount; ++i)
+        if ((*pTags)[i] == tag)
+            return;
+    if (*pCount >= *pMax) {
+        *pMax = *pMax ? *pMax * 2 : 32;
+        if (!(*pTags = (VMVALUE *)realloc(*pTags, *pMax * sizeof(VMVALUE))))
+            Abort(c, "insufficient memory");
+    }
+    (*pTags)[(*pCount)++] = tag;
+}
+
+/* BindMethods - turn sends to methods found at compile time into direct calls
+ *
+ * A send to a named object whose property held a method when the send was
+ * compiled is coded with the data offset of the property in place of its
+ * selector. Method properties can be assigned like any other property so the
+ * send only becomes a CALL of the method if no code in the program assigns a
+ * property with the same tag. Otherwise the selector is put back and the
+ * method is looked up when the message is sent.
+ */
+void BindMethods(ParseContext *c)
+{
+    int codeSize = c->codeFree - c->codeBuf;
+    int storedCount = 0, allStored = VMFALSE, offset, i, j;
+    VMVALUE *stored = NULL, property, tag;
+    ImageItem *item;
+
+    /* collect the property tags assigned anywhere in the program */
+    for (i = 0; i < c->codeItemCount; ++i)
+        storedCount += c->codeItems[i].storedTagCount;
+    if (storedCount > 0) {
+        stored = (VMVALUE *)LocalAlloc(c, storedCount * sizeof(VMVALUE));
+        for (i = storedCount = 0; i < c->codeItemCount; ++i) {
+            item = &c->codeItems[i];
+            for (j = 0; j < item->storedTagCount; ++j)
+                stored[storedCount++] = item->storedTags[j];
+        }
+        qsort(stored, storedCount, sizeof(VMVALUE), CompareTags);
+    }
+    for (i = 0; i < c->codeItemCount; ++i)
+        if (c->codeItems[i].dynamicStores)
+            allStored = VMTRUE;
+
+    for (offset = 0; offset + (int)sizeof(VMVALUE) < codeSize; ++offset) {
+        if (c->codeRelocs[offset] != RELOC_METHOD)
+            continue;
+        property = GetCodeAddress(c, offset);
+        tag = ((Property *)(c->dataBuf + property - sizeof(VMVALUE)))->tag & ~P_SHARED;
+
+        /* call the method directly if nothing can change it */
+        if (!allStored
+        &&  c->codeBuf[offset + sizeof(VMVALUE)] == OP_SEND
+        &&  c->dataRelocs[property] == RELOC_CODE
+        &&  (storedCount == 0 || !bsearch(&tag, stored, storedCount, sizeof(VMVALUE), CompareTags))) {
+            c->codeRelocs[offset] = RELOC_CODE;
+            SetCodeAddress(c, offset, *(VMVALUE *)(c->dataBuf + property));
+            c->codeBuf[offset + sizeof(VMVALUE)] = OP_CALL;
+        }
+
+        /* otherwise send the message and count the selector as used */
+        else {
+            c->codeRelocs[offset] = RELOC_NONE;
+            SetCodeAddress(c, offset, tag);
+            if ((i = FindItem(c->codeItems, c->codeItemCount, offset)) >= 0) {
+                item = &c->codeItems[i];
+                if (!(item->selectors = (VMVALUE *)realloc(item->selectors, (item->selectorCount + 1) * sizeof(VMVALUE))))
+                    Abort(c, "insufficient memory");
+                item->selectors[item->selectorCount++] = tag;
+            }
+        }
+
+        offset += sizeof(VMVALUE) - 1;
+    }
+
+    free(stored);
+}
+
+/* CompareTags - compare two property tags */
+static int CompareTags(const void *p1, const void *p2)
+{
+    VMVALUE tag1 = *(VMVALUE *)p1, tag2 = *(VMVALUE *)p2;
+    return tag1 < tag2 ? -1 : tag1 > tag2;
+}
+
+/* RelocateImage - move code and data to new offsets
+ *
+ * The maps give the new offset of each byte of code and data space or -1 if the
+ * byte is being removed. A NULL map leaves that space where it is. Every address
+ * stored in code or data, the global symbols, strings, objects, and items are
+ * updated to match.
+ */
+void RelocateImage(ParseContext *c, int *codeMap, int *dataMap)
+{
+    int codeSize = c->codeFree - c->codeBuf;
+    int dataSize = c->dataFree - c->dataBuf;
+    int newCodeSize = MapSize(codeMap, codeSize);
+    int newDataSize = MapSize(dataMap, dataSize);
+    uint8_t *buf, *relocs;
+    int offset;
+
+    /* update the addresses stored in code space */
+    for (offset = 0; offset < codeSize; ++offset) {
+        if ((!codeMap || codeMap[offset] >= 0) && c->codeRelocs[offset] != RELOC_NONE && c->codeRelocs[offset] != RELOC_STRING) {
+            VMVALUE value = GetCodeAddress(c, offset);
+            if (RELOC_TYPE(c->codeRelocs[offset]) == RELOC_CODE)
+                value = MapOffset(codeMap, codeSize, value);
+            else
+                value = MapOffset(dataMap, dataSize, value);
+            SetCodeAddress(c, offset, value);
+        }
+    }
+
+    /* update the addresses stored in data space */
+    UpdateDataAddresses(c, codeMap, codeSize, dataMap, dataSize);
+
+    /* move the code */
+    if (codeMap) {
+        buf = (uint8_t *)LocalAlloc(c, codeSize * 2 + 1);
+        relocs = buf + codeSize;
+        memset(relocs, RELOC_NONE, codeSize);
+        for (offset = 0; offset < codeSize; ++offset) {
+            if (codeMap[offset] >= 0) {
+                buf[codeMap[offset]] = c->codeBuf[offset];
+                relocs[codeMap[offset]] = c->codeRelocs[offset];
+            }
+        }
+        memcpy(c->codeBuf, buf, newCodeSize);
+        memcpy(c->codeRelocs, relocs, codeSize);
+        c->codeFree = c->codeBuf + newCodeSize;
+        free(buf);
+    }
+
+    /* move the data */
+    if (dataMap) {
+        buf = (uint8_t *)LocalAlloc(c, dataSize * 2 + 1);
+        relocs = buf + dataSize;
+        memset(relocs, RELOC_NONE, dataSize);
+        for (offset = 0; offset < dataSize; ++offset) {
+            if (dataMap[offset] >= 0) {
+                buf[dataMap[offset]] = c->dataBuf[offset];
+                relocs[dataMap[offset]] = c->dataRelocs[offset];
+            }
+        }
+        memcpy(c->dataBuf, buf, newDataSize);
+        memcpy(c->dataRelocs, relocs, dataSize);
+        c->dataFree = c->dataBuf + newDataSize;
+        free(buf);
+    }
+
+    /* update the symbols, strings, objects, and items */
+    UpdateReferences(c, codeMap, codeSize, dataMap, dataSize);
+}
+
+/* ReplaceCode - install a new copy of code space
+ *
+ * The map gives the new offset of each byte of the old code space or -1 if
+ * nothing can point to it. The new code must already contain its own updated
+ * addresses. The code addresses stored in data space, the function symbols, and
+ * the code items are updated to match.
+ */
+void ReplaceCode(ParseContext *c, uint8_t *code, uint8_t *relocs, int size, int *map)
+{
+    int codeSize = c->codeFree - c->codeBuf;
+    int dataSize = c->dataFree - c->dataBuf;
+    UpdateDataAddresses(c, map, codeSize, NULL, dataSize);
+    memcpy(c->codeBuf, code, size);
+    memcpy(c->codeRelocs, relocs, size);
+    if (size < codeSize)
+        memset(c->codeRelocs + size, RELOC_NONE, codeSize - size);
+    c->codeFree = c->codeBuf + size;
+    UpdateReferences(c, map, codeSize, NULL, dataSize);
+}
+
+/* GetCodeAddress - get an address stored in code space */
+VMVALUE GetCodeAddress(ParseContext *c, VMVALUE offset)
+{
+    if (c->codeRelocs[offset] & RELOC_SHORT)
+        return (c->codeBuf[offset] << 8) | c->codeBuf[offset + 1];
+    return rd_clong(c, offset);
+}
+
+/* SetCodeAddress - update an address stored in code space */
+void SetCodeAddress(ParseContext *c, VMVALUE offset, VMVALUE value)
+{
+    if (c->codeRelocs[offset] & RELOC_SHORT) {
+        c->codeBuf[offset] = (uint8_t)(value >> 8);
+        c->codeBuf[offset + 1] = (uint8_t)value;
+    }
+    else
+        wr_clong(c, offset, value);
+}
+
+/* UpdateDataAddresses - update the addresses stored in data space */
+static void UpdateDataAddresses(ParseContext *c, int *codeMap, int codeSize, int *dataMap, int dataSize)
+{
+    int offset;
+    for (offset = 0; offset < dataSize; ++offset) {
+        if ((!dataMap || dataMap[offset] >= 0) && c->dataRelocs[offset] != RELOC_NONE && c->dataRelocs[offset] != RELOC_STRING) {
+            VMVALUE *pValue = (VMVALUE *)&c->dataBuf[offset];
+            if (c->dataRelocs[offset] == RELOC_CODE)
+                *pValue = MapOffset(codeMap, codeSize, *pValue);
+            else
+                *pValue = MapOffset(dataMap, dataSize, *pValue);
+        }
+    }
+}
+
+/* UpdateReferences - update the global symbols, strings, objects, and items */
+static void UpdateReferences(ParseContext *c, int *codeMap, int codeSize, int *dataMap, int dataSize)
+{
+    ObjectListEntry *entry, **pEntry;
+    Symbol *sym;
+    String *str;
+
+    /* update the global symbols */
+    for (sym = c->globals.head; sym != NULL; sym = sym->next) {
+        if (!sym->valueDefined)
+            continue;
+        switch (sym->storageClass) {
+        case SC_FUNCTION:
+            sym->v.value = MapOffset(codeMap, codeSize, sym->v.value);
+            break;
+        case SC_VARIABLE:
+            if ((VMUVALUE)sym->v.value >= COG_BASE)
+                break;
+            /* fall through */
+        case SC_OBJECT:
+            sym->v.value = MapOffset(dataMap, dataSize, sym->v.value);
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* update the string offsets (strings that were moved to string space stay where they are) */
+    for (str = c->strings; str != NULL; str = str->next) {
+        if (str->offset >= 0 && str->offset < STRING_BASE && dataMap)
+            str->offset = str->offset < dataSize ? dataMap[str->offset] : -1;
+    }
+
+    /* update the object list */
+    for (pEntry = &c->objects; (entry = *pEntry) != NULL; ) {
+        if (dataMap && dataMap[entry->object] < 0)
+            *pEntry = entry->next;
+        else {
+            entry->object = MapOffset(dataMap, dataSize, entry->object);
+            pEntry = &entry->next;
+        }
+    }
+
+    /* update the items */
+    UpdateItems(c->codeItems, &c->codeItemCount, codeMap, codeSize);
+    UpdateItems(c->dataItems, &c->dataItemCount, dataMap, dataSize);
+}
+
+/* MapOffset - map an address to its new offset (removed targets become nil) */
+static VMVALUE MapOffset(int *map, int size, VMVALUE offset)
+{
+    if (!map || offset < 0 || offset >= size)
+        return offset;
+    return map[offset] >= 0 ? map[offset] : NIL;
+}
+
+/* MapSize - find the size of a space after it has been moved */
+static int MapSize(int *map, int size)
+{
+    int newSize = 0, offset;
+    if (!map)
+        return size;
+    for (offset = 0; offset < size; ++offset)
+        if (map[offset] >= newSize)
+            newSize = map[offset] + 1;
+    return newSize;
+}
+
+/* UpdateItems - move items to their new offsets and drop the ones that were removed */
+static void UpdateItems(ImageItem *items, int *pCount, int *map, int size)
+{
+    int i, j;
+    if (!map)
+        return;
+    for (i = j = 0; i < *pCount; ++i) {
+        if (items[i].offset < size && map[items[i].offset] >= 0) {
+            items[j] = items[i];
+            items[j].offset = map[items[i].offset];
+            ++j;
+        }
+        else {
+            free(items[i].selectors);
+            free(items[i].storedTags);
+        }
+    }
+    *pCount = j;
+
+    /* the items must stay in address order after code or data is reordered */
+    qsort(items, j, sizeof(ImageItem), CompareItems);
+}
+
+/* CompareItems - compare the offsets of two items */
+static int CompareItems(const void *p1, const void *p2)
+{
+    const ImageItem *item1 = (const ImageItem *)p1;
+    const ImageItem *item2 = (const ImageItem *)p2;
+    return item1->offset < item2->offset ? -1 : item1->offset > item2->offset;
+}
@@ -10,6 +10,12 @@
 #include <string.h>
 #include <setjmp.h>
 #include <ctype.h>
+#ifndef MINGW
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 #include "adv2compiler.h"
 
 /* keyword table */
@@ -43,9 +49,31 @@ static struct {
 {   "asm",      T_ASM       },
 {   "print",    T_PRINT     },
 {   "println",  T_PRINTLN   },
+{   "inline",   T_INLINE    },
+{   "noinline", T_NOINLINE  },
+{   "switch",   T_SWITCH    },
+{   "case",     T_CASE      },
+{   "default",  T_DEFAULT   },
 {   NULL,       0           }
 };
 
+/* keyword perfect hash
+ *
+ * Maps KEYWORDHASH of an identifier to one plus the index of the only keyword
+ * that can match it or zero if no keyword can. The multipliers were chosen so
+ * that no two keywords share a slot. Adding a keyword means finding new ones.
+ */
+#define KEYWORDHASH(p, len) (((p)[0] * 42 + (p)[(len) - 1] * 59 + (len)) & 63)
+#define MINKEYWORD  2
+#define MAXKEYWORD  8
+
+static unsigned char khash[64] = {
+     0, 24, 10,  0, 13,  6,  0, 25,  1, 28,  0, 14, 22,  9,  0,  0,
+     0,  0,  8,  0, 11,  0,  0,  0,  0,  0,  0, 26, 27,  5,  0, 21,
+     0, 23,  0,  0,  0,  3,  0,  0,  0, 17,  0, 29,  0,  2, 18,  0,
+    16,  0,  0,  0, 15,  0,  0,  0, 12,  0, 20, 19,  0,  0,  4,  7
+};
+
 /* special no-identifier tokens */
 static char *ttab[] = {
 "<=",
@@ -75,8 +103,14 @@ static char *ttab[] = {
 "<eof>"
 };
 
+/* the empty line scanned after the end of the last file */
+static char eofLine[1];
+
 /* local function prototypes */
+static int MapFile(ParseContext *c, ParseFile *f, const char *name);
+static void UnmapFile(ParseFile *f);
 static int NextToken(ParseContext *c);
+static void HashToken(ParseContext *c, int token);
 static int IdentifierToken(ParseContext *c, int ch);
 static int IdentifierCharP(int ch);
 static int NumberToken(ParseContext *c, int ch);
@@ -85,17 +119,24 @@ static int BinaryNumberToken(ParseContext *c);
 static int StringToken(ParseContext *c);
 static int CharToken(ParseContext *c);
 static int LiteralChar(ParseContext *c, int ch);
+static void GrowToken(ParseContext *c, size_t size);
 
 /* InitScan - initialize the token scanner */
 void InitScan(ParseContext *c)
 {
     c->currentFile = NULL;
     c->includedFiles = NULL;
+    InitHashTable(&c->includeHash);
     c->currentInclude = NULL;
-    c->linePtr = c->lineBuf;
-    c->lineBuf[0] = '\0';
+    c->lineStart = c->lineEnd = c->linePtr = eofLine;
+    if (!c->token) {
+        if (!(c->token = (char *)malloc(MAXTOKEN + 1)))
+            Abort(c, "insufficient memory");
+        c->tokenSize = MAXTOKEN + 1;
+    }
     c->savedToken = T_NONE;
     c->inComment = VMFALSE;
+    c->tokenHash = HASHSEED;
 }
 
 /* PushFile - push a file onto the input file stack */
@@ -105,30 +146,29 @@ int PushFile(ParseContext *c, const char *name)
     ParseFile *f;
     
     /* check to see if the file has already been included */
-    for (inc = c->includedFiles; inc != NULL; inc = inc->next)
-        if (strcmp(name, inc->name) == 0)
-            return VMTRUE;
+    if (FindHashEntry(&c->includeHash, name))
+        return VMTRUE;
     
     /* add this file to the list of already included files */
-    if (!(inc = (IncludedFile *)malloc(sizeof(IncludedFile) + strlen(name))))
-        ParseError(c, "insufficient memory");
-    strcpy(inc->name, name);
-    inc->next = c->includedFiles;
-    c->includedFiles = inc;
+    AddIncludedFile(c, name);
+    inc = c->includedFiles;
 
     /* allocate a parse file structure */
     if (!(f = (ParseFile *)malloc(sizeof(ParseFile))))
         ParseError(c, "insufficient memory");
     
-    /* open the input file */
-    if (!(f->file.fp = fopen(name, "r"))) {
+    /* map the input file */
+    if (!MapFile(c, f, name)) {
         free(f);
         return VMFALSE;
     }
     f->file.file = inc;
     
     /* initialize the parse context */
+    f->nextLine = f->text;
     f->lineNumber = 0;
+    f->module = NULL;
+    f->startTime = StatsTime(c);
     
     /* push the file onto the input file stack */
     f->next = c->currentFile;
@@ -139,43 +179,148 @@ int PushFile(ParseContext *c, const char *name)
     return VMTRUE;
 }
 
+/* AddIncludedFile - add a file to the list of already included files */
+void AddIncludedFile(ParseContext *c, const char *name)
+{
+    IncludedFile *inc;
+    if (!(inc = (IncludedFile *)malloc(sizeof(IncludedFile) + strlen(name))))
+        ParseError(c, "insufficient memory");
+    strcpy(inc->name, name);
+    inc->next = c->includedFiles;
+    c->includedFiles = inc;
+    AddHashEntry(c, &c->includeHash, inc->name, inc);
+}
+
+/* HashFile - compute the hash of the text of a file */
+int HashFile(ParseContext *c, const char *name, uint64_t *pHash)
+{
+    ParseFile f;
+    if (!MapFile(c, &f, name))
+        return VMFALSE;
+    *pHash = HashData(HASHSEED, f.text, f.size);
+    UnmapFile(&f);
+    return VMTRUE;
+}
+
+/* MapFile - map the text of a file into memory
+ *
+ * Every line of the text ends with a newline so a token never runs past the
+ * end of its line. A file that doesn't end with one, or that can't be mapped,
+ * is read into memory instead.
+ */
+static int MapFile(ParseContext *c, ParseFile *f, const char *name)
+{
+    size_t size, len;
+    char *text;
+    FILE *fp;
+    
+#ifndef MINGW
+    struct stat info;
+    int fd;
+    
+    /* map the file if it ends with a newline */
+    if ((fd = open(name, O_RDONLY)) < 0)
+        return VMFALSE;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        size = (size_t)info.st_size;
+        if ((text = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) != (char *)MAP_FAILED) {
+            if (text[size - 1] == '\n') {
+                close(fd);
+                f->text = text;
+                f->size = size;
+                f->mapped = VMTRUE;
+                return VMTRUE;
+            }
+            munmap(text, size);
+        }
+    }
+    close(fd);
+#endif
+
+    /* otherwise, read the file leaving room for a final newline */
+    if (!(fp = fopen(name, "r")))
+        return VMFALSE;
+    text = NULL;
+    size = len = 0;
+    do {
+        if (len + 1 >= size) {
+            char *newText;
+            size = size ? size * 2 : 4096;
+            if (!(newText = (char *)realloc(text, size))) {
+                free(text);
+                fclose(fp);
+                ParseError(c, "insufficient memory");
+            }
+            text = newText;
+        }
+        len += fread(text + len, 1, size - len - 1, fp);
+    } while (!feof(fp) && !ferror(fp));
+    fclose(fp);
+    if (len > 0 && text[len - 1] != '\n')
+        text[len++] = '\n';
+    
+    f->text = text;
+    f->size = len;
+    f->mapped = VMFALSE;
+    return VMTRUE;
+}
+
+/* UnmapFile - release the text of a file */
+static void UnmapFile(ParseFile *f)
+{
+#ifndef MINGW
+    if (f->mapped) {
+        munmap(f->text, f->size);
+        return;
+    }
+#endif
+    free(f->text);
+}
+
 /* GetLine - get the next input line */
 int GetLine(ParseContext *c)
 {
     ParseFile *f;
-    int len;
+    char *end;
 
     /* get the next input line */
     for (;;) {
         
         /* get the current input file */
-        if (!(f = c->currentFile))
+        if (!(f = c->currentFile)) {
+            c->lineStart = c->lineEnd = c->linePtr = eofLine;
             return VMFALSE;
+        }
         
         /* get a line from the main input */
-        if (fgets(c->lineBuf, sizeof(c->lineBuf) - 1, f->file.fp))
+        if (f->nextLine < f->text + f->size)
             break;
         
+        /* finish the module being recorded from the file */
+        if (f->module) {
+            int phase = BeginPhase(c, PHASE_MODULE);
+            EndModule(c, f);
+            EndPhase(c, phase);
+        }
+        AddFileStats(c, f->file.file->name, f->startTime, f->lineNumber, f->size, VMFALSE);
+        
         /* pop the input file stack on end of file */
         if ((c->currentFile = f->next) != NULL)
             c->currentInclude = c->currentFile->file.file;
         else
             c->currentInclude = NULL;
             
-        /* close the file we just finished */
-        fclose(f->file.fp);
+        /* release the file we just finished */
+        UnmapFile(f);
         free(f);
     }
     
-    /* make sure the line is correctly terminated */
-    len = strlen(c->lineBuf);
-    if (len == 0 || c->lineBuf[len - 1] != '\n') {
-        c->lineBuf[len++] = '\n';
-        c->lineBuf[len] = '\0';
-    }
+    /* find the end of the line (the text always ends with a newline) */
+    end = (char *)memchr(f->nextLine, '\n', f->text + f->size - f->nextLine);
 
-    /* initialize the input buffer */
-    c->linePtr = c->lineBuf;
+    /* initialize the input line */
+    c->lineStart = c->linePtr = f->nextLine;
+    c->lineEnd = f->nextLine = end + 1;
     ++f->lineNumber;
 
     /* clear lookahead token */
@@ -211,8 +356,13 @@ int GetToken(ParseContext *c)
         c->savedToken = T_NONE;
 
     /* otherwise, get the next token */
-    else
+    else {
+        int phase = BeginPhase(c, PHASE_SCAN);
         tkn = NextToken(c);
+        if (c->useModules)
+            HashToken(c, tkn);
+        EndPhase(c, phase);
+    }
 
     /* return the token */
     return tkn;
@@ -224,6 +374,21 @@ void SaveToken(ParseContext *c, int token)
     c->savedToken = token;
 }
 
+/* HashToken - add a token to the hash of the tokens read so far */
+static void HashToken(ParseContext *c, int token)
+{
+    c->tokenHash = HashData(c->tokenHash, &token, sizeof(token));
+    switch (token) {
+    case T_IDENTIFIER:
+    case T_STRING:
+        c->tokenHash = HashData(c->tokenHash, c->token, strlen(c->token) + 1);
+        break;
+    case T_NUMBER:
+        c->tokenHash = HashData(c->tokenHash, &c->value, sizeof(c->value));
+        break;
+    }
+}
+
 /* TokenName - get the name of a token */
 char *TokenName(int token)
 {
@@ -257,7 +422,7 @@ again:
     ch = SkipSpaces(c);
 
     /* remember the start of the current token */
-    c->tokenOffset = (int)(c->linePtr - c->lineBuf);
+    c->tokenOffset = (int)(c->linePtr - c->lineStart);
 
     /* check the next character */
     switch (ch) {
@@ -411,28 +576,35 @@ again:
     return tkn;
 }
 
-/* IdentifierToken - get an identifier */
+/* IdentifierToken - get an identifier
+ *
+ * The identifier is scanned in place. It can't run past the newline at the
+ * end of the line.
+ */
 static int IdentifierToken(ParseContext *c, int ch)
 {
+    char *start = c->linePtr - 1, *p = c->linePtr;
     int len, i;
-    char *p;
 
     /* get the identifier */
-    p = c->token; *p++ = ch; len = 1;
-    while ((ch = GetChar(c)) != EOF && IdentifierCharP(ch)) {
-        if (++len > MAXTOKEN)
-            ParseError(c, "Identifier too long");
-        *p++ = ch;
-    }
-    UngetC(c);
-    *p = '\0';
+    while (IdentifierCharP(*p))
+        ++p;
+    c->linePtr = p;
+    if ((len = (int)(p - start)) > MAXTOKEN)
+        ParseError(c, "Identifier too long");
 
     /* check to see if it is a keyword */
-    for (i = 0; ktab[i].keyword != NULL; ++i)
-        if (strcmp(ktab[i].keyword, c->token) == 0)
-            return ktab[i].token;
+    if (len >= MINKEYWORD && len <= MAXKEYWORD && (i = khash[KEYWORDHASH(start, len)]) != 0) {
+        char *keyword = ktab[i - 1].keyword;
+        if (strncmp(keyword, start, len) == 0 && keyword[len] == '\0') {
+            strcpy(c->token, keyword);
+            return ktab[i - 1].token;
+        }
+    }
 
     /* otherwise, it is an identifier */
+    memcpy(c->token, start, len);
+    c->token[len] = '\0';
     return T_IDENTIFIER;
 }
 
@@ -448,17 +620,19 @@ static int IdentifierCharP(int ch)
 /* NumberToken - get a number */
 static int NumberToken(ParseContext *c, int ch)
 {
-    char *p = c->token;
+    char *p, *q;
+
+    /* make room for the number (it ends before the end of the line) */
+    if ((size_t)(c->lineEnd - c->linePtr + 1) >= c->tokenSize)
+        GrowToken(c, c->lineEnd - c->linePtr + 2);
 
     /* get the number */
+    p = c->token; q = c->linePtr;
     *p++ = ch;
-    while ((ch = GetChar(c)) != EOF) {
-        if (isdigit(ch))
-            *p++ = ch;
-        else if (ch != '_')
-            break;
-    }
-    UngetC(c);
+    for (; isdigit(*q) || *q == '_'; ++q)
+        if (*q != '_')
+            *p++ = *q;
+    c->linePtr = q;
     *p = '\0';
     
     /* convert the string to an integer */
@@ -522,10 +696,12 @@ static int StringToken(ParseContext *c)
 
     /* collect the string */
     p = c->token; len = 0;
-    while ((ch = GetChar(c)) != '"') {
+    while ((ch = GetChar(c)) != '"' && ch != EOF) {
         ch = LiteralChar(c, ch);
-        if (++len > MAXTOKEN)
-            ParseError(c, "String too long");
+        if (++len >= c->tokenSize) {
+            GrowToken(c, c->tokenSize * 2);
+            p = c->token + len - 1;
+        }
         *p++ = ch;
     }
     *p = '\0';
@@ -607,6 +783,16 @@ static int LiteralChar(ParseContext *c, int ch)
     return ch;
 }
 
+/* GrowToken - make room for a longer token */
+static void GrowToken(ParseContext *c, size_t size)
+{
+    char *token;
+    if (!(token = (char *)realloc(c->token, size)))
+        ParseError(c, "insufficient memory");
+    c->token = token;
+    c->tokenSize = size;
+}
+
 /* SkipSpaces - skip leading spaces and the the next non-blank character */
 int SkipSpaces(ParseContext *c)
 {
@@ -620,16 +806,16 @@ int SkipSpaces(ParseContext *c)
 /* GetChar - get the next character */
 int GetChar(ParseContext *c)
 {
-    int ch;
-    
     /* get the next character on the current line */
-    while (!(ch = *c->linePtr++)) {
-        if (!GetLine(c))
+    while (c->linePtr >= c->lineEnd) {
+        if (!GetLine(c)) {
+            ++c->linePtr; /* so UngetC leaves us at the end */
             return EOF;
+        }
     }
     
     /* return the character */
-    return ch;
+    return *c->linePtr++;
 }
 
 /* UngetC - unget the most recent character */
@@ -652,10 +838,11 @@ void ParseError(ParseContext *c, char *fmt, ...)
     va_end(ap);
 
     /* show the context */
-    if (c->currentFile)
+    if (c->currentFile) {
         printf("  line %d\n", c->currentFile->lineNumber);
-    printf("    %s\n", c->lineBuf);
-    printf("    %*s\n", c->tokenOffset, "^");
+        printf("    %.*s\n", (int)(c->lineEnd - c->lineStart - 1), c->lineStart);
+        printf("    %*s\n", c->tokenOffset, "^");
+    }
 
     /* exit until we fix the compiler so it can recover from parse errors */
     longjmp(c->errorTarget, 1);
@@ -0,0 +1,335 @@
+/* adv2shake.c - remove functions, objects, and strings that can't be reached
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+
+/* tree shaker state */
+typedef struct {
+    ParseContext *c;
+    VMVALUE *usedTags;      /* properties used as constant selectors by reachable code (zero if empty) */
+    int usedTagCount;       /* number of used tags */
+    int usedTagSize;        /* size of the used tag table (a power of two) */
+    int allTagsUsed;        /* reachable code uses computed selectors */
+    int changed;            /* something new was found to be reachable */
+} ShakeState;
+
+/* removal statistics */
+typedef struct {
+    int functions;
+    int objects;
+    int variables;
+    int strings;
+    int properties;
+    int codeBytes;
+    int dataBytes;
+} ShakeStats;
+
+/* local function prototypes */
+static void MarkAddress(ShakeState *s, int relocType, VMVALUE value);
+static void UseTag(ShakeState *s, VMVALUE tag);
+static int IsTagUsed(ShakeState *s, VMVALUE tag);
+static VMVALUE *FindTag(ShakeState *s, VMVALUE tag);
+static void ScanCode(ShakeState *s, int i);
+static void ScanData(ShakeState *s, int i);
+static int *BuildCodeMap(ShakeState *s, ShakeStats *stats);
+static int *BuildDataMap(ShakeState *s, ShakeStats *stats);
+static VMVALUE ItemEnd(ImageItem *items, int count, int i, int size);
+
+/* ShakeTree - remove everything that can't be reached from main
+ *
+ * The initialization function is a root too since the data it leaves behind
+ * can point to anything it could reach.
+ * Reachability follows the addresses stored in reachable code and data. The
+ * value of a property is only followed if some reachable function uses its tag
+ * as a selector or if reachable code computes selectors at run time. Properties
+ * that are never selected are dropped from their objects.
+ */
+void ShakeTree(ParseContext *c)
+{
+    ShakeState state, *s = &state;
+    ShakeStats stats;
+    int *codeMap, *dataMap;
+    Symbol *sym;
+    int i;
+
+    /* BuildImage reports a missing main function */
+    if (!(sym = FindSymbol(c, c->mainName)) || !sym->valueDefined || sym->storageClass != SC_FUNCTION)
+        return;
+
+    /* initialize the shaker state */
+    memset(s, 0, sizeof(ShakeState));
+    s->c = c;
+    s->usedTagSize = 64;
+    while (s->usedTagSize < c->propertyCount * 2)
+        s->usedTagSize *= 2;
+    s->usedTags = (VMVALUE *)LocalAlloc(c, s->usedTagSize * sizeof(VMVALUE));
+    memset(s->usedTags, 0, s->usedTagSize * sizeof(VMVALUE));
+    for (i = 0; i < c->codeItemCount; ++i)
+        c->codeItems[i].reachable = VMFALSE;
+    for (i = 0; i < c->dataItemCount; ++i)
+        c->dataItems[i].reachable = VMFALSE;
+
+    /* mark the roots */
+    MarkAddress(s, RELOC_CODE, 0);
+    MarkAddress(s, RELOC_DATA, 0);
+    MarkAddress(s, RELOC_CODE, sym->v.value);
+    if (c->initName && (sym = FindSymbol(c, c->initName)) != NULL && sym->valueDefined && sym->storageClass == SC_FUNCTION)
+        MarkAddress(s, RELOC_CODE, sym->v.value);
+    if ((sym = FindSymbol(c, "_words")) != NULL && sym->valueDefined)
+        MarkAddress(s, RELOC_DATA, sym->v.value);
+    if ((sym = FindSymbol(c, "_wordTypes")) != NULL && sym->valueDefined)
+        MarkAddress(s, RELOC_DATA, sym->v.value);
+
+    /* scan reachable items until nothing new is found */
+    do {
+        s->changed = VMFALSE;
+        for (i = 0; i < c->codeItemCount; ++i)
+            if (c->codeItems[i].reachable)
+                ScanCode(s, i);
+        for (i = 0; i < c->dataItemCount; ++i)
+            if (c->dataItems[i].reachable)
+                ScanData(s, i);
+    } while (s->changed);
+
+    /* remove the unreachable items */
+    memset(&stats, 0, sizeof(ShakeStats));
+    codeMap = BuildCodeMap(s, &stats);
+    dataMap = BuildDataMap(s, &stats);
+    RelocateImage(c, codeMap, dataMap);
+    free(codeMap);
+    free(dataMap);
+    free(s->usedTags);
+
+    /* report what was removed with the other statistics (-T or -J) */
+    if (c->stats)
+        printf("shake: removed %d functions, %d objects, %d variables, %d strings, %d properties (%d code bytes, %d data bytes)\n",
+               stats.functions, stats.objects, stats.variables, stats.strings, stats.properties, stats.codeBytes, stats.dataBytes);
+}
+
+/* MarkAddress - mark the item containing an address as reachable */
+static void MarkAddress(ShakeState *s, int relocType, VMVALUE value)
+{
+    ParseContext *c = s->c;
+    ImageItem *item;
+    int i;
+    if (relocType == RELOC_CODE) {
+        if ((i = FindItem(c->codeItems, c->codeItemCount, value)) < 0)
+            return;
+        item = &c->codeItems[i];
+    }
+    else {
+        if ((i = FindItem(c->dataItems, c->dataItemCount, value)) < 0)
+            return;
+        item = &c->dataItems[i];
+    }
+    if (!item->reachable) {
+        item->reachable = VMTRUE;
+        s->changed = VMTRUE;
+    }
+}
+
+/* UseTag - note that a property is used as a selector
+ *
+ * The tags are kept in a hash table since the tags of a linked program are
+ * hashes of the property names rather than small numbers.
+ */
+static void UseTag(ShakeState *s, VMVALUE tag)
+{
+    VMVALUE *entry;
+    if (tag <= 0 || *(entry = FindTag(s, tag)) != 0)
+        return;
+    *entry = tag;
+    s->changed = VMTRUE;
+
+    /* keep the table at most half full */
+    if (++s->usedTagCount * 2 > s->usedTagSize) {
+        VMVALUE *oldTags = s->usedTags;
+        int oldSize = s->usedTagSize, i;
+        s->usedTagSize *= 2;
+        s->usedTags = (VMVALUE *)LocalAlloc(s->c, s->usedTagSize * sizeof(VMVALUE));
+        memset(s->usedTags, 0, s->usedTagSize * sizeof(VMVALUE));
+        for (i = 0; i < oldSize; ++i)
+            if (oldTags[i] != 0)
+                *FindTag(s, oldTags[i]) = oldTags[i];
+        free(oldTags);
+    }
+}
+
+/* IsTagUsed - check whether a property can be selected by reachable code */
+static int IsTagUsed(ShakeState *s, VMVALUE tag)
+{
+    tag &= ~P_SHARED;
+    return s->allTagsUsed || (tag > 0 && *FindTag(s, tag) != 0);
+}
+
+/* FindTag - find the used tag table entry of a tag or the empty entry where it belongs */
+static VMVALUE *FindTag(ShakeState *s, VMVALUE tag)
+{
+    int mask = s->usedTagSize - 1;
+    int i = (int)(((VMUVALUE)tag * 2654435761u) & mask);
+    while (s->usedTags[i] != 0 && s->usedTags[i] != tag)
+        i = (i + 1) & mask;
+    return &s->usedTags[i];
+}
+
+/* ScanCode - mark everything referenced by a reachable function */
+static void ScanCode(ShakeState *s, int i)
+{
+    ParseContext *c = s->c;
+    ImageItem *item = &c->codeItems[i];
+    VMVALUE end = ItemEnd(c->codeItems, c->codeItemCount, i, c->codeFree - c->codeBuf);
+    VMVALUE offset;
+    int j;
+
+    /* mark the properties selected by the function */
+    if (item->dynamicSelectors && !s->allTagsUsed) {
+        s->allTagsUsed = VMTRUE;
+        s->changed = VMTRUE;
+    }
+    for (j = 0; j < item->selectorCount; ++j)
+        UseTag(s, item->selectors[j]);
+
+    /* mark the functions, objects, variables, and strings referenced by the function */
+    for (offset = item->offset; offset < end; ++offset)
+        if (c->codeRelocs[offset] != RELOC_NONE)
+            MarkAddress(s, RELOC_TYPE(c->codeRelocs[offset]), GetCodeAddress(c, offset));
+}
+
+/* ScanData - mark everything referenced by a reachable object or variable */
+static void ScanData(ShakeState *s, int i)
+{
+    ParseContext *c = s->c;
+    ImageItem *item = &c->dataItems[i];
+    VMVALUE end = ItemEnd(c->dataItems, c->dataItemCount, i, c->dataFree - c->dataBuf);
+    VMVALUE offset;
+
+    switch (item->type) {
+    case IT_OBJECT:
+        {
+            ObjectHdr *objectHdr = (ObjectHdr *)(c->dataBuf + item->offset);
+            Property *property = (Property *)(objectHdr + 1);
+            int cnt;
+            if (c->dataRelocs[item->offset] != RELOC_NONE)
+                MarkAddress(s, RELOC_DATA, objectHdr->class);
+            for (cnt = objectHdr->nProperties; --cnt >= 0; ++property) {
+                offset = (uint8_t *)&property->value - c->dataBuf;
+                if (c->dataRelocs[offset] != RELOC_NONE && IsTagUsed(s, property->tag))
+                    MarkAddress(s, c->dataRelocs[offset], property->value);
+            }
+        }
+        break;
+    case IT_DATA:
+        for (offset = item->offset; offset < end; offset += sizeof(VMVALUE))
+            if (c->dataRelocs[offset] != RELOC_NONE)
+                MarkAddress(s, c->dataRelocs[offset], *(VMVALUE *)(c->dataBuf + offset));
+        break;
+    default:
+        break;
+    }
+}
+
+/* BuildCodeMap - assign new offsets to the reachable functions */
+static int *BuildCodeMap(ShakeState *s, ShakeStats *stats)
+{
+    ParseContext *c = s->c;
+    int codeSize = c->codeFree - c->codeBuf;
+    int *map = (int *)LocalAlloc(c, (codeSize + 1) * sizeof(int));
+    int newOffset = 0, i;
+    VMVALUE offset;
+
+    for (i = 0; i < c->codeItemCount; ++i) {
+        ImageItem *item = &c->codeItems[i];
+        VMVALUE end = ItemEnd(c->codeItems, c->codeItemCount, i, codeSize);
+        if (item->reachable) {
+            for (offset = item->offset; offset < end; ++offset)
+                map[offset] = newOffset++;
+        }
+        else {
+            if (c->debugMode)
+                printf("shake: removing function %s\n", item->name ? item->name : "(anonymous)");
+            for (offset = item->offset; offset < end; ++offset)
+                map[offset] = -1;
+            stats->codeBytes += end - item->offset;
+            ++stats->functions;
+        }
+    }
+
+    return map;
+}
+
+/* BuildDataMap - assign new offsets to the reachable data and drop unused properties */
+static int *BuildDataMap(ShakeState *s, ShakeStats *stats)
+{
+    ParseContext *c = s->c;
+    int dataSize = c->dataFree - c->dataBuf;
+    int *map = (int *)LocalAlloc(c, (dataSize + 1) * sizeof(int));
+    int newOffset = 0, i;
+    VMVALUE offset;
+
+    for (i = 0; i < c->dataItemCount; ++i) {
+        ImageItem *item = &c->dataItems[i];
+        VMVALUE end = ItemEnd(c->dataItems, c->dataItemCount, i, dataSize);
+        offset = item->offset;
+
+        /* remove unreachable items */
+        if (!item->reachable) {
+            if (c->debugMode && item->name)
+                printf("shake: removing %s %s\n", item->type == IT_OBJECT ? "object" : "variable", item->name);
+            while (offset < end)
+                map[offset++] = -1;
+            stats->dataBytes += end - item->offset;
+            switch (item->type) {
+            case IT_OBJECT:
+                ++stats->objects;
+                break;
+            case IT_STRING:
+                ++stats->strings;
+                break;
+            default:
+                ++stats->variables;
+                break;
+            }
+            continue;
+        }
+
+        /* remove properties that are never selected */
+        if (item->type == IT_OBJECT) {
+            ObjectHdr *objectHdr = (ObjectHdr *)(c->dataBuf + item->offset);
+            Property *property = (Property *)(objectHdr + 1);
+            int cnt, nProperties = 0;
+            while (offset < (uint8_t *)property - c->dataBuf)
+                map[offset++] = newOffset++;
+            for (cnt = objectHdr->nProperties; --cnt >= 0; ++property) {
+                if (IsTagUsed(s, property->tag)) {
+                    while (offset < (uint8_t *)(property + 1) - c->dataBuf)
+                        map[offset++] = newOffset++;
+                    ++nProperties;
+                }
+                else {
+                    while (offset < (uint8_t *)(property + 1) - c->dataBuf)
+                        map[offset++] = -1;
+                    stats->dataBytes += sizeof(Property);
+                    ++stats->properties;
+                }
+            }
+            objectHdr->nProperties = nProperties;
+        }
+
+        /* keep everything else */
+        while (offset < end)
+            map[offset++] = newOffset++;
+    }
+
+    return map;
+}
+
+/* ItemEnd - get the offset just past an item */
+static VMVALUE ItemEnd(ImageItem *items, int count, int i, int size)
+{
+    return i + 1 < count ? items[i + 1].offset : size;
+}
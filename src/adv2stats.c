@@ -0,0 +1,357 @@
+/* adv2stats.c - phase timing and memory statistics of a compile
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef MINGW
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "adv2compiler.h"
+
+/* statistics of a phase */
+typedef struct {
+    uint64_t time;              /* time spent in the phase (not counting the phases it starts) */
+    int calls;                  /* number of times the phase started */
+    size_t localBytes;          /* bytes allocated by LocalAlloc */
+    size_t arenaBytes;          /* bytes allocated from arenas */
+} PhaseStats;
+
+/* statistics of a source file */
+typedef struct FileStats FileStats;
+struct FileStats {
+    FileStats *next;            /* next file in the order the files were started */
+    uint64_t startTime;         /* time the file was started */
+    uint64_t time;              /* time from the start to the end of the file (including its includes) */
+    int lines;                  /* number of lines */
+    size_t size;                /* size of the text */
+    int cached;                 /* loaded from a module */
+    char name[1];               /* file name */
+};
+
+/* statistics of a compile */
+struct CompileStats {
+    PhaseStats phases[PHASECOUNT];
+    int phase;                  /* current phase */
+    uint64_t startTime;         /* time the statistics started */
+    uint64_t switchTime;        /* time of the last phase change */
+    uint64_t threadTime;        /* time spent generating code on other threads */
+    int threadFunctions;        /* number of functions generated on other threads */
+    FileStats *files;           /* files in the order they were started */
+};
+
+/* phase names (in the order of the phases) */
+static char *phaseNames[] = {
+    "other",
+    "scan",
+    "parse",
+    "optimize",
+    "generate",
+    "link",
+    "module",
+    "vocabulary",
+    "strings",
+    "connect",
+    "shake",
+    "relax",
+    "profile",
+    "initialize",
+    "image"
+};
+
+/* local function prototypes */
+static void ChargePhase(CompileStats *s);
+static void PrintReport(ParseContext *c, CompileStats *s, uint64_t total);
+static void WriteJson(ParseContext *c, CompileStats *s, uint64_t total, const char *inputFile, const char *name);
+static void WriteJsonString(FILE *fp, const char *str);
+static int StringBytes(ParseContext *c);
+static double Seconds(uint64_t time);
+static double Milliseconds(uint64_t time);
+
+/* StartStats - start collecting statistics */
+void StartStats(ParseContext *c)
+{
+    CompileStats *s = (CompileStats *)LocalAlloc(c, sizeof(CompileStats));
+    memset(s, 0, sizeof(CompileStats));
+    s->phase = PHASE_OTHER;
+    s->startTime = s->switchTime = ClockTime();
+    c->stats = s;
+}
+
+/* FreeStats - free the statistics */
+void FreeStats(ParseContext *c)
+{
+    CompileStats *s = c->stats;
+    FileStats *file, *next;
+    if (!s)
+        return;
+    for (file = s->files; file != NULL; file = next) {
+        next = file->next;
+        free(file);
+    }
+    free(s);
+    c->stats = NULL;
+}
+
+/* BeginPhase - start a phase and return the phase to go back to when it ends */
+int BeginPhase(ParseContext *c, CompilePhase phase)
+{
+    CompileStats *s = c->stats;
+    int previous;
+    if (!s)
+        return PHASE_OTHER;
+    ChargePhase(s);
+    previous = s->phase;
+    s->phase = phase;
+    ++s->phases[phase].calls;
+    return previous;
+}
+
+/* EndPhase - end the current phase and go back to the one returned by BeginPhase */
+void EndPhase(ParseContext *c, int phase)
+{
+    CompileStats *s = c->stats;
+    if (!s)
+        return;
+    ChargePhase(s);
+    s->phase = phase;
+}
+
+/* ChargePhase - add the time since the last phase change to the current phase */
+static void ChargePhase(CompileStats *s)
+{
+    uint64_t now = ClockTime();
+    s->phases[s->phase].time += now - s->switchTime;
+    s->switchTime = now;
+}
+
+/* CountAlloc - count memory allocated in the current phase */
+void CountAlloc(ParseContext *c, size_t size, int arena)
+{
+    CompileStats *s = c->stats;
+    if (arena)
+        s->phases[s->phase].arenaBytes += size;
+    else
+        s->phases[s->phase].localBytes += size;
+}
+
+/* ClockTime - get a monotonic time in nanoseconds */
+uint64_t ClockTime(void)
+{
+#ifdef MINGW
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)count.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/* StatsTime - get the time if statistics are being collected or zero */
+uint64_t StatsTime(ParseContext *c)
+{
+    return c->stats ? ClockTime() : 0;
+}
+
+/* AddThreadTime - count the time another thread spent generating the code of a function */
+void AddThreadTime(ParseContext *c, uint64_t time)
+{
+    CompileStats *s = c->stats;
+    if (!s)
+        return;
+    s->threadTime += time;
+    ++s->threadFunctions;
+}
+
+/* AddFileStats - record a file that has been compiled or loaded from a module */
+void AddFileStats(ParseContext *c, const char *name, uint64_t startTime, int lines, size_t size, int cached)
+{
+    CompileStats *s = c->stats;
+    FileStats *file, **pNext;
+
+    if (!s)
+        return;
+
+    file = (FileStats *)LocalAlloc(c, sizeof(FileStats) + strlen(name));
+    strcpy(file->name, name);
+    file->startTime = startTime;
+    file->time = ClockTime() - startTime;
+    file->lines = lines;
+    file->size = size;
+    file->cached = cached;
+
+    /* included files end before the files that include them */
+    for (pNext = &s->files; *pNext != NULL && (*pNext)->startTime <= startTime; pNext = &(*pNext)->next)
+        ;
+    file->next = *pNext;
+    *pNext = file;
+}
+
+/* ReportStats - print the statistics and write them to a JSON file */
+void ReportStats(ParseContext *c, const char *inputFile, int printReport, const char *jsonFile)
+{
+    CompileStats *s = c->stats;
+    uint64_t total;
+
+    if (!s)
+        return;
+
+    ChargePhase(s);
+    total = s->switchTime - s->startTime;
+
+    if (printReport)
+        PrintReport(c, s, total);
+    if (jsonFile)
+        WriteJson(c, s, total, inputFile, jsonFile);
+}
+
+/* PrintReport - print the statistics */
+static void PrintReport(ParseContext *c, CompileStats *s, uint64_t total)
+{
+    FileStats *file;
+    int i;
+
+    printf("phase           calls         time      %%  local bytes  arena bytes\n");
+    for (i = 0; i < PHASECOUNT; ++i) {
+        PhaseStats *phase = &s->phases[i];
+        if (phase->calls == 0 && phase->time == 0)
+            continue;
+        printf("  %-12s %7d %10.3fms %5.1f%% %12lu %12lu\n",
+               phaseNames[i],
+               phase->calls,
+               Milliseconds(phase->time),
+               total ? phase->time * 100.0 / total : 0.0,
+               (unsigned long)phase->localBytes,
+               (unsigned long)phase->arenaBytes);
+    }
+    printf("  %-12s %7s %10.3fms\n", "total", "", Milliseconds(total));
+
+    if (s->threadFunctions > 0)
+        printf("code generation threads: %.3fms for %d functions\n", Milliseconds(s->threadTime), s->threadFunctions);
+
+    printf("global symbols: %d (table size %d), strings: %d (%d bytes), words: %d, properties: %d\n",
+           c->globals.hash.count,
+           c->globals.hash.size,
+           c->stringHash.count,
+           StringBytes(c),
+           c->wordCount,
+           c->propertyCount);
+    printf("code items: %d, data items: %d\n", c->codeItemCount, c->dataItemCount);
+
+    if (s->files) {
+        printf("files:\n");
+        for (file = s->files; file != NULL; file = file->next)
+            printf("  %10.3fms %7d lines %9lu bytes  %s%s\n",
+                   Milliseconds(file->time),
+                   file->lines,
+                   (unsigned long)file->size,
+                   file->name,
+                   file->cached ? " (module)" : "");
+    }
+}
+
+/* WriteJson - write the statistics to a JSON file */
+static void WriteJson(ParseContext *c, CompileStats *s, uint64_t total, const char *inputFile, const char *name)
+{
+    FileStats *file;
+    FILE *fp;
+    int i;
+
+    if (!(fp = fopen(name, "w")))
+        Abort(c, "can't create file '%s'", name);
+
+    fprintf(fp, "{\n  \"input\": ");
+    WriteJsonString(fp, inputFile);
+    fprintf(fp, ",\n  \"optimizeLevel\": %d,\n", c->optimizeLevel);
+    fprintf(fp, "  \"totalSeconds\": %.6f,\n", Seconds(total));
+
+    fprintf(fp, "  \"phases\": [\n");
+    for (i = 0; i < PHASECOUNT; ++i) {
+        PhaseStats *phase = &s->phases[i];
+        fprintf(fp, "    { \"name\": \"%s\", \"calls\": %d, \"seconds\": %.6f, \"localBytes\": %lu, \"arenaBytes\": %lu }%s\n",
+                phaseNames[i],
+                phase->calls,
+                Seconds(phase->time),
+                (unsigned long)phase->localBytes,
+                (unsigned long)phase->arenaBytes,
+                i < PHASECOUNT - 1 ? "," : "");
+    }
+    fprintf(fp, "  ],\n");
+
+    fprintf(fp, "  \"threads\": { \"seconds\": %.6f, \"functions\": %d },\n", Seconds(s->threadTime), s->threadFunctions);
+
+    fprintf(fp, "  \"tables\": {\n");
+    fprintf(fp, "    \"globalSymbols\": %d,\n", c->globals.hash.count);
+    fprintf(fp, "    \"globalSymbolTableSize\": %d,\n", c->globals.hash.size);
+    fprintf(fp, "    \"strings\": %d,\n", c->stringHash.count);
+    fprintf(fp, "    \"stringTableSize\": %d,\n", c->stringHash.size);
+    fprintf(fp, "    \"stringBytes\": %d,\n", StringBytes(c));
+    fprintf(fp, "    \"words\": %d,\n", c->wordCount);
+    fprintf(fp, "    \"properties\": %d,\n", c->propertyCount);
+    fprintf(fp, "    \"codeItems\": %d,\n", c->codeItemCount);
+    fprintf(fp, "    \"dataItems\": %d,\n", c->dataItemCount);
+    fprintf(fp, "    \"codeBytes\": %d,\n", (int)(c->codeFree - c->codeBuf));
+    fprintf(fp, "    \"dataBytes\": %d\n", (int)(c->dataFree - c->dataBuf));
+    fprintf(fp, "  },\n");
+
+    fprintf(fp, "  \"files\": [");
+    for (file = s->files; file != NULL; file = file->next) {
+        fprintf(fp, "\n    { \"name\": ");
+        WriteJsonString(fp, file->name);
+        fprintf(fp, ", \"seconds\": %.6f, \"lines\": %d, \"bytes\": %lu, \"module\": %s }%s",
+                Seconds(file->time),
+                file->lines,
+                (unsigned long)file->size,
+                file->cached ? "true" : "false",
+                file->next ? "," : "\n  ");
+    }
+    fprintf(fp, "]\n}\n");
+
+    fclose(fp);
+}
+
+/* WriteJsonString - write a string as a JSON string */
+static void WriteJsonString(FILE *fp, const char *str)
+{
+    putc('"', fp);
+    for (; *str != '\0'; ++str) {
+        int ch = *str & 0xff;
+        if (ch == '"' || ch == '\\')
+            fprintf(fp, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(fp, "\\u%04x", ch);
+        else
+            putc(ch, fp);
+    }
+    putc('"', fp);
+}
+
+/* StringBytes - get the size of the string constants */
+static int StringBytes(ParseContext *c)
+{
+    String *str;
+    int size = 0;
+    for (str = c->strings; str != NULL; str = str->next)
+        size += str->size;
+    return size;
+}
+
+/* Seconds - convert a time in nanoseconds to seconds */
+static double Seconds(uint64_t time)
+{
+    return time / 1e9;
+}
+
+/* Milliseconds - convert a time in nanoseconds to milliseconds */
+static double Milliseconds(uint64_t time)
+{
+    return time / 1e6;
+}
@@ -0,0 +1,73 @@
+/* adv2text.c - compress the text of string constants with a dictionary of pairs
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "adv2compiler.h"
+
+/* a pair has to replace at least this many pairs of bytes to save more than its two dictionary bytes */
+#define TEXT_MINUSES    3
+
+/* local function prototypes */
+static int ReplacePair(uint8_t *data, int length, int first, int second, int code);
+
+/* CompressText - build a dictionary of pairs for a set of texts and compress them with it
+ *
+ * The pair of adjacent bytes that occurs most often in all of the texts is
+ * replaced everywhere by a new code until there are no codes left or the best
+ * pair no longer saves anything. Pairs can contain the codes of earlier pairs
+ * so common words and phrases end up as single bytes. The texts must only
+ * contain characters below TEXT_FIRSTPAIR. The pairs are stored as two bytes
+ * each and the number of pairs is returned.
+ */
+int CompressText(ParseContext *c, Text *texts, int count, uint8_t *pairs)
+{
+    int *counts = (int *)LocalAlloc(c, 256 * 256 * sizeof(int));
+    int pairCount, best, i, j;
+
+    for (pairCount = 0; pairCount < TEXT_MAXPAIRS; ++pairCount) {
+
+        /* count the pairs of adjacent bytes */
+        memset(counts, 0, 256 * 256 * sizeof(int));
+        for (i = 0; i < count; ++i) {
+            uint8_t *data = texts[i].data;
+            for (j = 1; j < texts[i].length; ++j)
+                ++counts[(data[j - 1] << 8) | data[j]];
+        }
+
+        /* find the most common pair (the first one wins a tie so the output doesn't change from build to build) */
+        for (best = 0, j = 1; j < 256 * 256; ++j)
+            if (counts[j] > counts[best])
+                best = j;
+        if (counts[best] < TEXT_MINUSES)
+            break;
+
+        /* replace it with the next code */
+        pairs[pairCount * 2] = best >> 8;
+        pairs[pairCount * 2 + 1] = best & 0xff;
+        for (i = 0; i < count; ++i)
+            texts[i].length = ReplacePair(texts[i].data, texts[i].length, best >> 8, best & 0xff, TEXT_FIRSTPAIR + pairCount);
+    }
+
+    free(counts);
+
+    return pairCount;
+}
+
+/* ReplacePair - replace each occurrence of a pair of bytes with a code and return the new length */
+static int ReplacePair(uint8_t *data, int length, int first, int second, int code)
+{
+    int i, j;
+    for (i = j = 0; i < length; ) {
+        if (i + 1 < length && data[i] == first && data[i + 1] == second) {
+            data[j++] = code;
+            i += 2;
+        }
+        else
+            data[j++] = data[i++];
+    }
+    return j;
+}
@@ -7,11 +7,48 @@
 #ifndef __ADV2VM_H__
 #define __ADV2VM_H__
 
+#include <stddef.h>
 #include "adv2image.h"
 
 #define MAXSTACK    128
+#define MAXEVALSTACK    4096    /* stack used by compile time calls */
+
+/* the interpreter addresses the stack by its offset from the data so the
+   compiler runs code with the stack right after the image, like MapImage */
+#define STACKOFFSET(size)   (((size) + sizeof(VMVALUE) - 1) & ~(sizeof(VMVALUE) - 1))
+#define STACKROOM(size)     (STACKOFFSET(size) + MAXEVALSTACK)
+
+/* execution profile */
+typedef struct Profile Profile;
+
+/* image loaded from a file by MapImage */
+typedef struct {
+    ImageHdr *image;        /* start of the image */
+    uint8_t *stack;         /* MAXSTACK bytes for the stack right after the image */
+    size_t mapSize;         /* size of the mapping (or zero if the image was read into memory) */
+} MappedImage;
 
 /* prototypes from adv2exe.c */
-int Execute(ImageHdr *image, int debug);
+int Execute(ImageHdr *image, uint8_t *stack, int debug, Profile *profile);
+int ExecuteMapped(MappedImage *m, int debug, Profile *profile);
+int Evaluate(ImageHdr *image, uint8_t *stack, long maxSteps, VMVALUE *pResult);
+int Initialize(ImageHdr *image, uint8_t *stack, long maxSteps);
+
+/* prototypes from adv2image.c */
+int IsSectionedImage(uint8_t *buf, long size);
+int CheckImage(uint8_t *buf, long size, const char **pError);
+int MapImage(const char *name, MappedImage *m, const char **pError);
+void UnmapImage(MappedImage *m);
+uint8_t *CompactImage(uint8_t *buf, long size, int *pSize);
+
+/* prototypes from adv2prof.c */
+Profile *NewProfile(ImageHdr *image);
+void FreeProfile(Profile *profile);
+void ProfileCall(Profile *profile, VMVALUE target);
+void ProfileBranch(Profile *profile, VMVALUE site, int taken);
+void ProfileProperty(Profile *profile, VMVALUE object, VMVALUE tag);
+void ProfileSend(Profile *profile, VMVALUE site, VMVALUE class);
+int WriteProfile(Profile *profile, const char *name);
+VMUVALUE ProfileChecksum(const uint8_t *code, int size);
 
 #endif
@@ -61,9 +61,54 @@ OTDEF OpcodeTable[] = {
 { OP_TRYEXIT,   "TRYEXIT",  FMT_NONE    },
 { OP_THROW,     "THROW",    FMT_NONE    },
 { OP_NATIVE,    "NATIVE",   FMT_NATIVE  },
+{ OP_JUMPTABLE, "JUMPTABLE",FMT_JUMPTABLE },
+{ OP_WLIT,      "WLIT",     FMT_WORD    },
+{ OP_SBRT,      "SBRT",     FMT_SBR     },
+{ OP_SBRTSC,    "SBRTSC",   FMT_SBR     },
+{ OP_SBRF,      "SBRF",     FMT_SBR     },
+{ OP_SBRFSC,    "SBRFSC",   FMT_SBR     },
+{ OP_SBR,       "SBR",      FMT_SBR     },
 { 0,            NULL,       0           }
 };
 
+/* DecodeJumpTable - decode the operands of a jump table instruction */
+static int DecodeJumpTable(const uint8_t *base, const uint8_t *lc, const char *name)
+{
+    const uint8_t *p = lc + 1;
+    VMVALUE first = 0;
+    VMWORD offset;
+    int count, i, j;
+    
+    /* get the first case value and the number of entries */
+    for (i = 0; i < sizeof(VMVALUE); ++i) {
+        first = (first << 8) | VMCODEBYTE(p);
+        printf("%02x ", VMCODEBYTE(p++));
+    }
+    count = (VMCODEBYTE(p) << 8) | VMCODEBYTE(p + 1);
+    p += sizeof(VMWORD);
+    printf("%s %d %d\n", name, first, count);
+    
+    /* show the default entry followed by one entry for each case value */
+    for (i = 0; i <= count; ++i) {
+        offset = 0;
+        for (j = 0; j < sizeof(VMWORD); ++j)
+            offset = (offset << 8) | VMCODEBYTE(p + j);
+        printf("%04x    ", (int)(p - base));
+        for (j = 0; j < sizeof(VMWORD); ++j)
+            printf("%02x ", VMCODEBYTE(p + j));
+        for (j = sizeof(VMWORD); j < sizeof(VMVALUE); ++j)
+            printf("   ");
+        if (i == 0)
+            printf("  default");
+        else
+            printf("  %d", first + i - 1);
+        p += sizeof(VMWORD);
+        printf(" # %04x\n", (int)((p + offset) - base));
+    }
+    
+    return p - lc - 1;
+}
+
 /* DecodeFunction - decode the instructions in a function code object */
 void DecodeFunction(const uint8_t *base, const uint8_t *code, int len)
 {
@@ -141,6 +186,27 @@ int DecodeInstruction(const uint8_t *base, const uint8_t *lc)
                 printf(" # %04x\n", (int)((lc + 1 + sizeof(VMWORD) + offset) - base));
                 n += sizeof(VMWORD);
                 break;
+            case FMT_WORD:
+                for (i = 0; i < sizeof(VMWORD); ++i) {
+                    bytes[i] = VMCODEBYTE(lc + i + 1);
+                    printf("%02x ", bytes[i]);
+                }
+                for (i = sizeof(VMWORD); i < sizeof(VMVALUE); ++i)
+                    printf("   ");
+                printf("%s %d\n", op->name, (bytes[0] << 8) | bytes[1]);
+                n += sizeof(VMWORD);
+                break;
+            case FMT_SBR:
+                sbyte = (int8_t)VMCODEBYTE(lc + 1);
+                printf("%02x ", (uint8_t)sbyte);
+                for (i = 1; i < sizeof(VMVALUE); ++i)
+                    printf("   ");
+                printf("%s %02x # %04x\n", op->name, (uint8_t)sbyte, (int)((lc + 2 + sbyte) - base));
+                n += 1;
+                break;
+            case FMT_JUMPTABLE:
+                n += DecodeJumpTable(base, lc, op->name);
+                break;
             }
             return n;
         }
@@ -16,6 +16,9 @@
 #define FMT_LONG        3
 #define FMT_BR          4
 #define FMT_NATIVE      5
+#define FMT_JUMPTABLE   6
+#define FMT_WORD        7
+#define FMT_SBR         8
 
 typedef struct {
     int code;
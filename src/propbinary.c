@@ -37,7 +37,15 @@ typedef struct {
 
 static void UpdateChecksum(uint8_t *binary, int size);
 
-/* BuildBinary - build a .binary file from a template and a VM image */
+/* MaxImageSize - get the size of the largest VM image that fits in a template */
+int MaxImageSize(uint8_t *template)
+{
+    SpinHdr *hdr = (SpinHdr *)template;
+    int size = HUB_SIZE - hdr->dcurr - MIN_STACK_SIZE;
+    return size < 0 ? 0 : size & ~(sizeof(uint32_t) - 1);
+}
+
+/* BuildBinary - build a .binary file from a template and a VM image (NULL if it is larger than MaxImageSize or memory runs out) */
 uint8_t *BuildBinary(uint8_t *template, int templateSize, uint8_t *image, int imageSize, int *pBinarySize)
 {
     int binarySize, paddedImageSize;
@@ -48,6 +56,8 @@ uint8_t *BuildBinary(uint8_t *template, int templateSize, uint8_t *image, int im
     
     /* pad the image to a long boundary */
     paddedImageSize = (imageSize + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1); 
+    if (paddedImageSize > MaxImageSize(template))
+        return NULL;
     
     /* compute the size of the binary file including the image */
     binarySize = templateSize + paddedImageSize;
@@ -3,6 +3,11 @@
 
 #include <stdint.h>
 
+/* Propeller hub memory that the template, the image, and the spin stack must share */
+#define HUB_SIZE        (32*1024)
+#define MIN_STACK_SIZE  256
+
+int MaxImageSize(uint8_t *template);
 uint8_t *BuildBinary(uint8_t *template, int templateSize, uint8_t *image, int imageSize, int *pBinarySize);
 void DumpSpinBinary(uint8_t *binary);
 
@@ -0,0 +1,454 @@
+/* advgen.c - generate large adventure programs to measure how the compiler scales
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* sizes of a world of scale 1 (every count is multiplied by the scale) */
+#define SCALE_LOCATIONS     10
+#define SCALE_CLASSES       2
+#define SCALE_OBJECTS       20
+#define SCALE_FUNCTIONS     10
+#define SCALE_WORDS         24
+
+/* sizes that don't grow with the scale */
+#define DEF_DEPTH           4
+#define DEF_PROPERTIES      8
+#define DEF_SEED            1
+
+/* stack words used by the generated code (the VM stack is only MAXSTACK bytes or 32 words) */
+#define STACK_WORDS         32
+#define MAIN_WORDS          6       /* frame of main and the temporaries of its statements */
+#define FUNCTION_WORDS      9       /* arguments, return address, frame, three locals, and temporaries of a function */
+
+/* the deepest chain of function calls that fits on the stack (methods walk their classes in a loop instead) */
+#define MAXCALLDEPTH        ((STACK_WORDS - MAIN_WORDS) / FUNCTION_WORDS)
+
+/* the exit properties (the first two and the second two lead back to each other) */
+static char *exitNames[] = { "east", "west", "north", "south", "up", "down" };
+#define EXITCOUNT   (sizeof(exitNames) / sizeof(exitNames[0]))
+
+/* syllables of the generated words */
+static char *syllables[] = {
+    "ka", "lo", "mi", "ren", "tor", "vas", "ul", "zen",
+    "bri", "dal", "fen", "gor", "hu", "jin", "pe", "sar"
+};
+
+/* world being generated */
+typedef struct {
+    FILE *fp;
+    int locations;              /* number of locations */
+    int classes;                /* number of classes */
+    int depth;                  /* inheritance depth of the classes */
+    int objects;                /* number of objects */
+    int properties;             /* number of numbered properties on each object */
+    int functions;              /* number of functions */
+    int words;                  /* number of vocabulary words */
+    unsigned long seed;         /* random number state */
+} World;
+
+static void Usage(void);
+static void GenerateWorld(World *w, char *args);
+static void GenerateDeclarations(World *w);
+static void GenerateVocabulary(World *w);
+static void GenerateClasses(World *w);
+static void GenerateLocations(World *w);
+static void GenerateObjects(World *w);
+static void GenerateFunctions(World *w);
+static void GenerateMain(World *w);
+static char *Adjective(World *w, char *buf);
+static char *Noun(World *w, int n, char *buf);
+static char *Word(int n, char *buf);
+static int Random(World *w, int n);
+static int GetCount(int argc, char *argv[], int *pI);
+
+/* main - the main program */
+int main(int argc, char *argv[])
+{
+    char *outputFile = NULL, args[1024];
+    int scale = 1, i;
+    World world, *w = &world;
+
+    memset(w, 0, sizeof(World));
+    w->locations = w->classes = w->objects = w->functions = w->words = -1;
+    w->depth = DEF_DEPTH;
+    w->properties = DEF_PROPERTIES;
+    w->seed = DEF_SEED;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-' || strlen(argv[i]) < 2)
+            Usage();
+        switch (argv[i][1]) {
+        case 'S':   // multiply every count that isn't given by a scale
+            scale = GetCount(argc, argv, &i);
+            break;
+        case 'l':
+            w->locations = GetCount(argc, argv, &i);
+            break;
+        case 'c':
+            w->classes = GetCount(argc, argv, &i);
+            break;
+        case 'd':
+            w->depth = GetCount(argc, argv, &i);
+            break;
+        case 'k':
+            w->objects = GetCount(argc, argv, &i);
+            break;
+        case 'p':
+            w->properties = GetCount(argc, argv, &i);
+            break;
+        case 'f':
+            w->functions = GetCount(argc, argv, &i);
+            break;
+        case 'w':
+            w->words = GetCount(argc, argv, &i);
+            break;
+        case 's':
+            w->seed = (unsigned long)GetCount(argc, argv, &i);
+            break;
+        case 'o':
+            if (argv[i][2])
+                outputFile = &argv[i][2];
+            else if (++i < argc)
+                outputFile = argv[i];
+            else
+                Usage();
+            break;
+        default:
+            Usage();
+            break;
+        }
+    }
+
+    /* fill in the counts that weren't given */
+    if (w->locations < 0)
+        w->locations = SCALE_LOCATIONS * scale;
+    if (w->classes < 0)
+        w->classes = SCALE_CLASSES * scale;
+    if (w->objects < 0)
+        w->objects = SCALE_OBJECTS * scale;
+    if (w->functions < 0)
+        w->functions = SCALE_FUNCTIONS * scale;
+    if (w->words < 0)
+        w->words = SCALE_WORDS * scale;
+
+    /* every world has at least one location, a class depth of one, and a word of each type */
+    if (w->locations < 1)
+        w->locations = 1;
+    if (w->depth < 1)
+        w->depth = 1;
+    if (w->words < 4)
+        w->words = 4;
+
+    /* open the output file */
+    if (!outputFile)
+        w->fp = stdout;
+    else if (!(w->fp = fopen(outputFile, "w"))) {
+        fprintf(stderr, "error: can't create '%s'\n", outputFile);
+        return 1;
+    }
+
+    sprintf(args, "-l %d -c %d -d %d -k %d -p %d -f %d -w %d -s %lu",
+            w->locations, w->classes, w->depth, w->objects, w->properties, w->functions, w->words, w->seed);
+    GenerateWorld(w, args);
+
+    if (w->fp != stdout && fclose(w->fp) != 0) {
+        fprintf(stderr, "error: can't write '%s'\n", outputFile);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: advgen [ -S <scale> ] [ -l <locations> ] [ -c <classes> ] [ -d <class-depth> ] [ -k <objects> ]\n\
+              [ -p <properties> ] [ -f <functions> ] [ -w <words> ] [ -s <seed> ] [ -o <output-file> ]\n");
+    exit(1);
+}
+
+/* GenerateWorld - generate a whole program */
+static void GenerateWorld(World *w, char *args)
+{
+    fprintf(w->fp, "// generated by advgen %s\n\n", args);
+    GenerateDeclarations(w);
+    GenerateVocabulary(w);
+    GenerateClasses(w);
+    GenerateLocations(w);
+    GenerateObjects(w);
+    GenerateFunctions(w);
+    GenerateMain(w);
+}
+
+/* GenerateDeclarations - generate the properties, variables, and base objects */
+static void GenerateDeclarations(World *w)
+{
+    unsigned int i;
+    int j;
+
+    fprintf(w->fp, "property ");
+    for (i = 0; i < EXITCOUNT; ++i)
+        fprintf(w->fp, "%s, ", exitNames[i]);
+    fprintf(w->fp, "name, description, weight, value, visits, describe, step, act");
+    for (j = 0; j < w->properties; ++j)
+        fprintf(w->fp, ", p%d", j);
+    fprintf(w->fp, ";\n\n");
+
+    fprintf(w->fp, "var total = 0, moves = 0;\n\n");
+
+    fprintf(w->fp, "object location {\n_child: nil;\ndescription: \"an empty place\";\nvisits: 0;\n");
+    for (i = 0; i < EXITCOUNT; ++i)
+        fprintf(w->fp, "%s: nil;\n", exitNames[i]);
+    fprintf(w->fp, "}\n\n");
+
+    fprintf(w->fp, "\
+object thing {\n\
+_parent: nil;\n\
+_sibling: nil;\n\
+name: \"a thing\";\n\
+weight: 1;\n\
+value: 0;\n");
+    for (j = 0; j < w->properties; ++j)
+        fprintf(w->fp, "p%d: %d;\n", j, j);
+    fprintf(w->fp, "\
+describe: method(x) {\n\
+    var k = self.class;\n\
+    while (k != nil) {\n\
+        x = k.step(x);\n\
+        k = k.class;\n\
+    }\n\
+    print #self.name, \"\\n\";\n\
+    return x + self.weight;\n\
+};\n\
+step: method(x) {\n\
+    return x;\n\
+};\n\
+act: method(n) {\n\
+    total += n;\n\
+    return n + 1;\n\
+};\n\
+}\n\n");
+}
+
+/* GenerateVocabulary - generate the verbs and the words that aren't attached to objects (the first quarter of the words) */
+static void GenerateVocabulary(World *w)
+{
+    char buf[32];
+    int verbs = w->words / 4, i;
+
+    fprintf(w->fp, "article \"a\", \"an\", \"the\";\n");
+    fprintf(w->fp, "preposition \"in\", \"on\", \"under\", \"with\";\n");
+    fprintf(w->fp, "conjunction \"and\";\n");
+    for (i = 0; i < verbs; ++i)
+        fprintf(w->fp, "verb \"%s\";\n", Word(i, buf));
+    fprintf(w->fp, "\n");
+}
+
+/* GenerateClasses - generate chains of classes that inherit from each other
+ *
+ * Each class has a step method that describe calls for every class an object
+ * inherits from. It walks the classes in a loop instead of chaining super
+ * sends so the stack doesn't grow with the depth.
+ */
+static void GenerateClasses(World *w)
+{
+    int i;
+    for (i = 0; i < w->classes; ++i) {
+        int p = Random(w, w->properties > 0 ? w->properties : 1);
+        if (i % w->depth == 0)
+            fprintf(w->fp, "thing c%d {\n", i);
+        else
+            fprintf(w->fp, "c%d c%d {\n", i - 1, i);
+        fprintf(w->fp, "weight: %d;\n", 1 + i % 9);
+        if (w->properties > 0)
+            fprintf(w->fp, "p%d: %d;\n", p, i);
+        fprintf(w->fp, "step: method(x) {\n");
+        fprintf(w->fp, "    var r = x + %d;\n", i % 5);
+        if (w->properties > 0)
+            fprintf(w->fp, "    if (r > 100)\n        r = r %% (self.p%d + 7);\n", p);
+        fprintf(w->fp, "    return r;\n};\n}\n\n");
+    }
+}
+
+/* GenerateLocations - generate locations connected in a chain with some extra exits */
+static void GenerateLocations(World *w)
+{
+    char adjective[32], noun[32];
+    unsigned int e;
+    int i;
+
+    for (i = 0; i < w->locations; ++i) {
+        fprintf(w->fp, "location l%d {\n", i);
+        fprintf(w->fp, "description: \"You are in the %s %s room.\";\n",
+                Adjective(w, adjective),
+                Noun(w, Random(w, w->words), noun));
+        if (i + 1 < w->locations)
+            fprintf(w->fp, "east: l%d;\n", i + 1);
+        if (i > 0)
+            fprintf(w->fp, "west: l%d;\n", i - 1);
+        for (e = 2; e < EXITCOUNT; ++e)
+            if (Random(w, 3) == 0)
+                fprintf(w->fp, "%s: l%d;\n", exitNames[e], Random(w, w->locations));
+        fprintf(w->fp, "}\n\n");
+    }
+}
+
+/* GenerateObjects - generate objects of the classes placed in the locations */
+static void GenerateObjects(World *w)
+{
+    char adjective[32], noun[32];
+    int i, j;
+
+    for (i = 0; i < w->objects; ++i) {
+        Adjective(w, adjective);
+        Noun(w, i, noun);
+        if (w->classes > 0)
+            fprintf(w->fp, "c%d k%d {\n", Random(w, w->classes), i);
+        else
+            fprintf(w->fp, "thing k%d {\n", i);
+        fprintf(w->fp, "name: \"the %s %s\";\n", adjective, noun);
+        fprintf(w->fp, "_loc: l%d;\n", Random(w, w->locations));
+        fprintf(w->fp, "noun: \"%s\";\n", noun);
+        fprintf(w->fp, "adjective: \"%s\";\n", adjective);
+        fprintf(w->fp, "value: %d;\n", Random(w, 100));
+        for (j = 0; j < w->properties; ++j)
+            if (Random(w, 2) == 0)
+                fprintf(w->fp, "p%d: %d;\n", j, Random(w, 1000));
+        if (Random(w, 4) == 0) {
+            fprintf(w->fp, "act: method(n) {\n");
+            fprintf(w->fp, "    if (n > self.value)\n        return super.act(n - 1);\n");
+            fprintf(w->fp, "    self.value -= n;\n    return self.value;\n};\n");
+        }
+        fprintf(w->fp, "}\n\n");
+    }
+}
+
+/* GenerateFunctions - generate functions with loops, branches, and calls to earlier functions
+ *
+ * The first argument limits the depth of the calls so the program can run.
+ * Methods are only called by main so the deepest chain of calls is just the
+ * functions.
+ */
+static void GenerateFunctions(World *w)
+{
+    int i;
+    for (i = 0; i < w->functions; ++i) {
+        fprintf(w->fp, "def f%d(a, b)\n{\n", i);
+        fprintf(w->fp, "    var x = a + %d, y = b, i;\n", i % 17);
+        fprintf(w->fp, "    for (i = 0; i < %d; ++i) {\n", 1 + Random(w, 4));
+        fprintf(w->fp, "        switch ((x + i) %% 4) {\n");
+        if (w->objects > 0 && w->properties > 0)
+            fprintf(w->fp, "        case 0:\n            x += k%d.p%d;\n            break;\n",
+                    Random(w, w->objects), Random(w, w->properties));
+        if (i > 0)
+            fprintf(w->fp, "        case 1:\n            if (a > 0)\n                y -= f%d(a - 1, x);\n            break;\n",
+                    Random(w, i));
+        fprintf(w->fp, "        case 2:\n            if (x > y)\n                x -= y;\n            else\n                y -= x;\n            break;\n");
+        fprintf(w->fp, "        default:\n            ++total;\n            break;\n");
+        fprintf(w->fp, "        }\n    }\n");
+        fprintf(w->fp, "    while (x > 1000)\n        x /= 2;\n");
+        if (Random(w, 3) == 0)
+            fprintf(w->fp, "    if (a == %d && b < 0)\n        print \"f%d: \", x, \"\\n\";\n", Random(w, MAXCALLDEPTH), i);
+        if (w->objects > 0 && Random(w, 3) == 0)
+            fprintf(w->fp, "    y += k%d.value;\n", Random(w, w->objects));
+        fprintf(w->fp, "    return x + y;\n}\n\n");
+    }
+}
+
+/* GenerateMain - generate the main function that calls a sample of the functions and methods
+ *
+ * A constant is computed by a call at compile time after all of the other
+ * code so the call runs in a copy of code space as large as the world. The
+ * setup function is meant to be run by the compiler with '-I setup'.
+ */
+static void GenerateMain(World *w)
+{
+    int step, i;
+
+    fprintf(w->fp, "def square(n)\n{\n    var r = n * n;\n    return r;\n}\n\n");
+    fprintf(w->fp, "def SQUARE = square(%d);\n\n", 1 + Random(w, 100));
+
+    fprintf(w->fp, "\
+def setup()\n\
+{\n\
+    var here = l0;\n\
+    while (here != nil) {\n\
+        ++here.visits;\n\
+        here = here.east;\n\
+    }\n\
+    total = SQUARE;\n\
+}\n\n");
+
+    fprintf(w->fp, "def main()\n{\n    var here = l0, s = SQUARE;\n");
+
+    step = w->functions / 16 + 1;
+    for (i = 0; i < w->functions; i += step)
+        fprintf(w->fp, "    s += f%d(%d, %d);\n", i, MAXCALLDEPTH - 1, i);
+
+    step = w->objects / 8 + 1;
+    for (i = 0; i < w->objects; i += step) {
+        fprintf(w->fp, "    s += k%d.describe(%d);\n", i, i);
+        fprintf(w->fp, "    s += k%d.act(%d);\n", i, i % 4);
+    }
+
+    fprintf(w->fp, "\
+    while (here.east != nil && moves < %d) {\n\
+        ++here.visits;\n\
+        ++moves;\n\
+        here = here.east;\n\
+    }\n", w->locations);
+    fprintf(w->fp, "    print \"moves \", moves, \" total \", total, \" sum \", s, \"\\n\";\n}\n");
+}
+
+/* Adjective - make a random adjective (the second quarter of the words) */
+static char *Adjective(World *w, char *buf)
+{
+    int first = w->words / 4;
+    return Word(first + Random(w, w->words / 2 - first), buf);
+}
+
+/* Noun - make the nth noun (the second half of the words) */
+static char *Noun(World *w, int n, char *buf)
+{
+    int first = w->words / 2;
+    return Word(first + n % (w->words - first), buf);
+}
+
+/* Word - make the nth vocabulary word (different numbers make different words) */
+static char *Word(int n, char *buf)
+{
+    int count = sizeof(syllables) / sizeof(syllables[0]);
+    *buf = '\0';
+    strcat(buf, syllables[n % count]);
+    n /= count;
+    do {
+        strcat(buf, syllables[n % count]);
+        n /= count;
+    } while (n > 0);
+    return buf;
+}
+
+/* Random - get a random number from zero to n - 1 */
+static int Random(World *w, int n)
+{
+    w->seed = w->seed * 1103515245 + 12345;
+    return n > 0 ? (int)((w->seed >> 16) & 0x7fff) % n : 0;
+}
+
+/* GetCount - get the count that follows an option */
+static int GetCount(int argc, char *argv[], int *pI)
+{
+    int i = *pI;
+    if (argv[i][2])
+        return atoi(&argv[i][2]);
+    if (++i >= argc)
+        Usage();
+    *pI = i;
+    return atoi(argv[i]);
+}
@@ -0,0 +1,345 @@
+/* compbench.c - measure how compile time, memory, and image size grow with the size of a program
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#ifdef MINGW
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+/* default programs and settings */
+#define DEF_COMPILER    "adv2com"
+#define DEF_GENERATOR   "advgen"
+#define DEF_INTERPRETER "adv2int"
+#define DEF_DIRECTORY   "."
+#define DEF_OPTLEVEL    "2"
+#define DEF_REPEATS     3
+#define DEF_SEEDS       8
+
+/* default scales of the generated programs */
+static int defaultScales[] = { 1, 4, 16, 64 };
+#define DEFSCALECOUNT   (sizeof(defaultScales) / sizeof(defaultScales[0]))
+
+/* maximum number of arguments passed to the compiler or the generator */
+#define MAXARGS         16
+
+/* measurements of one compile */
+typedef struct {
+    double seconds;             /* elapsed time */
+    long maxRss;                /* peak resident set size in KB (or -1 if unknown) */
+} Measurement;
+
+static void Usage(void);
+static int Run(char **args, Measurement *m);
+static double Now(void);
+static int Sweep(char *generator, char *compiler, char *interpreter, char *directory, char *optArg, char *scaleArg, int seeds);
+static long FileSize(const char *name);
+static char *OptionValue(int argc, char *argv[], int *pI);
+
+/* main - the main program */
+int main(int argc, char *argv[])
+{
+    char *compiler = DEF_COMPILER, *generator = DEF_GENERATOR, *interpreter = DEF_INTERPRETER;
+    char *directory = DEF_DIRECTORY, *optLevel = DEF_OPTLEVEL;
+    double lastSeconds = 0.0, lastSize = 0.0;
+    int repeats = DEF_REPEATS, seeds = DEF_SEEDS, *scales, scaleCount, i, j;
+
+    /* get the arguments */
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        switch (argv[i][1]) {
+        case 'c':
+            compiler = OptionValue(argc, argv, &i);
+            break;
+        case 'g':
+            generator = OptionValue(argc, argv, &i);
+            break;
+        case 'r':
+            interpreter = OptionValue(argc, argv, &i);
+            break;
+        case 'd':
+            directory = OptionValue(argc, argv, &i);
+            break;
+        case 'O':
+            optLevel = OptionValue(argc, argv, &i);
+            break;
+        case 'n':
+            repeats = atoi(OptionValue(argc, argv, &i));
+            break;
+        case 's':
+            seeds = atoi(OptionValue(argc, argv, &i));
+            break;
+        default:
+            Usage();
+            break;
+        }
+    }
+    if (repeats <= 0 || seeds < 0)
+        Usage();
+
+    /* get the scales */
+    if (i < argc) {
+        scaleCount = argc - i;
+        if (!(scales = (int *)malloc(scaleCount * sizeof(int)))) {
+            fprintf(stderr, "error: insufficient memory\n");
+            return 1;
+        }
+        for (j = 0; j < scaleCount; ++j)
+            if ((scales[j] = atoi(argv[i + j])) <= 0)
+                Usage();
+    }
+    else {
+        scales = defaultScales;
+        scaleCount = DEFSCALECOUNT;
+    }
+
+    printf("  scale  source bytes     seconds  peak RSS KB  image bytes  time order\n");
+
+    for (i = 0; i < scaleCount; ++i) {
+        char scaleArg[16], optArg[16], sourceFile[1024], imageFile[1024];
+        char *args[MAXARGS];
+        Measurement m, best;
+        long sourceSize, imageSize;
+
+        sprintf(scaleArg, "%d", scales[i]);
+        sprintf(optArg, "-O%s", optLevel);
+        sprintf(sourceFile, "%s/bench%d.adv", directory, scales[i]);
+        sprintf(imageFile, "%s/bench%d.dat", directory, scales[i]);
+
+        /* generate the program */
+        args[0] = generator;
+        args[1] = "-S";
+        args[2] = scaleArg;
+        args[3] = "-o";
+        args[4] = sourceFile;
+        args[5] = NULL;
+        if (!Run(args, &m)) {
+            fprintf(stderr, "error: '%s' failed to generate '%s'\n", generator, sourceFile);
+            return 1;
+        }
+        sourceSize = FileSize(sourceFile);
+
+        /* compile it several times and keep the fastest time and the largest memory use */
+        args[0] = compiler;
+        args[1] = optArg;
+        args[2] = "-o";
+        args[3] = imageFile;
+        args[4] = sourceFile;
+        args[5] = NULL;
+        for (j = 0; j < repeats; ++j) {
+            if (!Run(args, &m)) {
+                fprintf(stderr, "error: '%s' failed to compile '%s'\n", compiler, sourceFile);
+                return 1;
+            }
+            if (j == 0 || m.seconds < best.seconds)
+                best.seconds = m.seconds;
+            if (j == 0 || m.maxRss > best.maxRss)
+                best.maxRss = m.maxRss;
+        }
+        imageSize = FileSize(imageFile);
+
+        /* make sure worlds of this size with other seeds compile and run */
+        if (!Sweep(generator, compiler, interpreter, directory, optArg, scaleArg, seeds))
+            return 1;
+
+        /* the order is the exponent of the growth of the time with the source size (1 is linear, 2 is quadratic) */
+        printf("%7d %13ld %11.3f %12ld %12ld", scales[i], sourceSize, best.seconds, best.maxRss, imageSize);
+        if (i > 0 && lastSeconds > 0.0 && best.seconds > 0.0 && sourceSize > lastSize)
+            printf("  %10.2f", log(best.seconds / lastSeconds) / log(sourceSize / lastSize));
+        putchar('\n');
+
+        lastSeconds = best.seconds;
+        lastSize = (double)sourceSize;
+    }
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "\
+usage: compbench [ -c <compiler> ] [ -g <generator> ] [ -r <interpreter> ] [ -d <directory> ] [ -O <level> ]\n\
+                 [ -n <repeats> ] [ -s <seeds> ] [ <scale>... ]\n");
+    exit(1);
+}
+
+/* Sweep - generate, compile, and run worlds of one size with each seed from one to seeds
+ *
+ * A world that can't be compiled or doesn't run to the end is reported with
+ * the seed that made it so it can be generated again. Each world is also
+ * compiled without optimization, where its image is the largest, to check the
+ * code the compiler runs itself, including the setup function and the whole
+ * program run with '-r'.
+ */
+static int Sweep(char *generator, char *compiler, char *interpreter, char *directory, char *optArg, char *scaleArg, int seeds)
+{
+    char seedArg[16], sourceFile[1024], imageFile[1024];
+    char *args[MAXARGS];
+    Measurement m;
+    int seed;
+
+    sprintf(sourceFile, "%s/sweep%s.adv", directory, scaleArg);
+    sprintf(imageFile, "%s/sweep%s.dat", directory, scaleArg);
+
+    for (seed = 1; seed <= seeds; ++seed) {
+        sprintf(seedArg, "%d", seed);
+
+        args[0] = generator;
+        args[1] = "-S";
+        args[2] = scaleArg;
+        args[3] = "-s";
+        args[4] = seedArg;
+        args[5] = "-o";
+        args[6] = sourceFile;
+        args[7] = NULL;
+        if (!Run(args, &m)) {
+            fprintf(stderr, "error: '%s' failed to generate '%s'\n", generator, sourceFile);
+            return 0;
+        }
+
+        args[0] = compiler;
+        args[1] = optArg;
+        args[2] = "-o";
+        args[3] = imageFile;
+        args[4] = sourceFile;
+        args[5] = NULL;
+        if (!Run(args, &m)) {
+            fprintf(stderr, "error: '%s' failed to compile the world of scale %s with seed %d\n", compiler, scaleArg, seed);
+            return 0;
+        }
+
+        args[0] = interpreter;
+        args[1] = imageFile;
+        args[2] = NULL;
+        if (!Run(args, &m)) {
+            fprintf(stderr, "error: the world of scale %s with seed %d failed to run\n", scaleArg, seed);
+            return 0;
+        }
+
+        args[0] = compiler;
+        args[1] = "-O0";
+        args[2] = "-I";
+        args[3] = "setup";
+        args[4] = "-r";
+        args[5] = "-o";
+        args[6] = imageFile;
+        args[7] = sourceFile;
+        args[8] = NULL;
+        if (!Run(args, &m)) {
+            fprintf(stderr, "error: '%s' failed to compile and run the world of scale %s with seed %d at -O0\n", compiler, scaleArg, seed);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+#ifdef MINGW
+
+/* Run - run a program with its output discarded and measure it (the peak memory use isn't known) */
+static int Run(char **args, Measurement *m)
+{
+    char command[4096];
+    double start;
+    int status, i;
+
+    strcpy(command, "");
+    for (i = 0; args[i] != NULL; ++i) {
+        strcat(command, "\"");
+        strcat(command, args[i]);
+        strcat(command, "\" ");
+    }
+    strcat(command, "> NUL");
+
+    fflush(stdout);
+    start = Now();
+    status = system(command);
+    m->seconds = Now() - start;
+    m->maxRss = -1;
+    return status == 0;
+}
+
+/* Now - get the time in seconds */
+static double Now(void)
+{
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+}
+
+#else
+
+/* Run - run a program with its output discarded and measure it */
+static int Run(char **args, Measurement *m)
+{
+    struct rusage usage;
+    double start;
+    int status;
+    pid_t pid;
+
+    /* the child would write anything still in the output buffer again */
+    fflush(stdout);
+
+    start = Now();
+    if ((pid = fork()) < 0)
+        return 0;
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout))
+            _exit(127);
+        execvp(args[0], args);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return 0;
+    m->seconds = Now() - start;
+
+    /* macOS reports the peak memory use in bytes instead of KB */
+#ifdef MACOSX
+    m->maxRss = (long)usage.ru_maxrss / 1024;
+#else
+    m->maxRss = (long)usage.ru_maxrss;
+#endif
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Now - get the time in seconds */
+static double Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+#endif
+
+/* FileSize - get the size of a file (or -1 if it doesn't exist) */
+static long FileSize(const char *name)
+{
+    struct stat info;
+    return stat(name, &info) == 0 ? (long)info.st_size : -1;
+}
+
+/* OptionValue - get the value of an option that is either attached to it or the next argument */
+static char *OptionValue(int argc, char *argv[], int *pI)
+{
+    int i = *pI;
+    if (argv[i][2])
+        return &argv[i][2];
+    if (++i >= argc)
+        Usage();
+    *pI = i;
+    return argv[i];
+}
@@ -10,6 +10,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "propbinary.h"
+#include "adv2vm.h"
 
 extern uint8_t advsys2_run_template_array[];
 extern int advsys2_run_template_size;
@@ -32,6 +33,7 @@ int main(int argc, char *argv[])
     char *inputFile = NULL;
     char *outputFile = NULL;
     char *templateName = "run";
+    const char *error;
     int debugMode = 0;
     FILE *fp;
     
@@ -112,6 +114,36 @@ int main(int argc, char *argv[])
         return 1;
     }
     
+    if (!CheckImage(image, imageSize, &error)) {
+        printf("error: %s '%s'\n", error, inputFile);
+        return 1;
+    }
+    
+    /* the padding that lets the sections be mapped would only take up hub memory */
+    if (IsSectionedImage(image, imageSize)) {
+        ImageFileHdr *fileHdr = (ImageFileHdr *)image;
+        uint8_t *compactImage;
+        
+        /* images before version 3 didn't mark the features the PASM VM doesn't have */
+        if (fileHdr->version < 3 || (fileHdr->flags & IMAGE_HOSTONLY)) {
+            printf("error: '%s' can only be run by adv2int (compile it with '-t %s' instead)\n", inputFile, templateName);
+            return 1;
+        }
+        
+        if (!(compactImage = CompactImage(image, imageSize, &imageSize))) {
+            printf("error: insufficient memory\n");
+            return 1;
+        }
+        free(image);
+        image = compactImage;
+    }
+    
+    /* the image goes in the hub memory the template doesn't use */
+    if (imageSize > MaxImageSize(template)) {
+        printf("error: image too large (%d > %d)\n", imageSize, MaxImageSize(template));
+        return 1;
+    }
+    
     if (!(binary = BuildBinary(template, templateSize, image, imageSize, &binarySize))) {
         printf("error: insufficient memory\n");
         return 1;
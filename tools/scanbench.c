@@ -0,0 +1,157 @@
+/* scanbench.c - measure the throughput of the token scanner
+ *
+ * Copyright (c) 2018 by David Michael Betz.  All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "adv2compiler.h"
+
+/* default number of times to scan each file */
+#define DEF_PASSES  1000
+
+static ParseContext context;
+
+static void Usage(void);
+static long ScanFile(ParseContext *c, char *name, long *pTokens);
+static void FreeIncludedFiles(ParseContext *c);
+
+/* main - the main program */
+int main(int argc, char *argv[])
+{
+    ParseContext *c = &context;
+    long bytes = 0, tokens = 0, size;
+    int passes = DEF_PASSES, pass, i;
+    clock_t start;
+    double seconds;
+
+    /* get the arguments */
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (argv[i][1] == 'n') {
+            if (argv[i][2])
+                passes = atoi(&argv[i][2]);
+            else if (++i < argc)
+                passes = atoi(argv[i]);
+            else
+                Usage();
+        }
+        else
+            Usage();
+    }
+    if (i >= argc || passes <= 0)
+        Usage();
+
+    /* scan each file the requested number of times */
+    start = clock();
+    for (pass = 0; pass < passes; ++pass) {
+        int j;
+        for (j = i; j < argc; ++j) {
+            if ((size = ScanFile(c, argv[j], &tokens)) < 0)
+                return 1;
+            bytes += size;
+        }
+    }
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    /* show the throughput */
+    printf("%ld bytes, %ld tokens in %.3f seconds\n", bytes, tokens, seconds);
+    if (seconds > 0)
+        printf("%.1f MB/s, %.1f M tokens/s\n", bytes / seconds / (K * K), tokens / seconds / 1000000);
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: scanbench [ -n passes ] file...\n");
+    exit(1);
+}
+
+/* ScanFile - scan every token in a file and return its size */
+static long ScanFile(ParseContext *c, char *name, long *pTokens)
+{
+    long size;
+    FILE *fp;
+
+    /* get the size of the file */
+    if (!(fp = fopen(name, "rb"))) {
+        fprintf(stderr, "error: can't open '%s'\n", name);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fclose(fp);
+
+    /* setup an error target */
+    if (setjmp(c->errorTarget)) {
+        FreeIncludedFiles(c);
+        return -1;
+    }
+
+    /* scan the file */
+    InitScan(c);
+    if (!PushFile(c, name)) {
+        fprintf(stderr, "error: can't open '%s'\n", name);
+        return -1;
+    }
+    while (GetToken(c) != T_EOF)
+        ++*pTokens;
+    FreeIncludedFiles(c);
+
+    return size;
+}
+
+/* FreeIncludedFiles - free the list of included files */
+static void FreeIncludedFiles(ParseContext *c)
+{
+    IncludedFile *inc, *next;
+    for (inc = c->includedFiles; inc != NULL; inc = next) {
+        next = inc->next;
+        free(inc);
+    }
+    c->includedFiles = NULL;
+    FreeHashTable(&c->includeHash);
+}
+
+/* EndModule - modules aren't recorded while scanning */
+void EndModule(ParseContext *c, ParseFile *f)
+{
+}
+
+/* BeginPhase - statistics aren't collected while scanning */
+int BeginPhase(ParseContext *c, CompilePhase phase)
+{
+    return PHASE_OTHER;
+}
+
+/* EndPhase - statistics aren't collected while scanning */
+void EndPhase(ParseContext *c, int phase)
+{
+}
+
+/* StatsTime - statistics aren't collected while scanning */
+uint64_t StatsTime(ParseContext *c)
+{
+    return 0;
+}
+
+/* AddFileStats - statistics aren't collected while scanning */
+void AddFileStats(ParseContext *c, const char *name, uint64_t startTime, int lines, size_t size, int cached)
+{
+}
+
+/* Abort - report a fatal error */
+void Abort(ParseContext *c, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    printf("error: ");
+    vprintf(fmt, ap);
+    putchar('\n');
+    va_end(ap);
+    longjmp(c->errorTarget, 1);
+}